@@ -0,0 +1,58 @@
+// Payload loaded by the injector_bench "inject" benchmarks. It does nothing
+// but count, so the numbers measure the injector rather than the payload.
+// With a channel it echoes every command back as an event, for the
+// channel/ round-trip benchmarks.
+
+#include "injector_channel.h"
+#include <atomic>
+#include <thread>
+#include <sched.h>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<int> g_loads(0);
+std::atomic<int> g_inits(0);
+
+__attribute__((constructor)) void onLoad() {
+    g_loads++;
+}
+
+// Spins while commands keep coming, yields for a while, then sleeps
+void echoLoop(injector_channel* ch) {
+    injector_ring_ref commands = injector_channel_ring(ch, INJECTOR_RING_COMMANDS);
+    injector_ring_ref events = injector_channel_ring(ch, INJECTOR_RING_EVENTS);
+    int idle = 0;
+    for (;;) {
+        uint32_t type;
+        uint32_t len;
+        const void* message = injector_ring_peek(commands, &type, &len);
+        if (!message) {
+            if (++idle < 1000) {
+                sched_yield();
+            } else {
+                usleep(100);
+            }
+            continue;
+        }
+        idle = 0;
+        if (injector_ring_send(events, type, message, len) == 0) {
+            injector_ring_release(commands, len);
+        }
+    }
+}
+
+} // namespace
+
+extern "C" __attribute__((visibility("default"))) int bench_payload_init() {
+    return ++g_inits;
+}
+
+extern "C" __attribute__((visibility("default"))) int injector_channel_attach(void* base, uint64_t size) {
+    injector_channel* ch = injector_channel_open(base, size, getpid());
+    if (!ch) {
+        return -1;
+    }
+    std::thread(echoLoop, ch).detach();
+    return 0;
+}
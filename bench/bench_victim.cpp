@@ -0,0 +1,133 @@
+// Synthetic target process for injector_bench.
+//
+// Stands in for an app process: it maps libc and libdl like any dynamically
+// linked program, owns a heap buffer the memory benchmarks read and write,
+// and spends its time blocked in nanosleep the way an idle app thread sits
+// in epoll_wait. A second "render" thread ticks every 200 us and records
+// the longest gap between ticks, which shows how long an injection stalled
+// threads other than the hijacked one. The buffer and heartbeat addresses
+// are reported on stdout as "ready <buffer> <size> <heartbeat>" once the
+// process is set up.
+//
+// fleet_bench starts hundreds of these and shapes them like real apps:
+// -threads adds threads idling in nanosleep, -mappings adds that many
+// extra one-page mappings to the maps a scan has to read, and -quiet leaves
+// out the render thread so a large fleet does not keep the CPUs busy.
+//
+// Usage: bench_victim [-threads <n>] [-mappings <n>] [-quiet]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+const size_t kBufferSize = 1 << 20;
+const long kTickNs = 200 * 1000;
+
+// Read and reset by injector_bench through process_vm_readv/writev
+struct Heartbeat {
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint64_t> maxGapNs;
+};
+
+Heartbeat g_heartbeat;
+
+uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void renderLoop() {
+    struct timespec tick = { 0, kTickNs };
+    uint64_t last = monotonicNs();
+    for (;;) {
+        nanosleep(&tick, nullptr);
+        uint64_t now = monotonicNs();
+        uint64_t gap = now - last;
+        if (gap > g_heartbeat.maxGapNs.load(std::memory_order_relaxed)) {
+            g_heartbeat.maxGapNs.store(gap, std::memory_order_relaxed);
+        }
+        g_heartbeat.ticks.fetch_add(1, std::memory_order_relaxed);
+        last = now;
+    }
+}
+
+void idleLoop() {
+    struct timespec tick = { 1, 0 };
+    for (;;) {
+        nanosleep(&tick, nullptr);
+    }
+}
+
+// Alternate pages get another protection so the kernel cannot merge them
+// into one mapping
+bool addMappings(size_t count) {
+    if (count == 0) {
+        return true;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uint8_t* base = static_cast<uint8_t*>(mmap(nullptr, count * page, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    for (size_t i = 1; i < count; i += 2) {
+        if (mprotect(base + i * page, page, PROT_READ) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned threads = 0;
+    size_t mappings = 0;
+    bool quiet = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-mappings") == 0 && i + 1 < argc) {
+            mappings = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-quiet") == 0) {
+            quiet = true;
+        } else {
+            fprintf(stderr, "usage: %s [-threads <n>] [-mappings <n>] [-quiet]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    uint8_t* buffer = static_cast<uint8_t*>(malloc(kBufferSize));
+    if (!buffer) {
+        return 1;
+    }
+    memset(buffer, 0x5a, kBufferSize);
+    
+    if (!addMappings(mappings)) {
+        return 1;
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        std::thread(idleLoop).detach();
+    }
+    if (!quiet) {
+        std::thread(renderLoop).detach();
+    }
+    
+    printf("ready %lx %zu %lx\n", (unsigned long)(uintptr_t)buffer, kBufferSize,
+           (unsigned long)(uintptr_t)&g_heartbeat);
+    fflush(stdout);
+    
+    struct timespec tick = { 0, 10 * 1000 * 1000 };
+    for (;;) {
+        nanosleep(&tick, nullptr);
+    }
+}
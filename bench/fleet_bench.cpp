@@ -0,0 +1,383 @@
+// Fleet-scale load generator for host Linux.
+//
+// For each step of -targets, starts that many bench_victim processes (found
+// next to this binary) at once, shaped with -threads and -mappings like
+// real app processes, and injects bench_payload into all of them with one
+// LibraryInjector::inject() call, the way the daemon meets a burst of
+// launches. -by-name finds the fleet through the /proc scan instead of
+// passing the pids, so the scan is part of each injection. Per step it
+// reports:
+//
+//   spawn    time to start the fleet and see every victim ready
+//   scan     one ProcessUtils::findAllProcessesByName over the fleet
+//   wall     the inject() call, and injections/s from it
+//   stop     p50/p99/max of each target's attach-to-detach window
+//   cpu      this process's user+system time during inject(), and its
+//            share of the wall time (above 100% with several CPUs)
+//   rss      this process's resident set after the step, and the peak
+//
+// Each of -rounds injects into the same fleet again; the latency
+// percentiles are over all targets of all rounds. With -json the same
+// numbers go to a file for regression tracking.
+//
+// Usage: fleet_bench [-targets <n,n,...>] [-threads <n>] [-mappings <n>]
+//                    [-workers <n>] [-rounds <n>] [-by-name] [-seize]
+//                    [-json <file>]
+
+#include "injector.h"
+#include "process_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+namespace {
+
+// The victims' process name, for -by-name; their argv[0], not the binary's
+const char kFleetName[] = "bench_victim:fleet";
+
+struct Options {
+    std::vector<size_t> targets;
+    unsigned threads;
+    unsigned mappings;
+    uint32_t workers;       // 0: the injector's default
+    unsigned rounds;
+    bool byName;
+    bool seize;
+    const char* jsonPath;
+
+    Options() : threads(8), mappings(1000), workers(0), rounds(3), byName(false), seize(false),
+                jsonPath(nullptr) {}
+};
+
+struct StepResult {
+    size_t targets;
+    size_t injections;
+    size_t failures;
+    double spawnMs;
+    double scanMs;
+    double wallMs;          // all rounds
+    double cpuMs;
+    long rssKb;
+    long peakRssKb;
+    std::vector<double> stopMs;     // sorted
+    std::vector<double> planMs;     // sorted
+
+    StepResult() : targets(0), injections(0), failures(0), spawnMs(0), scanMs(0), wallMs(0),
+                   cpuMs(0), rssKb(0), peakRssKb(0) {}
+
+    double perSecond() const { return wallMs > 0 ? injections * 1000.0 / wallMs : 0; }
+    double cpuPercent() const { return wallMs > 0 ? cpuMs * 100.0 / wallMs : 0; }
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+double cpuMs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+long rssKb() {
+    long size = 0;
+    long pages = 0;
+    FILE* in = fopen("/proc/self/statm", "r");
+    if (in) {
+        if (fscanf(in, "%ld %ld", &size, &pages) != 2) pages = 0;
+        fclose(in);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+std::string binaryDir() {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) {
+        return ".";
+    }
+    path[len] = '\0';
+    char* slash = strrchr(path, '/');
+    if (slash) *slash = '\0';
+    return path;
+}
+
+bool parseTargets(const char* text, std::vector<size_t>& targets) {
+    targets.clear();
+    while (*text) {
+        char* end;
+        unsigned long n = strtoul(text, &end, 10);
+        if (end == text || n == 0 || (*end && *end != ',')) {
+            return false;
+        }
+        targets.push_back(n);
+        text = *end ? end + 1 : end;
+    }
+    return !targets.empty();
+}
+
+// A fleet of quiet bench_victims. They are all forked before any is waited
+// for, so they start up in parallel; the pipes are close-on-exec so no
+// victim holds another's open.
+class Fleet {
+public:
+    ~Fleet() { stop(); }
+
+    bool start(const std::string& path, size_t count, const Options& options) {
+        std::string threads = std::to_string(options.threads);
+        std::string mappings = std::to_string(options.mappings);
+        const char* argv[] = {
+            kFleetName, "-threads", threads.c_str(), "-mappings", mappings.c_str(), "-quiet", nullptr,
+        };
+
+        std::vector<FILE*> outputs;
+        bool ok = true;
+        for (size_t i = 0; i < count && ok; i++) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                perror("pipe");
+                ok = false;
+                break;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                dup2(fds[1], STDOUT_FILENO);
+                close(fds[0]);
+                close(fds[1]);
+                execv(path.c_str(), const_cast<char* const*>(argv));
+                _exit(127);
+            }
+            close(fds[1]);
+            if (pid < 0) {
+                perror("fork");
+                close(fds[0]);
+                ok = false;
+                break;
+            }
+            pids_.push_back(pid);
+            outputs.push_back(fdopen(fds[0], "r"));
+        }
+
+        for (FILE* in : outputs) {
+            char line[128];
+            if (!in || !fgets(line, sizeof(line), in) || strncmp(line, "ready ", 6) != 0) {
+                ok = false;
+            }
+            if (in) fclose(in);
+        }
+        if (!ok) {
+            fprintf(stderr, "Could not start %zu victims from %s\n", count, path.c_str());
+            stop();
+        }
+        return ok;
+    }
+
+    void stop() {
+        for (pid_t pid : pids_) {
+            kill(pid, SIGKILL);
+        }
+        for (pid_t pid : pids_) {
+            waitpid(pid, nullptr, 0);
+        }
+        pids_.clear();
+    }
+
+    const std::vector<pid_t>& pids() const { return pids_; }
+
+private:
+    std::vector<pid_t> pids_;
+};
+
+bool runStep(size_t count, const Options& options, const std::string& dir, StepResult& step) {
+    step.targets = count;
+
+    Fleet fleet;
+    auto start = std::chrono::steady_clock::now();
+    if (!fleet.start(dir + "/bench_victim", count, options)) {
+        return false;
+    }
+    step.spawnMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t found = ProcessUtils::findAllProcessesByName(kFleetName).size();
+    step.scanMs = elapsedMs(start);
+    if (found < count) {
+        fprintf(stderr, "The scan found %zu of %zu victims\n", found, count);
+    }
+
+    Injector::InjectionConfig config;
+    if (options.byName) {
+        config.packageName = kFleetName;
+        config.allProcesses = true;
+    } else {
+        config.pid = fleet.pids()[0];
+        config.pids = fleet.pids();
+    }
+    config.maxWorkers = options.workers;
+    config.seize = options.seize;
+    config.symbolCachePath.clear();
+
+    Injector::LibrarySpec lib;
+    lib.path = dir + "/libbench_payload.so";
+    config.libraries.push_back(lib);
+
+    // One injector for the whole fleet, as in the daemon
+    Injector::LibraryInjector injector;
+    for (unsigned round = 0; round < options.rounds; round++) {
+        double cpuStart = cpuMs();
+        start = std::chrono::steady_clock::now();
+        injector.inject(config);
+        step.wallMs += elapsedMs(start);
+        step.cpuMs += cpuMs() - cpuStart;
+
+        for (const Injector::TargetResult& result : injector.results()) {
+            if (result.success) {
+                step.injections++;
+                step.stopMs.push_back(result.stopMs);
+                step.planMs.push_back(result.planMs);
+            } else {
+                step.failures++;
+            }
+        }
+        step.failures += count - std::min(count, injector.results().size());
+    }
+
+    step.rssKb = rssKb();
+    step.peakRssKb = peakRssKb();
+    std::sort(step.stopMs.begin(), step.stopMs.end());
+    std::sort(step.planMs.begin(), step.planMs.end());
+    return true;
+}
+
+void printHeader() {
+    printf("%7s %6s %6s %9s %8s %9s %8s %9s %9s %9s %9s %6s %9s %9s\n", "TARGETS", "OK", "FAILED",
+           "SPAWN_MS", "SCAN_MS", "WALL_MS", "INJ/S", "STOP_P50", "STOP_P99", "STOP_MAX", "CPU_MS", "CPU%",
+           "RSS_KB", "PEAK_KB");
+}
+
+void printRow(const StepResult& s) {
+    printf("%7zu %6zu %6zu %9.1f %8.2f %9.1f %8.1f %9.3f %9.3f %9.3f %9.1f %6.1f %9ld %9ld\n",
+           s.targets, s.injections, s.failures, s.spawnMs, s.scanMs, s.wallMs, s.perSecond(),
+           percentile(s.stopMs, 0.5), percentile(s.stopMs, 0.99), percentile(s.stopMs, 1), s.cpuMs,
+           s.cpuPercent(), s.rssKb, s.peakRssKb);
+    fflush(stdout);
+}
+
+bool writeJson(const char* path, const Options& options, const std::vector<StepResult>& steps) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+
+    struct utsname host;
+    uname(&host);
+    fprintf(out, "{\n  \"suite\": \"fleet_bench\",\n");
+    fprintf(out, "  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", \"cpus\": %ld},\n",
+            host.release, host.machine, sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "  \"config\": {\"threads\": %u, \"mappings\": %u, \"workers\": %u, \"rounds\": %u, "
+            "\"by_name\": %s, \"seize\": %s},\n",
+            options.threads, options.mappings, options.workers, options.rounds,
+            options.byName ? "true" : "false", options.seize ? "true" : "false");
+    fprintf(out, "  \"steps\": [");
+    for (size_t i = 0; i < steps.size(); i++) {
+        const StepResult& s = steps[i];
+        fprintf(out, "%s\n    {\"targets\": %zu, \"injections\": %zu, \"failures\": %zu, "
+                "\"spawn_ms\": %.1f, \"scan_ms\": %.2f, \"wall_ms\": %.1f, \"injections_per_s\": %.1f, "
+                "\"stop_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+                "\"plan_ms\": {\"p50\": %.3f, \"p99\": %.3f}, "
+                "\"cpu_ms\": %.1f, \"cpu_percent\": %.1f, \"rss_kb\": %ld, \"peak_rss_kb\": %ld}",
+                i ? "," : "", s.targets, s.injections, s.failures, s.spawnMs, s.scanMs, s.wallMs,
+                s.perSecond(), percentile(s.stopMs, 0.5), percentile(s.stopMs, 0.99),
+                percentile(s.stopMs, 1), percentile(s.planMs, 0.5), percentile(s.planMs, 0.99), s.cpuMs,
+                s.cpuPercent(), s.rssKb, s.peakRssKb);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    parseTargets("10,50,100,200", options.targets);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-targets") == 0 && i + 1 < argc) {
+            if (!parseTargets(argv[++i], options.targets)) {
+                fprintf(stderr, "Bad -targets list: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            options.threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-mappings") == 0 && i + 1 < argc) {
+            options.mappings = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            options.workers = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc) {
+            options.rounds = std::max(1u, (unsigned)strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "-by-name") == 0) {
+            options.byName = true;
+        } else if (strcmp(argv[i], "-seize") == 0) {
+            options.seize = true;
+        } else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-targets <n,n,...>] [-threads <n>] [-mappings <n>] "
+                    "[-workers <n>] [-rounds <n>] [-by-name] [-seize] [-json <file>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Every victim holds a pipe until it is ready, and the injector a few
+    // /proc fds per target in flight
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    std::string dir = binaryDir();
+    std::vector<StepResult> steps;
+    bool allOk = true;
+    printHeader();
+    for (size_t count : options.targets) {
+        StepResult step;
+        if (!runStep(count, options, dir, step)) {
+            return 1;
+        }
+        printRow(step);
+        allOk = allOk && step.failures == 0;
+        steps.push_back(step);
+    }
+
+    if (options.jsonPath && !writeJson(options.jsonPath, options, steps)) {
+        return 1;
+    }
+    return allOk ? 0 : 1;
+}
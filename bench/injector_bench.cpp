@@ -0,0 +1,721 @@
+// Subsystem benchmark suite for host Linux.
+//
+// Starts bench_victim (found next to this binary) as a stand-in target and
+// times each hot path of the injector against it: /proc scanning, maps
+// parsing, ELF symbol lookup, remote memory transfers, remote call round
+// trips, a full inject-to-detach of bench_payload under both attach modes,
+// command/event round trips over its payload channel, and, in this process,
+// the payload runtime's task hand-off and timer accuracy. The stall/ rows
+// are not injector timings but the longest gap seen by a second victim
+// thread during one injection: how long the target's other threads were
+// held up. Every benchmark takes repeated samples after a warm-up; the
+// table goes to stdout and, with -json, the same numbers go to a file for
+// regression tracking.
+//
+// Usage: injector_bench [-iterations <n>] [-filter <substring>] [-json <file>]
+//                       [-cpu <n>] [-list]
+
+#include "elf_utils.h"
+#include "injector.h"
+#include "maps_query.h"
+#include "maps_snapshot.h"
+#include "payload_channel.h"
+#include "pattern_scanner.h"
+#include "payload_runtime.h"
+#include "proc_scanner.h"
+#include "process_utils.h"
+#include "ptrace_utils.h"
+#include "remote_call.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+namespace {
+
+struct Options {
+    size_t iterations;      // 0 = per-benchmark default
+    const char* filter;
+    const char* jsonPath;
+    int cpu;
+    bool list;
+
+    Options() : iterations(0), filter(nullptr), jsonPath(nullptr), cpu(-1), list(false) {}
+};
+
+struct BenchResult {
+    std::string name;
+    size_t inner;
+    bool ok;
+    std::vector<double> samples;    // ns per operation
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+class Suite {
+public:
+    explicit Suite(const Options& options) : options_(options) {}
+
+    // Each sample runs op `inner` times and records the mean, so operations
+    // far below timer resolution are still measurable.
+    void run(const char* name, size_t iterations, size_t inner, const std::function<bool()>& op) {
+        sample(name, iterations, inner, [&](double& ns) {
+            bool ok = true;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t j = 0; j < inner && ok; j++) {
+                ok = op();
+            }
+            auto end = std::chrono::steady_clock::now();
+            ns = std::chrono::duration<double, std::nano>(end - start).count() / inner;
+            return ok;
+        });
+    }
+
+    // Like run(), but op measures the sample itself (in ns per operation)
+    void sample(const char* name, size_t iterations, size_t inner,
+                const std::function<bool(double&)>& op) {
+        if (options_.filter && !strstr(name, options_.filter)) {
+            return;
+        }
+        if (options_.list) {
+            printf("%s\n", name);
+            return;
+        }
+        if (options_.iterations) {
+            iterations = options_.iterations;
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.inner = inner;
+        double ns = 0;
+        result.ok = op(ns);     // warm-up
+        result.samples.reserve(iterations);
+
+        for (size_t i = 0; i < iterations && result.ok; i++) {
+            result.ok = op(ns);
+            if (result.ok) {
+                result.samples.push_back(ns);
+            }
+        }
+
+        std::sort(result.samples.begin(), result.samples.end());
+        printRow(result);
+        results_.push_back(result);
+    }
+
+    void printHeader() const {
+        if (!options_.list) {
+            printf("%-28s %8s %12s %12s %12s %12s %12s\n", "BENCHMARK", "SAMPLES", "MIN_NS", "P50_NS",
+                   "P90_NS", "P99_NS", "MEAN_NS");
+        }
+    }
+
+    bool writeJson(const char* path) const {
+        FILE* out = fopen(path, "w");
+        if (!out) {
+            perror(path);
+            return false;
+        }
+
+        struct utsname host;
+        uname(&host);
+        fprintf(out, "{\n  \"suite\": \"injector_bench\",\n");
+        fprintf(out, "  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", \"cpus\": %ld},\n",
+                host.release, host.machine, sysconf(_SC_NPROCESSORS_ONLN));
+        fprintf(out, "  \"results\": [");
+        for (size_t i = 0; i < results_.size(); i++) {
+            const BenchResult& r = results_[i];
+            double sum = 0;
+            for (double s : r.samples) sum += s;
+            double mean = r.samples.empty() ? 0 : sum / r.samples.size();
+            fprintf(out, "%s\n    {\"name\": \"%s\", \"ok\": %s, \"samples\": %zu, \"ops_per_sample\": %zu, "
+                    "\"ns_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+                    "\"max\": %.1f, \"mean\": %.1f}}",
+                    i ? "," : "", r.name.c_str(), r.ok ? "true" : "false", r.samples.size(), r.inner,
+                    percentile(r.samples, 0), percentile(r.samples, 0.5), percentile(r.samples, 0.9),
+                    percentile(r.samples, 0.99), percentile(r.samples, 1), mean);
+        }
+        fprintf(out, "\n  ]\n}\n");
+        return fclose(out) == 0;
+    }
+
+    bool allOk() const {
+        for (const BenchResult& r : results_) {
+            if (!r.ok) return false;
+        }
+        return true;
+    }
+
+private:
+    void printRow(const BenchResult& r) const {
+        if (!r.ok) {
+            printf("%-28s %8s\n", r.name.c_str(), "FAILED");
+            return;
+        }
+        double sum = 0;
+        for (double s : r.samples) sum += s;
+        printf("%-28s %8zu %12.0f %12.0f %12.0f %12.0f %12.0f\n", r.name.c_str(), r.samples.size(),
+               percentile(r.samples, 0), percentile(r.samples, 0.5), percentile(r.samples, 0.9),
+               percentile(r.samples, 0.99), sum / r.samples.size());
+        fflush(stdout);
+    }
+
+    const Options& options_;
+    std::vector<BenchResult> results_;
+};
+
+// Directory of this executable, where the victim and payload are built.
+std::string binaryDir() {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) {
+        return ".";
+    }
+    path[len] = '\0';
+    char* slash = strrchr(path, '/');
+    if (slash) *slash = '\0';
+    return path;
+}
+
+struct Victim {
+    pid_t pid;
+    uintptr_t buffer;
+    size_t bufferSize;
+    uintptr_t heartbeat;    // bench_victim's Heartbeat {ticks, maxGapNs}
+
+    Victim() : pid(0), buffer(0), bufferSize(0), heartbeat(0) {}
+
+    bool start(const std::string& path) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return false;
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            execl(path.c_str(), path.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            return false;
+        }
+
+        char line[128] = { 0 };
+        FILE* in = fdopen(fds[0], "r");
+        bool ready = in && fgets(line, sizeof(line), in) &&
+                     sscanf(line, "ready %lx %zu %lx", (unsigned long*)&buffer, &bufferSize,
+                            (unsigned long*)&heartbeat) == 3;
+        if (in) fclose(in);
+        if (!ready) {
+            fprintf(stderr, "%s did not start\n", path.c_str());
+            stop();
+        }
+        return ready;
+    }
+
+    void stop() {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            pid = 0;
+        }
+    }
+};
+
+void runProcBenchmarks(Suite& suite) {
+    std::vector<ProcessUtils::ProcessEntry> table;
+    ProcessUtils::ProcScanner syncScanner;
+    syncScanner.setUseIoUring(false);
+    suite.run("proc_scan/sync", 200, 1, [&]() { return syncScanner.scan(table); });
+
+    ProcessUtils::ProcScanner uringScanner;
+    if (uringScanner.setUseIoUring(true)) {
+        suite.run("proc_scan/io_uring", 200, 1, [&]() { return uringScanner.scan(table); });
+    }
+
+    suite.run("proc_scan/find_by_name", 200, 1, [&]() {
+        return ProcessUtils::findProcessByName("bench_victim") > 0;
+    });
+}
+
+void runMapsBenchmarks(Suite& suite, pid_t pid) {
+    ProcessUtils::MapsSnapshot maps;
+    suite.run("maps/load", 500, 1, [&]() { return maps.load(pid); });
+
+    maps.load(pid);
+    uintptr_t probe = 0;
+    if (const ProcessUtils::MapsModule* libc = maps.findModule("libc.so")) {
+        probe = libc->base;
+    }
+    suite.run("maps/find_module", 100, 1000, [&]() { return maps.findModule("libc.so") != nullptr; });
+    suite.run("maps/find_segment", 100, 1000, [&]() { return maps.findSegment(probe) != nullptr; });
+
+    // Per-lookup cost of a long-lived query: a statm read, plus an ioctl
+    // check (module) or the whole lookup (region) under PROCMAP_QUERY
+    ProcessUtils::MapsQuery query;
+    if (query.open(pid)) {
+        ProcessUtils::ModuleInfo module;
+        ProcessUtils::MapsRegion region;
+        suite.run("maps/query_module", 100, 100, [&]() { return query.findModule("libc.so", module); });
+        suite.run("maps/query_region", 100, 100, [&]() { return query.findRegion(probe, region); });
+    }
+}
+
+// Scans a 128 MB file of random bytes with four patterns planted in it:
+// from a local mapping with each kernel, and as a module of this process
+// streamed out through process_vm_readv. Divide 128 MiB by the time for
+// the throughput.
+void runPatternScanBenchmarks(Suite& suite) {
+    const size_t size = 128 << 20;
+    const char* texts[] = {
+        "48 8b 05 ?? ?? ?? ?? e8 ?? ?? ?? ?? 85 c0",
+        "41 57 41 56 ?? 55 41 54 53",
+        "ff 25 ?? ?? ?? ?? 9? 90",
+        "de ad be ef ?? ?? ca fe ba be",
+    };
+    std::vector<PatternScanner::Pattern> patterns(4);
+    std::vector<uint8_t> data(size);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        memcpy(&data[i], &state, 8);
+    }
+    for (size_t i = 0; i < patterns.size(); i++) {
+        PatternScanner::parsePattern(texts[i], patterns[i]);
+        size_t at = size / 5 * (i + 1) + i;
+        for (size_t j = 0; j < patterns[i].bytes.size(); j++) {
+            data[at + j] = (uint8_t)((data[at + j] & ~patterns[i].mask[j]) | patterns[i].bytes[j]);
+        }
+    }
+
+    char path[] = "/tmp/injector_bench_scan_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return;
+    }
+    bool written = write(fd, data.data(), size) == (ssize_t)size;
+    void* mapping = written ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        unlink(path);
+        return;
+    }
+
+    std::vector<PatternScanner::Match> matches;
+    PatternScanner::ScanOptions options;
+    const PatternScanner::Kernel kernels[] = {
+        PatternScanner::Kernel::Scalar, PatternScanner::Kernel::Sse2,
+        PatternScanner::Kernel::Avx2, PatternScanner::Kernel::Neon,
+    };
+    char name[64];
+    for (PatternScanner::Kernel kernel : kernels) {
+        if (!PatternScanner::kernelAvailable(kernel)) {
+            continue;
+        }
+        options.kernel = kernel;
+        snprintf(name, sizeof(name), "pattern/local/%s", PatternScanner::kernelName(kernel));
+        suite.run(name, 10, 1, [&]() {
+            matches.clear();
+            PatternScanner::scanBuffer((const uint8_t*)mapping, size, size, 0, patterns, options, matches);
+            return matches.size() >= patterns.size();
+        });
+    }
+
+    options.kernel = PatternScanner::bestKernel();
+    std::string module = strrchr(path, '/') + 1;
+    suite.run("pattern/remote", 10, 1, [&]() {
+        matches.clear();
+        return PatternScanner::scanModule(getpid(), module, patterns, options, matches) &&
+               matches.size() >= patterns.size();
+    });
+
+    munmap(mapping, size);
+    unlink(path);
+}
+
+void runElfBenchmarks(Suite& suite, pid_t pid) {
+    ProcessUtils::ModuleInfo libc;
+    if (!ProcessUtils::findModule(pid, "libc.so", libc)) {
+        return;
+    }
+
+    suite.run("elf/open", 200, 1, [&]() {
+        ElfUtils::ElfImage image;
+        return image.open(libc.path);
+    });
+
+    ElfUtils::ElfImage image;
+    image.open(libc.path);
+    suite.run("elf/find_symbol_hit", 100, 1000, [&]() { return image.findSymbol("mmap") != 0; });
+    suite.run("elf/find_symbol_miss", 100, 1000, [&]() {
+        return image.findSymbol("no_such_symbol_here") == 0;
+    });
+
+    ElfUtils::SymbolLocation location;
+    suite.run("elf/resolve_remote", 200, 1, [&]() {
+        return ElfUtils::resolveSymbolLocation(pid, "libc.so", "getpid", location);
+    });
+
+    // A workflow-sized request list over three modules, a tenth of it
+    // misses: one call per symbol against one batch
+    const char* libcNames[] = {
+        "malloc", "free", "calloc", "realloc", "memcpy", "memmove", "memset", "memcmp", "strlen", "strcmp",
+        "strncmp", "strcpy", "strncpy", "strchr", "strrchr", "strstr", "strdup", "open", "close", "read",
+        "write", "pread64", "pwrite64", "lseek", "mmap", "munmap", "mprotect", "madvise", "getpid", "gettid",
+        "kill", "tgkill", "raise", "abort", "exit", "_exit", "fork", "execve", "waitpid", "pthread_create",
+        "pthread_join", "pthread_mutex_lock", "pthread_mutex_unlock", "pthread_self", "dlopen", "dlsym",
+        "dlclose", "dlerror", "printf", "fprintf", "snprintf", "vsnprintf", "fopen", "fclose", "fread",
+        "fwrite", "socket", "connect", "bind", "listen", "accept", "send", "recv", "epoll_create1",
+        "epoll_ctl", "epoll_wait", "clock_gettime", "nanosleep", "sigaction", "sigprocmask",
+    };
+    const char* otherModules[][2] = {
+        { "libstdc++", "_Znwm" }, { "libstdc++", "_ZdlPv" }, { "libstdc++", "__cxa_throw" },
+        { "libstdc++", "__cxa_begin_catch" }, { "libstdc++", "_ZSt9terminatev" },
+        { "libstdc++", "_ZNSt6thread4joinEv" }, { "libm.so", "sin" }, { "libm.so", "cos" },
+        { "libm.so", "pow" }, { "libm.so", "sqrt" }, { "libm.so", "exp" }, { "libm.so", "log" },
+    };
+    std::vector<ElfUtils::SymbolRequest> requests;
+    for (const char* name : libcNames) {
+        requests.push_back({ "libc.so", name });
+    }
+    for (const auto& entry : otherModules) {
+        requests.push_back({ entry[0], entry[1] });
+    }
+    for (size_t i = 0; i < 9; i++) {
+        requests.push_back({ i % 3 == 0 ? "libc.so" : i % 3 == 1 ? "libstdc++" : "libm.so",
+                             "no_such_symbol_" + std::to_string(i) });
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "elf/resolve_each/%zu", requests.size());
+    suite.run(name, 50, 1, [&]() {
+        for (const ElfUtils::SymbolRequest& r : requests) {
+            ElfUtils::resolveSymbolLocation(pid, r.module.c_str(), r.symbol.c_str(), location);
+        }
+        return true;
+    });
+    std::vector<ElfUtils::SymbolResolution> results;
+    snprintf(name, sizeof(name), "elf/resolve_batch/%zu", requests.size());
+    suite.run(name, 50, 1, [&]() {
+        return ElfUtils::resolveSymbols(pid, requests, results) + 9 == requests.size();
+    });
+}
+
+void runMemoryBenchmarks(Suite& suite, const Victim& victim) {
+    using PtraceUtils::MemoryBackend;
+    struct Backend { MemoryBackend backend; const char* name; };
+    const Backend backends[] = {
+        { MemoryBackend::VmReadv, "process_vm" },
+        { MemoryBackend::ProcMem, "proc_mem" },
+        { MemoryBackend::PtraceWord, "ptrace" },
+    };
+    const size_t sizes[] = { 64, 4096, 65536 };
+
+    std::vector<uint8_t> local(victim.bufferSize);
+    char name[64];
+    for (const Backend& b : backends) {
+        for (size_t size : sizes) {
+            // Word-at-a-time ptrace is too slow to be worth timing at 64K
+            if (b.backend == MemoryBackend::PtraceWord && size > 4096) {
+                continue;
+            }
+            PtraceUtils::RemoteIoVec iov = { victim.buffer, local.data(), size };
+            snprintf(name, sizeof(name), "mem_read/%s/%zu", b.name, size);
+            suite.run(name, 200, 1, [&]() { return PtraceUtils::readMemoryV(victim.pid, &iov, 1, b.backend); });
+            snprintf(name, sizeof(name), "mem_write/%s/%zu", b.name, size);
+            suite.run(name, 200, 1, [&]() { return PtraceUtils::writeMemoryV(victim.pid, &iov, 1, b.backend); });
+        }
+    }
+}
+
+void runRemoteCallBenchmarks(Suite& suite, pid_t pid) {
+    uintptr_t getpidAddr = ElfUtils::getRemoteFunctionAddress(pid, "libc.so", "getpid");
+    if (getpidAddr == 0) {
+        return;
+    }
+
+    uintptr_t trap = 0;
+    suite.run("remote_call/find_trap", 100, 1, [&]() {
+        return PtraceUtils::RemoteCallEngine::findTrap(pid, trap);
+    });
+
+    // One call per round trip inside an open session
+    PtraceUtils::RemoteCallEngine engine(pid);
+    engine.setTrapAddress(trap);
+    if (engine.begin()) {
+        suite.run("remote_call/round_trip", 200, 10, [&]() {
+            int call = engine.queue(getpidAddr, {});
+            return engine.run() && (pid_t)engine.result(call) == pid;
+        });
+        engine.end();
+    }
+
+    // Register save + one call + restore
+    suite.run("remote_call/session", 200, 1, [&]() {
+        PtraceUtils::RemoteCallEngine session(pid);
+        session.setTrapAddress(trap);
+        if (!session.begin()) {
+            return false;
+        }
+        int call = session.queue(getpidAddr, {});
+        bool ok = session.run() && (pid_t)session.result(call) == pid;
+        return session.end() && ok;
+    });
+}
+
+void runAttachBenchmarks(Suite& suite, pid_t pid) {
+    suite.run("attach/attach_detach", 200, 1, [&]() {
+        return PtraceUtils::attach(pid, PtraceUtils::AttachMode::Attach) && PtraceUtils::detach(pid);
+    });
+    suite.run("attach/seize_detach", 200, 1, [&]() {
+        return PtraceUtils::attach(pid, PtraceUtils::AttachMode::Seize) && PtraceUtils::detach(pid);
+    });
+}
+
+// Zeroes the victim's max-gap counter, runs op, and reports the longest gap
+// the victim's render thread saw meanwhile. The idle row is the baseline
+// (200 us tick plus timer slack) with nothing attached.
+bool measureStall(const Victim& victim, const std::function<bool()>& op, double& ns) {
+    uintptr_t maxGapAddr = victim.heartbeat + sizeof(uint64_t);
+    uint64_t gap = 0;
+    if (!PtraceUtils::writeMemory(victim.pid, maxGapAddr, &gap, sizeof(gap))) {
+        return false;
+    }
+    if (!op()) {
+        return false;
+    }
+    
+    // Let the render thread finish the tick that spanned the stop
+    usleep(1000);
+    if (!PtraceUtils::readMemory(victim.pid, maxGapAddr, &gap, sizeof(gap))) {
+        return false;
+    }
+    ns = (double)gap;
+    return true;
+}
+
+void runInjectBenchmarks(Suite& suite, const Victim& victim, const std::string& payload) {
+    Injector::InjectionConfig config;
+    config.pid = victim.pid;
+    config.pids.push_back(victim.pid);
+    config.symbolCachePath.clear();
+
+    Injector::LibrarySpec lib;
+    lib.path = payload;
+    config.libraries.push_back(lib);
+
+    // The first load runs the payload's constructors; later ones measure the
+    // injector on an already-loaded library.
+    Injector::LibraryInjector injector;
+    suite.run("inject/dlopen", 50, 1, [&]() { return injector.inject(config); });
+
+    config.seize = true;
+    suite.run("inject/dlopen_seize", 50, 1, [&]() { return injector.inject(config); });
+    config.seize = false;
+
+    config.libraries[0].initSymbol = "bench_payload_init";
+    suite.run("inject/dlopen_init", 50, 1, [&]() { return injector.inject(config); });
+    config.libraries[0].initSymbol.clear();
+
+    if (victim.heartbeat == 0) {
+        return;
+    }
+    suite.sample("stall/idle", 50, 1, [&](double& ns) {
+        return measureStall(victim, []() { return true; }, ns);
+    });
+    suite.sample("stall/inject_attach", 50, 1, [&](double& ns) {
+        return measureStall(victim, [&]() { return injector.inject(config); }, ns);
+    });
+    config.seize = true;
+    suite.sample("stall/inject_seize", 50, 1, [&](double& ns) {
+        return measureStall(victim, [&]() { return injector.inject(config); }, ns);
+    });
+}
+
+// bench_payload echoes every command back as an event
+void runChannelBenchmarks(Suite& suite, const Victim& victim, const std::string& payload) {
+    Injector::InjectionConfig config;
+    config.pid = victim.pid;
+    config.pids.push_back(victim.pid);
+    config.symbolCachePath.clear();
+    config.channelKb = 256;
+
+    Injector::LibrarySpec lib;
+    lib.path = payload;
+    config.libraries.push_back(lib);
+
+    Injector::LibraryInjector injector;
+    suite.run("channel/inject", 20, 1, [&]() { return injector.inject(config); });
+    if (injector.results().empty() || !injector.results()[0].channel) {
+        return;
+    }
+    std::shared_ptr<Injector::PayloadChannel> channel = injector.results()[0].channel;
+
+    suite.run("channel/connect", 200, 1, [&]() {
+        Injector::PayloadChannel other;
+        return other.connect(victim.pid);
+    });
+
+    uint8_t message[64] = { 0 };
+    auto receive = [&]() {
+        uint32_t type;
+        uint32_t size;
+        for (int spins = 0; !channel->peek(type, size); spins++) {
+            if (spins > 10000000) return false;
+            sched_yield();
+        }
+        channel->release(size);
+        return true;
+    };
+    suite.run("channel/round_trip_64b", 100, 100, [&]() {
+        return channel->send(1, message, sizeof(message)) && receive();
+    });
+
+    // Commands are queued back to back and the echoes drained afterwards
+    const size_t kBurst = 1024;
+    suite.sample("channel/burst_64b", 50, kBurst, [&](double& ns) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kBurst; i++) {
+            if (!channel->send(1, message, sizeof(message))) return false;
+        }
+        for (size_t i = 0; i < kBurst; i++) {
+            if (!receive()) return false;
+        }
+        ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / kBurst;
+        return true;
+    });
+}
+
+// The payload runtime in this process: a task posted from here and run on
+// the loop thread, and how late one-shot timers fire (ns past the deadline)
+void runRuntimeBenchmarks(Suite& suite) {
+    if (!PayloadRuntime::start()) {
+        return;
+    }
+
+    std::atomic<bool> done(false);
+    auto wait = [&]() {
+        for (int spins = 0; !done.load(std::memory_order_acquire); spins++) {
+            if (spins > 10000000) return false;
+            sched_yield();
+        }
+        return true;
+    };
+    suite.run("runtime/post_round_trip", 100, 100, [&]() {
+        done.store(false, std::memory_order_relaxed);
+        return PayloadRuntime::post([&]() { done.store(true, std::memory_order_release); }) != 0 && wait();
+    });
+
+    suite.run("runtime/schedule_cancel", 100, 1000, [&]() {
+        return PayloadRuntime::cancel(PayloadRuntime::schedule(60000, []() {}));
+    });
+
+    std::atomic<int64_t> fired(0);
+    suite.sample("runtime/timer_late_1ms", 50, 1, [&](double& ns) {
+        done.store(false, std::memory_order_relaxed);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+        bool ok = PayloadRuntime::schedule(1, [&]() {
+            fired.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            done.store(true, std::memory_order_release);
+        }) != 0 && wait();
+        ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::duration(fired.load()) - deadline.time_since_epoch()).count();
+        return ok;
+    });
+
+    PayloadRuntime::stop();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-iterations") == 0 && i + 1 < argc) {
+            options.iterations = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc) {
+            options.cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-list") == 0) {
+            options.list = true;
+        } else {
+            fprintf(stderr, "usage: %s [-iterations <n>] [-filter <substring>] [-json <file>] "
+                    "[-cpu <n>] [-list]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Pinning removes scheduler migration noise from the samples
+    if (options.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(options.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            perror("sched_setaffinity");
+        }
+    }
+
+    std::string dir = binaryDir();
+    Victim victim;
+    if (!victim.start(dir + "/bench_victim")) {
+        return 1;
+    }
+
+    Suite suite(options);
+    suite.printHeader();
+
+    runProcBenchmarks(suite);
+    runMapsBenchmarks(suite, victim.pid);
+    runElfBenchmarks(suite, victim.pid);
+    runPatternScanBenchmarks(suite);
+
+    if (PtraceUtils::attach(victim.pid)) {
+        runMemoryBenchmarks(suite, victim);
+        runRemoteCallBenchmarks(suite, victim.pid);
+        PtraceUtils::detach(victim.pid);
+    } else {
+        fprintf(stderr, "Cannot attach to the victim; skipping ptrace benchmarks\n");
+    }
+
+    runAttachBenchmarks(suite, victim.pid);
+    runInjectBenchmarks(suite, victim, dir + "/libbench_payload.so");
+    runChannelBenchmarks(suite, victim, dir + "/libbench_payload.so");
+    runRuntimeBenchmarks(suite);
+
+    victim.stop();
+
+    if (options.jsonPath && !options.list && !suite.writeJson(options.jsonPath)) {
+        return 1;
+    }
+    return suite.allOk() ? 0 : 1;
+}
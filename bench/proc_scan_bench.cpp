@@ -0,0 +1,106 @@
+// Benchmark of /proc scan time against the number of running processes.
+//
+// Spawns idle children in steps and times a full-table scan with the
+// previous opendir/ifstream approach and with ProcScanner, with and without
+// start times and io_uring batching.
+
+#include "proc_scanner.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using ProcessUtils::ProcScanner;
+using ProcessUtils::ProcessEntry;
+using ProcessUtils::ScanOptions;
+
+namespace {
+
+const int kSteps[] = { 0, 250, 500, 1000 };
+const int kIterations = 20;
+
+// The scan loop findAllProcessesByName used before ProcScanner.
+size_t scanIfstream(const char* filter) {
+    size_t matches = 0;
+    DIR* dir = opendir("/proc");
+    if (!dir) return 0;
+    
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_type != DT_DIR) continue;
+        if (atoi(entry->d_name) <= 0) continue;
+        
+        std::string cmdlinePath = "/proc/" + std::string(entry->d_name) + "/cmdline";
+        std::ifstream cmdlineFile(cmdlinePath);
+        if (!cmdlineFile.is_open()) continue;
+        
+        std::string cmdline;
+        std::getline(cmdlineFile, cmdline, '\0');
+        if (cmdline.find(filter) != std::string::npos) matches++;
+    }
+    closedir(dir);
+    return matches;
+}
+
+template <typename Fn>
+double timeMs(Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; i++) fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / kIterations;
+}
+
+} // namespace
+
+int main() {
+    std::vector<pid_t> children;
+    std::vector<ProcessEntry> table;
+    const char* filter = "no.such.package";
+    
+    ProcScanner scanner;
+    ProcScanner uringScanner;
+    bool haveUring = uringScanner.setUseIoUring(true);
+    
+    printf("%10s %10s %12s %12s %14s %12s\n", "spawned", "procs", "ifstream_ms",
+           "scanner_ms", "starttime_ms", "io_uring_ms");
+    
+    for (int target : kSteps) {
+        while ((int)children.size() < target) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                for (;;) pause();
+            }
+            if (pid < 0) {
+                perror("fork");
+                break;
+            }
+            children.push_back(pid);
+        }
+        
+        scanner.scan(table);
+        size_t procs = table.size();
+        
+        ScanOptions filtered;
+        filtered.nameFilter = filter;
+        ScanOptions withStart;
+        withStart.withStartTime = true;
+        
+        double legacy = timeMs([&] { scanIfstream(filter); });
+        double plain = timeMs([&] { scanner.scan(table, filtered); });
+        double start = timeMs([&] { scanner.scan(table, withStart); });
+        double uring = haveUring ? timeMs([&] { uringScanner.scan(table, filtered); }) : -1.0;
+        
+        printf("%10zu %10zu %12.3f %12.3f %14.3f %12.3f\n", children.size(), procs,
+               legacy, plain, start, uring);
+    }
+    
+    for (pid_t pid : children) kill(pid, SIGKILL);
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+    return 0;
+}
@@ -0,0 +1,468 @@
+#include "async_tracer.h"
+#include "trace.h"
+#include "logger.h"
+#include <sys/epoll.h>
+#include <sys/ptrace.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_TAG "AsyncTracer"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+namespace PtraceUtils {
+
+namespace {
+
+// Upper bound on one epoll_wait, so a SIGCHLD consumed by another thread
+// only delays a stop instead of losing it.
+const int kPollMs = 5;
+
+const uint64_t kSignalFdTag = UINT64_MAX;
+
+// A target whose deadline passed before it could be stopped again. Its stop
+// is still coming; run() waits a while longer for it before returning, then
+// restores the registers and detaches. One that still has not stopped is
+// retried by the next run() on this thread, if there is one.
+struct Abandoned {
+    pid_t pid;
+    AttachMode mode;
+    bool restore;
+    struct user_regs_struct regs;
+};
+
+thread_local std::vector<Abandoned> g_abandoned;
+
+int pidfdOpen(pid_t pid) {
+    return (int)syscall(__NR_pidfd_open, pid, 0);
+}
+
+// waitid reports what waitpid encodes in its status word: the signal and
+// the ptrace event (sig | event << 8) for stops, the exit code or the
+// signal for exits.
+int waitStatus(const siginfo_t& info) {
+    switch (info.si_code) {
+    case CLD_EXITED:
+        return (info.si_status & 0xff) << 8;
+    case CLD_KILLED:
+        return info.si_status & 0x7f;
+    case CLD_DUMPED:
+        return (info.si_status & 0x7f) | 0x80;
+    default:
+        return (info.si_status << 8) | 0x7f;
+    }
+}
+
+// Signals raised by an interrupted call or by the stop request itself;
+// the registers are restored before the target runs, so they are dropped.
+bool isStaleSignal(int sig) {
+    return sig == SIGTRAP || sig == SIGSTOP || sig == SIGSEGV || sig == SIGBUS ||
+           sig == SIGILL || sig == SIGFPE || sig == SIGABRT;
+}
+
+void resume(pid_t pid, int sig) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
+    ptrace(PTRACE_CONT, pid, NULL, (void*)(uintptr_t)sig);
+}
+
+void requestInterrupt(pid_t pid, AttachMode mode) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
+    if (mode == AttachMode::Seize) {
+        ptrace(PTRACE_INTERRUPT, pid, NULL, NULL);
+    } else {
+        syscall(SYS_tgkill, pid, pid, SIGSTOP);
+    }
+}
+
+void sweepAbandoned() {
+    for (size_t i = 0; i < g_abandoned.size();) {
+        Abandoned& a = g_abandoned[i];
+        int status;
+        pid_t waited = waitpid(a.pid, &status, WNOHANG | __WALL);
+        if (waited == 0) {
+            i++;
+            continue;
+        }
+        
+        if (waited == a.pid && WIFSTOPPED(status)) {
+            if (a.restore) {
+                setRegs(a.pid, &a.regs);
+                a.restore = false;
+            }
+            // Detaching before our own stop arrives would leave a pending
+            // SIGSTOP to freeze the target untraced
+            if (!isAttachStop(status, a.mode)) {
+                int sig = WSTOPSIG(status);
+                resume(a.pid, isStaleSignal(sig) ? 0 : sig);
+                i++;
+                continue;
+            }
+            detach(a.pid);
+            LOGI("Released abandoned PID %d", a.pid);
+        }
+        g_abandoned.erase(g_abandoned.begin() + i);
+    }
+}
+
+// Blocks up to timeoutMs for the stops of the abandoned targets. Left
+// behind, an attached target would keep the pending SIGSTOP and freeze
+// untraced once this process exits, and a hijacked one would resume inside
+// the injected call.
+void releaseAbandoned(uint32_t timeoutMs) {
+    uint64_t deadline = Trace::nowNs() + (uint64_t)timeoutMs * 1000000;
+    sweepAbandoned();
+    while (!g_abandoned.empty() && Trace::nowNs() < deadline) {
+        usleep(1000);
+        sweepAbandoned();
+    }
+    for (const Abandoned& a : g_abandoned) {
+        LOGE("PID %d never stopped, left traced%s", a.pid, a.restore ? " with its registers hijacked" : "");
+    }
+}
+
+} // namespace
+
+AsyncTracer::AsyncTracer(uint32_t stepTimeoutMs, size_t maxInFlight)
+    : stepTimeoutMs_(stepTimeoutMs), maxInFlight_(maxInFlight), inFlight_(0), epollFd_(-1) {
+}
+
+AsyncTracer::~AsyncTracer() {
+    for (Session& s : sessions_) {
+        if (s.pidfd >= 0) {
+            close(s.pidfd);
+        }
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+}
+
+void AsyncTracer::add(const AsyncTarget& target) {
+    Session s;
+    s.target = target;
+    s.state = State::Pending;
+    s.pidfd = -1;
+    s.deadlineNs = 0;
+    s.attachNs = 0;
+    s.stopNs = 0;
+    sessions_.push_back(std::move(s));
+}
+
+bool AsyncTracer::run() {
+    sigset_t chld, saved;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &chld, &saved);
+    
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        LOGE("epoll_create1 failed: %s", strerror(errno));
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+        return false;
+    }
+    
+    // Without the signalfd the loop still works, by polling
+    int signalFd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = kSignalFdTag;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, signalFd, &ev);
+    }
+    
+    sweepAbandoned();
+    
+    size_t next = 0;
+    for (;;) {
+        while (next < sessions_.size() && (maxInFlight_ == 0 || inFlight_ < maxInFlight_)) {
+            startSession(sessions_[next++]);
+        }
+        if (inFlight_ == 0 && next == sessions_.size()) {
+            break;
+        }
+        
+        uint64_t now = Trace::nowNs();
+        int timeout = kPollMs;
+        for (const Session& s : sessions_) {
+            if (s.state == State::Pending || s.state == State::Done || s.deadlineNs == 0) {
+                continue;
+            }
+            int untilMs = s.deadlineNs > now ? (int)((s.deadlineNs - now + 999999) / 1000000) : 0;
+            if (untilMs < timeout) timeout = untilMs;
+        }
+        
+        struct epoll_event events[16];
+        int count = epoll_wait(epollFd_, events, 16, timeout);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == kSignalFdTag) {
+                struct signalfd_siginfo info;
+                while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                }
+            }
+        }
+        
+        // One SIGCHLD can stand for several stops, so every live target is
+        // asked; a pidfd wakeup (exit) is handled the same way
+        for (Session& s : sessions_) {
+            int status;
+            while (s.state != State::Pending && s.state != State::Done && reap(s, status)) {
+                onStop(s, status);
+            }
+        }
+        
+        now = Trace::nowNs();
+        for (Session& s : sessions_) {
+            if (s.state != State::Pending && s.state != State::Done && s.deadlineNs != 0 && now >= s.deadlineNs) {
+                onDeadline(s);
+            }
+        }
+    }
+    
+    if (signalFd >= 0) {
+        close(signalFd);
+    }
+    close(epollFd_);
+    epollFd_ = -1;
+    pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+    
+    // Abandoned targets get one more step timeout to stop (without deadlines
+    // nothing is abandoned)
+    releaseAbandoned(stepTimeoutMs_);
+    return true;
+}
+
+void AsyncTracer::startSession(Session& s) {
+    pid_t pid = s.target.pid;
+    inFlight_++;
+    s.attachNs = Trace::nowNs();
+    
+    // A pidfd pins the process: its stops cannot be confused with those of
+    // a later process reusing the pid
+    s.pidfd = pidfdOpen(pid);
+    if (!requestAttach(pid, s.target.mode)) {
+        AsyncOutcome outcome;
+        outcome.error = "attach failed";
+        finish(s, outcome);
+        return;
+    }
+    
+    if (s.pidfd >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = (uint64_t)pid;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, s.pidfd, &ev);
+    }
+    s.state = State::Attaching;
+    armDeadline(s);
+}
+
+bool AsyncTracer::reap(Session& s, int& status) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int rc;
+    {
+        Trace::SyscallScope scope(Trace::SyscallClass::Wait);
+        if (s.pidfd >= 0) {
+            rc = waitid((idtype_t)P_PIDFD, (id_t)s.pidfd, &info, WEXITED | WSTOPPED | WNOHANG | __WALL);
+        } else {
+            rc = waitid(P_PID, (id_t)s.target.pid, &info, WEXITED | WSTOPPED | WNOHANG | __WALL);
+        }
+    }
+    
+    if (rc != 0) {
+        // ECHILD: no longer ours to wait for, so it is gone
+        if (errno != ECHILD) {
+            return false;
+        }
+        status = 0;
+        return true;
+    }
+    if (info.si_pid == 0) {
+        return false;
+    }
+    status = waitStatus(info);
+    return true;
+}
+
+void AsyncTracer::onStop(Session& s, int status) {
+    pid_t pid = s.target.pid;
+    bool exited = WIFEXITED(status) || WIFSIGNALED(status);
+    AsyncOutcome outcome;
+    
+    switch (s.state) {
+    case State::Attaching: {
+        if (exited) {
+            LOGE("PID %d exited while being attached", pid);
+            outcome.error = "exited";
+            finish(s, outcome);
+            return;
+        }
+        if (!isAttachStop(status, s.target.mode)) {
+            // A signal that arrived first: deliver it, the attach stop stays pending
+            resume(pid, WSTOPSIG(status));
+            return;
+        }
+        
+        s.stopNs = Trace::nowNs();
+        Trace::record("attach", s.attachNs, s.stopNs, pid);
+        LOGI("Attached to PID %d", pid);
+        
+        // Registers are saved once and restored once for the whole session
+        s.engine.reset(new RemoteCallEngine(pid));
+        if (s.target.trapAddr) {
+            s.engine->setTrapAddress(s.target.trapAddr);
+        }
+        if (!s.engine->begin()) {
+            release(s, false, "getregs failed");
+            return;
+        }
+        s.state = State::Calling;
+        advance(s, true);
+        return;
+    }
+    
+    case State::Calling: {
+        RemoteCallEngine::CallState state = s.engine->onStop(status);
+        if (exited || !s.engine->active()) {
+            outcome.error = "exited";
+            finish(s, outcome);
+        } else if (state != RemoteCallEngine::CallState::Running) {
+            advance(s, state == RemoteCallEngine::CallState::Idle);
+        }
+        return;
+    }
+    
+    case State::Interrupting: {
+        outcome.timedOut = true;
+        outcome.error = "timed out";
+        if (exited) {
+            finish(s, outcome);
+            return;
+        }
+        
+        // Registers first: whatever this stop is, the target resumes in
+        // its own code from here on
+        s.engine->end();
+        if (!isAttachStop(status, s.target.mode)) {
+            int sig = WSTOPSIG(status);
+            resume(pid, isStaleSignal(sig) ? 0 : sig);
+            return;
+        }
+        detach(pid);
+        finish(s, outcome);
+        return;
+    }
+    
+    default:
+        return;
+    }
+}
+
+void AsyncTracer::advance(Session& s, bool ok) {
+    for (;;) {
+        AsyncStep step = s.target.step(*s.engine, ok);
+        if (step != AsyncStep::Continue) {
+            release(s, step == AsyncStep::Finish, step == AsyncStep::Finish ? std::string() : "aborted");
+            return;
+        }
+        
+        RemoteCallEngine::CallState state = s.engine->launch();
+        if (state == RemoteCallEngine::CallState::Running) {
+            armDeadline(s);
+            return;
+        }
+        if (!s.engine->active()) {
+            AsyncOutcome outcome;
+            outcome.error = "exited";
+            finish(s, outcome);
+            return;
+        }
+        // Nothing left to run (or it failed to start): next step
+        ok = state == RemoteCallEngine::CallState::Idle;
+    }
+}
+
+void AsyncTracer::onDeadline(Session& s) {
+    pid_t pid = s.target.pid;
+    AsyncOutcome outcome;
+    outcome.timedOut = true;
+    
+    if (s.state == State::Calling) {
+        LOGE("Remote calls in PID %d overran %u ms, interrupting", pid, stepTimeoutMs_);
+        requestInterrupt(pid, s.target.mode);
+        s.state = State::Interrupting;
+        armDeadline(s);
+        return;
+    }
+    
+    // Not stopped, so nothing can be restored or detached now
+    Abandoned a;
+    a.pid = pid;
+    a.mode = s.target.mode;
+    a.restore = s.state == State::Interrupting && s.engine && s.engine->active();
+    if (a.restore) {
+        a.regs = s.engine->savedRegs();
+        s.engine->discard();
+    }
+    g_abandoned.push_back(a);
+    
+    LOGE("PID %d did not stop within %u ms, abandoned", pid, stepTimeoutMs_);
+    outcome.error = s.state == State::Attaching ? "attach timed out" : "timed out";
+    finish(s, outcome);
+}
+
+void AsyncTracer::release(Session& s, bool success, const std::string& error) {
+    AsyncOutcome outcome;
+    outcome.success = success;
+    outcome.error = error;
+    
+    if (s.engine && !s.engine->end()) {
+        outcome.success = false;
+        outcome.error = "restore failed";
+    }
+    if (!detach(s.target.pid)) {
+        outcome.success = false;
+        if (outcome.error.empty()) outcome.error = "detach failed";
+    }
+    finish(s, outcome);
+}
+
+void AsyncTracer::finish(Session& s, AsyncOutcome& outcome) {
+    if (s.stopNs != 0) {
+        uint64_t now = Trace::nowNs();
+        outcome.stopMs = (now - s.stopNs) / 1e6;
+        Trace::record("target_stopped", s.stopNs, now, s.target.pid);
+    }
+    
+    // Closing the pidfd also drops it from the epoll set
+    if (s.pidfd >= 0) {
+        close(s.pidfd);
+        s.pidfd = -1;
+    }
+    s.state = State::Done;
+    inFlight_--;
+    
+    if (s.target.done) {
+        s.target.done(outcome);
+    }
+}
+
+void AsyncTracer::armDeadline(Session& s) {
+    s.deadlineNs = stepTimeoutMs_ ? Trace::nowNs() + (uint64_t)stepTimeoutMs_ * 1000000 : 0;
+}
+
+} // namespace PtraceUtils
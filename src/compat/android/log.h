@@ -0,0 +1,69 @@
+#ifndef COMPAT_ANDROID_LOG_H
+#define COMPAT_ANDROID_LOG_H
+
+// Host (non-Android) stand-in for <android/log.h> so the injector builds on
+// plain Linux without liblog. Messages go to stderr as "Tag: message";
+// INJECTOR_LOG_LEVEL (a number from the priority enum below, e.g. 6 for
+// errors only, 8 for silent) raises the threshold, which keeps benchmark
+// output readable.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+static inline int __android_log_threshold(void) {
+    static int threshold = -1;
+    if (threshold < 0) {
+        const char* env = getenv("INJECTOR_LOG_LEVEL");
+        threshold = env ? atoi(env) : ANDROID_LOG_VERBOSE;
+    }
+    return threshold;
+}
+
+static inline int __android_log_vprint(int prio, const char* tag, const char* fmt, va_list ap) {
+    if (prio < __android_log_threshold()) {
+        return 0;
+    }
+    char line[1024];
+    vsnprintf(line, sizeof(line), fmt, ap);
+    // One fprintf per message so lines from worker threads do not interleave
+    return fprintf(stderr, "%s: %s\n", tag ? tag : "", line);
+}
+
+__attribute__((format(printf, 3, 4)))
+static inline int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int written = __android_log_vprint(prio, tag, fmt, ap);
+    va_end(ap);
+    return written;
+}
+
+static inline int __android_log_write(int prio, const char* tag, const char* text) {
+    if (prio < __android_log_threshold()) {
+        return 0;
+    }
+    return fprintf(stderr, "%s: %s\n", tag ? tag : "", text ? text : "");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPAT_ANDROID_LOG_H
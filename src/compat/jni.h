@@ -0,0 +1,68 @@
+#ifndef COMPAT_JNI_H
+#define COMPAT_JNI_H
+
+// Host (non-Android) stand-in for <jni.h>, just the invocation interface
+// the payload runtime uses, laid out like the real one so a host program
+// can hand it a JavaVM of its own. Payloads that call into Java are built
+// with the NDK's header.
+
+#include <stdint.h>
+
+typedef int32_t jint;
+typedef void* jobject;
+
+#define JNIEXPORT __attribute__((visibility("default")))
+#define JNICALL
+
+#define JNI_OK          0
+#define JNI_ERR         (-1)
+#define JNI_EDETACHED   (-2)
+#define JNI_EVERSION    (-3)
+
+#define JNI_VERSION_1_6 0x00010006
+
+#ifdef __cplusplus
+struct _JNIEnv;
+struct _JavaVM;
+typedef _JNIEnv JNIEnv;
+typedef _JavaVM JavaVM;
+#else
+typedef const void* JNIEnv;
+typedef const struct JNIInvokeInterface* JavaVM;
+#endif
+
+struct JavaVMAttachArgs {
+    jint version;
+    const char* name;
+    jobject group;
+};
+
+struct JNIInvokeInterface {
+    void* reserved0;
+    void* reserved1;
+    void* reserved2;
+    jint (*DestroyJavaVM)(JavaVM*);
+    jint (*AttachCurrentThread)(JavaVM*, JNIEnv**, void*);
+    jint (*DetachCurrentThread)(JavaVM*);
+    jint (*GetEnv)(JavaVM*, void**, jint);
+    jint (*AttachCurrentThreadAsDaemon)(JavaVM*, JNIEnv**, void*);
+};
+
+#ifdef __cplusplus
+struct _JNIEnv {
+    const void* functions;
+};
+
+struct _JavaVM {
+    const struct JNIInvokeInterface* functions;
+    
+    jint AttachCurrentThread(JNIEnv** env, void* args) { return functions->AttachCurrentThread(this, env, args); }
+    jint DetachCurrentThread() { return functions->DetachCurrentThread(this); }
+    jint GetEnv(void** env, jint version) { return functions->GetEnv(this, env, version); }
+    jint AttachCurrentThreadAsDaemon(JNIEnv** env, void* args) {
+        return functions->AttachCurrentThreadAsDaemon(this, env, args);
+    }
+};
+#endif
+
+#endif // COMPAT_JNI_H
@@ -0,0 +1,81 @@
+#include "daemon_client.h"
+#include "daemon_protocol.h"
+#include "logger.h"
+#include <unistd.h>
+
+#define LOG_TAG "DaemonClient"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace DaemonClient {
+
+namespace {
+
+// One request per connection; the daemon closes after replying. The reply
+// is the Result body, preceded in parts by any ResultPart bodies.
+Status request(DaemonProtocol::MessageType type, const std::vector<uint8_t>& body,
+               std::vector<std::vector<uint8_t>>& parts) {
+    int fd = DaemonProtocol::connectSocket();
+    if (fd < 0) {
+        return Status::Unavailable;
+    }
+    if (!DaemonProtocol::sendMessage(fd, type, body)) {
+        close(fd);
+        return Status::Unavailable;
+    }
+    
+    parts.clear();
+    DaemonProtocol::MessageType replyType;
+    std::vector<uint8_t> reply;
+    bool received;
+    while ((received = DaemonProtocol::recvMessage(fd, replyType, reply)) &&
+           replyType == DaemonProtocol::MessageType::ResultPart) {
+        parts.push_back(reply);
+    }
+    close(fd);
+    if (!received || replyType != DaemonProtocol::MessageType::Result) {
+        LOGE("No valid reply from the daemon");
+        return Status::Failed;
+    }
+    parts.push_back(reply);
+    return Status::Done;
+}
+
+} // namespace
+
+Status inject(const Injector::InjectionConfig& config, bool& success,
+              std::vector<Injector::TargetResult>& results) {
+    DaemonProtocol::Writer out;
+    DaemonProtocol::writeConfig(out, config);
+    
+    std::vector<std::vector<uint8_t>> parts;
+    Status status = request(DaemonProtocol::MessageType::Inject, out.bytes(), parts);
+    if (status != Status::Done) {
+        return status;
+    }
+    
+    results.clear();
+    for (const std::vector<uint8_t>& part : parts) {
+        std::vector<Injector::TargetResult> batch;
+        DaemonProtocol::Reader in(part.data(), part.size());
+        if (!DaemonProtocol::readResults(in, success, batch)) {
+            LOGE("Malformed reply from the daemon");
+            return Status::Failed;
+        }
+        results.insert(results.end(), batch.begin(), batch.end());
+    }
+    LOGI("Daemon handled the request (%s)", success ? "ok" : "failed");
+    return Status::Done;
+}
+
+bool ping() {
+    std::vector<std::vector<uint8_t>> reply;
+    return request(DaemonProtocol::MessageType::Ping, std::vector<uint8_t>(), reply) == Status::Done;
+}
+
+bool shutdown() {
+    std::vector<std::vector<uint8_t>> reply;
+    return request(DaemonProtocol::MessageType::Shutdown, std::vector<uint8_t>(), reply) == Status::Done;
+}
+
+} // namespace DaemonClient
@@ -0,0 +1,347 @@
+#include "daemon_protocol.h"
+#include "logger.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define LOG_TAG "DaemonProtocol"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace DaemonProtocol {
+
+namespace {
+
+const uint32_t kMaxEntries = 4096;
+
+socklen_t abstractAddress(const char* name, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t length = strnlen(name, sizeof(addr.sun_path) - 1);
+    // Leading NUL: abstract namespace, no file to create or clean up
+    memcpy(addr.sun_path + 1, name, length);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + length);
+}
+
+} // namespace
+
+void Writer::u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) bytes_.push_back((uint8_t)(value >> (8 * i)));
+}
+
+void Writer::u64(uint64_t value) {
+    for (int i = 0; i < 8; i++) bytes_.push_back((uint8_t)(value >> (8 * i)));
+}
+
+void Writer::f64(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    u64(bits);
+}
+
+void Writer::str(const std::string& value) {
+    u32((uint32_t)value.size());
+    bytes_.insert(bytes_.end(), value.begin(), value.end());
+}
+
+bool Reader::take(void* out, size_t size) {
+    if (!ok_ || size > size_ - pos_) {
+        ok_ = false;
+        memset(out, 0, size);
+        return false;
+    }
+    memcpy(out, data_ + pos_, size);
+    pos_ += size;
+    return true;
+}
+
+uint8_t Reader::u8() {
+    uint8_t value;
+    take(&value, sizeof(value));
+    return value;
+}
+
+uint32_t Reader::u32() {
+    uint8_t raw[4];
+    take(raw, sizeof(raw));
+    return raw[0] | (uint32_t)raw[1] << 8 | (uint32_t)raw[2] << 16 | (uint32_t)raw[3] << 24;
+}
+
+uint64_t Reader::u64() {
+    uint64_t low = u32();
+    uint64_t high = u32();
+    return low | high << 32;
+}
+
+double Reader::f64() {
+    uint64_t bits = u64();
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+std::string Reader::str() {
+    uint32_t length = u32();
+    if (!ok_ || length > size_ - pos_) {
+        ok_ = false;
+        return std::string();
+    }
+    std::string value((const char*)data_ + pos_, length);
+    pos_ += length;
+    return value;
+}
+
+void writeConfig(Writer& out, const Injector::InjectionConfig& config) {
+    out.str(config.packageName);
+    out.u32((uint32_t)config.pid);
+    out.u32((uint32_t)config.pids.size());
+    for (pid_t pid : config.pids) {
+        out.u32((uint32_t)pid);
+    }
+    out.u32((uint32_t)config.libraries.size());
+    for (const Injector::LibrarySpec& lib : config.libraries) {
+        out.str(lib.path);
+        out.str(lib.initSymbol);
+    }
+    out.u8(config.useMemfd);
+    out.u8(config.hideMaps);
+    out.u8(config.hideSolist);
+    out.u8(config.allProcesses);
+    out.u8(config.seize);
+    out.u32(config.delayUs);
+    out.u32(config.maxWorkers);
+    out.u32(config.stepTimeoutMs);
+    out.str(config.symbolName);
+    out.u32((uint32_t)config.entryArgs.size());
+    for (const std::string& arg : config.entryArgs) {
+        out.str(arg);
+    }
+    out.str(config.symbolCachePath);
+    out.u32(config.channelKb);
+}
+
+bool readConfig(Reader& in, Injector::InjectionConfig& config) {
+    config.packageName = in.str();
+    config.pid = (pid_t)in.u32();
+    uint32_t pidCount = in.u32();
+    if (pidCount > kMaxEntries) {
+        return false;
+    }
+    config.pids.clear();
+    for (uint32_t i = 0; i < pidCount && in.ok(); i++) {
+        config.pids.push_back((pid_t)in.u32());
+    }
+    uint32_t libraryCount = in.u32();
+    if (libraryCount > kMaxEntries) {
+        return false;
+    }
+    config.libraries.clear();
+    for (uint32_t i = 0; i < libraryCount && in.ok(); i++) {
+        Injector::LibrarySpec lib;
+        lib.path = in.str();
+        lib.initSymbol = in.str();
+        config.libraries.push_back(lib);
+    }
+    config.useMemfd = in.u8() != 0;
+    config.hideMaps = in.u8() != 0;
+    config.hideSolist = in.u8() != 0;
+    config.allProcesses = in.u8() != 0;
+    config.seize = in.u8() != 0;
+    config.delayUs = in.u32();
+    config.maxWorkers = in.u32();
+    config.stepTimeoutMs = in.u32();
+    config.symbolName = in.str();
+    uint32_t argCount = in.u32();
+    if (argCount > kMaxEntries) {
+        return false;
+    }
+    config.entryArgs.clear();
+    for (uint32_t i = 0; i < argCount && in.ok(); i++) {
+        config.entryArgs.push_back(in.str());
+    }
+    config.symbolCachePath = in.str();
+    config.channelKb = in.u32();
+    config.watchLaunch = false;
+    return in.ok();
+}
+
+namespace {
+
+void writeTarget(Writer& out, const Injector::TargetResult& r) {
+    out.u32((uint32_t)r.pid);
+    out.u8(r.success);
+    out.f64(r.planMs);
+    out.f64(r.stopMs);
+    out.f64(r.totalMs);
+    out.str(r.error);
+    out.u8(r.entryCalled);
+    out.u64(r.entryResult);
+    out.u64(r.channelAddr);
+    out.u32((uint32_t)r.libraries.size());
+    for (const Injector::LibraryResult& lib : r.libraries) {
+        out.str(lib.path);
+        out.u64(lib.handle);
+        out.u8(lib.success);
+        out.f64(lib.loadMs);
+    }
+}
+
+} // namespace
+
+void writeResults(Writer& out, bool success, const std::vector<Injector::TargetResult>& results) {
+    out.u8(success);
+    out.u32((uint32_t)results.size());
+    for (const Injector::TargetResult& r : results) {
+        writeTarget(out, r);
+    }
+}
+
+std::vector<Writer> writeResultParts(bool success, const std::vector<Injector::TargetResult>& results) {
+    // Room for the targets after the header, the success flag and the count
+    const size_t budget = kMaxMessage - sizeof(MessageHeader) - 1 - 4;
+    
+    std::vector<Writer> parts;
+    Writer targets;
+    uint32_t count = 0;
+    auto flush = [&]() {
+        Writer part;
+        part.u8(success);
+        part.u32(count);
+        part.append(targets);
+        parts.push_back(part);
+        targets = Writer();
+        count = 0;
+    };
+    
+    for (const Injector::TargetResult& r : results) {
+        Writer target;
+        writeTarget(target, r);
+        if (target.bytes().size() > budget) {
+            Injector::TargetResult trimmed = r;
+            trimmed.libraries.clear();
+            trimmed.error = "result too large for the protocol; library entries dropped";
+            target = Writer();
+            writeTarget(target, trimmed);
+        }
+        if (targets.bytes().size() + target.bytes().size() > budget) {
+            flush();
+        }
+        targets.append(target);
+        count++;
+    }
+    flush();
+    return parts;
+}
+
+bool readResults(Reader& in, bool& success, std::vector<Injector::TargetResult>& results) {
+    success = in.u8() != 0;
+    uint32_t count = in.u32();
+    if (count > kMaxEntries) {
+        return false;
+    }
+    results.clear();
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        Injector::TargetResult r;
+        r.pid = (pid_t)in.u32();
+        r.success = in.u8() != 0;
+        r.planMs = in.f64();
+        r.stopMs = in.f64();
+        r.totalMs = in.f64();
+        r.error = in.str();
+        r.entryCalled = in.u8() != 0;
+        r.entryResult = (uintptr_t)in.u64();
+        r.channelAddr = (uintptr_t)in.u64();
+        uint32_t libraryCount = in.u32();
+        if (libraryCount > kMaxEntries) {
+            return false;
+        }
+        for (uint32_t j = 0; j < libraryCount && in.ok(); j++) {
+            Injector::LibraryResult lib;
+            lib.path = in.str();
+            lib.handle = (uintptr_t)in.u64();
+            lib.success = in.u8() != 0;
+            lib.loadMs = in.f64();
+            r.libraries.push_back(lib);
+        }
+        results.push_back(r);
+    }
+    return in.ok();
+}
+
+int connectSocket(const char* name) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t length = abstractAddress(name, addr);
+    if (connect(fd, (struct sockaddr*)&addr, length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listenSocket(const char* name) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        LOGE("socket failed: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t length = abstractAddress(name, addr);
+    if (bind(fd, (struct sockaddr*)&addr, length) != 0 || listen(fd, 16) != 0) {
+        LOGE("Cannot listen on @%s: %s", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendMessage(int fd, MessageType type, const std::vector<uint8_t>& body) {
+    if (body.size() + sizeof(MessageHeader) > kMaxMessage) {
+        LOGE("Message of %zu bytes exceeds the protocol limit", body.size());
+        return false;
+    }
+    MessageHeader header = { kMagic, kVersion, (uint16_t)type, (uint32_t)body.size() };
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { (void*)body.data(), body.size() },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = body.empty() ? 1 : 2;
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t)(sizeof(header) + body.size());
+}
+
+bool recvMessage(int fd, MessageType& type, std::vector<uint8_t>& body) {
+    std::vector<uint8_t> buffer(kMaxMessage);
+    ssize_t received;
+    do {
+        received = recv(fd, buffer.data(), buffer.size(), 0);
+    } while (received < 0 && errno == EINTR);
+    if (received < (ssize_t)sizeof(MessageHeader)) {
+        return false;
+    }
+    
+    MessageHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion ||
+        header.length != (size_t)received - sizeof(header)) {
+        LOGE("Rejected message (magic %#x, version %u)", header.magic, header.version);
+        return false;
+    }
+    type = (MessageType)header.type;
+    body.assign(buffer.begin() + sizeof(header), buffer.begin() + received);
+    return true;
+}
+
+} // namespace DaemonProtocol
@@ -1,131 +1,896 @@
 #include "elf_utils.h"
 #include "process_utils.h"
-#include <android/log.h>
-#include <dlfcn.h>
-#include <link.h>
-#include <fstream>
+#include "symbol_cache.h"
+#include "maps_snapshot.h"
+#include "maps_query.h"
+#include "trace.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <errno.h>
 #include <elf.h>
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 #define LOG_TAG "ElfUtils"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 namespace ElfUtils {
 
-uintptr_t getLocalModuleBase(const char* moduleName) {
-    void* handle = dlopen(moduleName, RTLD_LAZY);
-    if (!handle) {
-        LOGE("Failed to dlopen %s: %s", moduleName, dlerror());
+namespace {
+
+struct SymbolFields {
+    uint32_t name;
+    uint64_t value;
+    uint16_t shndx;
+};
+
+SymbolFields readSymbol(const uint8_t* table, uint32_t index, bool is64) {
+    SymbolFields fields;
+    if (is64) {
+        const Elf64_Sym* sym = (const Elf64_Sym*)table + index;
+        fields.name = sym->st_name;
+        fields.value = sym->st_value;
+        fields.shndx = sym->st_shndx;
+    } else {
+        const Elf32_Sym* sym = (const Elf32_Sym*)table + index;
+        fields.name = sym->st_name;
+        fields.value = sym->st_value;
+        fields.shndx = sym->st_shndx;
+    }
+    return fields;
+}
+
+// Filter over the names a batch still looks for in .symtab; 64 words keep
+// false positives rare for a few hundred names. Sized here, never from the
+// file, so it cannot be empty.
+const size_t kSymtabBloomWords = 64;
+static_assert(kSymtabBloomWords > 0 && (kSymtabBloomWords & (kSymtabBloomWords - 1)) == 0,
+              "the .symtab bloom filter is indexed with a mask");
+
+// Two bits per name, as in the GNU hash filter
+uint64_t bloomBits(uint32_t hash) {
+    return (1ULL << (hash % 64)) | (1ULL << ((hash >> 12) % 64));
+}
+
+uint32_t gnuHash(const char* name) {
+    uint32_t h = 5381;
+    for (const uint8_t* p = (const uint8_t*)name; *p; p++) {
+        h = (h << 5) + h + *p;
+    }
+    return h;
+}
+
+uint32_t sysvHash(const char* name) {
+    uint32_t h = 0;
+    for (const uint8_t* p = (const uint8_t*)name; *p; p++) {
+        h = (h << 4) + *p;
+        uint32_t g = h & 0xf0000000;
+        h ^= g;
+        h ^= g >> 24;
+    }
+    return h;
+}
+
+template <typename Ehdr, typename Phdr>
+void collectHeaders(const uint8_t* data, uint16_t& machine, uint64_t& phoff, uint16_t& phnum) {
+    const Ehdr* ehdr = (const Ehdr*)data;
+    machine = ehdr->e_machine;
+    phoff = ehdr->e_phoff;
+    phnum = ehdr->e_phentsize == sizeof(Phdr) ? ehdr->e_phnum : 0;
+}
+
+} // namespace
+
+ElfImage::ElfImage()
+    : data_(nullptr), size_(0), is64_(false), machine_(0),
+      dynsym_(nullptr), dynsymCount_(0), dynstr_(nullptr), dynstrSize_(0),
+      gnuHash_(nullptr), sysvHash_(nullptr),
+      symtab_(nullptr), symtabCount_(0), strtab_(nullptr), strtabSize_(0) {
+}
+
+ElfImage::~ElfImage() {
+    close();
+}
+
+bool ElfImage::open(const std::string& path) {
+    close();
+    
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf32_Ehdr)) {
+        LOGE("Invalid ELF file size: %s", path.c_str());
+        ::close(fd);
+        return false;
+    }
+    
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        LOGE("Failed to mmap %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    data_ = (uint8_t*)mapping;
+    size_ = st.st_size;
+    
+    if (!parseHeaders()) {
+        LOGE("Not a usable ELF file: %s", path.c_str());
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+void ElfImage::close() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    loads_.clear();
+    needed_.clear();
+    runPath_.clear();
+    dynsym_ = nullptr;
+    dynsymCount_ = 0;
+    dynstr_ = nullptr;
+    dynstrSize_ = 0;
+    gnuHash_ = nullptr;
+    sysvHash_ = nullptr;
+    symtab_ = nullptr;
+    symtabCount_ = 0;
+    strtab_ = nullptr;
+    strtabSize_ = 0;
+}
+
+const uint8_t* ElfImage::fileAt(uint64_t offset, uint64_t size) const {
+    if (offset > size_ || size > size_ - offset) {
+        return nullptr;
+    }
+    return data_ + offset;
+}
+
+const uint8_t* ElfImage::vaddrToFile(uint64_t vaddr, uint64_t size) const {
+    for (const LoadSegment& seg : loads_) {
+        if (vaddr >= seg.vaddr && vaddr - seg.vaddr < seg.filesz) {
+            if (size > seg.filesz - (vaddr - seg.vaddr)) {
+                return nullptr;
+            }
+            return fileAt(seg.offset + (vaddr - seg.vaddr), size);
+        }
+    }
+    return nullptr;
+}
+
+bool ElfImage::parseHeaders() {
+    if (memcmp(data_, ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    
+    is64_ = data_[EI_CLASS] == ELFCLASS64;
+    if (!is64_ && data_[EI_CLASS] != ELFCLASS32) {
+        return false;
+    }
+    if (is64_ && size_ < sizeof(Elf64_Ehdr)) {
+        return false;
+    }
+    
+    uint64_t phoff;
+    uint16_t phnum;
+    if (is64_) {
+        collectHeaders<Elf64_Ehdr, Elf64_Phdr>(data_, machine_, phoff, phnum);
+    } else {
+        collectHeaders<Elf32_Ehdr, Elf32_Phdr>(data_, machine_, phoff, phnum);
+    }
+    
+    size_t phentSize = is64_ ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    const uint8_t* phdrs = fileAt(phoff, (uint64_t)phnum * phentSize);
+    if (!phdrs) {
+        return false;
+    }
+    
+    uint64_t dynOffset = 0, dynSize = 0;
+    for (uint16_t i = 0; i < phnum; i++) {
+        uint32_t type;
+        LoadSegment seg;
+        if (is64_) {
+            const Elf64_Phdr* ph = (const Elf64_Phdr*)phdrs + i;
+            type = ph->p_type;
+            seg = { ph->p_vaddr, ph->p_offset, ph->p_filesz, ph->p_memsz };
+        } else {
+            const Elf32_Phdr* ph = (const Elf32_Phdr*)phdrs + i;
+            type = ph->p_type;
+            seg = { ph->p_vaddr, ph->p_offset, ph->p_filesz, ph->p_memsz };
+        }
+        
+        if (type == PT_LOAD) {
+            loads_.push_back(seg);
+        } else if (type == PT_DYNAMIC) {
+            dynOffset = seg.offset;
+            dynSize = seg.filesz;
+        }
+    }
+    
+    if (loads_.empty()) {
+        return false;
+    }
+    
+    if (dynSize > 0) {
+        parseDynamic(dynOffset, dynSize);
+    }
+    parseSections();
+    
+    return true;
+}
+
+bool ElfImage::parseDynamic(uint64_t dynOffset, uint64_t dynSize) {
+    const uint8_t* dyn = fileAt(dynOffset, dynSize);
+    if (!dyn) {
+        return false;
+    }
+    
+    uint64_t symtabAddr = 0, strtabAddr = 0, strtabSize = 0;
+    uint64_t gnuHashAddr = 0, sysvHashAddr = 0;
+    uint64_t runPath = UINT64_MAX, rpath = UINT64_MAX;
+    std::vector<uint64_t> needed;
+    
+    size_t entSize = is64_ ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    for (size_t i = 0; i < dynSize / entSize; i++) {
+        int64_t tag;
+        uint64_t val;
+        if (is64_) {
+            const Elf64_Dyn* d = (const Elf64_Dyn*)dyn + i;
+            tag = d->d_tag;
+            val = d->d_un.d_val;
+        } else {
+            const Elf32_Dyn* d = (const Elf32_Dyn*)dyn + i;
+            tag = d->d_tag;
+            val = d->d_un.d_val;
+        }
+        
+        if (tag == DT_NULL) break;
+        switch (tag) {
+            case DT_SYMTAB: symtabAddr = val; break;
+            case DT_STRTAB: strtabAddr = val; break;
+            case DT_STRSZ: strtabSize = val; break;
+            case DT_GNU_HASH: gnuHashAddr = val; break;
+            case DT_HASH: sysvHashAddr = val; break;
+            case DT_NEEDED: needed.push_back(val); break;
+            case DT_RUNPATH: runPath = val; break;
+            case DT_RPATH: rpath = val; break;
+        }
+    }
+    
+    if (!symtabAddr || !strtabAddr || !strtabSize) {
+        return false;
+    }
+    
+    dynstr_ = (const char*)vaddrToFile(strtabAddr, strtabSize);
+    dynstrSize_ = dynstr_ ? strtabSize : 0;
+    
+    // Dynamic string offsets, bounded by DT_STRSZ
+    auto dynString = [&](uint64_t offset) {
+        if (!dynstr_ || offset >= dynstrSize_) {
+            return std::string();
+        }
+        return std::string(dynstr_ + offset, strnlen(dynstr_ + offset, dynstrSize_ - offset));
+    };
+    for (uint64_t offset : needed) {
+        needed_.push_back(dynString(offset));
+    }
+    if (runPath != UINT64_MAX || rpath != UINT64_MAX) {
+        runPath_ = dynString(runPath != UINT64_MAX ? runPath : rpath);
+    }
+    
+    if (sysvHashAddr) {
+        sysvHash_ = (const uint32_t*)vaddrToFile(sysvHashAddr, 2 * sizeof(uint32_t));
+        if (sysvHash_ && !vaddrToFile(sysvHashAddr, (2 + (uint64_t)sysvHash_[0] + sysvHash_[1]) * sizeof(uint32_t))) {
+            sysvHash_ = nullptr;
+        }
+    }
+    
+    size_t wordSize = is64_ ? 8 : 4;
+    uint32_t gnuMaxIndex = 0;
+    if (gnuHashAddr) {
+        gnuHash_ = (const uint32_t*)vaddrToFile(gnuHashAddr, 4 * sizeof(uint32_t));
+        if (gnuHash_) {
+            uint32_t nbuckets = gnuHash_[0];
+            uint32_t symoffset = gnuHash_[1];
+            uint32_t bloomSize = gnuHash_[2];
+            uint64_t headerSize = 4 * sizeof(uint32_t) + (uint64_t)bloomSize * wordSize;
+            
+            // lookupGnuHash divides by both sizes and indexes the bloom words
+            // unchecked, so the header and the whole filter must be in the file
+            const void* bloom = bloomSize ? vaddrToFile(gnuHashAddr, headerSize) : nullptr;
+            const uint32_t* buckets = (const uint32_t*)vaddrToFile(gnuHashAddr + headerSize,
+                                                                   (uint64_t)nbuckets * sizeof(uint32_t));
+            if (!bloom || !buckets || nbuckets == 0) {
+                gnuHash_ = nullptr;
+            } else {
+                // DT_GNU_HASH does not record the symbol count; walk the chain
+                // of the highest bucket to find the last index.
+                for (uint32_t i = 0; i < nbuckets; i++) {
+                    if (buckets[i] > gnuMaxIndex) gnuMaxIndex = buckets[i];
+                }
+                if (gnuMaxIndex >= symoffset) {
+                    uint64_t chainAddr = gnuHashAddr + headerSize + (uint64_t)nbuckets * sizeof(uint32_t);
+                    for (;;) {
+                        const uint32_t* entry = (const uint32_t*)vaddrToFile(
+                            chainAddr + (uint64_t)(gnuMaxIndex - symoffset) * sizeof(uint32_t), sizeof(uint32_t));
+                        if (!entry) {
+                            gnuHash_ = nullptr;
+                            break;
+                        }
+                        if (*entry & 1) break;
+                        gnuMaxIndex++;
+                    }
+                }
+                gnuMaxIndex++;
+            }
+        }
+    }
+    
+    size_t count = sysvHash_ ? sysvHash_[1] : gnuMaxIndex;
+    size_t symSize = is64_ ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    dynsym_ = vaddrToFile(symtabAddr, (uint64_t)count * symSize);
+    dynsymCount_ = dynsym_ ? count : 0;
+    
+    return dynsym_ != nullptr && dynstr_ != nullptr;
+}
+
+void ElfImage::parseSections() {
+    uint64_t shoff;
+    uint16_t shnum, shentsize;
+    if (is64_) {
+        const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)data_;
+        shoff = ehdr->e_shoff;
+        shnum = ehdr->e_shnum;
+        shentsize = ehdr->e_shentsize;
+    } else {
+        const Elf32_Ehdr* ehdr = (const Elf32_Ehdr*)data_;
+        shoff = ehdr->e_shoff;
+        shnum = ehdr->e_shnum;
+        shentsize = ehdr->e_shentsize;
+    }
+    
+    size_t expected = is64_ ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    if (shoff == 0 || shentsize != expected) {
+        return;
+    }
+    
+    const uint8_t* shdrs = fileAt(shoff, (uint64_t)shnum * shentsize);
+    if (!shdrs) {
+        return;
+    }
+    
+    auto section = [&](uint32_t index, uint32_t& type, uint64_t& offset, uint64_t& size, uint32_t& link) {
+        if (is64_) {
+            const Elf64_Shdr* sh = (const Elf64_Shdr*)shdrs + index;
+            type = sh->sh_type; offset = sh->sh_offset; size = sh->sh_size; link = sh->sh_link;
+        } else {
+            const Elf32_Shdr* sh = (const Elf32_Shdr*)shdrs + index;
+            type = sh->sh_type; offset = sh->sh_offset; size = sh->sh_size; link = sh->sh_link;
+        }
+    };
+    
+    size_t symSize = is64_ ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    for (uint16_t i = 0; i < shnum; i++) {
+        uint32_t type, link;
+        uint64_t offset, size;
+        section(i, type, offset, size, link);
+        
+        bool isSymtab = type == SHT_SYMTAB;
+        bool isDynsym = type == SHT_DYNSYM && !dynsym_;
+        if ((!isSymtab && !isDynsym) || link >= shnum) continue;
+        
+        uint32_t strType, strLink;
+        uint64_t strOffset, strSize;
+        section(link, strType, strOffset, strSize, strLink);
+        
+        const uint8_t* table = fileAt(offset, size);
+        const char* strings = (const char*)fileAt(strOffset, strSize);
+        if (!table || !strings || strType != SHT_STRTAB) continue;
+        
+        if (isSymtab) {
+            symtab_ = table;
+            symtabCount_ = size / symSize;
+            strtab_ = strings;
+            strtabSize_ = strSize;
+        } else {
+            // No usable PT_DYNAMIC view, fall back to the section headers.
+            dynsym_ = table;
+            dynsymCount_ = size / symSize;
+            dynstr_ = strings;
+            dynstrSize_ = strSize;
+        }
+    }
+}
+
+bool ElfImage::symbolMatches(const uint8_t* table, const char* strtab, size_t strtabSize,
+                             uint32_t index, const char* name, uintptr_t* value) const {
+    SymbolFields sym = readSymbol(table, index, is64_);
+    if (sym.name >= strtabSize || sym.shndx == SHN_UNDEF) {
+        return false;
+    }
+    
+    const char* symName = strtab + sym.name;
+    size_t maxLen = strtabSize - sym.name;
+    size_t nameLen = strlen(name);
+    if (nameLen >= maxLen || memcmp(symName, name, nameLen + 1) != 0) {
+        return false;
+    }
+    
+    *value = (uintptr_t)sym.value;
+    return true;
+}
+
+uint32_t ElfImage::lookupGnuHash(const char* name) const {
+    uint32_t nbuckets = gnuHash_[0];
+    uint32_t symoffset = gnuHash_[1];
+    uint32_t bloomSize = gnuHash_[2];
+    uint32_t bloomShift = gnuHash_[3];
+    uint32_t hash = gnuHash(name);
+    
+    // Bloom filter rejects most misses without touching the buckets.
+    uint32_t bits = is64_ ? 64 : 32;
+    uint64_t word;
+    if (is64_) {
+        const uint64_t* bloom = (const uint64_t*)(gnuHash_ + 4);
+        word = bloom[(hash / bits) % bloomSize];
+    } else {
+        word = gnuHash_[4 + (hash / bits) % bloomSize];
+    }
+    uint64_t mask = (1ULL << (hash % bits)) | (1ULL << ((hash >> bloomShift) % bits));
+    if ((word & mask) != mask) {
         return 0;
     }
     
-    struct link_map* map;
-    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0) {
-        LOGE("Failed to get link_map for %s", moduleName);
-        dlclose(handle);
+    const uint32_t* buckets = gnuHash_ + 4 + bloomSize * (bits / 32);
+    const uint32_t* chain = buckets + nbuckets;
+    
+    uint32_t index = buckets[hash % nbuckets];
+    if (index < symoffset) {
         return 0;
     }
     
-    uintptr_t baseAddr = (uintptr_t)map->l_addr;
-    dlclose(handle);
+    for (; index < dynsymCount_; index++) {
+        uint32_t chainHash = chain[index - symoffset];
+        uintptr_t value;
+        if ((chainHash | 1) == (hash | 1) &&
+            symbolMatches(dynsym_, dynstr_, dynstrSize_, index, name, &value)) {
+            return index;
+        }
+        if (chainHash & 1) break;
+    }
     
-    return baseAddr;
+    return 0;
 }
 
-uintptr_t getLocalFunctionAddress(const char* moduleName, const char* funcName) {
-    void* handle = dlopen(moduleName, RTLD_LAZY);
-    if (!handle) {
-        LOGE("Failed to dlopen %s: %s", moduleName, dlerror());
+uint32_t ElfImage::lookupSysvHash(const char* name) const {
+    uint32_t nbucket = sysvHash_[0];
+    uint32_t nchain = sysvHash_[1];
+    const uint32_t* buckets = sysvHash_ + 2;
+    const uint32_t* chain = buckets + nbucket;
+    
+    if (nbucket == 0) {
         return 0;
     }
     
-    void* funcAddr = dlsym(handle, funcName);
-    if (!funcAddr) {
-        LOGE("Failed to find symbol %s in %s: %s", funcName, moduleName, dlerror());
-        dlclose(handle);
+    uint32_t steps = 0;
+    for (uint32_t index = buckets[sysvHash(name) % nbucket];
+         index != STN_UNDEF && index < nchain && steps < nchain;
+         index = chain[index], steps++) {
+        uintptr_t value;
+        if (symbolMatches(dynsym_, dynstr_, dynstrSize_, index, name, &value)) {
+            return index;
+        }
+    }
+    
+    return 0;
+}
+
+uintptr_t ElfImage::scanSymtab(const char* name) const {
+    for (size_t i = 1; i < symtabCount_; i++) {
+        uintptr_t value;
+        if (symbolMatches(symtab_, strtab_, strtabSize_, (uint32_t)i, name, &value)) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+uint32_t ElfImage::lookupDynamic(const char* name) const {
+    if (!dynsym_) {
+        return 0;
+    }
+    if (gnuHash_) {
+        return lookupGnuHash(name);
+    }
+    if (sysvHash_) {
+        return lookupSysvHash(name);
+    }
+    for (size_t i = 1; i < dynsymCount_; i++) {
+        uintptr_t value;
+        if (symbolMatches(dynsym_, dynstr_, dynstrSize_, (uint32_t)i, name, &value)) {
+            return (uint32_t)i;
+        }
+    }
+    return 0;
+}
+
+uintptr_t ElfImage::findSymbol(const char* name) const {
+    if (!data_) {
         return 0;
     }
     
-    uintptr_t addr = (uintptr_t)funcAddr;
-    dlclose(handle);
+    uint32_t index = lookupDynamic(name);
+    if (index != 0) {
+        return (uintptr_t)readSymbol(dynsym_, index, is64_).value;
+    }
     
-    return addr;
+    // Internal symbols (e.g. the linker's __dl_ prefixed ones) only live in .symtab.
+    return scanSymtab(name);
+}
+
+void ElfImage::findSymbols(const std::vector<const char*>& names, std::vector<uintptr_t>& values) const {
+    values.assign(names.size(), 0);
+    if (!data_) {
+        return;
+    }
+    
+    // The GNU hash bloom filter turns most .dynsym misses away here
+    std::unordered_map<std::string_view, size_t> pending;
+    uint64_t bloom[kSymtabBloomWords] = {};
+    for (size_t i = 0; i < names.size(); i++) {
+        uint32_t index = lookupDynamic(names[i]);
+        if (index != 0) {
+            values[i] = (uintptr_t)readSymbol(dynsym_, index, is64_).value;
+        } else if (symtab_ && pending.emplace(names[i], i).second) {
+            uint32_t hash = gnuHash(names[i]);
+            bloom[(hash / 64) & (kSymtabBloomWords - 1)] |= bloomBits(hash);
+        }
+    }
+    
+    size_t left = pending.size();
+    for (size_t i = 1; i < symtabCount_ && left > 0; i++) {
+        SymbolFields sym = readSymbol(symtab_, (uint32_t)i, is64_);
+        if (sym.name >= strtabSize_ || sym.shndx == SHN_UNDEF) {
+            continue;
+        }
+        const char* symName = strtab_ + sym.name;
+        const char* end = (const char*)memchr(symName, '\0', strtabSize_ - sym.name);
+        if (!end) {
+            continue;
+        }
+        uint32_t hash = gnuHash(symName);
+        uint64_t bits = bloomBits(hash);
+        if ((bloom[(hash / 64) & (kSymtabBloomWords - 1)] & bits) != bits) {
+            continue;
+        }
+        auto it = pending.find(std::string_view(symName, end - symName));
+        if (it != pending.end() && values[it->second] == 0) {
+            values[it->second] = (uintptr_t)sym.value;
+            left--;
+        }
+    }
+    
+    // Repeated names share the first one's answer
+    for (size_t i = 0; i < names.size(); i++) {
+        if (values[i] == 0) {
+            auto it = pending.find(names[i]);
+            if (it != pending.end()) values[i] = values[it->second];
+        }
+    }
+}
+
+bool ElfImage::computeLoadBias(uintptr_t mapStart, uintptr_t mapOffset, uintptr_t& bias) const {
+    for (const LoadSegment& seg : loads_) {
+        uint64_t pageOffset = seg.offset & ~(uint64_t)(getpagesize() - 1);
+        if (mapOffset >= pageOffset && mapOffset < seg.offset + (seg.filesz ? seg.filesz : 1)) {
+            uint64_t vaddr = seg.vaddr - seg.offset + mapOffset;
+            bias = mapStart - (uintptr_t)vaddr;
+            return true;
+        }
+    }
+    return false;
 }
 
 uintptr_t getModuleBase(pid_t pid, const char* moduleName) {
-    ProcessUtils::ModuleInfo* module = ProcessUtils::findModule(pid, moduleName);
-    if (!module) {
+    ProcessUtils::ModuleInfo module;
+    if (!ProcessUtils::findModule(pid, moduleName, module)) {
         LOGE("Failed to find module %s in PID %d", moduleName, pid);
         return 0;
     }
     
-    return module->baseAddress;
+    return module.baseAddress;
 }
 
 uintptr_t getFunctionOffset(const char* modulePath, const char* funcName) {
-    // This is a simplified implementation
-    // Full implementation would parse ELF file and find symbol offset
-    
-    void* handle = dlopen(modulePath, RTLD_LAZY);
-    if (!handle) {
-        LOGE("Failed to dlopen %s: %s", modulePath, dlerror());
+    ElfImage image;
+    if (!image.open(modulePath)) {
         return 0;
     }
     
-    void* funcAddr = dlsym(handle, funcName);
-    if (!funcAddr) {
-        LOGE("Failed to find symbol %s: %s", funcName, dlerror());
-        dlclose(handle);
+    uintptr_t value = image.findSymbol(funcName);
+    if (value == 0) {
+        LOGE("Failed to find symbol %s in %s", funcName, modulePath);
         return 0;
     }
     
-    struct link_map* map;
-    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0) {
-        dlclose(handle);
+    // Offset from the start of the mapping at file offset 0, i.e. the module base.
+    uintptr_t bias;
+    if (!image.computeLoadBias(0, 0, bias)) {
         return 0;
     }
     
-    uintptr_t offset = (uintptr_t)funcAddr - (uintptr_t)map->l_addr;
-    dlclose(handle);
+    return value + bias;
+}
+
+bool resolveEntryPoint(const std::string& modulePath, const char* symbol, EntryPoint& entry) {
+    ElfImage image;
+    if (!image.open(modulePath)) {
+        return false;
+    }
+    uintptr_t value = image.findSymbol(symbol);
+    uintptr_t bias;
+    if (value == 0 || !image.computeLoadBias(0, 0, bias)) {
+        LOGE("Failed to find symbol %s in %s", symbol, modulePath.c_str());
+        return false;
+    }
     
-    return offset;
+    entry.offset = value + bias;
+    entry.baseVaddr = (uintptr_t)0 - bias;
+    return true;
 }
 
-uintptr_t getRemoteFunctionAddress(pid_t pid, const char* moduleName, const char* funcName) {
-    // Get module base in remote process
-    uintptr_t remoteBase = getModuleBase(pid, moduleName);
-    if (remoteBase == 0) {
-        return 0;
+bool resolveSymbolLocation(pid_t pid, const char* moduleName, const char* funcName,
+                           SymbolLocation& location, uintptr_t* remoteAddr) {
+    ProcessUtils::ModuleInfo module;
+    if (!ProcessUtils::findModule(pid, moduleName, module)) {
+        LOGE("Failed to find module %s in PID %d", moduleName, pid);
+        return false;
     }
+    location.modulePath = module.path;
     
-    // Get module base in local process
-    uintptr_t localBase = getLocalModuleBase(moduleName);
-    if (localBase == 0) {
-        return 0;
+    // Open the file the target actually mapped, as seen from its mount namespace.
+    std::string filePath = "/proc/" + std::to_string(pid) + "/root" + module.path;
+    if (access(filePath.c_str(), R_OK) != 0) {
+        filePath = module.path;
+    }
+    
+    // Cached offsets are relative to the mapping we found, so a hit needs
+    // neither the ELF headers nor the symbol tables.
+    uint64_t cacheKey = SymbolCache::moduleKey(filePath, module.offset);
+    switch (SymbolCache::lookup(cacheKey, funcName, location.offset)) {
+        case SymbolCache::LookupResult::Found:
+            LOGI("Function %s::%s at +0x%lx (cached)", moduleName, funcName, location.offset);
+            if (remoteAddr) *remoteAddr = module.baseAddress + location.offset;
+            return true;
+        case SymbolCache::LookupResult::Absent:
+            LOGE("Symbol %s not in %s (cached)", funcName, module.path.c_str());
+            return false;
+        case SymbolCache::LookupResult::Miss:
+            break;
+    }
+    
+    ElfImage image;
+    if (!image.open(filePath)) {
+        return false;
+    }
+    
+    uintptr_t value = image.findSymbol(funcName);
+    if (value == 0) {
+        LOGE("Failed to find symbol %s in %s", funcName, module.path.c_str());
+        SymbolCache::storeAbsent(cacheKey, funcName);
+        return false;
     }
     
-    // Get function address in local process
-    uintptr_t localFuncAddr = getLocalFunctionAddress(moduleName, funcName);
-    if (localFuncAddr == 0) {
+    uintptr_t bias;
+    if (!image.computeLoadBias(module.baseAddress, module.offset, bias)) {
+        LOGE("Mapping at 0x%lx does not belong to %s", module.baseAddress, module.path.c_str());
+        return false;
+    }
+    
+    location.offset = bias + value - module.baseAddress;
+    SymbolCache::store(cacheKey, funcName, location.offset);
+    LOGI("Function %s::%s at +0x%lx (value 0x%lx)", moduleName, funcName, location.offset, value);
+    if (remoteAddr) *remoteAddr = bias + value;
+    
+    return true;
+}
+
+uintptr_t applySymbolLocation(pid_t pid, const SymbolLocation& location) {
+    ProcessUtils::ModuleInfo module;
+    if (!ProcessUtils::queryModuleByPath(pid, location.modulePath, module)) {
+        LOGE("%s is not mapped in PID %d", location.modulePath.c_str(), pid);
+        return 0;
+    }
+    return module.baseAddress + location.offset;
+}
+
+uintptr_t applySymbolLocation(const ProcessUtils::MapsSnapshot& maps, const SymbolLocation& location) {
+    const ProcessUtils::MapsModule* module = maps.findModuleByPath(location.modulePath);
+    if (!module) {
+        LOGE("%s is not mapped in PID %d", location.modulePath.c_str(), maps.pid());
         return 0;
     }
     
-    // Calculate offset and apply to remote base
-    uintptr_t offset = localFuncAddr - localBase;
-    uintptr_t remoteFuncAddr = remoteBase + offset;
+    return module->base + location.offset;
+}
+
+namespace {
+
+// Requests that name the same module, by index
+struct ModuleBatch {
+    std::string module;
+    std::vector<size_t> requests;
+};
+
+void resolveBatch(pid_t pid, const ModuleBatch& batch, const std::vector<SymbolRequest>& requests,
+                  std::vector<SymbolResolution>& results) {
+    ProcessUtils::ModuleInfo module;
+    if (!ProcessUtils::findModule(pid, batch.module, module)) {
+        LOGE("Failed to find module %s in PID %d", batch.module.c_str(), pid);
+        return;
+    }
     
-    LOGI("Function %s::%s", moduleName, funcName);
-    LOGI("  Local base: 0x%lx", localBase);
-    LOGI("  Remote base: 0x%lx", remoteBase);
-    LOGI("  Offset: 0x%lx", offset);
-    LOGI("  Remote address: 0x%lx", remoteFuncAddr);
+    std::string filePath = "/proc/" + std::to_string(pid) + "/root" + module.path;
+    if (access(filePath.c_str(), R_OK) != 0) {
+        filePath = module.path;
+    }
+    uint64_t cacheKey = SymbolCache::moduleKey(filePath, module.offset);
+    
+    std::vector<size_t> misses;
+    for (size_t index : batch.requests) {
+        SymbolResolution& result = results[index];
+        result.location.modulePath = module.path;
+        switch (SymbolCache::lookup(cacheKey, requests[index].symbol.c_str(), result.location.offset)) {
+            case SymbolCache::LookupResult::Found:
+                result.found = true;
+                result.address = module.baseAddress + result.location.offset;
+                break;
+            case SymbolCache::LookupResult::Absent:
+                break;
+            case SymbolCache::LookupResult::Miss:
+                misses.push_back(index);
+                break;
+        }
+    }
+    if (misses.empty()) {
+        return;
+    }
+    
+    ElfImage image;
+    uintptr_t bias;
+    if (!image.open(filePath)) {
+        return;
+    }
+    if (!image.computeLoadBias(module.baseAddress, module.offset, bias)) {
+        LOGE("Mapping at 0x%lx does not belong to %s", module.baseAddress, module.path.c_str());
+        return;
+    }
+    
+    std::vector<const char*> names;
+    for (size_t index : misses) {
+        names.push_back(requests[index].symbol.c_str());
+    }
+    std::vector<uintptr_t> values;
+    image.findSymbols(names, values);
     
+    for (size_t i = 0; i < misses.size(); i++) {
+        SymbolResolution& result = results[misses[i]];
+        if (values[i] == 0) {
+            SymbolCache::storeAbsent(cacheKey, names[i]);
+            continue;
+        }
+        result.found = true;
+        result.address = bias + values[i];
+        result.location.offset = result.address - module.baseAddress;
+        SymbolCache::store(cacheKey, names[i], result.location.offset);
+    }
+}
+
+} // namespace
+
+size_t resolveSymbols(pid_t pid, const std::vector<SymbolRequest>& requests,
+                      std::vector<SymbolResolution>& results, size_t maxThreads) {
+    Trace::Scope trace("resolve_symbols", pid);
+    results.assign(requests.size(), SymbolResolution());
+    
+    std::vector<ModuleBatch> batches;
+    std::unordered_map<std::string, size_t> byModule;
+    for (size_t i = 0; i < requests.size(); i++) {
+        auto inserted = byModule.emplace(requests[i].module, batches.size());
+        if (inserted.second) {
+            batches.emplace_back();
+            batches.back().module = requests[i].module;
+        }
+        batches[inserted.first->second].requests.push_back(i);
+    }
+    
+    size_t threads = maxThreads ? maxThreads : std::thread::hardware_concurrency();
+    threads = std::max<size_t>(1, std::min(threads, batches.size()));
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < batches.size();) {
+            resolveBatch(pid, batches[i], requests, results);
+        }
+    };
+    
+    // The caller's thread takes a share of the modules as well
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    
+    size_t found = 0;
+    for (const SymbolResolution& result : results) {
+        if (result.found) found++;
+    }
+    trace.setDetail(std::to_string(found) + "/" + std::to_string(requests.size()) + " symbols in " +
+                    std::to_string(batches.size()) + " modules");
+    LOGI("Resolved %zu of %zu symbols in %zu modules of PID %d", found, requests.size(), batches.size(), pid);
+    return found;
+}
+
+uintptr_t getRemoteFunctionAddress(pid_t pid, const char* moduleName, const char* funcName) {
+    SymbolLocation location;
+    uintptr_t remoteFuncAddr = 0;
+    if (!resolveSymbolLocation(pid, moduleName, funcName, location, &remoteFuncAddr)) {
+        return 0;
+    }
+    
+    LOGI("Function %s::%s remote address: 0x%lx", moduleName, funcName, remoteFuncAddr);
     return remoteFuncAddr;
 }
 
 bool parseElfSymbols(const std::string& elfPath) {
-    // Placeholder for ELF parsing implementation
-    LOGI("Parsing ELF file: %s", elfPath.c_str());
+    ElfImage image;
+    if (!image.open(elfPath)) {
+        return false;
+    }
+    
+    LOGI("Parsed ELF file: %s (%s, machine %u, %zu dynamic / %zu static symbols)",
+         elfPath.c_str(), image.is64Bit() ? "ELF64" : "ELF32", image.machine(),
+         image.dynamicSymbolCount(), image.staticSymbolCount());
+    return true;
+}
+
+bool readElfIdentity(const std::string& path, uint16_t& machine, bool& is64) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    Elf64_Ehdr header;
+    ssize_t got = pread(fd, &header, sizeof(header), 0);
+    ::close(fd);
+    
+    // e_machine sits at the same offset in both classes
+    if (got < (ssize_t)sizeof(Elf32_Ehdr) || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    if (header.e_ident[EI_CLASS] != ELFCLASS32 && header.e_ident[EI_CLASS] != ELFCLASS64) {
+        return false;
+    }
+    is64 = header.e_ident[EI_CLASS] == ELFCLASS64;
+    machine = header.e_machine;
     return true;
 }
 
@@ -1,8 +1,11 @@
 #include <jni.h>
 #include <android/log.h>
-#include <thread>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <atomic>
+#include <string.h>
+#include "injector_channel.h"
+#include "payload_runtime.h"
 
 #define LOG_TAG "ExampleLib"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -11,6 +14,52 @@
 // Global JavaVM pointer
 static JavaVM* g_jvm = nullptr;
 
+// Shared-memory channel to the injector, set when injected with -channel
+static std::atomic<injector_channel*> g_channel(nullptr);
+
+// Answers each text command from the injector with an acknowledgement
+static void pollChannel() {
+    injector_channel* channel = g_channel.load();
+    if (!channel) {
+        return;
+    }
+    
+    char command[256];
+    uint32_t type;
+    int len;
+    while ((len = injector_channel_recv(channel, &type, command, sizeof(command) - 1)) != -1) {
+        if (len < 0) {
+            LOGE("Command too large, dropping the channel");
+            g_channel.store(nullptr);
+            return;
+        }
+        command[len] = '\0';
+        LOGI("Command (type %u): %s", type, command);
+        
+        // Your command handling here
+        char reply[300];
+        snprintf(reply, sizeof(reply), "ack: %s", command);
+        injector_channel_send(channel, INJECTOR_MSG_TEXT, reply, (uint32_t)strlen(reply));
+    }
+}
+
+// Called by the injector after dlopen, before anything else in this library
+extern "C" __attribute__((visibility("default"))) int injector_channel_attach(void* base, uint64_t size) {
+    injector_channel* channel = injector_channel_open(base, size, getpid());
+    if (!channel) {
+        LOGE("Channel rejected (other version?)");
+        return -1;
+    }
+    g_channel.store(channel);
+    LOGI("Channel attached: %p, %llu bytes", base, (unsigned long long)size);
+    
+    // Commands are polled every 100 ms on the runtime's loop thread, started
+    // here too since an injected library may never see JNI_OnLoad
+    PayloadRuntime::start();
+    PayloadRuntime::schedulePeriodic(0, 100, pollChannel);
+    return 0;
+}
+
 // Example hook function
 void exampleHookFunction() {
     LOGI("Example hook function called!");
@@ -19,62 +68,31 @@ void exampleHookFunction() {
     // This could modify game behavior, intercept function calls, etc.
 }
 
-// Background thread function
-void backgroundThread() {
-    LOGI("Background thread started!");
-    
-    // Wait for app to fully initialize
-    sleep(2);
+// Runs on the runtime's loop thread once the app had time to initialize
+void onAppReady() {
+    LOGI("App ready task running");
     
-    if (g_jvm) {
-        JNIEnv* env = nullptr;
-        bool attached = false;
-        
-        // Attach to current thread if needed
-        int status = g_jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
-        if (status == JNI_EDETACHED) {
-            LOGI("Attaching thread to JVM...");
-            if (g_jvm->AttachCurrentThread(&env, nullptr) == JNI_OK) {
-                attached = true;
-                LOGI("Thread attached successfully");
-            } else {
-                LOGE("Failed to attach thread");
-                return;
-            }
-        } else if (status == JNI_OK) {
-            LOGI("Thread already attached");
-        } else {
-            LOGE("Failed to get JNI environment");
-            return;
-        }
-        
-        if (env) {
-            // Example: Find and call Java methods
-            LOGI("JNIEnv obtained: %p", env);
-            
-            // Example: Find a class
-            // jclass clazz = env->FindClass("com/example/MainActivity");
-            // if (clazz) {
-            //     LOGI("Found MainActivity class");
-            //     // Call methods, modify fields, etc.
-            // }
-            
-            // Your injection logic here
-            exampleHookFunction();
-        }
-        
-        // Detach if we attached
-        if (attached) {
-            g_jvm->DetachCurrentThread();
-            LOGI("Thread detached");
-        }
+    // The loop thread is attached on first use and detached when it exits
+    JNIEnv* env = PayloadRuntime::env();
+    if (!env) {
+        LOGE("Failed to get JNI environment");
+        return;
     }
     
-    // Main loop - keep library loaded
-    while (true) {
-        sleep(10);
-        // Your periodic tasks here
-    }
+    // Example: Find and call Java methods
+    LOGI("JNIEnv obtained: %p", env);
+    
+    // Example: Find a class
+    // jclass clazz = env->FindClass("com/example/MainActivity");
+    // if (clazz) {
+    //     LOGI("Found MainActivity class");
+    //     // Call methods, modify fields, etc.
+    // }
+    
+    // Your injection logic here
+    exampleHookFunction();
+    
+    // Periodic work goes in PayloadRuntime::schedulePeriodic, not a loop
 }
 
 // Constructor - called when library is loaded
@@ -113,11 +131,15 @@ extern "C" JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
         LOGE("Failed to get JNIEnv");
     }
     
-    // Start background thread
-    // IMPORTANT: Start thread here, NOT in constructor!
+    // Start the runtime's loop thread and give the app 2 s to initialize
+    // IMPORTANT: Start it here, NOT in constructor!
     // Constructor may be called before JVM is ready
-    std::thread(backgroundThread).detach();
-    LOGI("Background thread started");
+    if (PayloadRuntime::start(vm)) {
+        PayloadRuntime::schedule(2000, onAppReady);
+        LOGI("Payload runtime started");
+    } else {
+        LOGE("Failed to start payload runtime");
+    }
     
     return JNI_VERSION_1_6;
 }
@@ -125,5 +147,13 @@ extern "C" JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
 // JNI_OnUnload - called when library is unloaded
 extern "C" JNIEXPORT void JNI_OnUnload(JavaVM* vm, void* reserved) {
     LOGI("JNI_OnUnload Called!");
+    
+    // Joins the loop thread, which detaches from the VM on its way out
+    PayloadRuntime::stop();
     g_jvm = nullptr;
+    
+    injector_channel* channel = g_channel.exchange(nullptr);
+    if (channel) {
+        injector_channel_close(channel);
+    }
 }
@@ -0,0 +1,110 @@
+#ifndef ASYNC_TRACER_H
+#define ASYNC_TRACER_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ptrace_utils.h"
+#include "remote_call.h"
+
+namespace PtraceUtils {
+
+// What a session does once its engine is idle.
+enum class AsyncStep {
+    Continue,   // calls were queued (or the step wants to be called again)
+    Finish,     // restore the registers and detach
+    Abort,      // same, but the session counts as failed
+};
+
+struct AsyncOutcome {
+    bool success;       // reached Finish and detached cleanly
+    bool timedOut;
+    std::string error;
+    double stopMs;      // attach stop to detach
+    
+    AsyncOutcome() : success(false), timedOut(false), stopMs(0) {}
+};
+
+// One target for AsyncTracer. step() runs on the tracer thread with the
+// registers saved, first with an empty queue and then every time the calls
+// it queued have run (ok is false if one of them faulted); done() reports
+// the end of the session, however it ended.
+struct AsyncTarget {
+    pid_t pid;
+    AttachMode mode;
+    uintptr_t trapAddr;     // 0: searched after attaching
+    std::function<AsyncStep(RemoteCallEngine& engine, bool ok)> step;
+    std::function<void(const AsyncOutcome& outcome)> done;
+    
+    AsyncTarget() : pid(0), mode(AttachMode::Attach), trapAddr(0) {}
+};
+
+// Drives many ptrace sessions from one thread. Each target is a small state
+// machine (attaching, calling, interrupting) advanced by its stops, which
+// are reaped with waitid(P_PIDFD) when a SIGCHLD signalfd or the target's
+// pidfd fires in an epoll loop; nothing blocks in waitpid. Every step has a
+// deadline: an overdue attach is abandoned, an overdue call is interrupted,
+// its registers restored and the target detached. run() waits up to one
+// more step timeout for abandoned targets to stop and releases them too. The interrupted call's
+// side effects (a lock it holds, say) are not undone.
+//
+// SIGCHLD is blocked in the calling thread while run() is active; block it
+// in every thread (before starting any) so no other thread consumes it. A
+// missed SIGCHLD costs latency only, the loop also polls every few ms.
+class AsyncTracer {
+public:
+    // stepTimeoutMs 0: no deadlines. maxInFlight 0: no limit on targets
+    // stopped at the same time.
+    AsyncTracer(uint32_t stepTimeoutMs, size_t maxInFlight);
+    ~AsyncTracer();
+    
+    AsyncTracer(const AsyncTracer&) = delete;
+    AsyncTracer& operator=(const AsyncTracer&) = delete;
+    
+    void add(const AsyncTarget& target);
+    
+    // Runs every added target to completion. False only if the event loop
+    // could not be set up; per-target results go to done().
+    bool run();
+
+private:
+    enum class State {
+        Pending,
+        Attaching,
+        Calling,
+        Interrupting,
+        Done,
+    };
+    
+    struct Session {
+        AsyncTarget target;
+        State state;
+        int pidfd;
+        uint64_t deadlineNs;
+        uint64_t attachNs;
+        uint64_t stopNs;
+        std::unique_ptr<RemoteCallEngine> engine;
+    };
+    
+    void startSession(Session& s);
+    bool reap(Session& s, int& status);
+    void onStop(Session& s, int status);
+    void advance(Session& s, bool ok);
+    void onDeadline(Session& s);
+    void release(Session& s, bool success, const std::string& error);
+    void finish(Session& s, AsyncOutcome& outcome);
+    void armDeadline(Session& s);
+    
+    uint32_t stepTimeoutMs_;
+    size_t maxInFlight_;
+    size_t inFlight_;
+    int epollFd_;
+    std::vector<Session> sessions_;
+};
+
+} // namespace PtraceUtils
+
+#endif // ASYNC_TRACER_H
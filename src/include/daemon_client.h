@@ -0,0 +1,25 @@
+#ifndef DAEMON_CLIENT_H
+#define DAEMON_CLIENT_H
+
+#include <vector>
+#include "injector.h"
+
+// Client side of DaemonProtocol: hands an injection to a running
+// InjectorDaemon instead of doing it in this process.
+namespace DaemonClient {
+
+enum class Status {
+    Done,           // the daemon ran the request; see success and results
+    Unavailable,    // nothing is listening; safe to inject in-process
+    Failed,         // the request may have reached the daemon; do not retry
+};
+
+Status inject(const Injector::InjectionConfig& config, bool& success,
+              std::vector<Injector::TargetResult>& results);
+
+bool ping();
+bool shutdown();
+
+} // namespace DaemonClient
+
+#endif // DAEMON_CLIENT_H
@@ -0,0 +1,101 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "injector.h"
+
+// Wire format between the injector client and the resident daemon. The
+// socket is an abstract-namespace AF_UNIX SOCK_SEQPACKET socket, so every
+// message is one datagram: a fixed header followed by a little-endian body
+// of u8/u32/u64/f64 fields and u32-length-prefixed strings. Both ends are
+// always built from the same tree; the version in the header rejects
+// anything else.
+namespace DaemonProtocol {
+
+#define DAEMON_SOCKET_NAME "injectord"
+
+const uint32_t kMagic = 0x444a4e49;     // "INJD"
+const uint16_t kVersion = 5;
+const size_t kMaxMessage = 64 * 1024;
+
+enum class MessageType : uint16_t {
+    Inject = 1,         // client -> daemon: InjectionConfig
+    Result = 2,         // daemon -> client: success flag + TargetResults
+    Ping = 3,           // client -> daemon, answered with an empty Result
+    Shutdown = 4,       // client -> daemon, answered with an empty Result
+    ResultPart = 5,     // daemon -> client: TargetResults ahead of the Result
+};
+
+struct MessageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t length;    // body bytes after the header
+};
+
+// Appends fields to a message body.
+class Writer {
+public:
+    void u8(uint8_t value) { bytes_.push_back(value); }
+    void u32(uint32_t value);
+    void u64(uint64_t value);
+    void f64(double value);
+    void str(const std::string& value);
+    void append(const Writer& other) { bytes_.insert(bytes_.end(), other.bytes_.begin(), other.bytes_.end()); }
+    
+    const std::vector<uint8_t>& bytes() const { return bytes_; }
+
+private:
+    std::vector<uint8_t> bytes_;
+};
+
+// Reads fields back; every accessor fails once the body is exhausted, so a
+// truncated or malformed message is caught by checking ok() at the end.
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : data_(data), size_(size), pos_(0), ok_(true) {}
+    
+    uint8_t u8();
+    uint32_t u32();
+    uint64_t u64();
+    double f64();
+    std::string str();
+    
+    bool ok() const { return ok_; }
+
+private:
+    bool take(void* out, size_t size);
+    
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_;
+    bool ok_;
+};
+
+void writeConfig(Writer& out, const Injector::InjectionConfig& config);
+bool readConfig(Reader& in, Injector::InjectionConfig& config);
+
+void writeResults(Writer& out, bool success, const std::vector<Injector::TargetResult>& results);
+bool readResults(Reader& in, bool& success, std::vector<Injector::TargetResult>& results);
+
+// The reply to an injection as message bodies in the writeResults layout,
+// each small enough for one datagram: all but the last go out as
+// ResultPart, the last as Result. A fan-out reports up to 4096 targets,
+// far more than 64 KB. A target too large on its own is sent without its
+// library entries and with an error saying so.
+std::vector<Writer> writeResultParts(bool success, const std::vector<Injector::TargetResult>& results);
+
+// Connected or listening socket for the daemon's abstract address.
+int connectSocket(const char* name = DAEMON_SOCKET_NAME);
+int listenSocket(const char* name = DAEMON_SOCKET_NAME);
+
+bool sendMessage(int fd, MessageType type, const std::vector<uint8_t>& body);
+// Blocks for one message; false on EOF, error or a bad header.
+bool recvMessage(int fd, MessageType& type, std::vector<uint8_t>& body);
+
+} // namespace DaemonProtocol
+
+#endif // DAEMON_PROTOCOL_H
@@ -2,21 +2,160 @@
 #define ELF_UTILS_H
 
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <cstddef>
 #include <sys/types.h>
 
+namespace ProcessUtils {
+class MapsSnapshot;
+}
+
 namespace ElfUtils {
 
-uintptr_t getLocalFunctionAddress(const char* moduleName, const char* funcName);
+// Read-only mapping of an ELF file on disk. Symbols are looked up through
+// DT_GNU_HASH / DT_HASH on .dynsym and a linear pass over .symtab, so no
+// code from the module is ever loaded into the injector. Both ELFCLASS32
+// and ELFCLASS64 images are handled regardless of the injector's own ABI.
+class ElfImage {
+public:
+    ElfImage();
+    ~ElfImage();
+    
+    ElfImage(const ElfImage&) = delete;
+    ElfImage& operator=(const ElfImage&) = delete;
+    
+    bool open(const std::string& path);
+    void close();
+    
+    bool isOpen() const { return data_ != nullptr; }
+    bool is64Bit() const { return is64_; }
+    uint16_t machine() const { return machine_; }
+    size_t dynamicSymbolCount() const { return dynsymCount_; }
+    size_t staticSymbolCount() const { return symtabCount_; }
+    
+    // DT_NEEDED entries in order, and DT_RUNPATH (DT_RPATH if there is no
+    // RUNPATH) as written, colon-separated, $ORIGIN unexpanded.
+    const std::vector<std::string>& neededLibraries() const { return needed_; }
+    const std::string& runPath() const { return runPath_; }
+    
+    // Link-time address (st_value) of a defined symbol, 0 if not found.
+    uintptr_t findSymbol(const char* name) const;
+    
+    // findSymbol for many names: values[i] for names[i]. Names .dynsym
+    // lacks share one pass over .symtab, where a bloom filter of their
+    // hashes skips most entries before any string compare.
+    void findSymbols(const std::vector<const char*>& names, std::vector<uintptr_t>& values) const;
+    
+    // Load bias of the image given one of its mappings in a process, i.e. the
+    // value to add to st_value to get a runtime address.
+    bool computeLoadBias(uintptr_t mapStart, uintptr_t mapOffset, uintptr_t& bias) const;
+    
+private:
+    struct LoadSegment {
+        uint64_t vaddr;
+        uint64_t offset;
+        uint64_t filesz;
+        uint64_t memsz;
+    };
+    
+    bool parseHeaders();
+    bool parseDynamic(uint64_t dynOffset, uint64_t dynSize);
+    void parseSections();
+    const uint8_t* fileAt(uint64_t offset, uint64_t size) const;
+    const uint8_t* vaddrToFile(uint64_t vaddr, uint64_t size) const;
+    
+    uint32_t lookupDynamic(const char* name) const;
+    uint32_t lookupGnuHash(const char* name) const;
+    uint32_t lookupSysvHash(const char* name) const;
+    uintptr_t scanSymtab(const char* name) const;
+    
+    bool symbolMatches(const uint8_t* table, const char* strtab, size_t strtabSize,
+                       uint32_t index, const char* name, uintptr_t* value) const;
+    
+    uint8_t* data_;
+    size_t size_;
+    bool is64_;
+    uint16_t machine_;
+    std::vector<LoadSegment> loads_;
+    std::vector<std::string> needed_;
+    std::string runPath_;
+    
+    const uint8_t* dynsym_;
+    size_t dynsymCount_;
+    const char* dynstr_;
+    size_t dynstrSize_;
+    const uint32_t* gnuHash_;
+    const uint32_t* sysvHash_;
+    
+    const uint8_t* symtab_;
+    size_t symtabCount_;
+    const char* strtab_;
+    size_t strtabSize_;
+};
+
+// Where a symbol lives relative to its module base (lowest mapping). The
+// same file maps the symbol at the same offset in every process, so one
+// resolution can be applied to many targets.
+struct SymbolLocation {
+    std::string modulePath;
+    uintptr_t offset;
+};
+
+// remoteAddr, if given, receives the symbol's address in pid itself.
+bool resolveSymbolLocation(pid_t pid, const char* moduleName, const char* funcName,
+                           SymbolLocation& location, uintptr_t* remoteAddr = nullptr);
+uintptr_t applySymbolLocation(pid_t pid, const SymbolLocation& location);
+// Same against an already loaded snapshot, so several locations cost one
+// maps read.
+uintptr_t applySymbolLocation(const ProcessUtils::MapsSnapshot& maps, const SymbolLocation& location);
+
+// One (module, symbol) pair of a batch; the module is named as for
+// ProcessUtils::findModule.
+struct SymbolRequest {
+    std::string module;
+    std::string symbol;
+};
+
+struct SymbolResolution {
+    bool found;
+    uintptr_t address;          // in the target
+    SymbolLocation location;
+    
+    SymbolResolution() : found(false), address(0) {}
+};
+
+// Resolves many symbols in pid at once. Requests are grouped by module;
+// each module is found in the maps once, its cached offsets are checked,
+// and its file is opened and searched once for the rest (see findSymbols).
+// Modules are independent and are resolved in parallel on up to
+// maxThreads threads (0: one per CPU). results[i] answers requests[i];
+// returns how many were found.
+size_t resolveSymbols(pid_t pid, const std::vector<SymbolRequest>& requests,
+                      std::vector<SymbolResolution>& results, size_t maxThreads = 0);
+
 uintptr_t getRemoteFunctionAddress(pid_t pid, const char* moduleName, const char* funcName);
 
 uintptr_t getModuleBase(pid_t pid, const char* moduleName);
-uintptr_t getLocalModuleBase(const char* moduleName);
 
 uintptr_t getFunctionOffset(const char* modulePath, const char* funcName);
 
+// A symbol of a module file as it will sit once the file is loaded: offset
+// from the module base (its mapping at file offset 0, as for getFunctionOffset)
+// and the base's link-time address, so that base = load bias + baseVaddr.
+// Enough to call into a freshly dlopen'ed module without a remote dlsym.
+struct EntryPoint {
+    uintptr_t offset;
+    uintptr_t baseVaddr;
+};
+
+bool resolveEntryPoint(const std::string& modulePath, const char* symbol, EntryPoint& entry);
+
 bool parseElfSymbols(const std::string& elfPath);
 
+// Class and machine from the ELF header alone, without mapping the file.
+bool readElfIdentity(const std::string& path, uint16_t& machine, bool& is64);
+
 } // namespace ElfUtils
 
 #endif // ELF_UTILS_H
@@ -2,24 +2,116 @@
 #define INJECTOR_H
 
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
 #include <cstdint>
 #include <sys/types.h>
+#include "symbol_cache.h"
+#include "elf_utils.h"
+#include "payload_channel.h"
 
 namespace Injector {
 
+// One payload to load; initSymbol, if set, is called with no arguments
+// right after the library is loaded.
+struct LibrarySpec {
+    std::string path;
+    std::string initSymbol;
+};
+
 struct InjectionConfig {
     std::string packageName;
     pid_t pid;
-    std::string libraryPath;
+    std::vector<pid_t> pids;
+    std::vector<LibrarySpec> libraries;
     bool useMemfd;
     bool hideMaps;
     bool hideSolist;
     bool watchLaunch;
+    bool allProcesses;
+    bool seize;
     uint32_t delayUs;
-    std::string symbolName;
+    uint32_t maxWorkers;        // targets stopped at the same time
+    uint32_t stepTimeoutMs;     // per attach / call batch; 0: wait forever
+    std::string symbolName;             // entry called in the first library after it loads
+    std::vector<std::string> entryArgs; // numbers, or strings passed by address
+    std::string symbolCachePath;
+    uint32_t channelKb;         // ring size of a payload channel for the first library; 0: none
     
     InjectionConfig() : pid(0), useMemfd(false), hideMaps(false),
-                        hideSolist(false), watchLaunch(false), delayUs(0) {}
+                        hideSolist(false), watchLaunch(false), allProcesses(false),
+                        seize(false), delayUs(0), maxWorkers(0), stepTimeoutMs(5000),
+                        symbolCachePath(SYMBOL_CACHE_DEFAULT_PATH), channelKb(0) {}
+};
+
+struct LibraryResult {
+    std::string path;
+    uintptr_t handle;
+    bool success;
+    double loadMs;
+    
+    LibraryResult() : handle(0), success(false), loadMs(0) {}
+};
+
+// Outcome of one target. planMs covers the work done before attaching,
+// stopMs attach to detach (the only time the target is frozen), totalMs the
+// whole per-target run including the optional delay.
+struct TargetResult {
+    pid_t pid;
+    bool success;
+    double planMs;
+    double stopMs;
+    double totalMs;
+    std::string error;
+    std::vector<LibraryResult> libraries;
+    bool entryCalled;
+    uintptr_t entryResult;
+    // The payload channel's address in the target, and this process's end
+    // of it (only for in-process injections; others connect() by pid)
+    uintptr_t channelAddr;
+    std::shared_ptr<PayloadChannel> channel;
+    
+    TargetResult() : pid(0), success(false), planMs(0), stopMs(0), totalMs(0),
+                     entryCalled(false), entryResult(0), channelAddr(0) {}
+};
+
+// Everything one target's session needs, computed before attaching: the
+// absolute addresses of the loader entry points in that process and the
+// string block (paths and init symbol names) that is copied into the
+// scratch arena with one write. Offsets are relative to the block start.
+struct InjectionPlan {
+    pid_t pid;
+    uintptr_t dlopenAddr;
+    uintptr_t dlsymAddr;
+    uintptr_t mmapAddr;         // 0: the arena goes on the target's stack
+    uintptr_t munmapAddr;
+    uintptr_t trapAddr;         // 0: the call engine searches after attaching
+    uintptr_t syscallAddr;      // libc syscall(), for the payload channel
+    bool handleIsLinkMap;       // glibc/musl: a dlopen handle points at the load bias
+    std::vector<uint8_t> block;
+    std::vector<size_t> pathOffsets;
+    std::vector<size_t> symbolOffsets;  // SIZE_MAX when there is no init symbol
+    
+    // Region size of the payload channel (0: none) and the block offsets of
+    // its memfd name and the payload's attach symbol
+    size_t channelSize;
+    size_t channelNameOffset;
+    size_t channelAttachOffset;
+    
+    // The -symbols entry of the first library (entryOffset 0: none), see
+    // ElfUtils::EntryPoint, and its arguments: literal, or a string at the
+    // given block offset when entryArgOffsets[i] != SIZE_MAX.
+    std::string entryModule;
+    uintptr_t entryOffset;
+    uintptr_t entryBaseVaddr;
+    std::vector<uintptr_t> entryArgs;
+    std::vector<size_t> entryArgOffsets;
+    
+    InjectionPlan() : pid(0), dlopenAddr(0), dlsymAddr(0), mmapAddr(0), munmapAddr(0), trapAddr(0),
+                      syscallAddr(0), handleIsLinkMap(false), channelSize(0), channelNameOffset(0),
+                      channelAttachOffset(0), entryOffset(0), entryBaseVaddr(0) {}
 };
 
 class LibraryInjector {
@@ -29,14 +121,74 @@ public:
     
     bool inject(const InjectionConfig& config);
     
+    const std::vector<TargetResult>& results() const { return results_; }
+    
+    // Keeps each target's planned addresses across inject() calls, so a
+    // repeated injection into a known process skips loader resolution and
+    // the maps read. Entries are keyed by (pid, start time), but an exec
+    // keeps both, so only enable this when every exec is reported through
+    // forgetProcess() (the daemon listens to the proc connector for that).
+    void setTargetCache(bool enable);
+    void forgetProcess(pid_t pid);
+    void forgetAllProcesses();
+    
 private:
-    bool injectByPid(pid_t pid, const std::string& libPath, const InjectionConfig& config);
-    bool injectByPackage(const std::string& package, const std::string& libPath, const InjectionConfig& config);
-    bool watchAndInject(const std::string& package, const std::string& libPath, const InjectionConfig& config);
+    // Entry points of the target's linker and libc; the same for every
+    // process mapping the same files, so fan-out resolves them once. dlsym
+    // is only resolved when a library has an init symbol or a channel is
+    // attached; mmap/munmap back the per-session scratch arena and, with
+    // syscall, create the channel.
+    struct LoaderSymbols {
+        ElfUtils::SymbolLocation dlopen;
+        ElfUtils::SymbolLocation dlsym;
+        ElfUtils::SymbolLocation mmap;
+        ElfUtils::SymbolLocation munmap;
+        ElfUtils::SymbolLocation syscall;
+        bool hasDlsym;
+        bool hasArena;
+        bool hasSyscall;
+        
+        LoaderSymbols() : hasDlsym(false), hasArena(false), hasSyscall(false) {}
+    };
+    
+    struct CachedTarget {
+        uint64_t startTime;
+        InjectionPlan plan;     // addresses only, no string block
+    };
+    
+    bool injectByPid(pid_t pid, const InjectionConfig& config);
+    bool injectByPackage(const std::string& package, const InjectionConfig& config);
+    bool watchAndInject(const std::string& package, const InjectionConfig& config);
+    bool injectMany(const std::vector<pid_t>& pids, const InjectionConfig& config);
+    
+    bool resolveLoader(pid_t pid, const InjectionConfig& config, LoaderSymbols& loader);
+    
+    // Plans every target, then runs all the stopped sessions concurrently
+    // on an AsyncTracer. Planning never stops a target; a session only
+    // attaches, writes the block, calls and detaches.
+    bool injectTargets(const std::vector<pid_t>& pids, const InjectionConfig& config,
+                       const LoaderSymbols& loader);
+    bool planTarget(pid_t pid, const InjectionConfig& config, const LoaderSymbols& loader,
+                    const ElfUtils::EntryPoint& entry, InjectionPlan& plan, TargetResult& result);
+    
+    bool planAddresses(pid_t pid, const InjectionConfig& config, const LoaderSymbols& shared,
+                       InjectionPlan& plan, TargetResult& result);
+    bool lookupTarget(pid_t pid, uint64_t startTime, const InjectionConfig& config, InjectionPlan& plan);
+    void storeTarget(pid_t pid, uint64_t startTime, const InjectionPlan& plan);
+    bool validatePayloads(const InjectionConfig& config);
+    bool preflightPayloads(pid_t pid, const InjectionConfig& config, TargetResult& result);
     
     pid_t findProcessByPackage(const std::string& package);
     uintptr_t getRemoteFunctionAddress(pid_t pid, const char* moduleName, const char* funcName);
     bool callRemoteFunction(pid_t pid, uintptr_t funcAddr, uintptr_t* params, int paramCount, uintptr_t* retValue);
+    
+    std::vector<TargetResult> results_;
+    bool prepared_;
+    // Payload path -> SymbolCache::moduleKey of the file that validated
+    std::unordered_map<std::string, uint64_t> validated_;
+    bool cacheTargets_;
+    std::mutex targetsLock_;
+    std::unordered_map<pid_t, CachedTarget> targets_;
 };
 
 } // namespace Injector
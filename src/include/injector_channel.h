@@ -0,0 +1,278 @@
+#ifndef INJECTOR_CHANNEL_H
+#define INJECTOR_CHANNEL_H
+
+/*
+ * Shared-memory channel between the injector and a payload (C and C++).
+ *
+ * With -channel the injector creates a memfd in the target, maps it there,
+ * maps the same pages into itself and lays out a versioned header and two
+ * single-producer/single-consumer rings: commands from the injector to the
+ * payload and events from the payload back. The payload is handed the
+ * region before its init symbol and -symbols entry run, by a call to
+ *
+ *     extern "C" int injector_channel_attach(void* base, uint64_t size);
+ *
+ * which it must export and which should pass the region to
+ * injector_channel_open(). Any later injector run (or the daemon) finds the
+ * region again through the target's maps, so commands and events flow
+ * without ptrace, syscalls or logging on either side.
+ *
+ * Messages are a 32-bit type chosen by the application and up to half a
+ * ring of bytes. Each ring has exactly one writer and one reader; neither
+ * side ever blocks, a full ring rejects the message (and counts it), and
+ * readers poll.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INJECTOR_CHANNEL_MAGIC      0x4e484349u     /* "ICHN" */
+#define INJECTOR_CHANNEL_VERSION    1
+#define INJECTOR_CHANNEL_ATTACH     "injector_channel_attach"
+#define INJECTOR_CHANNEL_NAME       "injector-channel"  /* memfd name */
+
+/* Ring indices: injector -> payload and payload -> injector */
+#define INJECTOR_RING_COMMANDS      0
+#define INJECTOR_RING_EVENTS        1
+
+/* Message types; the rest are the application's */
+#define INJECTOR_MSG_TEXT           1u              /* UTF-8, not terminated */
+#define INJECTOR_MSG_PAD            0xffffffffu     /* internal: skip to the ring start */
+
+/* payload_state */
+#define INJECTOR_PAYLOAD_NONE       0u
+#define INJECTOR_PAYLOAD_ATTACHED   1u
+#define INJECTOR_PAYLOAD_CLOSED     2u
+
+/* One ring's indices: free-running byte counters, each written by one side
+ * only and kept on its own cache line with that side's copy of the other. */
+struct injector_ring {
+    uint64_t head;              /* producer */
+    uint64_t tail_cache;        /* producer's last view of tail */
+    uint64_t dropped;           /* producer: messages rejected as full */
+    uint8_t pad0[40];
+    uint64_t tail;              /* consumer */
+    uint64_t head_cache;        /* consumer's last view of head */
+    uint8_t pad1[48];
+};
+
+struct injector_channel {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t size;              /* whole region */
+    uint64_t ring_offset[2];    /* data areas, from the region start */
+    uint64_t ring_capacity[2];  /* bytes, a power of two */
+    int32_t injector_pid;
+    int32_t payload_pid;        /* set by injector_channel_open */
+    uint32_t payload_state;
+    uint8_t pad[4];
+    struct injector_ring rings[2];
+};
+
+typedef struct injector_channel injector_channel;
+
+/* Record header in a ring; the data follows, padded to 8 bytes. */
+struct injector_record {
+    uint32_t length;
+    uint32_t type;
+};
+
+#define INJECTOR_ALIGN8(n) (((n) + 7u) & ~(uint64_t)7u)
+
+/* One direction of a channel, with the geometry read once: the side that
+ * trusts the other less keeps its own validated copy. */
+struct injector_ring_ref {
+    struct injector_ring* ctl;
+    uint8_t* data;
+    uint64_t capacity;
+};
+
+/* Whether size bytes at base hold a channel this header understands. */
+static inline int injector_channel_check(const void* base, uint64_t size) {
+    const injector_channel* ch = (const injector_channel*)base;
+    int i;
+    if (!base || size < sizeof(*ch) || ch->magic != INJECTOR_CHANNEL_MAGIC ||
+        ch->version != INJECTOR_CHANNEL_VERSION || ch->header_size < sizeof(*ch) || ch->size != size) {
+        return 0;
+    }
+    for (i = 0; i < 2; i++) {
+        uint64_t cap = ch->ring_capacity[i];
+        if (cap < 64 || (cap & (cap - 1)) != 0 || ch->ring_offset[i] % 8 != 0 ||
+            ch->ring_offset[i] < ch->header_size || cap > size || ch->ring_offset[i] > size - cap) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Checks a region handed over by the injector and marks the payload (pid)
+ * as attached; NULL if it is not a channel this header understands. */
+static inline injector_channel* injector_channel_open(void* base, uint64_t size, int32_t pid) {
+    injector_channel* ch = (injector_channel*)base;
+    if (!injector_channel_check(base, size)) {
+        return NULL;
+    }
+    ch->payload_pid = pid;
+    __atomic_store_n(&ch->payload_state, INJECTOR_PAYLOAD_ATTACHED, __ATOMIC_RELEASE);
+    return ch;
+}
+
+/* Tells the injector side that no more events will come. */
+static inline void injector_channel_close(injector_channel* ch) {
+    __atomic_store_n(&ch->payload_state, INJECTOR_PAYLOAD_CLOSED, __ATOMIC_RELEASE);
+}
+
+static inline struct injector_ring_ref injector_channel_ring(injector_channel* ch, int ring) {
+    struct injector_ring_ref ref;
+    ref.ctl = &ch->rings[ring];
+    ref.data = (uint8_t*)ch + ch->ring_offset[ring];
+    ref.capacity = ch->ring_capacity[ring];
+    return ref;
+}
+
+/* Offset of a counter in the data area. Counters only ever advance by
+ * multiples of 8; the mask keeps a damaged one inside the ring regardless. */
+static inline uint64_t injector_ring_pos(struct injector_ring_ref r, uint64_t counter) {
+    return counter & (r.capacity - 1) & ~(uint64_t)7u;
+}
+
+/* The largest message a ring accepts. */
+static inline uint32_t injector_ring_max_message(struct injector_ring_ref r) {
+    return (uint32_t)(r.capacity / 2 - sizeof(struct injector_record));
+}
+
+/*
+ * Zero-copy producer side: reserve room for len bytes, fill them, commit.
+ * NULL if the ring is full (counted in dropped) or len is too large.
+ */
+static inline void* injector_ring_reserve(struct injector_ring_ref r, uint32_t len) {
+    uint64_t need = INJECTOR_ALIGN8(sizeof(struct injector_record) + (uint64_t)len);
+    uint64_t head = __atomic_load_n(&r.ctl->head, __ATOMIC_RELAXED);
+    uint64_t pos = injector_ring_pos(r, head);
+    uint64_t contig = r.capacity - pos;
+    uint64_t total = contig < need ? contig + need : need;
+    
+    if (len > injector_ring_max_message(r)) {
+        return NULL;
+    }
+    if (r.capacity - (head - r.ctl->tail_cache) < total) {
+        r.ctl->tail_cache = __atomic_load_n(&r.ctl->tail, __ATOMIC_ACQUIRE);
+        if (head - r.ctl->tail_cache > r.capacity || r.capacity - (head - r.ctl->tail_cache) < total) {
+            __atomic_store_n(&r.ctl->dropped, r.ctl->dropped + 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+    
+    /* A record never wraps: the end of the ring is skipped with a pad record,
+     * published on its own */
+    if (contig < need) {
+        struct injector_record* pad = (struct injector_record*)(r.data + pos);
+        pad->length = (uint32_t)(contig - sizeof(*pad));
+        pad->type = INJECTOR_MSG_PAD;
+        __atomic_store_n(&r.ctl->head, head + contig, __ATOMIC_RELEASE);
+        pos = 0;
+    }
+    return r.data + pos + sizeof(struct injector_record);
+}
+
+static inline void injector_ring_commit(struct injector_ring_ref r, uint32_t type, uint32_t len) {
+    uint64_t head = __atomic_load_n(&r.ctl->head, __ATOMIC_RELAXED);
+    struct injector_record* rec = (struct injector_record*)(r.data + injector_ring_pos(r, head));
+    rec->length = len;
+    rec->type = type;
+    __atomic_store_n(&r.ctl->head, head + INJECTOR_ALIGN8(sizeof(*rec) + (uint64_t)len), __ATOMIC_RELEASE);
+}
+
+/*
+ * Zero-copy consumer side: the oldest message, valid until release; NULL if
+ * the ring is empty. A record the producer could not have written (a length
+ * past the ring) reads as empty too. The record header is read from shared
+ * memory exactly once and only that validated copy is used, so a producer
+ * rewriting it meanwhile cannot stretch the message; release takes the
+ * length peek returned instead of reading it again.
+ */
+static inline const void* injector_ring_peek(struct injector_ring_ref r, uint32_t* type, uint32_t* len) {
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&r.ctl->tail, __ATOMIC_RELAXED);
+        uint64_t pos = injector_ring_pos(r, tail);
+        const struct injector_record* src;
+        struct injector_record rec;
+        if (tail == r.ctl->head_cache) {
+            r.ctl->head_cache = __atomic_load_n(&r.ctl->head, __ATOMIC_ACQUIRE);
+            if (tail == r.ctl->head_cache) {
+                return NULL;
+            }
+        }
+        src = (const struct injector_record*)(r.data + pos);
+        rec.length = __atomic_load_n(&src->length, __ATOMIC_RELAXED);
+        rec.type = __atomic_load_n(&src->type, __ATOMIC_RELAXED);
+        if (rec.type == INJECTOR_MSG_PAD) {
+            if (rec.length != r.capacity - pos - sizeof(rec)) {
+                return NULL;
+            }
+            __atomic_store_n(&r.ctl->tail, tail + r.capacity - pos, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (rec.length > r.capacity - pos - sizeof(rec)) {
+            return NULL;
+        }
+        *type = rec.type;
+        *len = rec.length;
+        return src + 1;
+    }
+}
+
+/* Frees the message peek returned; len is the length it reported. */
+static inline void injector_ring_release(struct injector_ring_ref r, uint32_t len) {
+    uint64_t tail = __atomic_load_n(&r.ctl->tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&r.ctl->tail, tail + INJECTOR_ALIGN8(sizeof(struct injector_record) + (uint64_t)len),
+                     __ATOMIC_RELEASE);
+}
+
+/* Copying forms. send returns 0, or -1 when the ring is full or len too
+ * large. recv returns the message length, -1 when there is none, or -2 (the
+ * message stays queued) when it does not fit in cap bytes. */
+static inline int injector_ring_send(struct injector_ring_ref r, uint32_t type, const void* buf, uint32_t len) {
+    void* dst = injector_ring_reserve(r, len);
+    if (!dst) {
+        return -1;
+    }
+    memcpy(dst, buf, len);
+    injector_ring_commit(r, type, len);
+    return 0;
+}
+
+static inline int injector_ring_recv(struct injector_ring_ref r, uint32_t* type, void* buf, uint32_t cap) {
+    uint32_t len;
+    const void* src = injector_ring_peek(r, type, &len);
+    if (!src) {
+        return -1;
+    }
+    if (len > cap) {
+        return -2;
+    }
+    memcpy(buf, src, len);
+    injector_ring_release(r, len);
+    return (int)len;
+}
+
+/* The payload's side: send an event, receive a command. */
+static inline int injector_channel_send(injector_channel* ch, uint32_t type, const void* buf, uint32_t len) {
+    return injector_ring_send(injector_channel_ring(ch, INJECTOR_RING_EVENTS), type, buf, len);
+}
+
+static inline int injector_channel_recv(injector_channel* ch, uint32_t* type, void* buf, uint32_t cap) {
+    return injector_ring_recv(injector_channel_ring(ch, INJECTOR_RING_COMMANDS), type, buf, cap);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INJECTOR_CHANNEL_H */
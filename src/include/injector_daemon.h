@@ -0,0 +1,60 @@
+#ifndef INJECTOR_DAEMON_H
+#define INJECTOR_DAEMON_H
+
+#include <vector>
+#include <sys/types.h>
+#include "injector.h"
+#include "proc_scanner.h"
+#include "daemon_protocol.h"
+
+namespace Injector {
+
+// Resident injector. Serves requests from DaemonProtocol clients on an
+// abstract unix socket, one at a time, with one long-lived LibraryInjector:
+// the SELinux context, symbol cache mapping and validated payloads carry
+// over between requests, and so do each target's planned addresses. A
+// process table (pid, start time, name) answers package lookups without a
+// /proc scan. Both are kept current from proc connector EXEC/COMM/EXIT
+// events; without the connector the table is rescanned per lookup and
+// per-process addresses are not cached.
+class InjectorDaemon {
+public:
+    InjectorDaemon();
+    ~InjectorDaemon();
+    
+    InjectorDaemon(const InjectorDaemon&) = delete;
+    InjectorDaemon& operator=(const InjectorDaemon&) = delete;
+    
+    // Blocks SIGINT/SIGTERM in the calling thread only; block them in main()
+    // before starting any thread, or another thread takes them and dies.
+    bool start(const char* socketName = DAEMON_SOCKET_NAME);
+    
+    // Serves until a Shutdown request, SIGINT or SIGTERM.
+    bool run();
+    void stop();
+
+private:
+    void acceptClient();
+    bool authorized(int fd);
+    bool handleRequest(int fd);
+    bool resolveTargets(InjectionConfig& config, std::string& error);
+    
+    void readProcEvents();
+    void rescanTable();
+    void updateEntry(pid_t pid);
+    void removeEntry(pid_t pid);
+    
+    int listenFd_;
+    int netlinkFd_;
+    int signalFd_;
+    int epollFd_;
+    bool running_;
+    bool tableValid_;
+    ProcessUtils::ProcScanner scanner_;
+    std::vector<ProcessUtils::ProcessEntry> table_;    // sorted by pid
+    LibraryInjector injector_;
+};
+
+} // namespace Injector
+
+#endif // INJECTOR_DAEMON_H
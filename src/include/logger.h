@@ -0,0 +1,56 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <android/log.h>
+
+// Records below this priority are compiled out entirely. Release builds
+// keep warnings and errors only; override with -DINJECTOR_MIN_LOG_LEVEL=<n>
+// (an ANDROID_LOG_* value, e.g. 2 for everything).
+#ifndef INJECTOR_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define INJECTOR_MIN_LOG_LEVEL ANDROID_LOG_WARN
+#else
+#define INJECTOR_MIN_LOG_LEVEL ANDROID_LOG_VERBOSE
+#endif
+#endif
+
+// Each source file defines LOGI/LOGE on top of this:
+//   #define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define INJECTOR_LOG(prio, tag, ...)                        \
+    do {                                                    \
+        if ((prio) >= INJECTOR_MIN_LOG_LEVEL) {             \
+            Logger::write((prio), (tag), __VA_ARGS__);      \
+        }                                                   \
+    } while (0)
+
+// Asynchronous logging. Once started, write() formats the record straight
+// into a slot of a fixed lock-free ring and returns without a syscall; a
+// background thread drains the ring to logcat, stderr or a file. A full
+// ring drops records (and counts them) rather than blocking, so logging
+// never stretches the window a target is held stopped. Before start() and
+// after stop() records are written synchronously to logcat.
+namespace Logger {
+
+enum class Sink {
+    Logcat,
+    Stderr,
+    File,
+};
+
+// path is used by Sink::File only.
+bool start(Sink sink, const char* path = nullptr);
+
+// Drains everything queued and stops the writer thread.
+void stop();
+
+bool running();
+
+// Records dropped because the ring was full.
+unsigned long dropped();
+
+// tag must be a string literal (it is stored by pointer).
+void write(int prio, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+} // namespace Logger
+
+#endif // LOGGER_H
@@ -0,0 +1,95 @@
+#ifndef MAPS_QUERY_H
+#define MAPS_QUERY_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+#include "maps_snapshot.h"
+#include "process_utils.h"
+
+namespace ProcessUtils {
+
+// The mapping covering one address.
+struct MapsRegion {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t offset;
+    uint32_t perms;     // MapsPerm bits
+    std::string path;   // as the maps show it; empty for anonymous mappings
+};
+
+// Repeated lookups in one process's address space without reparsing its
+// maps each time. Address lookups use the PROCMAP_QUERY ioctl (Linux 6.11)
+// on an open /proc/<pid>/maps when the kernel has it: one syscall, no text.
+// Module lookups go through a MapsSnapshot that is reread only when the
+// process's VM size in /proc/<pid>/statm changed, which every mmap, munmap
+// and dlopen does; with the ioctl the module's base mapping is also checked
+// before it is returned, so a same-size replacement is caught as well.
+//
+// Both files stay open, so they keep referring to the process they were
+// opened for: once it exits, lookups fail instead of reading a new process
+// that reused the pid.
+class MapsQuery {
+public:
+    MapsQuery();
+    ~MapsQuery();
+    
+    MapsQuery(const MapsQuery&) = delete;
+    MapsQuery& operator=(const MapsQuery&) = delete;
+    
+    bool open(pid_t pid);
+    void close();
+    
+    pid_t pid() const { return pid_; }
+    bool usesIoctl() const { return ioctl_; }
+    
+    // False once the process has exited.
+    bool alive();
+    
+    // Same matching as MapsSnapshot::findModule / findModuleByPath.
+    bool findModule(std::string_view name, ModuleInfo& module);
+    bool findModuleByPath(std::string_view path, ModuleInfo& module);
+    bool findRegion(uintptr_t addr, MapsRegion& region);
+    
+    // The current snapshot, or nullptr if the process is gone.
+    const MapsSnapshot* snapshot();
+    
+    // Rereads the maps on the next lookup, for callers that just changed them.
+    void invalidate() { generation_ = 0; }
+
+private:
+    bool current();
+    bool reload();
+    bool readGeneration(uint64_t& generation);
+    bool queryVma(uintptr_t addr, MapsRegion& region);
+    bool lookupModule(std::string_view key, bool byPath, ModuleInfo& module);
+    
+    pid_t pid_;
+    int mapsFd_;
+    int statmFd_;
+    bool ioctl_;
+    uint64_t generation_;
+    MapsSnapshot snapshot_;
+};
+
+// Lookups through a few MapsQuery objects kept per pid and shared by all
+// threads, so consecutive lookups for one target, from any module, reuse
+// one parse of its maps.
+bool queryModule(pid_t pid, std::string_view name, ModuleInfo& module);
+bool queryModuleByPath(pid_t pid, std::string_view path, ModuleInfo& module);
+bool queryRegion(pid_t pid, uintptr_t addr, MapsRegion& region);
+
+// Runs fn on the process's current snapshot; false if the process is gone.
+// fn runs under the process-wide cache lock, which every lookup for every
+// pid takes: it must not do lookups of its own, nor any I/O (remote memory
+// reads, file probes). Copy what it needs out of the snapshot and do the
+// rest after withMaps returns.
+bool withMaps(pid_t pid, const std::function<void(const MapsSnapshot& maps)>& fn);
+
+void invalidateMaps(pid_t pid);
+
+} // namespace ProcessUtils
+
+#endif // MAPS_QUERY_H
@@ -0,0 +1,91 @@
+#ifndef MAPS_SNAPSHOT_H
+#define MAPS_SNAPSHOT_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace ProcessUtils {
+
+enum MapsPerm : uint32_t {
+    MAPS_READ = 1 << 0,
+    MAPS_WRITE = 1 << 1,
+    MAPS_EXEC = 1 << 2,
+    MAPS_SHARED = 1 << 3,
+};
+
+const uint32_t kNoModule = ~0u;
+
+// One line of /proc/<pid>/maps. The path is a view into the snapshot's
+// buffer and is empty for anonymous mappings.
+struct MapsSegment {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t offset;
+    uint32_t perms;
+    uint32_t module;
+    std::string_view path;
+};
+
+// All file-backed segments sharing one path.
+struct MapsModule {
+    std::string_view name;
+    std::string_view path;
+    uintptr_t base;
+    uintptr_t end;
+    uint32_t firstSegment;
+    uint32_t segmentCount;
+    uint32_t perms;
+};
+
+// Parsed copy of /proc/<pid>/maps taken at one point in time. The file is
+// read with a few large read() calls into one buffer that all paths point
+// into; after the first load() of a given size, reloading does not allocate.
+// Lookups by module name are hashed and lookups by address are a binary
+// search over the segments, which the kernel emits sorted by address.
+class MapsSnapshot {
+public:
+    MapsSnapshot();
+    
+    bool load(pid_t pid);
+    void clear();
+    
+    pid_t pid() const { return pid_; }
+    const std::vector<MapsSegment>& segments() const { return segments_; }
+    const std::vector<MapsModule>& modules() const { return modules_; }
+    
+    // Exact match on the file name first, then a substring match on names.
+    const MapsModule* findModule(std::string_view name) const;
+    const MapsModule* findModuleByPath(std::string_view path) const;
+    
+    const MapsSegment* findSegment(uintptr_t addr) const;
+    const MapsModule* moduleAt(uintptr_t addr) const;
+    
+    // Segment i of a module, in address order.
+    const MapsSegment& moduleSegment(const MapsModule& module, uint32_t i) const {
+        return segments_[moduleSegments_[module.firstSegment + i]];
+    }
+    
+private:
+    bool readFile(pid_t pid);
+    void parse();
+    void buildIndex();
+    uint32_t lookup(const std::vector<uint32_t>& table, std::string_view key, bool byPath) const;
+    void insert(std::vector<uint32_t>& table, uint32_t module, bool byPath);
+    
+    pid_t pid_;
+    std::vector<char> buffer_;
+    size_t length_;
+    std::vector<MapsSegment> segments_;
+    std::vector<MapsModule> modules_;
+    std::vector<uint32_t> moduleSegments_;
+    // Open-addressing tables of module index + 1, keyed by name and by path.
+    std::vector<uint32_t> nameTable_;
+    std::vector<uint32_t> pathTable_;
+};
+
+} // namespace ProcessUtils
+
+#endif // MAPS_SNAPSHOT_H
@@ -0,0 +1,86 @@
+#ifndef PATTERN_SCANNER_H
+#define PATTERN_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include "elf_utils.h"
+
+// Byte-signature search over a module mapped in another process, for code
+// that has no symbol to resolve. The module's readable segments are found
+// through the maps cache and streamed out of the target with
+// process_vm_readv in large chunks, read on a helper thread into one of two
+// windows while the other is scanned. Each window is matched against every
+// pattern block by block, so the data comes from memory once however many
+// patterns there are. A pattern is anchored on its two rarest fixed bytes,
+// compared 32 (AVX2) or 16 (SSE2, NEON) positions at a time; the candidates
+// are then checked against the whole masked pattern.
+namespace PatternScanner {
+
+// "48 8b 05 ?? ?? ?? ?? e8 4? ?? ?? ??" or "488b05????????": hex bytes,
+// "??" (or a lone "?") for any byte, a '?' nibble for half of one.
+struct Pattern {
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+    std::string text;       // normalised, e.g. "48 8b 05 ?? ??"
+};
+
+bool parsePattern(const std::string& text, Pattern& pattern);
+
+enum class Kernel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+};
+
+Kernel bestKernel();
+bool kernelAvailable(Kernel kernel);
+const char* kernelName(Kernel kernel);
+
+struct Match {
+    uint32_t pattern;       // index into the pattern list
+    uintptr_t address;
+};
+
+struct ScanOptions {
+    Kernel kernel;
+    size_t maxMatches;      // per pattern; 0: no limit
+    bool includeWritable;   // also .data/.bss, whose contents differ per process
+    
+    ScanOptions() : kernel(bestKernel()), maxMatches(0), includeWritable(false) {}
+};
+
+struct ScanStats {
+    size_t bytes;
+    double ms;
+    
+    ScanStats() : bytes(0), ms(0) {}
+};
+
+// Matches every pattern against data as if it were mapped at base. Matches
+// may start anywhere below scanSize; the bytes from scanSize to size only
+// let a match run past it. Appends to matches.
+void scanBuffer(const uint8_t* data, size_t size, size_t scanSize, uintptr_t base,
+                const std::vector<Pattern>& patterns, const ScanOptions& options,
+                std::vector<Match>& matches);
+
+// All patterns over one module of pid (named as for findModule), in one
+// pass. Matches are sorted by address. The target keeps running; memory it
+// changes during the scan may or may not be seen.
+bool scanModule(pid_t pid, const std::string& module, const std::vector<Pattern>& patterns,
+                const ScanOptions& options, std::vector<Match>& matches, ScanStats* stats = nullptr);
+
+// The single match of pattern in the module's read-only segments, as a
+// location for ElfUtils::applySymbolLocation and, in remoteAddr, an address
+// for RemoteCallEngine::queue / callFunction. No match or several is an
+// error. Results are kept in the SymbolCache under the module's identity
+// like symbol offsets, so an unchanged module is scanned once.
+bool resolvePattern(pid_t pid, const std::string& module, const std::string& pattern,
+                    ElfUtils::SymbolLocation& location, uintptr_t* remoteAddr = nullptr);
+
+} // namespace PatternScanner
+
+#endif // PATTERN_SCANNER_H
@@ -0,0 +1,77 @@
+#ifndef PAYLOAD_CHANNEL_H
+#define PAYLOAD_CHANNEL_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include "injector_channel.h"
+
+namespace Injector {
+
+// The injector's end of a payload channel (see injector_channel.h): the
+// target's memfd region mapped into this process through
+// /proc/<pid>/map_files. The geometry is validated once and kept locally,
+// so a payload that scribbles over the shared header cannot steer this
+// side's reads and writes outside the rings.
+class PayloadChannel {
+public:
+    PayloadChannel();
+    ~PayloadChannel();
+    
+    PayloadChannel(const PayloadChannel&) = delete;
+    PayloadChannel& operator=(const PayloadChannel&) = delete;
+    
+    // Region size for rings of at least ringBytes each (a power of two, at
+    // least 4 KB, whole pages overall).
+    static size_t regionSize(size_t ringBytes);
+    
+    // Maps the region just mapped at remoteAddr in pid and lays out a fresh
+    // header, before the payload is told about it.
+    bool create(pid_t pid, uintptr_t remoteAddr, size_t size);
+    
+    // Maps the channel an earlier injection left in pid.
+    bool connect(pid_t pid);
+    
+    void close();
+    
+    bool isOpen() const { return base_ != nullptr; }
+    pid_t pid() const { return pid_; }
+    uintptr_t remoteAddress() const { return remoteAddr_; }
+    size_t size() const { return size_; }
+    
+    // INJECTOR_PAYLOAD_* as the payload last set it.
+    uint32_t payloadState() const;
+    
+    // A command for the payload; false if the ring is full or the message
+    // too large.
+    bool send(uint32_t type, const void* data, size_t size);
+    bool send(const std::string& text) { return send(INJECTOR_MSG_TEXT, text.data(), text.size()); }
+    
+    // The oldest event from the payload; false if there is none.
+    bool receive(uint32_t& type, std::string& data);
+    
+    // Zero-copy forms, as injector_ring_reserve/commit and peek/release.
+    void* reserve(uint32_t size) { return injector_ring_reserve(commands_, size); }
+    void commit(uint32_t type, uint32_t size) { injector_ring_commit(commands_, type, size); }
+    const void* peek(uint32_t& type, uint32_t& size) { return injector_ring_peek(events_, &type, &size); }
+    void release(uint32_t size) { injector_ring_release(events_, size); }
+    
+    // Messages each side had to drop because the other fell behind.
+    uint64_t droppedCommands() const;
+    uint64_t droppedEvents() const;
+
+private:
+    bool map(pid_t pid, uintptr_t start, uintptr_t end);
+    
+    pid_t pid_;
+    uintptr_t remoteAddr_;
+    size_t size_;
+    injector_channel* base_;
+    injector_ring_ref commands_;
+    injector_ring_ref events_;
+};
+
+} // namespace Injector
+
+#endif // PAYLOAD_CHANNEL_H
@@ -0,0 +1,66 @@
+#ifndef PAYLOAD_RUNTIME_H
+#define PAYLOAD_RUNTIME_H
+
+#include <jni.h>
+#include <functional>
+#include <cstdint>
+
+// Executor for injected payloads: one event-loop thread that runs posted
+// tasks, one-shot and periodic timers and fd callbacks, instead of a
+// detached thread per job sleeping in a loop. The thread blocks in
+// epoll_wait on a timerfd armed for the earliest deadline, an eventfd that
+// posts and stop() ring, and the watched fds; an idle payload costs no
+// wakeups at all.
+//
+// The runtime is a static library linked into each payload, so every
+// payload gets one loop thread however many tasks it runs. Tasks run on
+// that thread one at a time, in deadline order, and may schedule, cancel
+// and watch themselves. A task that blocks delays all the others.
+namespace PayloadRuntime {
+
+using Task = std::function<void()>;
+using FdCallback = std::function<void(uint32_t events)>;
+using TaskId = uint64_t;    // 0: none
+
+// Starts the loop thread; does nothing if it is already running. vm, if
+// given, is used for env() on every thread; it may also be set later.
+bool start(JavaVM* vm = nullptr);
+void setJavaVM(JavaVM* vm);
+
+// Stops the loop and joins it: the running task finishes, pending ones are
+// dropped and the loop thread detaches from the VM. Call from JNI_OnUnload.
+// From a task it only asks the loop to exit once that task returns.
+void stop();
+
+bool running();
+bool onLoopThread();
+
+// Runs task on the loop thread as soon as possible. Like all the scheduling
+// calls, returns 0 when the runtime is not running.
+TaskId post(Task task);
+
+// Runs task once after delayMs.
+TaskId schedule(uint32_t delayMs, Task task);
+
+// Runs task every periodMs, first after initialDelayMs, at a fixed rate;
+// ticks missed while the loop was busy are skipped, not run back to back.
+TaskId schedulePeriodic(uint32_t initialDelayMs, uint32_t periodMs, Task task);
+
+// False if the task already ran (one-shot) or was never scheduled. A
+// running task cancelling itself stops further periods.
+bool cancel(TaskId id);
+
+// Calls callback on the loop thread with the epoll events whenever fd is
+// ready (level-triggered). The fd stays the caller's.
+bool watchFd(int fd, uint32_t events, FdCallback callback);
+bool unwatchFd(int fd);
+
+// The calling thread's JNIEnv, attaching it to the VM on first use; nullptr
+// without a VM. A thread attached here is detached automatically when it
+// exits; threads the VM already knew are left alone.
+JNIEnv* env();
+JavaVM* javaVM();
+
+} // namespace PayloadRuntime
+
+#endif // PAYLOAD_RUNTIME_H
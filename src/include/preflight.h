@@ -0,0 +1,40 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+// Checks a payload against one target before the target is stopped, so a
+// payload that dlopen would reject fails the injection with a reason
+// instead of a 0 handle:
+//  - its ELF class and machine match the target's executable,
+//  - the path is visible in the target's mount namespace,
+//  - every DT_NEEDED entry is either already loaded in the target or found
+//    in the target's view of its library path (RUNPATH/RPATH, LD_LIBRARY_PATH,
+//    the directories of its loaded modules, the platform directories), with
+//    a matching class and machine,
+//  - every requested entry symbol is defined.
+//
+// Only the checks the payload alone decides (ABI, entry symbols) are
+// cached, per (payload content, target ABI, entry symbols): in memory, and
+// in the SymbolCache file when it is open, keyed both by the file's
+// identity and by a hash of its contents, so a copy of a known payload is
+// not checked again either. The namespace and dependency checks depend on
+// the target (on Android every app shares app_process64 but not its
+// library directory) and run for each one against its warm maps snapshot;
+// files are only probed for dependencies the target has not loaded.
+// Failures are never cached; a missing dependency may be installed before
+// the next run.
+namespace Preflight {
+
+bool checkPayload(pid_t pid, const std::string& path, const std::vector<std::string>& entrySymbols,
+                  std::string& error);
+
+// 64-bit hash of the file's contents; 0 if it cannot be read.
+uint64_t contentHash(const std::string& path);
+
+} // namespace Preflight
+
+#endif // PREFLIGHT_H
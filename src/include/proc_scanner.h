@@ -0,0 +1,73 @@
+#ifndef PROC_SCANNER_H
+#define PROC_SCANNER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace ProcessUtils {
+
+const size_t kProcessNameMax = 256;
+
+// One process of a /proc snapshot. name is argv[0] from cmdline (the
+// package name for Android app processes). startTime is field 22 of
+// /proc/<pid>/stat in clock ticks since boot, so (pid, startTime) identifies
+// a process even after its PID is reused; it is 0 unless requested.
+struct ProcessEntry {
+    pid_t pid;
+    uint64_t startTime;
+    uint32_t nameLength;
+    char name[kProcessNameMax];
+};
+
+struct ScanOptions {
+    // Only keep processes whose name contains this string (nullptr = all).
+    const char* nameFilter;
+    bool stopAtFirst;
+    bool withStartTime;
+    
+    ScanOptions() : nameFilter(nullptr), stopAtFirst(false), withStartTime(false) {}
+};
+
+// Reusable /proc walker. The directory is listed with raw getdents64 into a
+// fixed buffer and each cmdline/stat is read with openat()+read() relative
+// to one /proc descriptor into fixed buffers, so a warm scanner performs no
+// heap allocation per process. When enabled and supported by the kernel,
+// the per-process opens and reads are batched through io_uring.
+class ProcScanner {
+public:
+    ProcScanner();
+    ~ProcScanner();
+    
+    ProcScanner(const ProcScanner&) = delete;
+    ProcScanner& operator=(const ProcScanner&) = delete;
+    
+    bool scan(std::vector<ProcessEntry>& table, const ScanOptions& options = ScanOptions());
+    
+    bool readName(pid_t pid, char* name, size_t size, uint32_t* length = nullptr);
+    bool readStartTime(pid_t pid, uint64_t& startTime);
+    
+    // Returns false if io_uring is not available; the scanner then keeps
+    // using plain syscalls.
+    bool setUseIoUring(bool enable);
+    bool usingIoUring() const { return uring_ != nullptr; }
+    
+private:
+    struct IoUringBatch;
+    
+    bool listPids();
+    bool scanSync(std::vector<ProcessEntry>& table, const ScanOptions& options);
+    bool scanBatched(std::vector<ProcessEntry>& table, const ScanOptions& options);
+    
+    int procFd_;
+    std::vector<char> direntBuffer_;
+    std::vector<pid_t> pids_;
+    IoUringBatch* uring_;
+};
+
+bool parseStartTime(const char* stat, size_t length, uint64_t& startTime);
+
+} // namespace ProcessUtils
+
+#endif // PROC_SCANNER_H
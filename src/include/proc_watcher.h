@@ -0,0 +1,87 @@
+#ifndef PROC_WATCHER_H
+#define PROC_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+#include "proc_scanner.h"
+
+namespace ProcessUtils {
+
+// proc_event.what values; spelled out because older uapi headers scope the
+// enum inside struct proc_event, newer ones do not.
+const uint32_t kProcEventExec = 0x00000002;
+const uint32_t kProcEventComm = 0x00000200;
+const uint32_t kProcEventExit = 0x80000000;
+
+// Subscribes to the netlink proc connector with a socket filter that only
+// lets the given proc_event.what values through. Returns the socket, or -1
+// if the connector is unavailable (no CAP_NET_ADMIN, no kernel support).
+int openProcConnector(const uint32_t* events, size_t count);
+
+// A process that started matching the watched name.
+struct LaunchEvent {
+    pid_t pid;
+    uint64_t startTime;
+    // Time from the kernel event (netlink) or the process start time
+    // (polling) to the match, in nanoseconds.
+    uint64_t latencyNs;
+    const char* source;
+};
+
+// Waits for processes whose argv[0] contains a name. Uses the netlink proc
+// connector (PROC_EVENT_EXEC / PROC_EVENT_COMM, filtered in the kernel with
+// a socket filter) when the injector may subscribe to it, and otherwise
+// polls /proc with an interval that shrinks while processes are appearing
+// and backs off while the system is idle. Candidates that exist but do not
+// match yet (e.g. a zygote child before setArgV0) are tracked via pidfd so
+// an exit or PID reuse is never mistaken for a launch.
+class ProcWatcher {
+public:
+    ProcWatcher();
+    ~ProcWatcher();
+    
+    ProcWatcher(const ProcWatcher&) = delete;
+    ProcWatcher& operator=(const ProcWatcher&) = delete;
+    
+    // Subscribes; must be called before checking for an already running
+    // process so no launch can slip in between.
+    bool start(const std::string& name);
+    void stop();
+    
+    // Blocks until a matching process appears or timeoutMs passes (-1 waits
+    // forever). Processes that already matched at start() are not reported.
+    bool waitForLaunch(LaunchEvent& event, int timeoutMs = -1);
+    
+    bool usingNetlink() const { return netlinkFd_ >= 0; }
+    
+private:
+    struct Candidate {
+        pid_t pid;
+        int pidfd;
+        uint64_t eventNs;
+        const char* source;
+    };
+    
+    bool openNetlink();
+    bool waitNetlink(LaunchEvent& event, int64_t deadlineNs);
+    bool waitPolling(LaunchEvent& event, int64_t deadlineNs);
+    bool checkCandidate(pid_t pid, uint64_t eventNs, const char* source, LaunchEvent& event);
+    bool recheckCandidates(LaunchEvent& event);
+    void trackCandidate(pid_t pid, uint64_t eventNs, const char* source);
+    void dropCandidate(size_t index);
+    bool isKnown(pid_t pid, uint64_t startTime) const;
+    
+    std::string name_;
+    int netlinkFd_;
+    ProcScanner scanner_;
+    std::vector<ProcessEntry> table_;
+    std::vector<ProcessEntry> known_;
+    std::vector<Candidate> candidates_;
+    int pollIntervalMs_;
+};
+
+} // namespace ProcessUtils
+
+#endif // PROC_WATCHER_H
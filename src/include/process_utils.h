@@ -3,14 +3,18 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <sys/types.h>
 
 namespace ProcessUtils {
 
+// A module as a whole: baseAddress is its lowest mapping, whose file
+// offset is recorded in offset, and endAddress the end of its highest one.
 struct ModuleInfo {
     std::string name;
     uintptr_t baseAddress;
     uintptr_t endAddress;
+    uintptr_t offset;
     std::string path;
 };
 
@@ -18,12 +22,18 @@ pid_t findProcessByName(const std::string& processName);
 std::vector<pid_t> findAllProcessesByName(const std::string& processName);
 pid_t findProcessByPackage(const std::string& packageName);
 
+// Main process "pkg" and its secondary processes "pkg:remote", "pkg:service"...
+bool belongsToPackage(const std::string& name, const std::string& package);
+
 bool getProcessModules(pid_t pid, std::vector<ModuleInfo>& modules);
-ModuleInfo* findModule(pid_t pid, const std::string& moduleName);
+bool findModule(pid_t pid, const std::string& moduleName, ModuleInfo& module);
 
 bool isProcessRunning(pid_t pid);
 std::string getProcessName(pid_t pid);
 
+// Field 22 of /proc/<pid>/stat; false if the process is gone.
+bool getProcessStartTime(pid_t pid, uint64_t& startTime);
+
 bool setSelinuxContext(const std::string& context);
 
 } // namespace ProcessUtils
@@ -4,10 +4,45 @@
 #include <sys/types.h>
 #include <sys/user.h>
 #include <cstdint>
+#include <cstddef>
 
 namespace PtraceUtils {
 
-bool attach(pid_t pid);
+// Transport used to move bytes between the injector and the target.
+// Auto tries process_vm_readv/writev first, then /proc/<pid>/mem, then
+// PTRACE_PEEKDATA/POKEDATA words; the explicit values force one path.
+enum class MemoryBackend {
+    Auto,
+    VmReadv,
+    ProcMem,
+    PtraceWord,
+};
+
+// One remote range <-> local buffer pair of a scatter/gather transfer.
+struct RemoteIoVec {
+    uintptr_t remoteAddr;
+    void* localBuffer;
+    size_t size;
+};
+
+// How attach() stops the target thread. Attach uses PTRACE_ATTACH, which
+// queues a real SIGSTOP; it is swallowed at the attach stop, but a group
+// stop already under way or a racing signal can be mistaken for it. Seize
+// uses PTRACE_SEIZE + PTRACE_INTERRUPT: no signal is sent and the stop is
+// reported unambiguously as PTRACE_EVENT_STOP. Either way only the traced
+// thread stops; the process's other threads keep running.
+enum class AttachMode {
+    Attach,
+    Seize,
+};
+
+bool attach(pid_t pid, AttachMode mode = AttachMode::Attach);
+
+// Non-blocking half of attach() for event loops: requests the stop, which
+// is later reported by waitpid/waitid and recognised by isAttachStop().
+// Any other stop before it is a signal to pass on with PTRACE_CONT.
+bool requestAttach(pid_t pid, AttachMode mode);
+bool isAttachStop(int status, AttachMode mode);
 bool detach(pid_t pid);
 
 bool getRegs(pid_t pid, struct user_regs_struct* regs);
@@ -16,9 +51,24 @@ bool setRegs(pid_t pid, const struct user_regs_struct* regs);
 bool readMemory(pid_t pid, uintptr_t addr, void* buffer, size_t size);
 bool writeMemory(pid_t pid, uintptr_t addr, const void* buffer, size_t size);
 
+bool readMemoryV(pid_t pid, const RemoteIoVec* iov, size_t count,
+                 MemoryBackend backend = MemoryBackend::Auto);
+bool writeMemoryV(pid_t pid, const RemoteIoVec* iov, size_t count,
+                  MemoryBackend backend = MemoryBackend::Auto);
+
+const char* memoryBackendName(MemoryBackend backend);
+
 bool continueExecution(pid_t pid);
 bool waitForSignal(pid_t pid);
 
+// Bytes below the stack pointer the interrupted code may still be using
+// (the x86_64 red zone; harmless elsewhere).
+const uintptr_t kStackRedZone = 128;
+
+uintptr_t getStackPointer(const struct user_regs_struct* regs);
+
+// Saves the registers, calls funcAddr and restores them. A single-call
+// RemoteCallEngine session; use the engine directly for call sequences.
 uintptr_t callFunction(pid_t pid, uintptr_t funcAddr, const uintptr_t* args, int argCount);
 
 } // namespace PtraceUtils
@@ -0,0 +1,79 @@
+#ifndef REMOTE_ARENA_H
+#define REMOTE_ARENA_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace PtraceUtils {
+
+class RemoteCallEngine;
+
+// Scratch memory in a stopped target for strings, argument blocks and result
+// buffers. One region is mapped per session (a remote mmap call, or a slice
+// of the target's stack when mmap is unavailable), carved up with a local
+// bump allocator and filled from a local mirror, so everything placed
+// between two flush() calls reaches the target in a single write.
+class RemoteArena {
+public:
+    explicit RemoteArena(RemoteCallEngine& engine);
+    ~RemoteArena();
+
+    // Maps size bytes (rounded up to pages) by calling the target's mmap.
+    bool map(uintptr_t mmapAddr, size_t size);
+
+    // Uses size bytes below the engine's stack top instead.
+    bool mapOnStack(size_t size);
+
+    // Unmaps a region from map() by calling the target's munmap; a stack
+    // region is just dropped.
+    bool unmap(uintptr_t munmapAddr);
+
+    // map() and unmap() split around the remote call for callers that drive
+    // the engine from an event loop: queue, run the engine, then complete
+    // with the returned call index.
+    int queueMap(uintptr_t mmapAddr, size_t size);
+    bool completeMap(int call);
+    int queueUnmap(uintptr_t munmapAddr);
+    bool completeUnmap(int call);
+
+    bool isMapped() const { return base_ != 0; }
+    bool onStack() const { return onStack_; }
+    uintptr_t base() const { return base_; }
+    size_t size() const { return size_; }
+    size_t used() const { return top_; }
+
+    // Reserve space without staging data (result buffers); 0 when full.
+    uintptr_t alloc(size_t size, size_t align = sizeof(uintptr_t));
+
+    // Reserve space and stage data to be written by the next flush().
+    uintptr_t put(const void* data, size_t size, size_t align = sizeof(uintptr_t));
+    uintptr_t putString(const std::string& str);
+
+    // Writes everything staged since the last flush.
+    bool flush();
+
+    // Reads back from the region (e.g. a result buffer).
+    bool read(uintptr_t addr, void* buffer, size_t size) const;
+
+    // Forgets all allocations; the region stays mapped.
+    void reset();
+
+private:
+    RemoteCallEngine& engine_;
+    pid_t pid_;
+    uintptr_t base_;
+    size_t size_;
+    size_t top_;
+    size_t dirtyStart_;
+    size_t dirtyEnd_;
+    bool onStack_;
+    size_t pendingSize_;
+    std::vector<uint8_t> mirror_;
+};
+
+} // namespace PtraceUtils
+
+#endif // REMOTE_ARENA_H
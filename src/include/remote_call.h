@@ -0,0 +1,144 @@
+#ifndef REMOTE_CALL_H
+#define REMOTE_CALL_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+namespace ProcessUtils {
+class MapsSnapshot;
+}
+
+namespace PtraceUtils {
+
+// Argument of a queued remote call: a literal value or the return value of
+// an earlier call in the same session.
+struct RemoteArg {
+    uintptr_t value;
+    int resultOf;
+    
+    RemoteArg(uintptr_t v) : value(v), resultOf(-1) {}
+    
+    static RemoteArg result(int callIndex) {
+        RemoteArg arg(0);
+        arg.resultOf = callIndex;
+        return arg;
+    }
+};
+
+// Runs a sequence of function calls in a stopped tracee with one register
+// save/restore. Every call returns into a trap instruction found in the
+// target's own code (int3 / BRK / BKPT), so each call costs exactly one
+// SETREGS, CONT, wait and GETREGS. Arguments beyond the register ones are
+// passed on the stack on every ABI; on i386 all of them are.
+//
+// A call whose function or arguments refer to an earlier result that came
+// back 0 is skipped, which makes dlopen -> dlsym -> init chains safe to
+// queue up front.
+class RemoteCallEngine {
+public:
+    explicit RemoteCallEngine(pid_t pid);
+    ~RemoteCallEngine();
+    
+    // Saves the registers and locates the return trap. Call frames are built
+    // below stackTop; 0 means below the interrupted stack's red zone.
+    bool begin(uintptr_t stackTop = 0);
+    
+    // Restores the registers saved by begin().
+    bool end();
+    
+    // Carves size bytes (16-byte aligned) off the top of the call stack area
+    // for caller data such as strings; later frames go below it.
+    uintptr_t reserveStack(size_t size);
+    
+    // Queue a call; the returned index names its result.
+    int queue(uintptr_t funcAddr, std::initializer_list<RemoteArg> args);
+    int queue(uintptr_t funcAddr, const RemoteArg* args, size_t argCount);
+    
+    // Queue a call to the address returned by an earlier call.
+    int queueIndirect(int funcResult, std::initializer_list<RemoteArg> args);
+    
+    // Executes the calls queued since the last run(). False if a call
+    // faulted or the target could not be driven; skipped calls are not
+    // errors.
+    bool run();
+    
+    enum class CallState {
+        Idle,       // nothing in flight, the queue is drained
+        Running,    // a call is executing; wait for the tracee to stop
+        Failed,     // a call faulted or the target is gone; the queue is dropped
+    };
+    
+    // Event-loop form of run(): launch() starts the next queued call without
+    // waiting, and every stop the caller reaps for this tracee goes to
+    // onStop() as a waitpid status, which completes the call and launches
+    // the next one.
+    CallState launch();
+    CallState onStop(int status);
+    bool inFlight() const { return inFlight_; }
+    bool active() const { return active_; }
+    
+    // Forgets the session without restoring the registers, for a tracee that
+    // is running again and cannot take SETREGS; the caller keeps savedRegs().
+    void discard();
+    
+    uintptr_t result(int callIndex) const;
+    bool executed(int callIndex) const;
+    
+    // Use a known trap instead of scanning the target for one; 0 selects the
+    // fallback of returning to address 0 and catching the SIGSEGV.
+    void setTrapAddress(uintptr_t addr);
+    uintptr_t trapAddress() const { return trap_; }
+    
+    pid_t pid() const { return pid_; }
+    const struct user_regs_struct& savedRegs() const { return saved_; }
+    
+    // The code ranges of the target's libc, then linker, in scan order.
+    struct TrapCandidate {
+        const char* module;
+        std::vector<std::pair<uintptr_t, uintptr_t>> code;
+    };
+    using TrapCandidates = std::vector<TrapCandidate>;
+    
+    // Scans the target's libc (then linker) code for a trap instruction.
+    // The scan reads remote memory, so a caller that already holds a maps
+    // snapshot copies the ranges out with trapCandidates() inside withMaps()
+    // and scans after the lock is released.
+    static bool findTrap(pid_t pid, uintptr_t& addr);
+    static void trapCandidates(const ProcessUtils::MapsSnapshot& maps, TrapCandidates& candidates);
+    static bool findTrap(pid_t pid, const TrapCandidates& candidates, uintptr_t& addr);
+
+private:
+    struct Call {
+        uintptr_t funcAddr;
+        int funcResult;
+        std::vector<RemoteArg> args;
+        uintptr_t result;
+        bool executed;
+    };
+    
+    bool resolveArg(const RemoteArg& arg, uintptr_t& value) const;
+    bool start(Call& call, bool& skipped);
+    CallState fail();
+    
+    pid_t pid_;
+    bool active_;
+    bool inFlight_;
+    uint64_t callStartNs_;
+    bool trapKnown_;
+    uintptr_t trap_;
+    uintptr_t stackTop_;
+    struct user_regs_struct saved_;
+    std::vector<Call> calls_;
+    size_t nextCall_;
+    std::vector<uintptr_t> lastFrame_;
+    uintptr_t lastFrameSp_;
+};
+
+} // namespace PtraceUtils
+
+#endif // REMOTE_CALL_H
@@ -0,0 +1,42 @@
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+#include <string>
+#include <cstdint>
+
+namespace SymbolCache {
+
+#ifdef __ANDROID__
+#define SYMBOL_CACHE_DEFAULT_PATH "/data/local/tmp/.injector_symcache"
+#else
+#define SYMBOL_CACHE_DEFAULT_PATH "/tmp/.injector_symcache"
+#endif
+
+// Persistent (module, symbol) -> offset table shared by all injector
+// processes through a MAP_SHARED file. Lookups are a hash probe into the
+// mapping with no parsing and no locks; inserts serialize on flock().
+bool open(const std::string& path);
+void close();
+bool isOpen();
+
+// Identity of a module file on disk (device, inode, size, mtime) mixed with
+// the file offset of the mapping the cached offsets are relative to. A
+// rebuilt or replaced module gets a new key, so stale entries are never hit.
+// Returns 0 if the file cannot be stat'ed.
+uint64_t moduleKey(const std::string& path, uintptr_t mapOffset);
+
+// Cached entries record misses too, so a symbol known to be absent does not
+// trigger a full ELF parse on every run.
+enum class LookupResult {
+    Miss,
+    Found,
+    Absent,
+};
+
+LookupResult lookup(uint64_t moduleKey, const char* symbol, uintptr_t& offset);
+bool store(uint64_t moduleKey, const char* symbol, uintptr_t offset);
+bool storeAbsent(uint64_t moduleKey, const char* symbol);
+
+} // namespace SymbolCache
+
+#endif // SYMBOL_CACHE_H
@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Monotonic-clock instrumentation for injection phases and the syscalls
+// behind them. Disabled by default; a disabled scope costs one relaxed
+// atomic load. Recorded spans are kept in per-thread buffers, merged only
+// when read out, and exported as Chrome trace-event JSON (chrome://tracing,
+// Perfetto) or summarised as log2 histograms per phase and per syscall class.
+namespace Trace {
+
+enum class SyscallClass {
+    Ptrace,         // attach/detach, GETREGS/SETREGS, CONT
+    Wait,           // waitpid on the tracee
+    MemoryRead,     // process_vm_readv, /proc/pid/mem, PEEKDATA
+    MemoryWrite,    // process_vm_writev, /proc/pid/mem, POKEDATA
+    ProcFs,         // /proc listing and maps reads
+    Count,
+};
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enable);
+void reset();
+
+uint64_t nowNs();
+
+// target is the PID the span worked on (0 if none); detail is free text
+// such as a library path.
+void record(const char* phase, uint64_t startNs, uint64_t endNs, pid_t target = 0,
+            const std::string& detail = std::string());
+void recordSyscall(SyscallClass cls, uint64_t startNs, uint64_t endNs);
+
+const char* syscallClassName(SyscallClass cls);
+
+// Times the enclosing block as one phase.
+class Scope {
+public:
+    explicit Scope(const char* phase, pid_t target = 0)
+        : phase_(phase), target_(target), start_(enabled() ? nowNs() : 0) {}
+    ~Scope() {
+        if (start_ != 0) record(phase_, start_, nowNs(), target_, detail_);
+    }
+
+    void setDetail(const std::string& detail) { detail_ = detail; }
+
+private:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    const char* phase_;
+    pid_t target_;
+    uint64_t start_;
+    std::string detail_;
+};
+
+// Times the enclosing block as one syscall of the given class.
+class SyscallScope {
+public:
+    explicit SyscallScope(SyscallClass cls)
+        : cls_(cls), start_(enabled() ? nowNs() : 0) {}
+    ~SyscallScope() {
+        if (start_ != 0) recordSyscall(cls_, start_, nowNs());
+    }
+
+private:
+    SyscallScope(const SyscallScope&) = delete;
+    SyscallScope& operator=(const SyscallScope&) = delete;
+
+    SyscallClass cls_;
+    uint64_t start_;
+};
+
+bool writeChromeTrace(const char* path);
+
+// Per phase and per syscall class: count, total, mean, p50/p90/p99, max.
+void printStats(FILE* out);
+
+} // namespace Trace
+
+#endif // TRACE_H
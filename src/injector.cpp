@@ -1,19 +1,42 @@
 #include "injector.h"
 #include "ptrace_utils.h"
+#include "remote_call.h"
+#include "remote_arena.h"
+#include "async_tracer.h"
+#include "trace.h"
 #include "process_utils.h"
 #include "elf_utils.h"
-#include <android/log.h>
+#include "symbol_cache.h"
+#include "proc_watcher.h"
+#include "maps_snapshot.h"
+#include "maps_query.h"
+#include "preflight.h"
+#include "logger.h"
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <elf.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <memory>
 
 #define LOG_TAG "LibraryInjector"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
 
 namespace Injector {
 
-LibraryInjector::LibraryInjector() {
+LibraryInjector::LibraryInjector() : prepared_(false), cacheTargets_(false) {
     LOGI("LibraryInjector initialized");
 }
 
@@ -21,139 +44,799 @@ LibraryInjector::~LibraryInjector() {
     LOGI("LibraryInjector destroyed");
 }
 
+namespace {
+
+const uint32_t kMaxInFlight = 64;
+
+double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Starts readahead of the whole file; the page cache is shared with the
+// target, so its dlopen later maps the payload without blocking on I/O.
+void prefetchFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+const int RTLD_NOW = 2;
+const int RTLD_GLOBAL = 0x00100;
+
+// dlsym is needed for init symbols and to find the channel's attach entry
+bool needsDlsym(const InjectionConfig& config) {
+    for (const LibrarySpec& lib : config.libraries) {
+        if (!lib.initSymbol.empty()) return true;
+    }
+    return config.channelKb != 0;
+}
+
+// An -args entry that is entirely a number (decimal, 0x hex, 0 octal,
+// optionally negative) is passed as is; anything else as a string.
+bool parseNumber(const std::string& text, uintptr_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    if (text[0] == '-') {
+        value = (uintptr_t)strtoll(text.c_str(), &end, 0);
+    } else {
+        value = (uintptr_t)strtoull(text.c_str(), &end, 0);
+    }
+    return errno == 0 && end && *end == '\0';
+}
+
+// One target's stopped session as AsyncTracer steps: map the arena, write
+// the planned block, one batch of dlopen/dlsym/init per library, unmap.
+class TargetScript {
+public:
+    TargetScript(const InjectionPlan& plan, const InjectionConfig& config, TargetResult& result)
+        : plan_(plan), config_(config), result_(result), stage_(Stage::Start),
+          mapCall_(-1), unmapCall_(-1), openCall_(-1), initCall_(-1), entryCall_(-1), channelCall_(-1),
+          attachCall_(-1), next_(0), block_(0), loadStartNs_(0) {}
+    
+    PtraceUtils::AsyncStep step(PtraceUtils::RemoteCallEngine& engine, bool ok) {
+        switch (stage_) {
+        case Stage::Start:
+            arena_.reset(new PtraceUtils::RemoteArena(engine));
+            if (plan_.mmapAddr) {
+                mapCall_ = arena_->queueMap(plan_.mmapAddr, plan_.block.size());
+                stage_ = Stage::Mapping;
+                return PtraceUtils::AsyncStep::Continue;
+            }
+            return writeBlock(engine);
+        case Stage::Mapping:
+            arena_->completeMap(mapCall_);
+            return writeBlock(engine);
+        case Stage::Channel:
+            return finishChannel(engine, ok);
+        case Stage::Loading:
+            finishLibrary(engine, ok);
+            if (!ok) {
+                return stopCalling(engine, "load call failed");
+            }
+            if (next_ == 1 && plan_.entryOffset != 0 && result_.libraries[0].success) {
+                return callEntry(engine);
+            }
+            return loadNext(engine);
+        case Stage::Entry:
+            result_.entryCalled = ok && engine.executed(entryCall_);
+            result_.entryResult = engine.result(entryCall_);
+            Trace::record("entry_call", loadStartNs_, Trace::nowNs(), plan_.pid, config_.symbolName);
+            if (result_.entryCalled) {
+                LOGI("Entry %s returned 0x%lx", config_.symbolName.c_str(), result_.entryResult);
+            } else {
+                LOGE("Entry %s failed in PID %d", config_.symbolName.c_str(), plan_.pid);
+            }
+            if (!ok) {
+                return stopCalling(engine, "entry call failed");
+            }
+            return loadNext(engine);
+        case Stage::Unmapping:
+            arena_->completeUnmap(unmapCall_);
+            stage_ = Stage::Done;
+            return PtraceUtils::AsyncStep::Finish;
+        default:
+            return PtraceUtils::AsyncStep::Finish;
+        }
+    }
+
+private:
+    enum class Stage { Start, Mapping, Channel, Loading, Entry, Unmapping, Done };
+    
+    // The planned block reaches the target in a single write; the stack
+    // stands in for a failed or unavailable mmap
+    PtraceUtils::AsyncStep writeBlock(PtraceUtils::RemoteCallEngine& engine) {
+        if (arena_->isMapped() || arena_->mapOnStack(plan_.block.size())) {
+            block_ = arena_->put(plan_.block.data(), plan_.block.size(), 1);
+        }
+        if (block_ == 0) {
+            result_.error = "no scratch memory";
+            return PtraceUtils::AsyncStep::Abort;
+        }
+        if (!arena_->flush()) {
+            result_.error = "write failed";
+            return unmap();
+        }
+        return plan_.channelSize ? createChannel(engine) : loadNext(engine);
+    }
+    
+    // The channel region: a memfd of the target's own, so it lives exactly
+    // as long as the target does, mapped shared and its fd closed again in
+    // the same batch. The syscall numbers are this build's, which targets
+    // the same ABI.
+    PtraceUtils::AsyncStep createChannel(PtraceUtils::RemoteCallEngine& engine) {
+        int memfd = engine.queue(plan_.syscallAddr, { (uintptr_t)SYS_memfd_create, block_ + plan_.channelNameOffset,
+                                                      (uintptr_t)MFD_CLOEXEC });
+        PtraceUtils::RemoteArg fd = PtraceUtils::RemoteArg::result(memfd);
+        engine.queue(plan_.syscallAddr, { (uintptr_t)SYS_ftruncate, fd, plan_.channelSize });
+        channelCall_ = engine.queue(plan_.mmapAddr, { 0, plan_.channelSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 });
+        engine.queue(plan_.syscallAddr, { (uintptr_t)SYS_close, fd });
+        stage_ = Stage::Channel;
+        return PtraceUtils::AsyncStep::Continue;
+    }
+    
+    // The injector's end is mapped and laid out while the target is still
+    // stopped, so the payload sees a complete header when it attaches
+    PtraceUtils::AsyncStep finishChannel(PtraceUtils::RemoteCallEngine& engine, bool ok) {
+        uintptr_t addr = engine.result(channelCall_);
+        bool mapped = ok && engine.executed(channelCall_) && addr != 0 && addr != (uintptr_t)MAP_FAILED;
+        std::shared_ptr<PayloadChannel> channel(new PayloadChannel());
+        if (!mapped || !channel->create(plan_.pid, addr, plan_.channelSize)) {
+            LOGE("Cannot set up the payload channel in PID %d", plan_.pid);
+            result_.error = "channel setup failed";
+            if (mapped) {
+                engine.queue(plan_.munmapAddr, { addr, plan_.channelSize });
+            }
+            return unmap();
+        }
+        result_.channelAddr = addr;
+        result_.channel = channel;
+        return loadNext(engine);
+    }
+    
+    PtraceUtils::AsyncStep loadNext(PtraceUtils::RemoteCallEngine& engine) {
+        if (next_ == config_.libraries.size()) {
+            return unmap();
+        }
+        size_t i = next_++;
+        loadStarted_ = std::chrono::steady_clock::now();
+        loadStartNs_ = Trace::nowNs();
+        
+        // dlopen(path, RTLD_NOW | RTLD_GLOBAL); the third argument is the
+        // caller address __loader_dlopen expects and plain dlopen ignores.
+        // dlsym and the init call are skipped by the engine if dlopen fails.
+        openCall_ = engine.queue(plan_.dlopenAddr, { block_ + plan_.pathOffsets[i], RTLD_NOW | RTLD_GLOBAL, 0 });
+        PtraceUtils::RemoteArg handle = PtraceUtils::RemoteArg::result(openCall_);
+        
+        // The first library gets the channel before its init symbol runs
+        attachCall_ = -1;
+        if (i == 0 && result_.channel) {
+            int attachSym = engine.queue(plan_.dlsymAddr, { handle, block_ + plan_.channelAttachOffset, 0 });
+            attachCall_ = engine.queueIndirect(attachSym, { result_.channelAddr, plan_.channelSize });
+        }
+        initCall_ = -1;
+        if (plan_.symbolOffsets[i] != SIZE_MAX) {
+            int symCall = engine.queue(plan_.dlsymAddr, { handle, block_ + plan_.symbolOffsets[i], 0 });
+            initCall_ = engine.queueIndirect(symCall, {});
+        }
+        stage_ = Stage::Loading;
+        return PtraceUtils::AsyncStep::Continue;
+    }
+    
+    void finishLibrary(PtraceUtils::RemoteCallEngine& engine, bool ran) {
+        const LibrarySpec& lib = config_.libraries[next_ - 1];
+        LibraryResult libResult;
+        libResult.path = lib.path;
+        libResult.handle = engine.result(openCall_);
+        libResult.success = ran && libResult.handle != 0;
+        if (!ran) {
+            LOGE("Remote call failed while loading %s", lib.path.c_str());
+        } else if (!libResult.success) {
+            LOGE("dlopen failed for %s", lib.path.c_str());
+        } else if (attachCall_ >= 0 && (!engine.executed(attachCall_) || (int)engine.result(attachCall_) != 0)) {
+            LOGE("%s did not accept the channel", lib.path.c_str());
+            result_.error = "channel attach failed";
+            libResult.success = false;
+        } else if (initCall_ >= 0 && !engine.executed(initCall_)) {
+            LOGE("Init symbol %s not found in %s", lib.initSymbol.c_str(), lib.path.c_str());
+            libResult.success = false;
+        }
+        
+        libResult.loadMs = elapsedMs(loadStarted_);
+        Trace::record("load_library", loadStartNs_, Trace::nowNs(), plan_.pid, lib.path);
+        if (libResult.success) {
+            LOGI("Library %s loaded, handle: 0x%lx (%.3f ms)", lib.path.c_str(), libResult.handle, libResult.loadMs);
+        }
+        result_.libraries.push_back(libResult);
+    }
+    
+    // Runtime address of the entry from the fresh handle. A glibc or musl
+    // handle starts with the load bias, checked against the ELF header it
+    // must point at; bionic's is opaque, so the module is found in the maps.
+    uintptr_t entryAddress(uintptr_t handle) {
+        pid_t pid = plan_.pid;
+        uintptr_t base = 0;
+        if (plan_.handleIsLinkMap) {
+            uintptr_t bias;
+            uint8_t magic[SELFMAG];
+            if (PtraceUtils::readMemory(pid, handle, &bias, sizeof(bias)) &&
+                PtraceUtils::readMemory(pid, bias + plan_.entryBaseVaddr, magic, sizeof(magic)) &&
+                memcmp(magic, ELFMAG, SELFMAG) == 0) {
+                base = bias + plan_.entryBaseVaddr;
+            }
+        }
+        if (base == 0) {
+            ProcessUtils::ModuleInfo module;
+            if (ProcessUtils::queryModuleByPath(pid, plan_.entryModule, module) && module.offset == 0) {
+                base = module.baseAddress;
+            }
+        }
+        return base ? base + plan_.entryOffset : 0;
+    }
+    
+    PtraceUtils::AsyncStep callEntry(PtraceUtils::RemoteCallEngine& engine) {
+        loadStartNs_ = Trace::nowNs();
+        uintptr_t addr = entryAddress(result_.libraries[0].handle);
+        if (addr == 0) {
+            LOGE("Cannot locate %s in PID %d", config_.symbolName.c_str(), plan_.pid);
+            return loadNext(engine);
+        }
+        
+        std::vector<PtraceUtils::RemoteArg> args;
+        for (size_t i = 0; i < plan_.entryArgs.size(); i++) {
+            size_t offset = plan_.entryArgOffsets[i];
+            args.push_back(offset == SIZE_MAX ? plan_.entryArgs[i] : block_ + offset);
+        }
+        entryCall_ = engine.queue(addr, args.data(), args.size());
+        stage_ = Stage::Entry;
+        return PtraceUtils::AsyncStep::Continue;
+    }
+    
+    // A failed batch faulted, timed out or was interrupted, so the thread
+    // may be stopped inside a half-finished dlopen holding the loader lock:
+    // no further library goes into it, only the unmap, if that can still run
+    PtraceUtils::AsyncStep stopCalling(PtraceUtils::RemoteCallEngine& engine, const char* error) {
+        result_.error = error;
+        if (!engine.active()) {
+            return PtraceUtils::AsyncStep::Abort;
+        }
+        return unmap();
+    }
+    
+    // The strings are no longer needed once dlopen/dlsym returned
+    PtraceUtils::AsyncStep unmap() {
+        unmapCall_ = arena_->queueUnmap(plan_.munmapAddr);
+        stage_ = Stage::Unmapping;
+        return PtraceUtils::AsyncStep::Continue;
+    }
+    
+    const InjectionPlan& plan_;
+    const InjectionConfig& config_;
+    TargetResult& result_;
+    Stage stage_;
+    std::unique_ptr<PtraceUtils::RemoteArena> arena_;
+    int mapCall_;
+    int unmapCall_;
+    int openCall_;
+    int initCall_;
+    int entryCall_;
+    int channelCall_;
+    int attachCall_;
+    size_t next_;
+    uintptr_t block_;
+    std::chrono::steady_clock::time_point loadStarted_;
+    uint64_t loadStartNs_;
+};
+
+} // namespace
+
 bool LibraryInjector::inject(const InjectionConfig& config) {
-    // Set SELinux context if needed
-    ProcessUtils::setSelinuxContext("u:r:su:s0");
+    results_.clear();
+    
+    // Set SELinux context if needed; once per injector, which a long-lived
+    // one (the daemon's) then never pays again
+    if (!prepared_) {
+        ProcessUtils::setSelinuxContext("u:r:su:s0");
+        prepared_ = true;
+    }
+    
+    // A cache that cannot be opened only costs us the warm lookups
+    if (!config.symbolCachePath.empty() && !SymbolCache::isOpen()) {
+        SymbolCache::open(config.symbolCachePath);
+    }
+    
+    if (!validatePayloads(config)) {
+        return false;
+    }
     
     if (config.watchLaunch && !config.packageName.empty()) {
-        return watchAndInject(config.packageName, config.libraryPath, config);
+        return watchAndInject(config.packageName, config);
+    }
+    
+    if (config.allProcesses && !config.packageName.empty()) {
+        std::vector<pid_t> pids;
+        for (pid_t pid : ProcessUtils::findAllProcessesByName(config.packageName)) {
+            if (ProcessUtils::belongsToPackage(ProcessUtils::getProcessName(pid), config.packageName)) {
+                pids.push_back(pid);
+            }
+        }
+        if (pids.empty()) {
+            LOGE("Failed to find any process for package: %s", config.packageName.c_str());
+            return false;
+        }
+        return injectMany(pids, config);
     }
     
     if (!config.packageName.empty()) {
-        return injectByPackage(config.packageName, config.libraryPath, config);
+        return injectByPackage(config.packageName, config);
+    }
+    
+    if (config.pids.size() > 1) {
+        return injectMany(config.pids, config);
     }
     
     if (config.pid > 0) {
-        return injectByPid(config.pid, config.libraryPath, config);
+        return injectByPid(config.pid, config);
     }
     
     LOGE("Invalid configuration");
     return false;
 }
 
-bool LibraryInjector::injectByPackage(const std::string& package, const std::string& libPath, const InjectionConfig& config) {
+// Validated once up front rather than per target, and pulled into the page
+// cache so the target's dlopen does not wait on storage. A file that already
+// validated is not parsed again until it changes on disk.
+bool LibraryInjector::validatePayloads(const InjectionConfig& config) {
+    Trace::Scope trace("validate_payload");
+    for (const LibrarySpec& lib : config.libraries) {
+        uint64_t key = SymbolCache::moduleKey(lib.path, 0);
+        auto known = validated_.find(lib.path);
+        if (key == 0 || known == validated_.end() || known->second != key) {
+            if (!ElfUtils::parseElfSymbols(lib.path)) {
+                LOGE("Invalid payload: %s", lib.path.c_str());
+                validated_.erase(lib.path);
+                return false;
+            }
+            validated_[lib.path] = key;
+        }
+        prefetchFile(lib.path);
+    }
+    return true;
+}
+
+void LibraryInjector::setTargetCache(bool enable) {
+    std::lock_guard<std::mutex> guard(targetsLock_);
+    cacheTargets_ = enable;
+    targets_.clear();
+}
+
+void LibraryInjector::forgetProcess(pid_t pid) {
+    std::lock_guard<std::mutex> guard(targetsLock_);
+    targets_.erase(pid);
+}
+
+void LibraryInjector::forgetAllProcesses() {
+    std::lock_guard<std::mutex> guard(targetsLock_);
+    targets_.clear();
+}
+
+bool LibraryInjector::lookupTarget(pid_t pid, uint64_t startTime, const InjectionConfig& config,
+                                   InjectionPlan& plan) {
+    std::lock_guard<std::mutex> guard(targetsLock_);
+    auto it = targets_.find(pid);
+    if (it == targets_.end() || it->second.startTime != startTime) {
+        return false;
+    }
+    if (needsDlsym(config) && it->second.plan.dlsymAddr == 0) {
+        return false;
+    }
+    if (config.channelKb && it->second.plan.syscallAddr == 0) {
+        return false;
+    }
+    plan = it->second.plan;
+    return true;
+}
+
+void LibraryInjector::storeTarget(pid_t pid, uint64_t startTime, const InjectionPlan& plan) {
+    std::lock_guard<std::mutex> guard(targetsLock_);
+    if (cacheTargets_) {
+        targets_[pid] = CachedTarget{ startTime, plan };
+    }
+}
+
+bool LibraryInjector::injectByPackage(const std::string& package, const InjectionConfig& config) {
     LOGI("Finding process for package: %s", package.c_str());
     
-    pid_t pid = ProcessUtils::findProcessByPackage(package);
+    pid_t pid;
+    {
+        Trace::Scope trace("find_process");
+        pid = ProcessUtils::findProcessByPackage(package);
+    }
     if (pid <= 0) {
         LOGE("Failed to find process for package: %s", package.c_str());
         return false;
     }
     
     LOGI("Found PID: %d", pid);
-    return injectByPid(pid, libPath, config);
+    return injectByPid(pid, config);
 }
 
-bool LibraryInjector::injectByPid(pid_t pid, const std::string& libPath, const InjectionConfig& config) {
-    LOGI("Starting injection into PID: %d", pid);
-    LOGI("Library path: %s", libPath.c_str());
+bool LibraryInjector::resolveLoader(pid_t pid, const InjectionConfig& config, LoaderSymbols& loader) {
+    Trace::Scope trace("resolve_loader", pid);
+    // The Android linker first; glibc (2.34+ in libc, older in libdl) on
+    // host Linux targets
+    const char* loaderModules[] = { sizeof(void*) == 8 ? "linker64" : "linker", "libc.so", "libdl.so" };
+    bool needDlsym = needsDlsym(config);
     
-    // Verify process is running
-    if (!ProcessUtils::isProcessRunning(pid)) {
-        LOGE("Process %d is not running", pid);
+    // Every candidate in one batch: each module is opened once, and the
+    // linker and libc are searched in parallel. Requests come in groups of
+    // four per loader module (dlopen, its alternative name, the same for
+    // dlsym, which costs nothing extra here even if unused), then mmap,
+    // munmap and syscall.
+    std::vector<ElfUtils::SymbolRequest> requests;
+    std::vector<const char*> present;
+    for (const char* module : loaderModules) {
+        ProcessUtils::ModuleInfo info;
+        if (!ProcessUtils::queryModule(pid, module, info)) {
+            continue;
+        }
+        present.push_back(module);
+        for (const char* symbol : { "dlopen", "__loader_dlopen", "dlsym", "__loader_dlsym" }) {
+            requests.push_back({ module, symbol });
+        }
+    }
+    size_t arena = requests.size();
+    requests.push_back({ "libc.so", "mmap" });
+    requests.push_back({ "libc.so", "munmap" });
+    requests.push_back({ "libc.so", "syscall" });
+    std::vector<ElfUtils::SymbolResolution> results;
+    ElfUtils::resolveSymbols(pid, requests, results);
+    
+    size_t group = 0;
+    while (group < present.size() && !results[group * 4].found && !results[group * 4 + 1].found) {
+        group++;
+    }
+    if (group == present.size()) {
+        LOGE("Failed to find dlopen function");
+        return false;
+    }
+    const ElfUtils::SymbolResolution* r = &results[group * 4];
+    loader.dlopen = r[0].found ? r[0].location : r[1].location;
+    
+    if (needDlsym) {
+        loader.hasDlsym = r[2].found || r[3].found;
+        if (!loader.hasDlsym) {
+            LOGE("Failed to find dlsym function");
+            return false;
+        }
+        loader.dlsym = r[2].found ? r[2].location : r[3].location;
+    }
+    
+    // Scratch arena; optional, the stack is used without it
+    loader.hasArena = results[arena].found && results[arena + 1].found;
+    if (loader.hasArena) {
+        loader.mmap = results[arena].location;
+        loader.munmap = results[arena + 1].location;
+    }
+    loader.hasSyscall = results[arena + 2].found;
+    if (loader.hasSyscall) {
+        loader.syscall = results[arena + 2].location;
+    }
+    
+    return true;
+}
+
+bool LibraryInjector::injectByPid(pid_t pid, const InjectionConfig& config) {
+    // Resolved by planTarget unless the target is already cached
+    LoaderSymbols loader;
+    return injectTargets(std::vector<pid_t>(1, pid), config, loader);
+}
+
+bool LibraryInjector::injectMany(const std::vector<pid_t>& pids, const InjectionConfig& config) {
+    LOGI("Injecting into %zu processes", pids.size());
+    
+    // Resolve once; each plan only needs to find the linker's base in its
+    // own target. Not needed at all when every target is cached.
+    LoaderSymbols loader;
+    bool allCached = false;
+    {
+        std::lock_guard<std::mutex> guard(targetsLock_);
+        if (cacheTargets_) {
+            allCached = true;
+            for (pid_t pid : pids) {
+                if (targets_.find(pid) == targets_.end()) allCached = false;
+            }
+        }
+    }
+    if (!allCached && !resolveLoader(pids[0], config, loader)) {
         return false;
     }
     
-    // Add delay if specified
+    bool ok = injectTargets(pids, config, loader);
+    size_t succeeded = 0;
+    for (const TargetResult& result : results_) {
+        if (result.success) succeeded++;
+    }
+    LOGI("Injected into %zu of %zu processes", succeeded, pids.size());
+    return ok;
+}
+
+bool LibraryInjector::injectTargets(const std::vector<pid_t>& pids, const InjectionConfig& config,
+                                    const LoaderSymbols& loader) {
+    auto started = std::chrono::steady_clock::now();
+    
+    // Add delay if specified; planning comes after it so the addresses
+    // reflect the processes as they are when we attach
     if (config.delayUs > 0) {
         LOGI("Waiting %u microseconds before injection", config.delayUs);
         usleep(config.delayUs);
     }
     
-    // Attach to process
-    if (!PtraceUtils::attach(pid)) {
-        LOGE("Failed to attach to process %d", pid);
-        return false;
+    // Offsets of the -symbols entry come from the payload file, once
+    ElfUtils::EntryPoint entry = { 0, 0 };
+    if (!config.symbolName.empty() && !config.libraries.empty()) {
+        ElfUtils::resolveEntryPoint(config.libraries[0].path, config.symbolName.c_str(), entry);
     }
     
-    LOGI("Attached to process successfully");
+    std::vector<TargetResult> results(pids.size());
+    std::vector<InjectionPlan> plans(pids.size());
+    std::vector<std::unique_ptr<TargetScript>> scripts(pids.size());
+    std::vector<uint64_t> startNs(pids.size());
     
-    // Get dlopen function address
-    const char* linkerName = sizeof(void*) == 8 ? "linker64" : "linker";
-    uintptr_t dlopenAddr = ElfUtils::getRemoteFunctionAddress(pid, linkerName, "dlopen");
+    // Every target is planned before the first one is stopped; then a single
+    // thread drives all stopped sessions, maxWorkers of them at a time
+    size_t maxInFlight = config.maxWorkers ? config.maxWorkers : kMaxInFlight;
+    PtraceUtils::AsyncTracer tracer(config.stepTimeoutMs, maxInFlight);
+    PtraceUtils::AttachMode mode = config.seize ? PtraceUtils::AttachMode::Seize : PtraceUtils::AttachMode::Attach;
+    for (size_t i = 0; i < pids.size(); i++) {
+        pid_t pid = pids[i];
+        TargetResult& result = results[i];
+        result.pid = pid;
+        startNs[i] = Trace::nowNs();
+        LOGI("Starting injection into PID: %d", pid);
+        
+        auto planStarted = std::chrono::steady_clock::now();
+        bool planned = planTarget(pid, config, loader, entry, plans[i], result);
+        result.planMs = elapsedMs(planStarted);
+        if (!planned) {
+            result.totalMs = elapsedMs(started);
+            Trace::record("inject_target", startNs[i], Trace::nowNs(), pid);
+            continue;
+        }
+        
+        scripts[i].reset(new TargetScript(plans[i], config, result));
+        TargetScript* script = scripts[i].get();
+        PtraceUtils::AsyncTarget target;
+        target.pid = pid;
+        target.mode = mode;
+        target.trapAddr = plans[i].trapAddr;
+        target.step = [script](PtraceUtils::RemoteCallEngine& engine, bool ok) {
+            return script->step(engine, ok);
+        };
+        target.done = [&, i](const PtraceUtils::AsyncOutcome& outcome) {
+            TargetResult& r = results[i];
+            r.stopMs = outcome.stopMs;
+            r.totalMs = elapsedMs(started);
+            bool allLoaded = r.libraries.size() == config.libraries.size();
+            for (const LibraryResult& lib : r.libraries) {
+                allLoaded = allLoaded && lib.success;
+            }
+            r.success = outcome.success && allLoaded && (plans[i].entryOffset == 0 || r.entryCalled);
+            if (r.error.empty() && !outcome.error.empty()) {
+                r.error = outcome.error;
+            } else if (r.error.empty() && !allLoaded) {
+                r.error = "dlopen failed";
+            } else if (r.error.empty() && !r.success) {
+                r.error = "entry call failed";
+            }
+            Trace::record("inject_target", startNs[i], Trace::nowNs(), r.pid);
+            if (r.success) {
+                LOGI("Injection into PID %d completed (%zu libraries, planned %.3f ms, stopped %.3f ms, total %.3f ms)",
+                     r.pid, config.libraries.size(), r.planMs, r.stopMs, r.totalMs);
+            }
+        };
+        tracer.add(target);
+    }
     
-    if (dlopenAddr == 0) {
-        // Try alternative function name
-        dlopenAddr = ElfUtils::getRemoteFunctionAddress(pid, linkerName, "__loader_dlopen");
+    if (!tracer.run()) {
+        for (size_t i = 0; i < pids.size(); i++) {
+            if (scripts[i]) results[i].error = "tracer failed";
+        }
     }
     
-    if (dlopenAddr == 0) {
-        LOGE("Failed to find dlopen function");
-        PtraceUtils::detach(pid);
+    bool ok = true;
+    for (const TargetResult& result : results) {
+        ok = ok && result.success;
+        results_.push_back(result);
+    }
+    return ok;
+}
+
+bool LibraryInjector::planTarget(pid_t pid, const InjectionConfig& config, const LoaderSymbols& loader,
+                                 const ElfUtils::EntryPoint& entry, InjectionPlan& plan, TargetResult& result) {
+    Trace::Scope trace("plan_target", pid);
+    
+    uint64_t startTime = 0;
+    if (!ProcessUtils::getProcessStartTime(pid, startTime)) {
+        LOGE("Process %d is not running", pid);
+        result.error = "not running";
         return false;
     }
     
-    LOGI("Found dlopen at: 0x%lx", dlopenAddr);
+    if (!preflightPayloads(pid, config, result)) {
+        return false;
+    }
     
-    // Allocate memory in remote process for library path
-    // Write library path to remote process memory
-    // Call dlopen with RTLD_NOW | RTLD_GLOBAL
-    // This is simplified - full implementation would include:
-    // - Memory allocation in remote process
-    // - Writing library path
-    // - Calling dlopen via ptrace
-    // - Handling return value
-    // - Calling JNI_OnLoad if present
+    if (lookupTarget(pid, startTime, config, plan)) {
+        LOGI("Using cached addresses for PID %d", pid);
+    } else if (!planAddresses(pid, config, loader, plan, result)) {
+        return false;
+    } else {
+        storeTarget(pid, startTime, plan);
+    }
+    plan.pid = pid;
     
-    const int RTLD_NOW = 2;
-    const int RTLD_GLOBAL = 0x00100;
+    // NUL-terminated strings back to back, in library order
+    for (const LibrarySpec& lib : config.libraries) {
+        plan.pathOffsets.push_back(plan.block.size());
+        plan.block.insert(plan.block.end(), lib.path.begin(), lib.path.end());
+        plan.block.push_back(0);
+        if (lib.initSymbol.empty()) {
+            plan.symbolOffsets.push_back(SIZE_MAX);
+            continue;
+        }
+        plan.symbolOffsets.push_back(plan.block.size());
+        plan.block.insert(plan.block.end(), lib.initSymbol.begin(), lib.initSymbol.end());
+        plan.block.push_back(0);
+    }
     
-    // Prepare arguments for dlopen(libPath, RTLD_NOW | RTLD_GLOBAL)
-    uintptr_t args[2];
-    // args[0] would be remote address of library path string
-    // args[1] would be flags
-    args[1] = RTLD_NOW | RTLD_GLOBAL;
+    // The channel is created with the target's mmap and syscall
+    if (config.channelKb) {
+        if (plan.mmapAddr == 0 || plan.syscallAddr == 0) {
+            LOGE("PID %d: no mmap or syscall in libc for the payload channel", pid);
+            result.error = "channel unavailable";
+            return false;
+        }
+        const char name[] = INJECTOR_CHANNEL_NAME;
+        const char attach[] = INJECTOR_CHANNEL_ATTACH;
+        plan.channelSize = PayloadChannel::regionSize((size_t)config.channelKb * 1024);
+        plan.channelNameOffset = plan.block.size();
+        plan.block.insert(plan.block.end(), name, name + sizeof(name));
+        plan.channelAttachOffset = plan.block.size();
+        plan.block.insert(plan.block.end(), attach, attach + sizeof(attach));
+    }
     
-    // Call dlopen (simplified)
-    uintptr_t handle = PtraceUtils::callFunction(pid, dlopenAddr, args, 2);
+    // The entry is called at an address computed from the handle, so no
+    // remote dlsym; its string arguments travel in the same block
+    if (entry.offset != 0) {
+        char canonical[PATH_MAX];
+        const std::string& path = config.libraries[0].path;
+        plan.entryModule = realpath(path.c_str(), canonical) ? canonical : path;
+        plan.entryOffset = entry.offset;
+        plan.entryBaseVaddr = entry.baseVaddr;
+        for (const std::string& arg : config.entryArgs) {
+            uintptr_t value = 0;
+            if (parseNumber(arg, value)) {
+                plan.entryArgOffsets.push_back(SIZE_MAX);
+            } else {
+                plan.entryArgOffsets.push_back(plan.block.size());
+                plan.block.insert(plan.block.end(), arg.begin(), arg.end());
+                plan.block.push_back(0);
+            }
+            plan.entryArgs.push_back(value);
+        }
+    }
     
-    if (handle == 0) {
-        LOGE("dlopen failed");
-        PtraceUtils::detach(pid);
+    LOGI("Planned PID %d: dlopen at 0x%lx, %zu byte string block", pid, plan.dlopenAddr, plan.block.size());
+    return true;
+}
+
+// A payload dlopen would reject fails here, before the target is stopped.
+// The -symbols entry belongs to the first payload.
+bool LibraryInjector::preflightPayloads(pid_t pid, const InjectionConfig& config, TargetResult& result) {
+    for (size_t i = 0; i < config.libraries.size(); i++) {
+        const LibrarySpec& lib = config.libraries[i];
+        std::vector<std::string> entrySymbols;
+        if (!lib.initSymbol.empty()) {
+            entrySymbols.push_back(lib.initSymbol);
+        }
+        if (i == 0 && !config.symbolName.empty()) {
+            entrySymbols.push_back(config.symbolName);
+        }
+        if (i == 0 && config.channelKb) {
+            entrySymbols.push_back(INJECTOR_CHANNEL_ATTACH);
+        }
+        
+        std::string error;
+        if (!Preflight::checkPayload(pid, lib.path, entrySymbols, error)) {
+            result.error = lib.path + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LibraryInjector::planAddresses(pid_t pid, const InjectionConfig& config, const LoaderSymbols& shared,
+                                    InjectionPlan& plan, TargetResult& result) {
+    // A single target resolves its own loader symbols; fan-out shares them
+    LoaderSymbols own;
+    if (shared.dlopen.modulePath.empty() && !resolveLoader(pid, config, own)) {
+        result.error = "loader symbols not found";
         return false;
     }
+    const LoaderSymbols& loader = shared.dlopen.modulePath.empty() ? own : shared;
     
-    LOGI("Library loaded successfully, handle: 0x%lx", handle);
+    // One maps read, usually the one resolveLoader already made, serves
+    // every address; the trap scan reads target memory, so only its code
+    // ranges are taken under the maps lock
+    PtraceUtils::RemoteCallEngine::TrapCandidates trapCandidates;
+    bool running = ProcessUtils::withMaps(pid, [&](const ProcessUtils::MapsSnapshot& maps) {
+        plan.dlopenAddr = ElfUtils::applySymbolLocation(maps, loader.dlopen);
+        plan.dlsymAddr = loader.hasDlsym ? ElfUtils::applySymbolLocation(maps, loader.dlsym) : 0;
+        
+        // Without libc's mmap the arena falls back to the target's stack
+        if (loader.hasArena) {
+            plan.mmapAddr = ElfUtils::applySymbolLocation(maps, loader.mmap);
+            plan.munmapAddr = ElfUtils::applySymbolLocation(maps, loader.munmap);
+            if (plan.mmapAddr == 0 || plan.munmapAddr == 0) {
+                plan.mmapAddr = plan.munmapAddr = 0;
+            }
+        }
+        plan.syscallAddr = loader.hasSyscall ? ElfUtils::applySymbolLocation(maps, loader.syscall) : 0;
+        
+        PtraceUtils::RemoteCallEngine::trapCandidates(maps, trapCandidates);
+    });
+    if (!running) {
+        LOGE("Process %d is not running", pid);
+        result.error = "not running";
+        return false;
+    }
     
-    // Detach from process
-    if (!PtraceUtils::detach(pid)) {
-        LOGE("Warning: Failed to detach cleanly");
+    // Code pages do not change while the target runs, so the return trap
+    // can be found without stopping it
+    PtraceUtils::RemoteCallEngine::findTrap(pid, trapCandidates, plan.trapAddr);
+    if (plan.dlopenAddr == 0 || (loader.hasDlsym && plan.dlsymAddr == 0)) {
+        result.error = "linker not mapped";
+        return false;
     }
     
-    LOGI("Injection completed successfully");
+    plan.handleIsLinkMap = loader.dlopen.modulePath.find("linker") == std::string::npos;
     return true;
 }
 
-bool LibraryInjector::watchAndInject(const std::string& package, const std::string& libPath, const InjectionConfig& config) {
+bool LibraryInjector::watchAndInject(const std::string& package, const InjectionConfig& config) {
     LOGI("Starting watch mode for package: %s", package.c_str());
     
-    // Monitor process creation and inject when app launches
-    // This is simplified - full implementation would:
-    // - Monitor /proc for new process creation
-    // - Check if new process matches package name
-    // - Inject immediately when detected
+    // Subscribe before looking for a running instance so a launch in
+    // between cannot be missed.
+    ProcessUtils::ProcWatcher watcher;
+    if (!watcher.start(package)) {
+        LOGE("Failed to start process watcher");
+        return false;
+    }
     
-    while (true) {
-        pid_t pid = ProcessUtils::findProcessByPackage(package);
-        if (pid > 0) {
-            LOGI("Process detected, PID: %d", pid);
-            usleep(500000); // Wait 500ms for app to initialize
-            return injectByPid(pid, libPath, config);
-        }
-        usleep(1000000); // Check every second
+    pid_t pid = ProcessUtils::findProcessByPackage(package);
+    if (pid > 0) {
+        LOGI("Process already running, PID: %d", pid);
+        return injectByPid(pid, config);
     }
     
-    return false;
+    ProcessUtils::LaunchEvent event;
+    if (!watcher.waitForLaunch(event)) {
+        LOGE("Watching for %s failed", package.c_str());
+        return false;
+    }
+    
+    LOGI("Process detected, PID: %d (via %s, detection latency %.3f ms)",
+         event.pid, event.source, event.latencyNs / 1e6);
+    uint64_t detected = Trace::nowNs();
+    Trace::record("launch_detect", detected - event.latencyNs, detected, event.pid, event.source);
+    return injectByPid(event.pid, config);
 }
 
 } // namespace Injector
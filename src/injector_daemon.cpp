@@ -0,0 +1,328 @@
+#include "injector_daemon.h"
+#include "process_utils.h"
+#include "proc_watcher.h"
+#include "logger.h"
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/netlink.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#define LOG_TAG "InjectorDaemon"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace Injector {
+
+namespace {
+
+// A client that connects and goes quiet must not hold up the next one
+const int kClientTimeoutMs = 1000;
+
+bool byPid(const ProcessUtils::ProcessEntry& entry, pid_t pid) {
+    return entry.pid < pid;
+}
+
+void closeFd(int& fd) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+} // namespace
+
+InjectorDaemon::InjectorDaemon()
+    : listenFd_(-1), netlinkFd_(-1), signalFd_(-1), epollFd_(-1), running_(false), tableValid_(false) {
+}
+
+InjectorDaemon::~InjectorDaemon() {
+    stop();
+}
+
+bool InjectorDaemon::start(const char* socketName) {
+    stop();
+    
+    listenFd_ = DaemonProtocol::listenSocket(socketName);
+    if (listenFd_ < 0) {
+        return false;
+    }
+    
+    // SIGINT/SIGTERM end the loop through a signalfd instead of a handler
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    signalFd_ = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    
+    const uint32_t events[] = {
+        ProcessUtils::kProcEventExec, ProcessUtils::kProcEventComm, ProcessUtils::kProcEventExit,
+    };
+    netlinkFd_ = ProcessUtils::openProcConnector(events, sizeof(events) / sizeof(events[0]));
+    injector_.setTargetCache(netlinkFd_ >= 0);
+    
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        LOGE("epoll_create1 failed: %s", strerror(errno));
+        stop();
+        return false;
+    }
+    for (int fd : { listenFd_, netlinkFd_, signalFd_ }) {
+        if (fd < 0) continue;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+    
+    rescanTable();
+    LOGI("Listening on @%s (%s, %zu processes)", socketName,
+         netlinkFd_ >= 0 ? "proc events" : "no proc events, rescanning per request", table_.size());
+    return true;
+}
+
+void InjectorDaemon::stop() {
+    closeFd(epollFd_);
+    closeFd(listenFd_);
+    closeFd(netlinkFd_);
+    closeFd(signalFd_);
+    running_ = false;
+}
+
+bool InjectorDaemon::run() {
+    if (listenFd_ < 0) {
+        return false;
+    }
+    
+    running_ = true;
+    struct epoll_event events[8];
+    while (running_) {
+        int count = epoll_wait(epollFd_, events, 8, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            return false;
+        }
+        for (int i = 0; i < count && running_; i++) {
+            int fd = events[i].data.fd;
+            if (fd == netlinkFd_) {
+                readProcEvents();
+            } else if (fd == listenFd_) {
+                acceptClient();
+            } else if (fd == signalFd_) {
+                LOGI("Signal received, shutting down");
+                running_ = false;
+            }
+        }
+    }
+    stop();
+    return true;
+}
+
+bool InjectorDaemon::authorized(int fd) {
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) {
+        return false;
+    }
+    // The daemon loads whatever path it is given into other processes, so
+    // only root and the daemon's own user may ask
+    if (cred.uid != 0 && cred.uid != geteuid()) {
+        LOGE("Rejected client PID %d (uid %d)", cred.pid, cred.uid);
+        return false;
+    }
+    return true;
+}
+
+void InjectorDaemon::acceptClient() {
+    int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct timeval timeout = { kClientTimeoutMs / 1000, (kClientTimeoutMs % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    if (authorized(fd)) {
+        handleRequest(fd);
+    }
+    close(fd);
+}
+
+bool InjectorDaemon::handleRequest(int fd) {
+    DaemonProtocol::MessageType type;
+    std::vector<uint8_t> body;
+    if (!DaemonProtocol::recvMessage(fd, type, body)) {
+        return false;
+    }
+    
+    DaemonProtocol::Writer reply;
+    switch (type) {
+        case DaemonProtocol::MessageType::Ping:
+            break;
+        case DaemonProtocol::MessageType::Shutdown:
+            LOGI("Shutdown requested");
+            running_ = false;
+            break;
+        case DaemonProtocol::MessageType::Inject: {
+            auto started = std::chrono::steady_clock::now();
+            InjectionConfig config;
+            DaemonProtocol::Reader in(body.data(), body.size());
+            if (!DaemonProtocol::readConfig(in, config)) {
+                LOGE("Malformed inject request");
+                return false;
+            }
+            
+            std::string error;
+            bool ok = false;
+            std::vector<TargetResult> results;
+            if (resolveTargets(config, error)) {
+                ok = injector_.inject(config);
+                results = injector_.results();
+            } else {
+                TargetResult failed;
+                failed.error = error;
+                results.push_back(failed);
+            }
+            
+            // Large fan-outs do not fit one datagram; the last part is the Result
+            std::vector<DaemonProtocol::Writer> parts = DaemonProtocol::writeResultParts(ok, results);
+            for (size_t i = 0; i + 1 < parts.size(); i++) {
+                if (!DaemonProtocol::sendMessage(fd, DaemonProtocol::MessageType::ResultPart, parts[i].bytes())) {
+                    LOGE("Client went away during the reply");
+                    return false;
+                }
+            }
+            reply = parts.back();
+            LOGI("Request for %zu targets %s in %.3f ms", results.size(), ok ? "succeeded" : "failed",
+                 std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+            break;
+        }
+        default:
+            LOGE("Unknown request type %u", (unsigned)type);
+            return false;
+    }
+    return DaemonProtocol::sendMessage(fd, DaemonProtocol::MessageType::Result, reply.bytes());
+}
+
+// Package names are looked up in the warm table and turned into PIDs, so
+// the injector itself never scans /proc for a daemon request.
+bool InjectorDaemon::resolveTargets(InjectionConfig& config, std::string& error) {
+    if (config.packageName.empty()) {
+        return true;
+    }
+    if (!tableValid_) {
+        rescanTable();
+    }
+    
+    const std::string& package = config.packageName;
+    std::vector<pid_t> pids;
+    for (const ProcessUtils::ProcessEntry& entry : table_) {
+        std::string name(entry.name, entry.nameLength);
+        if (name.find(package) == std::string::npos) {
+            continue;
+        }
+        if (!config.allProcesses) {
+            pids.push_back(entry.pid);
+            break;
+        }
+        if (ProcessUtils::belongsToPackage(name, package)) {
+            pids.push_back(entry.pid);
+        }
+    }
+    if (pids.empty()) {
+        LOGE("No process for package %s", package.c_str());
+        error = "package not running";
+        return false;
+    }
+    
+    config.packageName.clear();
+    config.allProcesses = false;
+    config.pid = pids[0];
+    config.pids = pids;
+    return true;
+}
+
+void InjectorDaemon::rescanTable() {
+    ProcessUtils::ScanOptions options;
+    options.withStartTime = true;
+    tableValid_ = scanner_.scan(table_, options) && netlinkFd_ >= 0;
+    std::sort(table_.begin(), table_.end(),
+              [](const ProcessUtils::ProcessEntry& a, const ProcessUtils::ProcessEntry& b) { return a.pid < b.pid; });
+}
+
+void InjectorDaemon::updateEntry(pid_t pid) {
+    ProcessUtils::ProcessEntry entry;
+    entry.pid = pid;
+    if (!scanner_.readName(pid, entry.name, sizeof(entry.name), &entry.nameLength) ||
+        !scanner_.readStartTime(pid, entry.startTime)) {
+        removeEntry(pid);
+        return;
+    }
+    auto it = std::lower_bound(table_.begin(), table_.end(), pid, byPid);
+    if (it != table_.end() && it->pid == pid) {
+        *it = entry;
+    } else {
+        table_.insert(it, entry);
+    }
+}
+
+void InjectorDaemon::removeEntry(pid_t pid) {
+    auto it = std::lower_bound(table_.begin(), table_.end(), pid, byPid);
+    if (it != table_.end() && it->pid == pid) {
+        table_.erase(it);
+    }
+}
+
+void InjectorDaemon::readProcEvents() {
+    alignas(struct nlmsghdr) char buffer[8192];
+    for (;;) {
+        ssize_t len = recv(netlinkFd_, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                // Events were lost, so nothing cached can be trusted
+                LOGI("Proc connector overrun, dropping cached state");
+                injector_.forgetAllProcesses();
+                rescanTable();
+                continue;
+            }
+            return;
+        }
+        
+        for (struct nlmsghdr* nlh = (struct nlmsghdr*)buffer; NLMSG_OK(nlh, (size_t)len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR) continue;
+            
+            const struct cn_msg* msg = (const struct cn_msg*)NLMSG_DATA(nlh);
+            const struct proc_event* ev = (const struct proc_event*)msg->data;
+            if (ev->what == ProcessUtils::kProcEventExec) {
+                // A new image: every address planned for this PID is stale
+                pid_t pid = ev->event_data.exec.process_tgid;
+                injector_.forgetProcess(pid);
+                updateEntry(pid);
+            } else if (ev->what == ProcessUtils::kProcEventComm) {
+                if (ev->event_data.comm.process_pid == ev->event_data.comm.process_tgid) {
+                    updateEntry(ev->event_data.comm.process_tgid);
+                }
+            } else if (ev->what == ProcessUtils::kProcEventExit) {
+                // Thread exits are reported too; only the leader ends the process
+                if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid) {
+                    pid_t pid = ev->event_data.exit.process_tgid;
+                    injector_.forgetProcess(pid);
+                    removeEntry(pid);
+                }
+            }
+        }
+    }
+}
+
+} // namespace Injector
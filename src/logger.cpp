@@ -0,0 +1,228 @@
+#include "logger.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+namespace Logger {
+
+namespace {
+
+// 512 slots of ~512 bytes: a few hundred KB of BSS, of which only the pages
+// actually used are ever touched.
+const size_t kSlots = 512;
+const size_t kTextSize = 480;
+
+// Writer back-off while the ring is empty
+const long kMinIdleNs = 1000 * 1000;
+const long kMaxIdleNs = 50 * 1000 * 1000;
+
+// Bounded multi-producer ring (Vyukov): a slot's sequence equals its
+// position when free for that position and position + 1 once published.
+struct Slot {
+    std::atomic<size_t> seq;
+    int prio;
+    const char* tag;
+    pid_t tid;
+    struct timespec time;
+    char text[kTextSize];
+};
+
+Slot g_slots[kSlots];
+alignas(64) std::atomic<size_t> g_head(0);
+alignas(64) size_t g_tail = 0;
+std::atomic<unsigned long> g_dropped(0);
+
+std::atomic<bool> g_running(false);
+std::atomic<bool> g_stopping(false);
+std::thread g_writer;
+Sink g_sink = Sink::Logcat;
+FILE* g_file = nullptr;
+
+pid_t currentTid() {
+    static thread_local pid_t tid = (pid_t)syscall(SYS_gettid);
+    return tid;
+}
+
+char priorityChar(int prio) {
+    switch (prio) {
+        case ANDROID_LOG_VERBOSE: return 'V';
+        case ANDROID_LOG_DEBUG: return 'D';
+        case ANDROID_LOG_INFO: return 'I';
+        case ANDROID_LOG_WARN: return 'W';
+        case ANDROID_LOG_ERROR: return 'E';
+        case ANDROID_LOG_FATAL: return 'F';
+        default: return '?';
+    }
+}
+
+void emit(int prio, const char* tag, pid_t tid, const struct timespec& time, const char* text) {
+    if (g_sink == Sink::Logcat) {
+        __android_log_write(prio, tag, text);
+        return;
+    }
+    
+    // logcat-style "MM-DD HH:MM:SS.mmm  TID P Tag: message"
+    struct tm local;
+    localtime_r(&time.tv_sec, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%m-%d %H:%M:%S", &local);
+    FILE* out = g_sink == Sink::File ? g_file : stderr;
+    fprintf(out, "%s.%03ld %5d %c %s: %s\n", stamp, time.tv_nsec / 1000000, tid,
+            priorityChar(prio), tag, text);
+}
+
+// Single consumer; returns the number of records written.
+size_t drain() {
+    size_t count = 0;
+    for (;;) {
+        Slot& slot = g_slots[g_tail % kSlots];
+        if (slot.seq.load(std::memory_order_acquire) != g_tail + 1) {
+            break;
+        }
+        emit(slot.prio, slot.tag, slot.tid, slot.time, slot.text);
+        slot.seq.store(g_tail + kSlots, std::memory_order_release);
+        g_tail++;
+        count++;
+    }
+    
+    static unsigned long reported = 0;
+    unsigned long lost = g_dropped.load(std::memory_order_relaxed);
+    if (lost != reported) {
+        char text[64];
+        snprintf(text, sizeof(text), "%lu log records dropped (ring full)", lost - reported);
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        emit(ANDROID_LOG_WARN, "Logger", currentTid(), now, text);
+        reported = lost;
+    }
+    
+    if (count && g_sink != Sink::Logcat) {
+        fflush(g_sink == Sink::File ? g_file : stderr);
+    }
+    return count;
+}
+
+void writerLoop() {
+    long idleNs = kMinIdleNs;
+    while (!g_stopping.load(std::memory_order_acquire)) {
+        if (drain()) {
+            idleNs = kMinIdleNs;
+            continue;
+        }
+        struct timespec pause = { 0, idleNs };
+        nanosleep(&pause, nullptr);
+        idleNs = idleNs * 2 < kMaxIdleNs ? idleNs * 2 : kMaxIdleNs;
+    }
+    drain();
+}
+
+bool enqueue(int prio, const char* tag, const char* fmt, va_list ap) {
+    size_t pos = g_head.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &g_slots[pos % kSlots];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (g_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = g_head.load(std::memory_order_relaxed);
+        }
+    }
+    
+    // clock_gettime goes through the vDSO, so the producer stays syscall-free
+    slot->prio = prio;
+    slot->tag = tag;
+    slot->tid = currentTid();
+    clock_gettime(CLOCK_REALTIME, &slot->time);
+    vsnprintf(slot->text, kTextSize, fmt, ap);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void stopAtExit() {
+    stop();
+}
+
+} // namespace
+
+bool start(Sink sink, const char* path) {
+    if (g_running.load()) {
+        return true;
+    }
+    
+    if (sink == Sink::File) {
+        g_file = fopen(path, "a");
+        if (!g_file) {
+            __android_log_print(ANDROID_LOG_ERROR, "Logger", "Cannot open log file %s: %s",
+                                path, strerror(errno));
+            return false;
+        }
+    }
+    
+    for (size_t i = 0; i < kSlots; i++) {
+        g_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    g_head.store(0, std::memory_order_relaxed);
+    g_tail = 0;
+    g_sink = sink;
+    g_stopping.store(false);
+    g_writer = std::thread(writerLoop);
+    g_running.store(true, std::memory_order_release);
+    
+    static bool registered = false;
+    if (!registered) {
+        atexit(stopAtExit);
+        registered = true;
+    }
+    return true;
+}
+
+void stop() {
+    if (!g_running.exchange(false)) {
+        return;
+    }
+    
+    // A producer racing with stop() may publish after the final drain; that
+    // record is lost, which only matters for the last lines before exit.
+    g_stopping.store(true, std::memory_order_release);
+    g_writer.join();
+    
+    if (g_file) {
+        fclose(g_file);
+        g_file = nullptr;
+    }
+}
+
+bool running() {
+    return g_running.load(std::memory_order_acquire);
+}
+
+unsigned long dropped() {
+    return g_dropped.load(std::memory_order_relaxed);
+}
+
+void write(int prio, const char* tag, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (g_running.load(std::memory_order_acquire)) {
+        enqueue(prio, tag, fmt, ap);
+    } else {
+        __android_log_vprint(prio, tag, fmt, ap);
+    }
+    va_end(ap);
+}
+
+} // namespace Logger
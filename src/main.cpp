@@ -1,11 +1,26 @@
 #include "injector.h"
+#include "injector_daemon.h"
+#include "daemon_client.h"
+#include "pattern_scanner.h"
+#include "payload_channel.h"
+#include "process_utils.h"
+#include "trace.h"
 #include <iostream>
 #include <cstring>
-#include <android/log.h>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "logger.h"
 
 #define LOG_TAG "Injector"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 void printUsage(const char* programName) {
     std::cout << "Android SO Injector - Usage:\n";
@@ -14,19 +29,289 @@ void printUsage(const char* programName) {
     std::cout << "  " << programName << " -pid <process_id> -lib <library_path>\n";
     std::cout << "\nArguments:\n";
     std::cout << "  -pkg <package>      Target application package name\n";
-    std::cout << "  -pid <pid>          Target process ID\n";
-    std::cout << "  -lib <path>         Path to .so library to inject (required)\n";
+    std::cout << "  -pid <pid[,pid...]> Target process ID(s)\n";
+    std::cout << "  -all                Inject into every process of the package (pkg, pkg:remote, ...)\n";
+    std::cout << "  -jobs <n>           Maximum parallel targets for -all / PID lists\n";
+    std::cout << "  -lib <path[:sym]>   Library to inject (required); comma-separated or repeated\n";
+    std::cout << "                      for several, each optionally followed by an init symbol\n";
     std::cout << "  -dl_memfd           Use memfd_create & dlopen_ext\n";
     std::cout << "  -hide_maps          Hide library from /proc/[pid]/maps\n";
     std::cout << "  -hide_solist        Remove library from linker solist\n";
     std::cout << "  -watch              Monitor and inject on app launch\n";
+    std::cout << "  -seize              Stop only the hijacked thread (PTRACE_SEIZE/INTERRUPT)\n";
     std::cout << "  -delay <us>         Delay in microseconds before injection\n";
-    std::cout << "  -symbols <name>     Symbol name to call in library\n";
+    std::cout << "  -timeout <ms>       Give up on a target stuck in attach or a call (default 5000, 0: never)\n";
+    std::cout << "  -symbols <name>     Entry symbol of the first library, called after it loads\n";
+    std::cout << "  -args <a,b,...>     Entry arguments: numbers, anything else is passed as a string\n";
+    std::cout << "  -scan <module>:<hex> Print where a byte pattern (?? = any byte) occurs in a module\n";
+    std::cout << "                      of -pid instead of injecting; repeat for several, one pass\n";
+    std::cout << "  -channel <kb>       Hand the first library a shared-memory channel with rings of <kb> KB\n";
+    std::cout << "  -send <text>        Send a text command over the payload's channel; repeat for several\n";
+    std::cout << "  -listen <seconds>   Print the payload's channel events (0: until it closes or exits)\n";
+    std::cout << "  -symcache <path>    Symbol offset cache file (default " SYMBOL_CACHE_DEFAULT_PATH ")\n";
+    std::cout << "  -no_symcache        Resolve every symbol from the ELF files\n";
+    std::cout << "  -log <sink>         Log to logcat (default), stderr or the given file\n";
+    std::cout << "  -trace <file>       Write per-phase timings as Chrome trace-event JSON\n";
+    std::cout << "  -stats, --stats     Print per-phase and per-syscall latency histograms\n";
+    std::cout << "  -daemon             Stay resident and serve injections on @" DAEMON_SOCKET_NAME "\n";
+    std::cout << "  -daemon_stop        Stop a running daemon\n";
+    std::cout << "  -no_daemon          Inject from this process even if a daemon is running\n";
     std::cout << "  -h, --help          Show this help message\n";
     std::cout << "\nExamples:\n";
     std::cout << "  " << programName << " -pkg com.example.app -lib /data/local/tmp/hook.so\n";
     std::cout << "  " << programName << " -pid 12345 -lib /data/local/tmp/hook.so -dl_memfd\n";
     std::cout << "  " << programName << " -pkg com.game -lib /data/local/tmp/cheat.so -watch\n";
+    std::cout << "  " << programName << " -pkg com.example.app -lib /data/local/tmp/hook.so -all\n";
+    std::cout << "  " << programName << " -pid 12345 -lib /data/local/tmp/a.so,/data/local/tmp/b.so:b_init\n";
+    std::cout << "  " << programName << " -daemon -log /data/local/tmp/injectord.log &\n";
+    std::cout << "  " << programName << " -pid 12345 -scan \"libil2cpp.so:48 8b 05 ?? ?? ?? ?? e8\"\n";
+    std::cout << "  " << programName << " -pid 12345 -lib /data/local/tmp/hook.so -channel 64 -listen 0\n";
+    std::cout << "  " << programName << " -pid 12345 -send \"set fps 60\"\n";
+}
+
+bool parsePidList(const char* arg, std::vector<pid_t>& pids) {
+    pids.clear();
+    const char* p = arg;
+    while (*p) {
+        char* end;
+        long pid = strtol(p, &end, 10);
+        if (end == p || pid <= 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        pids.push_back((pid_t)pid);
+        p = *end ? end + 1 : end;
+    }
+    return !pids.empty();
+}
+
+// Appends the comma-separated entries of arg; empty ones are kept.
+void splitList(const char* arg, std::vector<std::string>& out) {
+    std::string list(arg);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        out.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
+
+// Appends "path[:symbol],..." entries. The symbol separator is the last ':'
+// after the final '/', so directory names containing ':' still work.
+bool parseLibraryList(const char* arg, std::vector<Injector::LibrarySpec>& libraries) {
+    std::string list(arg);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        std::string entry = list.substr(start, comma - start);
+        
+        Injector::LibrarySpec lib;
+        size_t slash = entry.rfind('/');
+        size_t colon = entry.rfind(':');
+        if (colon != std::string::npos && (slash == std::string::npos || colon > slash)) {
+            lib.path = entry.substr(0, colon);
+            lib.initSymbol = entry.substr(colon + 1);
+        } else {
+            lib.path = entry;
+        }
+        if (lib.path.empty()) {
+            return false;
+        }
+        libraries.push_back(lib);
+        start = comma + 1;
+    }
+    return true;
+}
+
+// Scans each module once for all of its patterns and prints every match.
+// True if each pattern matched somewhere.
+bool runScans(pid_t pid, const std::vector<std::pair<std::string, std::string>>& scans) {
+    std::vector<std::string> modules;
+    for (const auto& scan : scans) {
+        if (std::find(modules.begin(), modules.end(), scan.first) == modules.end()) {
+            modules.push_back(scan.first);
+        }
+    }
+    
+    bool allFound = true;
+    for (const std::string& module : modules) {
+        std::vector<PatternScanner::Pattern> patterns;
+        for (const auto& scan : scans) {
+            if (scan.first != module) continue;
+            patterns.emplace_back();
+            if (!PatternScanner::parsePattern(scan.second, patterns.back())) {
+                std::cerr << "Invalid pattern: " << scan.second << "\n";
+                return false;
+            }
+        }
+        
+        ProcessUtils::ModuleInfo info;
+        std::vector<PatternScanner::Match> matches;
+        PatternScanner::ScanStats stats;
+        if (!ProcessUtils::findModule(pid, module, info) ||
+            !PatternScanner::scanModule(pid, module, patterns, PatternScanner::ScanOptions(), matches, &stats)) {
+            printf("PID %d: cannot scan %s\n", pid, module.c_str());
+            allFound = false;
+            continue;
+        }
+        printf("PID %d: %s, %zu bytes scanned in %.3f ms\n", pid, info.path.c_str(), stats.bytes, stats.ms);
+        
+        std::vector<size_t> counts(patterns.size(), 0);
+        for (const PatternScanner::Match& m : matches) {
+            counts[m.pattern]++;
+            printf("  %s+%#lx  %#lx  %s\n", info.name.c_str(), (unsigned long)(m.address - info.baseAddress),
+                   (unsigned long)m.address, patterns[m.pattern].text.c_str());
+        }
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (counts[i] == 0) {
+                printf("  no match  %s\n", patterns[i].text.c_str());
+                allFound = false;
+            }
+        }
+    }
+    return allFound;
+}
+
+double monotonicSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sends the text commands to every payload, then prints their events for
+// listenSeconds (0: until each payload closed its end or exited; negative:
+// not at all). Both sides only poll shared memory; a full ring is retried
+// for a second before the command is given up.
+bool runChannels(const std::vector<std::shared_ptr<Injector::PayloadChannel>>& channels,
+                 const std::vector<std::string>& sends, double listenSeconds) {
+    bool ok = true;
+    for (const auto& channel : channels) {
+        for (const std::string& text : sends) {
+            int tries = 0;
+            while (!channel->send(text) && ++tries < 1000) {
+                usleep(1000);
+            }
+            if (tries == 1000) {
+                printf("PID %d: channel full, command not sent: %s\n", channel->pid(), text.c_str());
+                ok = false;
+            }
+        }
+    }
+    if (listenSeconds < 0) {
+        return ok;
+    }
+    
+    double deadline = listenSeconds > 0 ? monotonicSeconds() + listenSeconds : 0;
+    double nextCheck = 0;
+    std::vector<bool> done(channels.size(), false);
+    size_t remaining = channels.size();
+    uint32_t type;
+    std::string data;
+    while (remaining > 0 && (deadline == 0 || monotonicSeconds() < deadline)) {
+        bool any = false;
+        for (const auto& channel : channels) {
+            while (channel->receive(type, data)) {
+                any = true;
+                if (type == INJECTOR_MSG_TEXT) {
+                    printf("PID %d: %.*s\n", channel->pid(), (int)data.size(), data.c_str());
+                    continue;
+                }
+                printf("PID %d: type %u, %zu bytes:", channel->pid(), type, data.size());
+                for (size_t i = 0; i < data.size() && i < 32; i++) {
+                    printf(" %02x", (uint8_t)data[i]);
+                }
+                printf(data.size() > 32 ? " ...\n" : "\n");
+            }
+        }
+        fflush(stdout);
+        if (any) {
+            continue;
+        }
+        
+        // Whether the payloads are still there is only checked when idle;
+        // events queued before they left are printed first
+        double now = monotonicSeconds();
+        if (listenSeconds == 0 && now >= nextCheck) {
+            nextCheck = now + 0.1;
+            for (size_t i = 0; i < channels.size(); i++) {
+                if (!done[i] && (channels[i]->payloadState() == INJECTOR_PAYLOAD_CLOSED ||
+                                 kill(channels[i]->pid(), 0) != 0)) {
+                    done[i] = true;
+                    remaining--;
+                }
+            }
+        }
+        usleep(1000);
+    }
+    
+    for (const auto& channel : channels) {
+        if (channel->droppedEvents() || channel->droppedCommands()) {
+            printf("PID %d: dropped %lu events, %lu commands\n", channel->pid(),
+                   (unsigned long)channel->droppedEvents(), (unsigned long)channel->droppedCommands());
+        }
+    }
+    return ok;
+}
+
+// The channels of pids: this process's end from an in-process injection,
+// otherwise found in each target's maps.
+bool openChannels(const std::vector<pid_t>& pids, const std::vector<Injector::TargetResult>& results,
+                  std::vector<std::shared_ptr<Injector::PayloadChannel>>& channels) {
+    for (pid_t pid : pids) {
+        std::shared_ptr<Injector::PayloadChannel> channel;
+        for (const Injector::TargetResult& r : results) {
+            if (r.pid == pid && r.channel) channel = r.channel;
+        }
+        if (!channel) {
+            channel.reset(new Injector::PayloadChannel());
+            if (!channel->connect(pid)) {
+                std::cerr << "PID " << pid << " has no payload channel\n";
+                return false;
+            }
+        }
+        channels.push_back(channel);
+    }
+    return true;
+}
+
+void printResults(const std::vector<Injector::TargetResult>& results) {
+    if (results.size() >= 2) {
+        printf("%8s  %-7s  %10s  %10s  %10s  %s\n", "PID", "RESULT", "PLAN_MS", "STOP_MS", "TOTAL_MS", "ERROR");
+        for (const Injector::TargetResult& r : results) {
+            printf("%8d  %-7s  %10.3f  %10.3f  %10.3f  %s\n", r.pid, r.success ? "ok" : "FAILED",
+                   r.planMs, r.stopMs, r.totalMs, r.error.c_str());
+        }
+    } else if (results.size() == 1) {
+        const Injector::TargetResult& r = results[0];
+        printf("PID %d: %s, planned %.3f ms, stopped %.3f ms, total %.3f ms\n", r.pid,
+               r.success ? "ok" : "FAILED", r.planMs, r.stopMs, r.totalMs);
+        if (!r.success && !r.error.empty()) {
+            printf("PID %d: %s\n", r.pid, r.error.c_str());
+        }
+    }
+    
+    for (const Injector::TargetResult& r : results) {
+        if (r.entryCalled) {
+            printf("PID %d: entry returned %#lx\n", r.pid, (unsigned long)r.entryResult);
+        }
+        if (r.channelAddr) {
+            printf("PID %d: channel at %#lx\n", r.pid, (unsigned long)r.channelAddr);
+        }
+    }
+    
+    // Per-library breakdown when one session loaded several payloads
+    for (const Injector::TargetResult& r : results) {
+        if (r.libraries.size() < 2) {
+            continue;
+        }
+        printf("PID %d: %zu libraries, stopped %.3f ms\n", r.pid, r.libraries.size(), r.stopMs);
+        printf("  %-7s  %10s  %18s  %s\n", "RESULT", "LOAD_MS", "HANDLE", "LIBRARY");
+        for (const Injector::LibraryResult& lib : r.libraries) {
+            printf("  %-7s  %10.3f  %#18lx  %s\n", lib.success ? "ok" : "FAILED",
+                   lib.loadMs, (unsigned long)lib.handle, lib.path.c_str());
+        }
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -38,6 +323,15 @@ int main(int argc, char* argv[]) {
     }
     
     Injector::InjectionConfig config;
+    const char* tracePath = nullptr;
+    const char* logSink = "logcat";
+    bool printStats = false;
+    bool runDaemon = false;
+    bool stopDaemon = false;
+    bool useDaemon = true;
+    std::vector<std::pair<std::string, std::string>> scans;
+    std::vector<std::string> sends;
+    double listenSeconds = -1;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -49,10 +343,23 @@ int main(int argc, char* argv[]) {
             config.packageName = argv[++i];
         }
         else if (strcmp(argv[i], "-pid") == 0 && i + 1 < argc) {
-            config.pid = atoi(argv[++i]);
+            if (!parsePidList(argv[++i], config.pids)) {
+                std::cerr << "Invalid PID list: " << argv[i] << "\n";
+                return 1;
+            }
+            config.pid = config.pids[0];
+        }
+        else if (strcmp(argv[i], "-all") == 0) {
+            config.allProcesses = true;
+        }
+        else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+            config.maxWorkers = atoi(argv[++i]);
         }
         else if (strcmp(argv[i], "-lib") == 0 && i + 1 < argc) {
-            config.libraryPath = argv[++i];
+            if (!parseLibraryList(argv[++i], config.libraries)) {
+                std::cerr << "Invalid library list: " << argv[i] << "\n";
+                return 1;
+            }
         }
         else if (strcmp(argv[i], "-dl_memfd") == 0) {
             config.useMemfd = true;
@@ -66,16 +373,144 @@ int main(int argc, char* argv[]) {
         else if (strcmp(argv[i], "-watch") == 0) {
             config.watchLaunch = true;
         }
+        else if (strcmp(argv[i], "-seize") == 0) {
+            config.seize = true;
+        }
         else if (strcmp(argv[i], "-delay") == 0 && i + 1 < argc) {
             config.delayUs = atoi(argv[++i]);
         }
+        else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc) {
+            config.stepTimeoutMs = atoi(argv[++i]);
+        }
         else if (strcmp(argv[i], "-symbols") == 0 && i + 1 < argc) {
             config.symbolName = argv[++i];
         }
+        else if (strcmp(argv[i], "-args") == 0 && i + 1 < argc) {
+            splitList(argv[++i], config.entryArgs);
+        }
+        else if (strcmp(argv[i], "-scan") == 0 && i + 1 < argc) {
+            std::string scan = argv[++i];
+            size_t colon = scan.find(':');
+            if (colon == std::string::npos || colon == 0) {
+                std::cerr << "Invalid scan, expected <module>:<pattern>: " << scan << "\n";
+                return 1;
+            }
+            scans.push_back(std::make_pair(scan.substr(0, colon), scan.substr(colon + 1)));
+        }
+        else if (strcmp(argv[i], "-channel") == 0 && i + 1 < argc) {
+            config.channelKb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-send") == 0 && i + 1 < argc) {
+            sends.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-listen") == 0 && i + 1 < argc) {
+            listenSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-symcache") == 0 && i + 1 < argc) {
+            config.symbolCachePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-no_symcache") == 0) {
+            config.symbolCachePath.clear();
+        }
+        else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            logSink = argv[++i];
+        }
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-stats") == 0 || strcmp(argv[i], "--stats") == 0) {
+            printStats = true;
+        }
+        else if (strcmp(argv[i], "-daemon") == 0) {
+            runDaemon = true;
+        }
+        else if (strcmp(argv[i], "-daemon_stop") == 0) {
+            stopDaemon = true;
+        }
+        else if (strcmp(argv[i], "-no_daemon") == 0) {
+            useDaemon = false;
+        }
+    }
+    
+    // Tracee stops arrive as SIGCHLD on the tracer's signalfd; blocked
+    // before the logger thread exists so that thread cannot swallow them.
+    // The daemon reads SIGINT/SIGTERM from a signalfd the same way; left
+    // unblocked in the logger thread, they would kill it mid-injection.
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    if (runDaemon) {
+        sigaddset(&blocked, SIGINT);
+        sigaddset(&blocked, SIGTERM);
+    }
+    pthread_sigmask(SIG_BLOCK, &blocked, nullptr);
+    
+    // From here on log records go through the asynchronous ring
+    if (strcmp(logSink, "logcat") == 0) {
+        Logger::start(Logger::Sink::Logcat);
+    } else if (strcmp(logSink, "stderr") == 0) {
+        Logger::start(Logger::Sink::Stderr);
+    } else if (!Logger::start(Logger::Sink::File, logSink)) {
+        std::cerr << "Cannot open log file " << logSink << "\n";
+        return 1;
+    }
+    
+    if (stopDaemon) {
+        if (!DaemonClient::shutdown()) {
+            std::cerr << "No daemon is running\n";
+            return 1;
+        }
+        std::cout << "Daemon stopped\n";
+        return 0;
+    }
+    
+    if (runDaemon) {
+        if (getuid() != 0) {
+            std::cerr << "Error: This tool requires root privileges\n";
+            return 1;
+        }
+        Injector::InjectorDaemon daemon;
+        if (!daemon.start()) {
+            std::cerr << "Cannot start the daemon (already running?)\n";
+            return 1;
+        }
+        std::cout << "Daemon listening on @" DAEMON_SOCKET_NAME "\n" << std::flush;
+        return daemon.run() ? 0 : 1;
+    }
+    
+    // A scan reads the target's memory only; it never stops it
+    if (!scans.empty()) {
+        if (config.pids.size() != 1) {
+            std::cerr << "-scan needs a single -pid\n";
+            return 1;
+        }
+        Trace::setEnabled(tracePath != nullptr || printStats);
+        bool found = runScans(config.pid, scans);
+        if (printStats) {
+            Trace::printStats(stdout);
+        }
+        if (tracePath && !Trace::writeChromeTrace(tracePath)) {
+            std::cerr << "Failed to write trace to " << tracePath << "\n";
+        }
+        return found ? 0 : 1;
+    }
+    
+    // Commands and events for payloads injected earlier; nothing is stopped
+    bool talk = !sends.empty() || listenSeconds >= 0;
+    if (talk && config.libraries.empty()) {
+        if (config.pids.empty()) {
+            std::cerr << "-send and -listen without -lib need -pid\n";
+            return 1;
+        }
+        std::vector<std::shared_ptr<Injector::PayloadChannel>> channels;
+        if (!openChannels(config.pids, std::vector<Injector::TargetResult>(), channels)) {
+            return 1;
+        }
+        return runChannels(channels, sends, listenSeconds) ? 0 : 1;
     }
     
     // Validate arguments
-    if (config.libraryPath.empty()) {
+    if (config.libraries.empty()) {
         LOGE("Error: Library path (-lib) is required");
         printUsage(argv[0]);
         return 1;
@@ -99,20 +534,69 @@ int main(int argc, char* argv[]) {
     if (!config.packageName.empty()) {
         LOGI("  Package: %s", config.packageName.c_str());
     }
-    if (config.pid != 0) {
-        LOGI("  PID: %d", config.pid);
+    for (pid_t pid : config.pids) {
+        LOGI("  PID: %d", pid);
+    }
+    if (config.allProcesses) LOGI("  All package processes: enabled");
+    for (const Injector::LibrarySpec& lib : config.libraries) {
+        if (lib.initSymbol.empty()) {
+            LOGI("  Library: %s", lib.path.c_str());
+        } else {
+            LOGI("  Library: %s (init %s)", lib.path.c_str(), lib.initSymbol.c_str());
+        }
     }
-    LOGI("  Library: %s", config.libraryPath.c_str());
     if (config.useMemfd) LOGI("  Use memfd: enabled");
     if (config.hideMaps) LOGI("  Hide maps: enabled");
     if (config.hideSolist) LOGI("  Hide solist: enabled");
     if (config.watchLaunch) LOGI("  Watch launch: enabled");
+    if (config.seize) LOGI("  Attach mode: seize");
     if (config.delayUs > 0) LOGI("  Delay: %u us", config.delayUs);
+    if (!config.symbolName.empty()) LOGI("  Entry: %s (%zu arguments)", config.symbolName.c_str(), config.entryArgs.size());
+    if (config.stepTimeoutMs > 0) LOGI("  Step timeout: %u ms", config.stepTimeoutMs);
+    if (config.channelKb) LOGI("  Payload channel: %u KB rings", config.channelKb);
+    
+    // A running daemon has everything warm already. Watching and tracing
+    // need this process, so they always run in-process.
+    bool ok = false;
+    std::vector<Injector::TargetResult> results;
+    DaemonClient::Status status = DaemonClient::Status::Unavailable;
+    if (useDaemon && !config.watchLaunch && !tracePath && !printStats) {
+        status = DaemonClient::inject(config, ok, results);
+        if (status == DaemonClient::Status::Failed) {
+            std::cerr << "The daemon did not answer; the injection may or may not have happened\n";
+            return 1;
+        }
+    }
     
     // Perform injection
-    Injector::LibraryInjector injector;
+    if (status == DaemonClient::Status::Unavailable) {
+        Injector::LibraryInjector injector;
+        
+        Trace::setEnabled(tracePath != nullptr || printStats);
+        ok = injector.inject(config);
+        results = injector.results();
+    }
+    printResults(results);
+    
+    if (printStats) {
+        Trace::printStats(stdout);
+    }
+    if (tracePath && !Trace::writeChromeTrace(tracePath)) {
+        std::cerr << "Failed to write trace to " << tracePath << "\n";
+    }
+    
+    if (ok && talk) {
+        std::vector<pid_t> pids;
+        std::vector<std::shared_ptr<Injector::PayloadChannel>> channels;
+        for (const Injector::TargetResult& r : results) {
+            pids.push_back(r.pid);
+        }
+        LOGI("Injection successful!");
+        std::cout << "Injection successful!\n" << std::flush;
+        return openChannels(pids, results, channels) && runChannels(channels, sends, listenSeconds) ? 0 : 1;
+    }
     
-    if (injector.inject(config)) {
+    if (ok) {
         LOGI("Injection successful!");
         std::cout << "Injection successful!\n";
         return 0;
@@ -0,0 +1,294 @@
+#include "maps_query.h"
+#include "trace.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "MapsQuery"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// From <linux/fs.h> of Linux 6.11; older headers (and the NDK's) lack it.
+#ifndef PROCMAP_QUERY
+struct procmap_query {
+    uint64_t size;
+    uint64_t query_flags;
+    uint64_t query_addr;
+    uint64_t vma_start;
+    uint64_t vma_end;
+    uint64_t vma_flags;
+    uint64_t vma_page_size;
+    uint64_t vma_offset;
+    uint64_t inode;
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint32_t vma_name_size;
+    uint32_t build_id_size;
+    uint64_t vma_name_addr;
+    uint64_t build_id_addr;
+};
+#define PROCMAP_QUERY _IOWR('f', 17, struct procmap_query)
+#define PROCMAP_QUERY_VMA_READABLE 0x01
+#define PROCMAP_QUERY_VMA_WRITABLE 0x02
+#define PROCMAP_QUERY_VMA_EXECUTABLE 0x04
+#define PROCMAP_QUERY_VMA_SHARED 0x08
+#endif
+
+namespace ProcessUtils {
+
+namespace {
+
+// Few targets are worked on at once; each entry holds two fds and a
+// snapshot buffer.
+const size_t kCachedProcesses = 4;
+
+std::mutex g_mutex;
+std::vector<std::unique_ptr<MapsQuery>> g_queries;   // most recently used last
+
+int openProc(pid_t pid, const char* entry) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, entry);
+    return ::open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// The pid's entry, opened (or reopened for a new process) as needed;
+// nullptr if the process is not running. Called with g_mutex held.
+MapsQuery* queryFor(pid_t pid) {
+    for (size_t i = 0; i < g_queries.size(); i++) {
+        if (g_queries[i]->pid() != pid) {
+            continue;
+        }
+        std::unique_ptr<MapsQuery> query = std::move(g_queries[i]);
+        g_queries.erase(g_queries.begin() + i);
+        // Reopened once the process exits; the pid may name a new one by now
+        if (!query->alive() && !query->open(pid)) {
+            return nullptr;
+        }
+        g_queries.push_back(std::move(query));
+        return g_queries.back().get();
+    }
+    
+    std::unique_ptr<MapsQuery> query(new MapsQuery());
+    if (!query->open(pid)) {
+        return nullptr;
+    }
+    if (g_queries.size() == kCachedProcesses) {
+        g_queries.erase(g_queries.begin());
+    }
+    g_queries.push_back(std::move(query));
+    return g_queries.back().get();
+}
+
+} // namespace
+
+MapsQuery::MapsQuery() : pid_(0), mapsFd_(-1), statmFd_(-1), ioctl_(false), generation_(0) {
+}
+
+MapsQuery::~MapsQuery() {
+    close();
+}
+
+bool MapsQuery::open(pid_t pid) {
+    close();
+    mapsFd_ = openProc(pid, "maps");
+    statmFd_ = openProc(pid, "statm");
+    if (mapsFd_ < 0 || statmFd_ < 0) {
+        close();
+        return false;
+    }
+    pid_ = pid;
+    
+    // An exact query at address 0 fails with ENOENT where the ioctl exists
+    // and ENOTTY where it does not
+    procmap_query query;
+    memset(&query, 0, sizeof(query));
+    query.size = sizeof(query);
+    ioctl_ = ioctl(mapsFd_, PROCMAP_QUERY, &query) == 0 || errno == ENOENT;
+    LOGI("PID %d: maps lookups %s", pid, ioctl_ ? "via PROCMAP_QUERY" : "via cached snapshots");
+    return true;
+}
+
+void MapsQuery::close() {
+    if (mapsFd_ >= 0) ::close(mapsFd_);
+    if (statmFd_ >= 0) ::close(statmFd_);
+    mapsFd_ = statmFd_ = -1;
+    pid_ = 0;
+    ioctl_ = false;
+    generation_ = 0;
+    snapshot_.clear();
+}
+
+bool MapsQuery::readGeneration(uint64_t& generation) {
+    Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+    char buf[64];
+    ssize_t n = pread(statmFd_, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    
+    // Total VM size in pages, the first field
+    generation = strtoull(buf, nullptr, 10);
+    return generation != 0;
+}
+
+bool MapsQuery::alive() {
+    uint64_t generation;
+    return statmFd_ >= 0 && readGeneration(generation);
+}
+
+bool MapsQuery::reload() {
+    uint64_t generation;
+    if (!readGeneration(generation) || !snapshot_.load(pid_)) {
+        generation_ = 0;
+        return false;
+    }
+    // Read before the maps, so a change during the read is seen next time
+    generation_ = generation;
+    return true;
+}
+
+bool MapsQuery::current() {
+    if (mapsFd_ < 0) {
+        return false;
+    }
+    uint64_t generation;
+    if (!readGeneration(generation)) {
+        return false;
+    }
+    return generation == generation_ || reload();
+}
+
+const MapsSnapshot* MapsQuery::snapshot() {
+    return current() ? &snapshot_ : nullptr;
+}
+
+bool MapsQuery::queryVma(uintptr_t addr, MapsRegion& region) {
+    Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+    char name[PATH_MAX];
+    procmap_query query;
+    memset(&query, 0, sizeof(query));
+    query.size = sizeof(query);
+    query.query_addr = addr;
+    query.vma_name_addr = (uintptr_t)name;
+    query.vma_name_size = sizeof(name);
+    if (ioctl(mapsFd_, PROCMAP_QUERY, &query) != 0) {
+        return false;
+    }
+    
+    region.start = query.vma_start;
+    region.end = query.vma_end;
+    region.offset = query.vma_offset;
+    region.perms = 0;
+    if (query.vma_flags & PROCMAP_QUERY_VMA_READABLE) region.perms |= MAPS_READ;
+    if (query.vma_flags & PROCMAP_QUERY_VMA_WRITABLE) region.perms |= MAPS_WRITE;
+    if (query.vma_flags & PROCMAP_QUERY_VMA_EXECUTABLE) region.perms |= MAPS_EXEC;
+    if (query.vma_flags & PROCMAP_QUERY_VMA_SHARED) region.perms |= MAPS_SHARED;
+    // The size includes the terminator; 0 means no name
+    region.path.assign(name, query.vma_name_size ? query.vma_name_size - 1 : 0);
+    return true;
+}
+
+bool MapsQuery::lookupModule(std::string_view key, bool byPath, ModuleInfo& module) {
+    // A second pass only after the ioctl showed the snapshot to be stale
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!current()) {
+            return false;
+        }
+        const MapsModule* mod = byPath ? snapshot_.findModuleByPath(key) : snapshot_.findModule(key);
+        if (!mod) {
+            return false;
+        }
+        
+        module.name.assign(mod->name.data(), mod->name.size());
+        module.path.assign(mod->path.data(), mod->path.size());
+        module.baseAddress = mod->base;
+        module.endAddress = mod->end;
+        module.offset = snapshot_.moduleSegment(*mod, 0).offset;
+        if (!ioctl_) {
+            return true;
+        }
+        
+        MapsRegion base;
+        if (queryVma(module.baseAddress, base) && base.start == module.baseAddress &&
+            base.offset == module.offset && base.path == module.path) {
+            return true;
+        }
+        invalidate();
+    }
+    return false;
+}
+
+bool MapsQuery::findModule(std::string_view name, ModuleInfo& module) {
+    return lookupModule(name, false, module);
+}
+
+bool MapsQuery::findModuleByPath(std::string_view path, ModuleInfo& module) {
+    return lookupModule(path, true, module);
+}
+
+bool MapsQuery::findRegion(uintptr_t addr, MapsRegion& region) {
+    if (ioctl_) {
+        return mapsFd_ >= 0 && queryVma(addr, region);
+    }
+    
+    const MapsSegment* seg = current() ? snapshot_.findSegment(addr) : nullptr;
+    if (!seg) {
+        return false;
+    }
+    region.start = seg->start;
+    region.end = seg->end;
+    region.offset = seg->offset;
+    region.perms = seg->perms;
+    region.path.assign(seg->path.data(), seg->path.size());
+    return true;
+}
+
+bool queryModule(pid_t pid, std::string_view name, ModuleInfo& module) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    MapsQuery* query = queryFor(pid);
+    return query && query->findModule(name, module);
+}
+
+bool queryModuleByPath(pid_t pid, std::string_view path, ModuleInfo& module) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    MapsQuery* query = queryFor(pid);
+    return query && query->findModuleByPath(path, module);
+}
+
+bool queryRegion(pid_t pid, uintptr_t addr, MapsRegion& region) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    MapsQuery* query = queryFor(pid);
+    return query && query->findRegion(addr, region);
+}
+
+bool withMaps(pid_t pid, const std::function<void(const MapsSnapshot& maps)>& fn) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    MapsQuery* query = queryFor(pid);
+    const MapsSnapshot* maps = query ? query->snapshot() : nullptr;
+    if (!maps) {
+        return false;
+    }
+    fn(*maps);
+    return true;
+}
+
+void invalidateMaps(pid_t pid) {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    for (const std::unique_ptr<MapsQuery>& query : g_queries) {
+        if (query->pid() == pid) {
+            query->invalidate();
+        }
+    }
+}
+
+} // namespace ProcessUtils
@@ -0,0 +1,278 @@
+#include "maps_snapshot.h"
+#include "trace.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#define LOG_TAG "MapsSnapshot"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace ProcessUtils {
+
+namespace {
+
+// Large enough for the maps of a typical ART process in one or two reads.
+const size_t kInitialBuffer = 256 * 1024;
+
+uintptr_t parseHex(const char*& p, const char* end) {
+    uintptr_t value = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c >= '0' && c <= '9') value = (value << 4) | (uintptr_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') value = (value << 4) | (uintptr_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') value = (value << 4) | (uintptr_t)(c - 'A' + 10);
+        else break;
+    }
+    return value;
+}
+
+const char* skipField(const char* p, const char* end) {
+    while (p < end && *p != ' ') p++;
+    while (p < end && *p == ' ') p++;
+    return p;
+}
+
+uint32_t hashView(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (char c : s) {
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+std::string_view baseName(std::string_view path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+} // namespace
+
+MapsSnapshot::MapsSnapshot() : pid_(0), length_(0) {
+}
+
+void MapsSnapshot::clear() {
+    pid_ = 0;
+    length_ = 0;
+    segments_.clear();
+    modules_.clear();
+    moduleSegments_.clear();
+    nameTable_.clear();
+    pathTable_.clear();
+}
+
+bool MapsSnapshot::load(pid_t pid) {
+    Trace::Scope trace("maps_load", pid);
+    clear();
+    
+    if (!readFile(pid)) {
+        return false;
+    }
+    
+    pid_ = pid;
+    parse();
+    buildIndex();
+    return true;
+}
+
+bool MapsSnapshot::readFile(pid_t pid) {
+    Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s", path, strerror(errno));
+        return false;
+    }
+    
+    if (buffer_.size() < kInitialBuffer) {
+        buffer_.resize(kInitialBuffer);
+    }
+    
+    for (;;) {
+        if (length_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        
+        ssize_t n = read(fd, buffer_.data() + length_, buffer_.size() - length_);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Failed to read %s: %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        length_ += (size_t)n;
+    }
+    
+    close(fd);
+    return true;
+}
+
+void MapsSnapshot::parse() {
+    const char* p = buffer_.data();
+    const char* end = p + length_;
+    
+    while (p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd) lineEnd = end;
+        
+        // start-end perms offset dev inode [path]
+        MapsSegment seg;
+        seg.start = parseHex(p, lineEnd);
+        if (p < lineEnd && *p == '-') p++;
+        seg.end = parseHex(p, lineEnd);
+        while (p < lineEnd && *p == ' ') p++;
+        
+        seg.perms = 0;
+        if (lineEnd - p >= 4) {
+            if (p[0] == 'r') seg.perms |= MAPS_READ;
+            if (p[1] == 'w') seg.perms |= MAPS_WRITE;
+            if (p[2] == 'x') seg.perms |= MAPS_EXEC;
+            if (p[3] == 's') seg.perms |= MAPS_SHARED;
+        }
+        p = skipField(p, lineEnd);
+        seg.offset = parseHex(p, lineEnd);
+        while (p < lineEnd && *p == ' ') p++;
+        p = skipField(p, lineEnd); // dev
+        p = skipField(p, lineEnd); // inode
+        
+        seg.path = std::string_view(p, lineEnd - p);
+        seg.module = kNoModule;
+        
+        if (seg.end > seg.start) {
+            segments_.push_back(seg);
+        }
+        p = lineEnd + 1;
+    }
+}
+
+uint32_t MapsSnapshot::lookup(const std::vector<uint32_t>& table, std::string_view key, bool byPath) const {
+    if (table.empty()) {
+        return kNoModule;
+    }
+    
+    size_t mask = table.size() - 1;
+    for (size_t i = hashView(key) & mask;; i = (i + 1) & mask) {
+        uint32_t slot = table[i];
+        if (slot == 0) {
+            return kNoModule;
+        }
+        const MapsModule& mod = modules_[slot - 1];
+        if ((byPath ? mod.path : mod.name) == key) {
+            return slot - 1;
+        }
+    }
+}
+
+void MapsSnapshot::insert(std::vector<uint32_t>& table, uint32_t module, bool byPath) {
+    std::string_view key = byPath ? modules_[module].path : modules_[module].name;
+    size_t mask = table.size() - 1;
+    size_t i = hashView(key) & mask;
+    while (table[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    table[i] = module + 1;
+}
+
+void MapsSnapshot::buildIndex() {
+    // Twice the segment count bounds the number of modules, keeping both
+    // tables at most half full.
+    size_t tableSize = 16;
+    while (tableSize < segments_.size() * 2) tableSize <<= 1;
+    pathTable_.assign(tableSize, 0);
+    nameTable_.assign(tableSize, 0);
+    
+    for (uint32_t i = 0; i < segments_.size(); i++) {
+        MapsSegment& seg = segments_[i];
+        if (seg.path.empty() || seg.path[0] != '/') {
+            continue;
+        }
+        
+        uint32_t module = lookup(pathTable_, seg.path, true);
+        if (module == kNoModule) {
+            MapsModule mod;
+            mod.path = seg.path;
+            mod.name = baseName(seg.path);
+            mod.base = seg.start;
+            mod.end = seg.end;
+            mod.firstSegment = 0;
+            mod.segmentCount = 0;
+            mod.perms = 0;
+            module = (uint32_t)modules_.size();
+            modules_.push_back(mod);
+            insert(pathTable_, module, true);
+            if (lookup(nameTable_, mod.name, false) == kNoModule) {
+                insert(nameTable_, module, false);
+            }
+        }
+        
+        MapsModule& mod = modules_[module];
+        mod.base = std::min(mod.base, seg.start);
+        mod.end = std::max(mod.end, seg.end);
+        mod.segmentCount++;
+        mod.perms |= seg.perms;
+        seg.module = module;
+    }
+    
+    // Counting sort of segment indices by module keeps each module's
+    // segments contiguous and in address order.
+    uint32_t next = 0;
+    for (MapsModule& mod : modules_) {
+        mod.firstSegment = next;
+        next += mod.segmentCount;
+        mod.segmentCount = 0;
+    }
+    moduleSegments_.resize(next);
+    for (uint32_t i = 0; i < segments_.size(); i++) {
+        uint32_t module = segments_[i].module;
+        if (module == kNoModule) continue;
+        MapsModule& mod = modules_[module];
+        moduleSegments_[mod.firstSegment + mod.segmentCount++] = i;
+    }
+}
+
+const MapsModule* MapsSnapshot::findModule(std::string_view name) const {
+    uint32_t module = lookup(nameTable_, name, false);
+    if (module != kNoModule) {
+        return &modules_[module];
+    }
+    
+    for (const MapsModule& mod : modules_) {
+        if (mod.name.find(name) != std::string_view::npos) {
+            return &mod;
+        }
+    }
+    return nullptr;
+}
+
+const MapsModule* MapsSnapshot::findModuleByPath(std::string_view path) const {
+    uint32_t module = lookup(pathTable_, path, true);
+    return module == kNoModule ? nullptr : &modules_[module];
+}
+
+const MapsSegment* MapsSnapshot::findSegment(uintptr_t addr) const {
+    auto it = std::upper_bound(segments_.begin(), segments_.end(), addr,
+                               [](uintptr_t a, const MapsSegment& seg) { return a < seg.start; });
+    if (it == segments_.begin()) {
+        return nullptr;
+    }
+    --it;
+    return addr < it->end ? &*it : nullptr;
+}
+
+const MapsModule* MapsSnapshot::moduleAt(uintptr_t addr) const {
+    const MapsSegment* seg = findSegment(addr);
+    if (!seg || seg->module == kNoModule) {
+        return nullptr;
+    }
+    return &modules_[seg->module];
+}
+
+} // namespace ProcessUtils
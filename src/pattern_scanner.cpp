@@ -0,0 +1,639 @@
+#include "pattern_scanner.h"
+#include "maps_query.h"
+#include "process_utils.h"
+#include "ptrace_utils.h"
+#include "symbol_cache.h"
+#include "trace.h"
+#include "logger.h"
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATTERN_SCANNER_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define PATTERN_SCANNER_NEON 1
+#endif
+
+#define LOG_TAG "PatternScanner"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace PatternScanner {
+
+namespace {
+
+// Bytes read from the target per process_vm_readv; two windows are live.
+const size_t kWindowSize = 4 * 1024 * 1024;
+// Candidate positions per pattern pass; the block stays in L1 while every
+// pattern is run over it.
+const size_t kBlockSize = 16 * 1024;
+
+// A pattern prepared for the kernels: the two fixed bytes to compare
+// vector-wide first, chosen as the least common ones in machine code.
+struct Compiled {
+    const uint8_t* bytes;
+    const uint8_t* mask;
+    size_t length;
+    size_t anchor1;
+    size_t anchor2;
+    bool anchored;
+    uint32_t index;
+};
+
+class Sink {
+public:
+    Sink(std::vector<Match>& matches, size_t patterns, size_t maxMatches, uintptr_t base)
+        : matches_(matches), counts_(patterns, 0), maxMatches_(maxMatches), base_(base) {}
+    
+    bool full(uint32_t pattern) const {
+        return maxMatches_ != 0 && counts_[pattern] >= maxMatches_;
+    }
+    
+    bool allFull() const {
+        for (uint32_t i = 0; i < counts_.size(); i++) {
+            if (!full(i)) return false;
+        }
+        return true;
+    }
+    
+    // False once the pattern has all the matches it may have
+    bool add(uint32_t pattern, size_t at) {
+        matches_.push_back({ pattern, base_ + at });
+        return ++counts_[pattern] != maxMatches_;
+    }
+    
+    void rebase(uintptr_t base) { base_ = base; }
+
+private:
+    std::vector<Match>& matches_;
+    std::vector<size_t> counts_;
+    size_t maxMatches_;
+    uintptr_t base_;
+};
+
+int commonness(uint8_t b) {
+    switch (b) {
+        case 0x00:
+            return 4;
+        case 0xff:
+            return 3;
+        // x86 REX.W, mov, two-byte escape, int3/nop padding, SIB rsp
+        case 0x48: case 0x89: case 0x8b: case 0x0f: case 0xcc: case 0x90: case 0x24:
+            return 2;
+    }
+    // Small aligned immediates, AArch64 register and condition fields
+    return (b & 0x0f) == 0 ? 1 : 0;
+}
+
+void compile(const Pattern& pattern, uint32_t index, Compiled& c) {
+    c.bytes = pattern.bytes.data();
+    c.mask = pattern.mask.data();
+    c.length = pattern.bytes.size();
+    c.index = index;
+    c.anchored = false;
+    c.anchor1 = c.anchor2 = 0;
+    for (size_t i = 0; i < c.length; i++) {
+        if (c.mask[i] != 0xff) continue;
+        if (!c.anchored || commonness(c.bytes[i]) < commonness(c.bytes[c.anchor1])) {
+            c.anchor1 = i;
+        }
+        c.anchored = true;
+    }
+    // A single fixed byte is compared twice
+    c.anchor2 = c.anchor1;
+    bool second = false;
+    for (size_t i = 0; i < c.length; i++) {
+        if (c.mask[i] != 0xff || i == c.anchor1) continue;
+        if (!second || commonness(c.bytes[i]) < commonness(c.bytes[c.anchor2])) {
+            c.anchor2 = i;
+            second = true;
+        }
+    }
+}
+
+inline bool verify(const uint8_t* p, const Compiled& c) {
+    for (size_t i = 0; i < c.length; i++) {
+        if ((p[i] ^ c.bytes[i]) & c.mask[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Candidates k in [from, limit); every byte of a candidate is in bounds.
+// Returns where the vector loop stopped, or limit once the pattern is full.
+typedef size_t (*KernelFn)(const uint8_t* data, size_t from, size_t limit, const Compiled& c, Sink& sink);
+
+void scanScalar(const uint8_t* data, size_t k, size_t limit, const Compiled& c, Sink& sink) {
+    if (!c.anchored) {
+        for (; k < limit; k++) {
+            if (verify(data + k, c) && !sink.add(c.index, k)) return;
+        }
+        return;
+    }
+    
+    // memchr is vectorised in libc, which makes this the portable kernel
+    const uint8_t anchor = c.bytes[c.anchor1];
+    while (k < limit) {
+        const uint8_t* hit = (const uint8_t*)memchr(data + k + c.anchor1, anchor, limit - k);
+        if (!hit) {
+            return;
+        }
+        k = hit - data - c.anchor1;
+        if (verify(data + k, c) && !sink.add(c.index, k)) return;
+        k++;
+    }
+}
+
+size_t scanNone(const uint8_t*, size_t from, size_t, const Compiled&, Sink&) {
+    return from;
+}
+
+#ifdef PATTERN_SCANNER_X86
+
+#ifdef __SSE2__
+size_t scanSse2(const uint8_t* data, size_t k, size_t limit, const Compiled& c, Sink& sink) {
+    const __m128i b1 = _mm_set1_epi8((char)c.bytes[c.anchor1]);
+    const __m128i b2 = _mm_set1_epi8((char)c.bytes[c.anchor2]);
+    for (; k + 16 <= limit; k += 16) {
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + k + c.anchor1)), b1);
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + k + c.anchor2)), b2);
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(e1, e2));
+        while (bits) {
+            size_t at = k + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (verify(data + at, c) && !sink.add(c.index, at)) return limit;
+        }
+    }
+    return k;
+}
+#endif
+
+__attribute__((target("avx2")))
+size_t scanAvx2(const uint8_t* data, size_t k, size_t limit, const Compiled& c, Sink& sink) {
+    const __m256i b1 = _mm256_set1_epi8((char)c.bytes[c.anchor1]);
+    const __m256i b2 = _mm256_set1_epi8((char)c.bytes[c.anchor2]);
+    for (; k + 32 <= limit; k += 32) {
+        __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + k + c.anchor1)), b1);
+        __m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + k + c.anchor2)), b2);
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(e1, e2));
+        while (bits) {
+            size_t at = k + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (verify(data + at, c) && !sink.add(c.index, at)) return limit;
+        }
+    }
+    return k;
+}
+
+#endif // PATTERN_SCANNER_X86
+
+#ifdef PATTERN_SCANNER_NEON
+size_t scanNeon(const uint8_t* data, size_t k, size_t limit, const Compiled& c, Sink& sink) {
+    const uint8x16_t b1 = vdupq_n_u8(c.bytes[c.anchor1]);
+    const uint8x16_t b2 = vdupq_n_u8(c.bytes[c.anchor2]);
+    for (; k + 16 <= limit; k += 16) {
+        uint8x16_t e = vandq_u8(vceqq_u8(vld1q_u8(data + k + c.anchor1), b1),
+                                vceqq_u8(vld1q_u8(data + k + c.anchor2), b2));
+        // No movemask: narrowing by 4 leaves one nibble per byte
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(e), 4)), 0);
+        while (bits) {
+            unsigned nibble = __builtin_ctzll(bits) >> 2;
+            bits &= ~(0xfULL << (nibble * 4));
+            size_t at = k + nibble;
+            if (verify(data + at, c) && !sink.add(c.index, at)) return limit;
+        }
+    }
+    return k;
+}
+#endif
+
+KernelFn kernelFunction(Kernel kernel) {
+    switch (kernel) {
+#ifdef PATTERN_SCANNER_X86
+#ifdef __SSE2__
+        case Kernel::Sse2: return scanSse2;
+#endif
+        case Kernel::Avx2: return scanAvx2;
+#endif
+#ifdef PATTERN_SCANNER_NEON
+        case Kernel::Neon: return scanNeon;
+#endif
+        default: return scanNone;
+    }
+}
+
+// Runs every pattern over [start, end) of the window.
+void scanBlock(const uint8_t* data, size_t size, size_t start, size_t end,
+               const std::vector<Compiled>& compiled, KernelFn kernel, Sink& sink) {
+    for (const Compiled& c : compiled) {
+        if (size < c.length || sink.full(c.index)) {
+            continue;
+        }
+        size_t limit = std::min(end, size - c.length + 1);
+        if (start >= limit) {
+            continue;
+        }
+        size_t k = c.anchored ? kernel(data, start, limit, c, sink) : start;
+        scanScalar(data, k, limit, c, sink);
+    }
+}
+
+void scanWindow(const uint8_t* data, size_t size, size_t scanSize,
+                const std::vector<Compiled>& compiled, KernelFn kernel, Sink& sink) {
+    for (size_t start = 0; start < scanSize; start += kBlockSize) {
+        scanBlock(data, size, start, std::min(start + kBlockSize, scanSize), compiled, kernel, sink);
+    }
+}
+
+bool compileAll(const std::vector<Pattern>& patterns, const ScanOptions& options,
+                std::vector<Compiled>& compiled, KernelFn& kernel) {
+    compiled.resize(patterns.size());
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (patterns[i].bytes.empty()) {
+            return false;
+        }
+        compile(patterns[i], (uint32_t)i, compiled[i]);
+    }
+    kernel = kernelAvailable(options.kernel) ? kernelFunction(options.kernel) : scanNone;
+    return true;
+}
+
+// Piece of a run of readable memory: matches start in [addr, addr +
+// scanSize), the read extends past that so they can end beyond it.
+struct Chunk {
+    uintptr_t addr;
+    size_t scanSize;
+    size_t readSize;
+};
+
+// Reads the chunks on a helper thread into two alternating windows, so the
+// transfer of the next chunk overlaps the scan of the current one.
+class ChunkReader {
+public:
+    ChunkReader(pid_t pid, const std::vector<Chunk>& chunks, size_t windowSize)
+        : pid_(pid), chunks_(chunks), stop_(false) {
+        for (Slot& slot : slots_) {
+            slot.data.resize(windowSize);
+            slot.full = false;
+            slot.ok = false;
+        }
+        thread_ = std::thread(&ChunkReader::run, this);
+    }
+    
+    ~ChunkReader() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
+    }
+    
+    // Window of chunk i, which must be released before chunk i + 2 is
+    // asked for; nullptr if it could not be read.
+    const uint8_t* acquire(size_t i) {
+        Slot& slot = slots_[i & 1];
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() { return slot.full; });
+        return slot.ok ? slot.data.data() : nullptr;
+    }
+    
+    void release(size_t i) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            slots_[i & 1].full = false;
+        }
+        cond_.notify_all();
+    }
+
+private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        bool full;
+        bool ok;
+    };
+    
+    void run() {
+        for (size_t i = 0; i < chunks_.size(); i++) {
+            Slot& slot = slots_[i & 1];
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [&]() { return !slot.full || stop_; });
+                if (stop_) return;
+            }
+            
+            const Chunk& chunk = chunks_[i];
+            PtraceUtils::RemoteIoVec iov = { chunk.addr, slot.data.data(), chunk.readSize };
+            bool ok = PtraceUtils::readMemoryV(pid_, &iov, 1);
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                slot.ok = ok;
+                slot.full = true;
+            }
+            cond_.notify_all();
+        }
+    }
+    
+    pid_t pid_;
+    const std::vector<Chunk>& chunks_;
+    Slot slots_[2];
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+};
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+bool parsePattern(const std::string& text, Pattern& pattern) {
+    pattern.bytes.clear();
+    pattern.mask.clear();
+    pattern.text.clear();
+    
+    size_t pos = 0;
+    bool fixed = false;
+    while (pos < text.size()) {
+        if (text[pos] == ' ' || text[pos] == '\t') {
+            pos++;
+            continue;
+        }
+        size_t end = text.find_first_of(" \t", pos);
+        std::string token = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end == std::string::npos ? text.size() : end;
+        
+        if (token == "?") {
+            token = "??";
+        }
+        if (token.size() % 2 != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < token.size(); i += 2) {
+            uint8_t byte = 0;
+            uint8_t mask = 0;
+            for (size_t j = 0; j < 2; j++) {
+                char c = token[i + j];
+                int digit = hexDigit(c);
+                if (c != '?' && digit < 0) {
+                    return false;
+                }
+                byte <<= 4;
+                mask <<= 4;
+                if (c != '?') {
+                    byte |= (uint8_t)digit;
+                    mask |= 0xf;
+                }
+            }
+            fixed = fixed || mask != 0;
+            pattern.bytes.push_back(byte);
+            pattern.mask.push_back(mask);
+            
+            char normal[3];
+            normal[0] = (mask & 0xf0) ? "0123456789abcdef"[byte >> 4] : '?';
+            normal[1] = (mask & 0x0f) ? "0123456789abcdef"[byte & 0xf] : '?';
+            normal[2] = '\0';
+            if (!pattern.text.empty()) pattern.text += ' ';
+            pattern.text += normal;
+        }
+    }
+    
+    // A pattern of wildcards only would match everywhere
+    return fixed;
+}
+
+Kernel bestKernel() {
+#if defined(PATTERN_SCANNER_X86)
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernel::Avx2;
+    }
+#if defined(__SSE2__)
+    return Kernel::Sse2;
+#endif
+#elif defined(PATTERN_SCANNER_NEON)
+    return Kernel::Neon;
+#endif
+    return Kernel::Scalar;
+}
+
+bool kernelAvailable(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar:
+            return true;
+        case Kernel::Sse2:
+#if defined(PATTERN_SCANNER_X86) && defined(__SSE2__)
+            return true;
+#else
+            return false;
+#endif
+        case Kernel::Avx2:
+#if defined(PATTERN_SCANNER_X86)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        case Kernel::Neon:
+#if defined(PATTERN_SCANNER_NEON)
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char* kernelName(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar: return "scalar";
+        case Kernel::Sse2: return "sse2";
+        case Kernel::Avx2: return "avx2";
+        case Kernel::Neon: return "neon";
+    }
+    return "unknown";
+}
+
+void scanBuffer(const uint8_t* data, size_t size, size_t scanSize, uintptr_t base,
+                const std::vector<Pattern>& patterns, const ScanOptions& options,
+                std::vector<Match>& matches) {
+    std::vector<Compiled> compiled;
+    KernelFn kernel;
+    if (!compileAll(patterns, options, compiled, kernel)) {
+        return;
+    }
+    Sink sink(matches, patterns.size(), options.maxMatches, base);
+    scanWindow(data, size, std::min(scanSize, size), compiled, kernel, sink);
+}
+
+bool scanModule(pid_t pid, const std::string& module, const std::vector<Pattern>& patterns,
+                const ScanOptions& options, std::vector<Match>& matches, ScanStats* stats) {
+    Trace::Scope trace("pattern_scan", pid);
+    trace.setDetail(module);
+    uint64_t startNs = Trace::nowNs();
+    
+    std::vector<Compiled> compiled;
+    KernelFn kernel;
+    if (patterns.empty() || !compileAll(patterns, options, compiled, kernel)) {
+        LOGE("No valid pattern to scan %s for", module.c_str());
+        return false;
+    }
+    size_t longest = 0;
+    for (const Pattern& pattern : patterns) {
+        longest = std::max(longest, pattern.bytes.size());
+    }
+    
+    // Runs of adjacent readable segments, so matches may span segments
+    std::vector<std::pair<uintptr_t, uintptr_t>> runs;
+    bool found = false;
+    uint32_t skip = ProcessUtils::MAPS_SHARED | (options.includeWritable ? 0u : (uint32_t)ProcessUtils::MAPS_WRITE);
+    bool running = ProcessUtils::withMaps(pid, [&](const ProcessUtils::MapsSnapshot& maps) {
+        const ProcessUtils::MapsModule* mod = maps.findModule(module);
+        if (!mod) {
+            return;
+        }
+        found = true;
+        for (uint32_t i = 0; i < mod->segmentCount; i++) {
+            const ProcessUtils::MapsSegment& seg = maps.moduleSegment(*mod, i);
+            if (!(seg.perms & ProcessUtils::MAPS_READ) || (seg.perms & skip)) {
+                continue;
+            }
+            if (!runs.empty() && runs.back().second == seg.start) {
+                runs.back().second = seg.end;
+            } else {
+                runs.push_back(std::make_pair(seg.start, seg.end));
+            }
+        }
+    });
+    if (!running || !found) {
+        LOGE("Module %s not found in PID %d", module.c_str(), pid);
+        return false;
+    }
+    
+    std::vector<Chunk> chunks;
+    size_t total = 0;
+    for (const std::pair<uintptr_t, uintptr_t>& run : runs) {
+        for (uintptr_t addr = run.first; addr < run.second; addr += kWindowSize) {
+            Chunk chunk;
+            chunk.addr = addr;
+            chunk.scanSize = std::min(kWindowSize, (size_t)(run.second - addr));
+            chunk.readSize = std::min(chunk.scanSize + longest - 1, (size_t)(run.second - addr));
+            chunks.push_back(chunk);
+            total += chunk.scanSize;
+        }
+    }
+    
+    size_t first = matches.size();
+    Sink sink(matches, patterns.size(), options.maxMatches, 0);
+    bool ok = true;
+    if (chunks.size() == 1) {
+        // Nothing to overlap the read with
+        std::vector<uint8_t> window(chunks[0].readSize);
+        PtraceUtils::RemoteIoVec iov = { chunks[0].addr, window.data(), window.size() };
+        ok = PtraceUtils::readMemoryV(pid, &iov, 1);
+        if (ok) {
+            sink.rebase(chunks[0].addr);
+            scanWindow(window.data(), window.size(), chunks[0].scanSize, compiled, kernel, sink);
+        }
+    } else if (!chunks.empty()) {
+        ChunkReader reader(pid, chunks, kWindowSize + longest - 1);
+        for (size_t i = 0; i < chunks.size() && !sink.allFull(); i++) {
+            const uint8_t* window = reader.acquire(i);
+            if (!window) {
+                ok = false;
+                break;
+            }
+            sink.rebase(chunks[i].addr);
+            scanWindow(window, chunks[i].readSize, chunks[i].scanSize, compiled, kernel, sink);
+            reader.release(i);
+        }
+    }
+    if (!ok) {
+        LOGE("Failed to read %s in PID %d", module.c_str(), pid);
+        return false;
+    }
+    
+    // Blocks interleave the patterns; callers want address order
+    std::sort(matches.begin() + first, matches.end(), [](const Match& a, const Match& b) {
+        return a.address < b.address || (a.address == b.address && a.pattern < b.pattern);
+    });
+    
+    double ms = (Trace::nowNs() - startNs) / 1e6;
+    Kernel used = kernelAvailable(options.kernel) ? options.kernel : Kernel::Scalar;
+    LOGI("Scanned %zu bytes of %s in PID %d for %zu patterns with %s in %.3f ms, %zu matches",
+         total, module.c_str(), pid, patterns.size(), kernelName(used), ms, matches.size() - first);
+    if (stats) {
+        stats->bytes = total;
+        stats->ms = ms;
+    }
+    return true;
+}
+
+bool resolvePattern(pid_t pid, const std::string& module, const std::string& pattern,
+                    ElfUtils::SymbolLocation& location, uintptr_t* remoteAddr) {
+    std::vector<Pattern> patterns(1);
+    if (!parsePattern(pattern, patterns[0])) {
+        LOGE("Invalid pattern: %s", pattern.c_str());
+        return false;
+    }
+    ProcessUtils::ModuleInfo info;
+    if (!ProcessUtils::findModule(pid, module, info)) {
+        LOGE("Failed to find module %s in PID %d", module.c_str(), pid);
+        return false;
+    }
+    location.modulePath = info.path;
+    
+    // Keyed like symbol offsets: by the file the target mapped, relative to
+    // the mapping found, under a name no symbol can have
+    std::string filePath = "/proc/" + std::to_string(pid) + "/root" + info.path;
+    if (access(filePath.c_str(), R_OK) != 0) {
+        filePath = info.path;
+    }
+    uint64_t cacheKey = SymbolCache::moduleKey(filePath, info.offset);
+    std::string cacheName = "pattern/" + patterns[0].text;
+    switch (SymbolCache::lookup(cacheKey, cacheName.c_str(), location.offset)) {
+        case SymbolCache::LookupResult::Found:
+            if (remoteAddr) *remoteAddr = info.baseAddress + location.offset;
+            return true;
+        case SymbolCache::LookupResult::Absent:
+            LOGE("Pattern %s not in %s (cached)", patterns[0].text.c_str(), info.path.c_str());
+            return false;
+        case SymbolCache::LookupResult::Miss:
+            break;
+    }
+    
+    // Two are enough to tell a unique match from an ambiguous one
+    ScanOptions options;
+    options.maxMatches = 2;
+    std::vector<Match> matches;
+    if (!scanModule(pid, module, patterns, options, matches)) {
+        return false;
+    }
+    if (matches.size() != 1) {
+        LOGE("Pattern %s has %s in %s", patterns[0].text.c_str(),
+             matches.empty() ? "no match" : "several matches", info.path.c_str());
+        if (matches.empty()) {
+            SymbolCache::storeAbsent(cacheKey, cacheName.c_str());
+        }
+        return false;
+    }
+    
+    location.offset = matches[0].address - info.baseAddress;
+    SymbolCache::store(cacheKey, cacheName.c_str(), location.offset);
+    LOGI("Pattern %s at %s+0x%lx", patterns[0].text.c_str(), info.path.c_str(), location.offset);
+    if (remoteAddr) *remoteAddr = matches[0].address;
+    return true;
+}
+
+} // namespace PatternScanner
@@ -0,0 +1,179 @@
+#include "payload_channel.h"
+#include "maps_query.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_TAG "PayloadChannel"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace Injector {
+
+namespace {
+
+const size_t kMinRing = 4096;
+
+// The rings start on their own page after the header
+const size_t kHeaderBytes = 4096;
+
+} // namespace
+
+PayloadChannel::PayloadChannel() : pid_(0), remoteAddr_(0), size_(0), base_(nullptr) {
+    memset(&commands_, 0, sizeof(commands_));
+    memset(&events_, 0, sizeof(events_));
+}
+
+PayloadChannel::~PayloadChannel() {
+    close();
+}
+
+size_t PayloadChannel::regionSize(size_t ringBytes) {
+    size_t ring = kMinRing;
+    while (ring < ringBytes && ring < ((size_t)1 << 30)) {
+        ring <<= 1;
+    }
+    return kHeaderBytes + 2 * ring;
+}
+
+bool PayloadChannel::map(pid_t pid, uintptr_t start, uintptr_t end) {
+    close();
+    
+    // The mapping itself, not the fd the target already closed; needs
+    // CAP_SYS_ADMIN, which the injector has as root
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/map_files/%lx-%lx", pid, (unsigned long)start, (unsigned long)end);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Cannot open %s", path);
+        return false;
+    }
+    
+    struct stat st;
+    size_t size = end - start;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == size) {
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        LOGE("Cannot map the channel of PID %d", pid);
+        return false;
+    }
+    
+    pid_ = pid;
+    remoteAddr_ = start;
+    size_ = size;
+    base_ = static_cast<injector_channel*>(base);
+    return true;
+}
+
+bool PayloadChannel::create(pid_t pid, uintptr_t remoteAddr, size_t size) {
+    if (size <= kHeaderBytes || !map(pid, remoteAddr, remoteAddr + size)) {
+        return false;
+    }
+    
+    // The memfd is fresh, so everything not set here is already zero
+    size_t ring = (size - kHeaderBytes) / 2;
+    base_->magic = INJECTOR_CHANNEL_MAGIC;
+    base_->version = INJECTOR_CHANNEL_VERSION;
+    base_->header_size = sizeof(injector_channel);
+    base_->size = size;
+    base_->ring_offset[INJECTOR_RING_COMMANDS] = kHeaderBytes;
+    base_->ring_offset[INJECTOR_RING_EVENTS] = kHeaderBytes + ring;
+    base_->ring_capacity[INJECTOR_RING_COMMANDS] = ring;
+    base_->ring_capacity[INJECTOR_RING_EVENTS] = ring;
+    base_->injector_pid = getpid();
+    
+    commands_ = injector_channel_ring(base_, INJECTOR_RING_COMMANDS);
+    events_ = injector_channel_ring(base_, INJECTOR_RING_EVENTS);
+    LOGI("Channel of PID %d at 0x%lx, %zu byte rings", pid, remoteAddr, ring);
+    return true;
+}
+
+bool PayloadChannel::connect(pid_t pid) {
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    ProcessUtils::withMaps(pid, [&](const ProcessUtils::MapsSnapshot& maps) {
+        // "/memfd:injector-channel (deleted)"
+        const char prefix[] = "/memfd:" INJECTOR_CHANNEL_NAME;
+        for (const ProcessUtils::MapsSegment& seg : maps.segments()) {
+            if (seg.path.compare(0, sizeof(prefix) - 1, prefix) == 0 && (seg.perms & ProcessUtils::MAPS_SHARED)) {
+                start = seg.start;
+                end = seg.end;
+                break;
+            }
+        }
+    });
+    if (start == 0) {
+        LOGE("PID %d has no payload channel", pid);
+        return false;
+    }
+    if (!map(pid, start, end)) {
+        return false;
+    }
+    
+    // The geometry is read once, here, and only used from the local copies
+    injector_channel header;
+    memcpy(&header, base_, sizeof(header));
+    if (!injector_channel_check(&header, size_)) {
+        LOGE("The channel of PID %d is damaged or of another version", pid);
+        close();
+        return false;
+    }
+    for (int ring : { INJECTOR_RING_COMMANDS, INJECTOR_RING_EVENTS }) {
+        injector_ring_ref& ref = ring == INJECTOR_RING_COMMANDS ? commands_ : events_;
+        ref.ctl = &base_->rings[ring];
+        ref.data = (uint8_t*)base_ + header.ring_offset[ring];
+        ref.capacity = header.ring_capacity[ring];
+    }
+    return true;
+}
+
+void PayloadChannel::close() {
+    if (base_) {
+        munmap(base_, size_);
+    }
+    base_ = nullptr;
+    pid_ = 0;
+    remoteAddr_ = 0;
+    size_ = 0;
+    memset(&commands_, 0, sizeof(commands_));
+    memset(&events_, 0, sizeof(events_));
+}
+
+uint32_t PayloadChannel::payloadState() const {
+    return base_ ? __atomic_load_n(&base_->payload_state, __ATOMIC_ACQUIRE) : INJECTOR_PAYLOAD_NONE;
+}
+
+bool PayloadChannel::send(uint32_t type, const void* data, size_t size) {
+    if (!base_ || size > injector_ring_max_message(commands_)) {
+        return false;
+    }
+    return injector_ring_send(commands_, type, data, (uint32_t)size) == 0;
+}
+
+bool PayloadChannel::receive(uint32_t& type, std::string& data) {
+    uint32_t size;
+    const void* message = base_ ? injector_ring_peek(events_, &type, &size) : nullptr;
+    if (!message) {
+        return false;
+    }
+    data.assign(static_cast<const char*>(message), size);
+    injector_ring_release(events_, size);
+    return true;
+}
+
+uint64_t PayloadChannel::droppedCommands() const {
+    return base_ ? __atomic_load_n(&commands_.ctl->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+uint64_t PayloadChannel::droppedEvents() const {
+    return base_ ? __atomic_load_n(&events_.ctl->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+} // namespace Injector
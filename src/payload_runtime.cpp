@@ -0,0 +1,403 @@
+#include "payload_runtime.h"
+#include <android/log.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define LOG_TAG "PayloadRuntime"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace PayloadRuntime {
+
+namespace {
+
+const int kMaxEvents = 16;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct Entry {
+    std::shared_ptr<Task> task;
+    uint64_t deadline;
+    uint64_t periodNs;      // 0: one-shot
+};
+
+struct Due {
+    uint64_t deadline;
+    TaskId id;
+    
+    bool operator>(const Due& other) const {
+        return deadline != other.deadline ? deadline > other.deadline : id > other.id;
+    }
+};
+
+// Everything below is guarded by mutex, except that only the loop thread
+// touches armed and the fds are fixed while it runs. Cancelled and
+// rescheduled tasks leave stale heap entries behind, recognised by a
+// missing id or a different deadline and skipped when they come up.
+struct Loop {
+    std::mutex mutex;
+    std::thread thread;
+    std::thread::id loopThread;
+    bool running = false;
+    bool stopping = false;
+    int epollFd = -1;
+    int timerFd = -1;
+    int wakeFd = -1;
+    uint64_t armed = 0;
+    TaskId nextId = 1;
+    std::unordered_map<TaskId, Entry> tasks;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> heap;
+    std::unordered_map<int, std::shared_ptr<FdCallback>> fds;
+};
+
+Loop g_loop;
+std::atomic<JavaVM*> g_vm(nullptr);
+
+// JNI attachment, cached per thread; the key's destructor detaches the
+// threads env() attached when they exit
+pthread_key_t g_envKey;
+pthread_once_t g_envKeyOnce = PTHREAD_ONCE_INIT;
+thread_local JNIEnv* t_env = nullptr;
+
+void detachThread(void* vm) {
+    static_cast<JavaVM*>(vm)->DetachCurrentThread();
+}
+
+void createEnvKey() {
+    pthread_key_create(&g_envKey, detachThread);
+}
+
+void closeFds() {
+    if (g_loop.epollFd >= 0) close(g_loop.epollFd);
+    if (g_loop.timerFd >= 0) close(g_loop.timerFd);
+    if (g_loop.wakeFd >= 0) close(g_loop.wakeFd);
+    g_loop.epollFd = g_loop.timerFd = g_loop.wakeFd = -1;
+}
+
+void wake() {
+    uint64_t one = 1;
+    if (g_loop.wakeFd >= 0 && write(g_loop.wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOGE("Cannot wake the loop: errno %d", errno);
+    }
+}
+
+// Called with the lock held.
+TaskId add(uint64_t deadline, uint64_t periodNs, Task&& task) {
+    if (!g_loop.running || g_loop.stopping || !task) {
+        return 0;
+    }
+    TaskId id = g_loop.nextId++;
+    g_loop.tasks[id] = Entry{ std::make_shared<Task>(std::move(task)), deadline, periodNs };
+    g_loop.heap.push(Due{ deadline, id });
+    
+    // The loop rearms the timer itself after every round of tasks
+    if (std::this_thread::get_id() != g_loop.loopThread) {
+        wake();
+    }
+    return id;
+}
+
+// The earliest live deadline, with stale heap entries dropped; 0 if none.
+// Called with the lock held.
+uint64_t earliest() {
+    while (!g_loop.heap.empty()) {
+        const Due& top = g_loop.heap.top();
+        auto it = g_loop.tasks.find(top.id);
+        if (it != g_loop.tasks.end() && it->second.deadline == top.deadline) {
+            return top.deadline;
+        }
+        g_loop.heap.pop();
+    }
+    return 0;
+}
+
+void arm(uint64_t deadline) {
+    if (deadline == g_loop.armed) {
+        return;
+    }
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = deadline / 1000000000ull;
+    spec.it_value.tv_nsec = deadline % 1000000000ull;
+    // A zero it_value disarms; a deadline already past fires at once
+    if (deadline != 0 && spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(g_loop.timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    g_loop.armed = deadline;
+}
+
+// Runs every task due by now, each looked up again right before it runs so
+// an earlier one in the same round can still cancel it.
+void runDue() {
+    uint64_t now = nowNs();
+    std::vector<TaskId> due;
+    {
+        std::lock_guard<std::mutex> guard(g_loop.mutex);
+        uint64_t deadline;
+        while ((deadline = earliest()) != 0 && deadline <= now) {
+            due.push_back(g_loop.heap.top().id);
+            g_loop.heap.pop();
+        }
+    }
+    
+    for (TaskId id : due) {
+        std::shared_ptr<Task> task;
+        {
+            std::lock_guard<std::mutex> guard(g_loop.mutex);
+            auto it = g_loop.tasks.find(id);
+            if (g_loop.stopping || it == g_loop.tasks.end()) {
+                continue;
+            }
+            Entry& entry = it->second;
+            task = entry.task;
+            if (entry.periodNs == 0) {
+                g_loop.tasks.erase(it);
+            } else {
+                // Next tick on the original grid, skipping the ones missed
+                uint64_t next = entry.deadline + entry.periodNs;
+                if (next <= now) {
+                    next = now + entry.periodNs - (now - entry.deadline) % entry.periodNs;
+                }
+                entry.deadline = next;
+                g_loop.heap.push(Due{ next, id });
+            }
+        }
+        (*task)();
+    }
+}
+
+void runFd(int fd, uint32_t events) {
+    std::shared_ptr<FdCallback> callback;
+    {
+        std::lock_guard<std::mutex> guard(g_loop.mutex);
+        auto it = g_loop.fds.find(fd);
+        if (it == g_loop.fds.end() || g_loop.stopping) {
+            return;
+        }
+        callback = it->second;
+    }
+    (*callback)(events);
+}
+
+void loopMain() {
+    pthread_setname_np(pthread_self(), "payload-loop");
+    LOGI("Event loop started");
+    
+    struct epoll_event events[kMaxEvents];
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(g_loop.mutex);
+            if (g_loop.stopping) {
+                break;
+            }
+            arm(earliest());
+        }
+        
+        int n = epoll_wait(g_loop.epollFd, events, kMaxEvents, -1);
+        if (n < 0 && errno != EINTR) {
+            LOGE("epoll_wait failed: errno %d", errno);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == g_loop.wakeFd || fd == g_loop.timerFd) {
+                // Both are nonblocking; EAGAIN only means already drained
+                uint64_t count;
+                if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    LOGE("Cannot drain fd %d: errno %d", fd, errno);
+                }
+                if (fd == g_loop.timerFd) {
+                    g_loop.armed = 0;
+                }
+            } else {
+                runFd(fd, events[i].events);
+            }
+        }
+        runDue();
+    }
+    
+    // Dropped tasks are destroyed after the lock is released, in case what
+    // they captured calls back in
+    std::unordered_map<TaskId, Entry> tasks;
+    std::unordered_map<int, std::shared_ptr<FdCallback>> fds;
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    tasks.swap(g_loop.tasks);
+    fds.swap(g_loop.fds);
+    g_loop.heap = decltype(g_loop.heap)();
+    closeFds();
+    g_loop.armed = 0;
+    g_loop.running = false;
+    g_loop.stopping = false;
+    g_loop.loopThread = std::thread::id();
+    // Stopped from one of its own tasks: nobody will join this thread
+    if (g_loop.thread.joinable() && g_loop.thread.get_id() == std::this_thread::get_id()) {
+        g_loop.thread.detach();
+    }
+    LOGI("Event loop stopped");
+}
+
+} // namespace
+
+bool start(JavaVM* vm) {
+    if (vm) {
+        setJavaVM(vm);
+    }
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    if (g_loop.running) {
+        return true;
+    }
+    
+    g_loop.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    g_loop.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_loop.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    bool ok = g_loop.epollFd >= 0 && g_loop.timerFd >= 0 && g_loop.wakeFd >= 0;
+    for (int fd : { g_loop.timerFd, g_loop.wakeFd }) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        ok = ok && epoll_ctl(g_loop.epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+    if (!ok) {
+        LOGE("Cannot create the event loop: errno %d", errno);
+        closeFds();
+        return false;
+    }
+    
+    g_loop.running = true;
+    g_loop.stopping = false;
+    g_loop.thread = std::thread(loopMain);
+    g_loop.loopThread = g_loop.thread.get_id();
+    return true;
+}
+
+void setJavaVM(JavaVM* vm) {
+    g_vm.store(vm);
+}
+
+void stop() {
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> guard(g_loop.mutex);
+        if (!g_loop.running || g_loop.stopping) {
+            return;
+        }
+        g_loop.stopping = true;
+        if (std::this_thread::get_id() == g_loop.loopThread) {
+            return;
+        }
+        thread = std::move(g_loop.thread);
+        wake();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool running() {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    return g_loop.running && !g_loop.stopping;
+}
+
+bool onLoopThread() {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    return g_loop.running && std::this_thread::get_id() == g_loop.loopThread;
+}
+
+TaskId post(Task task) {
+    return schedule(0, std::move(task));
+}
+
+TaskId schedule(uint32_t delayMs, Task task) {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    return add(nowNs() + delayMs * 1000000ull, 0, std::move(task));
+}
+
+TaskId schedulePeriodic(uint32_t initialDelayMs, uint32_t periodMs, Task task) {
+    if (periodMs == 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    return add(nowNs() + initialDelayMs * 1000000ull, periodMs * 1000000ull, std::move(task));
+}
+
+bool cancel(TaskId id) {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    return g_loop.tasks.erase(id) != 0;
+}
+
+bool watchFd(int fd, uint32_t events, FdCallback callback) {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    if (!g_loop.running || g_loop.stopping || fd < 0 || !callback) {
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    bool known = g_loop.fds.count(fd) != 0;
+    if (epoll_ctl(g_loop.epollFd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+        LOGE("Cannot watch fd %d: errno %d", fd, errno);
+        return false;
+    }
+    g_loop.fds[fd] = std::make_shared<FdCallback>(std::move(callback));
+    return true;
+}
+
+bool unwatchFd(int fd) {
+    std::lock_guard<std::mutex> guard(g_loop.mutex);
+    if (g_loop.fds.erase(fd) == 0) {
+        return false;
+    }
+    epoll_ctl(g_loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    return true;
+}
+
+JNIEnv* env() {
+    if (t_env) {
+        return t_env;
+    }
+    JavaVM* vm = g_vm.load();
+    if (!vm) {
+        return nullptr;
+    }
+    
+    // A thread the VM already knows (any Java thread) stays its to detach
+    JNIEnv* e = nullptr;
+    if (vm->GetEnv((void**)&e, JNI_VERSION_1_6) == JNI_OK) {
+        t_env = e;
+        return e;
+    }
+    
+    char name[16] = "payload";
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    JavaVMAttachArgs args = { JNI_VERSION_1_6, name, nullptr };
+    if (vm->AttachCurrentThread(&e, &args) != JNI_OK) {
+        LOGE("Cannot attach thread %s to the VM", name);
+        return nullptr;
+    }
+    pthread_once(&g_envKeyOnce, createEnvKey);
+    pthread_setspecific(g_envKey, vm);
+    t_env = e;
+    return e;
+}
+
+JavaVM* javaVM() {
+    return g_vm.load();
+}
+
+} // namespace PayloadRuntime
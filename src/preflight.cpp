@@ -0,0 +1,368 @@
+#include "preflight.h"
+#include "elf_utils.h"
+#include "maps_query.h"
+#include "symbol_cache.h"
+#include "trace.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <elf.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#define LOG_TAG "Preflight"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace Preflight {
+
+namespace {
+
+// What the per-target checks need from a payload whose own checks passed
+struct PayloadInfo {
+    std::vector<std::string> needed;
+    std::string runPath;
+};
+
+std::mutex g_mutex;
+std::unordered_map<std::string, PayloadInfo> g_passed;
+
+uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::string procPath(pid_t pid, const char* entry) {
+    return "/proc/" + std::to_string(pid) + "/" + entry;
+}
+
+std::string dirName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+void splitPath(const std::string& list, std::vector<std::string>& out) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(':', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) out.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+const char* className(bool is64) {
+    return is64 ? "ELF64" : "ELF32";
+}
+
+// The target's LD_LIBRARY_PATH, from its initial environment.
+std::string targetLibraryPath(pid_t pid) {
+    int fd = open(procPath(pid, "environ").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::string();
+    }
+    std::string env;
+    char buf[4096];
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof(buf))) > 0) {
+        env.append(buf, got);
+    }
+    close(fd);
+    
+    const std::string prefix = "LD_LIBRARY_PATH=";
+    size_t pos = 0;
+    while (pos < env.size()) {
+        size_t end = env.find('\0', pos);
+        if (end == std::string::npos) end = env.size();
+        if (env.compare(pos, prefix.size(), prefix) == 0) {
+            return env.substr(pos + prefix.size(), end - pos - prefix.size());
+        }
+        pos = end + 1;
+    }
+    return std::string();
+}
+
+// Platform library directories for the target's ABI. Candidates of the
+// wrong class are rejected by the identity check, so listing too many
+// only costs a failed open.
+void systemDirs(uint16_t machine, bool is64, std::vector<std::string>& dirs) {
+#ifdef __ANDROID__
+    (void)machine;
+    const char* lib = is64 ? "lib64" : "lib";
+    for (const char* root : { "/system", "/system_ext", "/product", "/vendor", "/odm" }) {
+        dirs.push_back(std::string(root) + "/" + lib);
+    }
+    dirs.push_back(std::string("/apex/com.android.runtime/") + lib + "/bionic");
+#else
+    const char* triplet = nullptr;
+    switch (machine) {
+        case EM_X86_64: triplet = "x86_64-linux-gnu"; break;
+        case EM_386: triplet = "i386-linux-gnu"; break;
+        case EM_AARCH64: triplet = "aarch64-linux-gnu"; break;
+        case EM_ARM: triplet = "arm-linux-gnueabihf"; break;
+    }
+    if (triplet) {
+        dirs.push_back(std::string("/lib/") + triplet);
+        dirs.push_back(std::string("/usr/lib/") + triplet);
+    }
+    if (is64) {
+        dirs.push_back("/lib64");
+        dirs.push_back("/usr/lib64");
+    }
+    dirs.push_back("/lib");
+    dirs.push_back("/usr/lib");
+    dirs.push_back("/usr/local/lib");
+#endif
+}
+
+// Resolves a dependency the target has not loaded the way its loader
+// would: a file of the right ABI in one of dirs under the target's root.
+bool resolveNeeded(const std::string& root, const std::vector<std::string>& dirs, const std::string& name,
+                   uint16_t machine, bool is64) {
+    // A DT_NEEDED with a slash is a path, not a search
+    std::vector<std::string> candidates;
+    if (name.find('/') != std::string::npos) {
+        candidates.push_back(name);
+    } else {
+        for (const std::string& dir : dirs) {
+            candidates.push_back(dir + "/" + name);
+        }
+    }
+    for (const std::string& candidate : candidates) {
+        uint16_t depMachine;
+        bool dep64;
+        if (ElfUtils::readElfIdentity(root + candidate, depMachine, dep64) &&
+            depMachine == machine && dep64 == is64) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The checks only the payload decides: ABI and entry symbols. Their
+// verdict is what gets cached.
+bool checkImage(const ElfUtils::ElfImage& image, const std::vector<std::string>& entrySymbols,
+                uint16_t machine, bool is64, std::string& error) {
+    if (image.machine() != machine || image.is64Bit() != is64) {
+        error = "built for machine " + std::to_string(image.machine()) + " " + className(image.is64Bit()) +
+                ", target is machine " + std::to_string(machine) + " " + className(is64);
+        return false;
+    }
+    for (const std::string& symbol : entrySymbols) {
+        if (image.findSymbol(symbol.c_str()) == 0) {
+            error = "entry symbol " + symbol + " is not defined";
+            return false;
+        }
+    }
+    return true;
+}
+
+// The checks that depend on the target's view: its mount namespace, its
+// loaded modules, LD_LIBRARY_PATH and app library directory. Run for every
+// target; the common case is one access() and a pass over the warm maps.
+bool checkTarget(pid_t pid, const std::string& path, const PayloadInfo& info, uint16_t machine, bool is64,
+                 std::string& error) {
+    // dlopen resolves the path in the target's mount namespace, not ours
+    std::string root = procPath(pid, "root");
+    if (access((root + path).c_str(), R_OK) != 0) {
+        error = "not visible in the target's mount namespace";
+        return false;
+    }
+    
+    if (info.needed.empty()) {
+        return true;
+    }
+    
+    // The files are probed after the maps lock is released
+    std::vector<std::string> missing;
+    std::vector<std::string> moduleDirs;
+    bool running = ProcessUtils::withMaps(pid, [&](const ProcessUtils::MapsSnapshot& maps) {
+        for (const std::string& needed : info.needed) {
+            const ProcessUtils::MapsModule* loaded = maps.findModule(needed);
+            if (!loaded || loaded->name != needed) {
+                missing.push_back(needed);
+            }
+        }
+        if (missing.empty()) {
+            return;
+        }
+        for (const ProcessUtils::MapsModule& module : maps.modules()) {
+            if (!module.path.empty() && module.path[0] == '/') {
+                std::string dir = dirName(std::string(module.path));
+                if (std::find(moduleDirs.begin(), moduleDirs.end(), dir) == moduleDirs.end()) {
+                    moduleDirs.push_back(dir);
+                }
+            }
+        }
+    });
+    if (!running) {
+        error = "not running";
+        return false;
+    }
+    if (missing.empty()) {
+        return true;
+    }
+    
+    // Search order of the loaders: RUNPATH, LD_LIBRARY_PATH, then the
+    // directories the target already loads from (the app's own library
+    // directory, APEX modules) and the platform ones
+    std::vector<std::string> runPath;
+    splitPath(info.runPath, runPath);
+    std::vector<std::string> dirs;
+    std::string origin = dirName(path);
+    for (std::string dir : runPath) {
+        if (dir.compare(0, 7, "$ORIGIN") == 0) {
+            dir = origin + dir.substr(7);
+        } else if (dir.compare(0, 9, "${ORIGIN}") == 0) {
+            dir = origin + dir.substr(9);
+        }
+        dirs.push_back(dir);
+    }
+    splitPath(targetLibraryPath(pid), dirs);
+    for (const std::string& dir : moduleDirs) {
+        if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+            dirs.push_back(dir);
+        }
+    }
+    systemDirs(machine, is64, dirs);
+    
+    for (const std::string& needed : missing) {
+        if (!resolveNeeded(root, dirs, needed, machine, is64)) {
+            error = "dependency " + needed + " not found in the target's library path";
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+uint64_t contentHash(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    void* mapping = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+    
+    // Word at a time; the size is mixed in so a truncated copy differs
+    const uint8_t* data = (const uint8_t*)mapping;
+    uint64_t hash = mix(size ^ 0x9e3779b97f4a7c15ULL);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    if (i < size) {
+        uint64_t tail = 0;
+        memcpy(&tail, data + i, size - i);
+        hash = mix(hash ^ tail);
+    }
+    
+    if (mapping) {
+        munmap(mapping, size);
+    }
+    return hash ? hash : 1;
+}
+
+bool checkPayload(pid_t pid, const std::string& path, const std::vector<std::string>& entrySymbols,
+                  std::string& error) {
+    Trace::Scope trace("preflight", pid);
+    trace.setDetail(path);
+    
+    uint16_t machine;
+    bool is64;
+    std::string exePath = procPath(pid, "exe");
+    if (!ElfUtils::readElfIdentity(exePath, machine, is64)) {
+        error = "cannot read the target's executable";
+        return false;
+    }
+    
+    // Everything the payload's own verdict depends on besides the payload;
+    // nothing about the target beyond its ABI, so one pass serves every app
+    std::string verdict = "preflight/" + std::to_string(machine) + "/" + className(is64);
+    for (const std::string& symbol : entrySymbols) {
+        verdict += "/" + symbol;
+    }
+    
+    uint64_t fileKey = SymbolCache::moduleKey(path, 0);
+    std::string memoKey = std::to_string(fileKey) + ":" + verdict;
+    PayloadInfo info;
+    bool known = false;
+    if (fileKey != 0) {
+        std::lock_guard<std::mutex> guard(g_mutex);
+        auto it = g_passed.find(memoKey);
+        if (it != g_passed.end()) {
+            info = it->second;
+            known = true;
+        }
+    }
+    
+    if (!known) {
+        ElfUtils::ElfImage image;
+        if (!image.open(path)) {
+            error = "not a loadable ELF file";
+            LOGE("Preflight of %s for PID %d failed: %s", path.c_str(), pid, error.c_str());
+            return false;
+        }
+        
+        uintptr_t value;
+        bool cached = SymbolCache::lookup(fileKey, verdict.c_str(), value) == SymbolCache::LookupResult::Found;
+        uint64_t hash = 0;
+        if (!cached) {
+            hash = contentHash(path);
+            cached = SymbolCache::lookup(hash, verdict.c_str(), value) == SymbolCache::LookupResult::Found;
+            if (cached) {
+                SymbolCache::store(fileKey, verdict.c_str(), 1);
+            }
+        }
+        if (cached) {
+            trace.setDetail(path + " (cached)");
+        } else {
+            if (!checkImage(image, entrySymbols, machine, is64, error)) {
+                LOGE("Preflight of %s for PID %d failed: %s", path.c_str(), pid, error.c_str());
+                return false;
+            }
+            SymbolCache::store(hash, verdict.c_str(), 1);
+            SymbolCache::store(fileKey, verdict.c_str(), 1);
+        }
+        
+        info.needed = image.neededLibraries();
+        info.runPath = image.runPath();
+        if (fileKey != 0) {
+            std::lock_guard<std::mutex> guard(g_mutex);
+            g_passed[memoKey] = info;
+        }
+    } else {
+        trace.setDetail(path + " (cached)");
+    }
+    
+    if (!checkTarget(pid, path, info, machine, is64, error)) {
+        LOGE("Preflight of %s for PID %d failed: %s", path.c_str(), pid, error.c_str());
+        return false;
+    }
+    LOGI("Preflight of %s for PID %d passed", path.c_str(), pid);
+    return true;
+}
+
+} // namespace Preflight
@@ -0,0 +1,468 @@
+#include "proc_scanner.h"
+#include "trace.h"
+#include "logger.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+
+#define LOG_TAG "ProcScanner"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace ProcessUtils {
+
+namespace {
+
+const size_t kDirentBuffer = 32 * 1024;
+const size_t kStatBuffer = 512;
+
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+pid_t parsePid(const char* name) {
+    pid_t pid = 0;
+    for (; *name; name++) {
+        if (*name < '0' || *name > '9') return 0;
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+ssize_t readAt(int dirFd, const char* path, char* buffer, size_t size) {
+    Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+    int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, buffer, size);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    return n;
+}
+
+// argv[0] is the first NUL-terminated string of cmdline.
+uint32_t copyName(const char* cmdline, ssize_t length, char* name, size_t size) {
+    if (length <= 0 || size == 0) {
+        if (size) name[0] = '\0';
+        return 0;
+    }
+    size_t len = strnlen(cmdline, (size_t)length);
+    if (len >= size) len = size - 1;
+    memcpy(name, cmdline, len);
+    name[len] = '\0';
+    return (uint32_t)len;
+}
+
+bool nameMatches(const ProcessEntry& entry, const ScanOptions& options) {
+    return !options.nameFilter || strstr(entry.name, options.nameFilter) != nullptr;
+}
+
+} // namespace
+
+bool parseStartTime(const char* stat, size_t length, uint64_t& startTime) {
+    // comm (field 2) may contain spaces and parentheses, so count fields
+    // from the last ')'.
+    const char* end = stat + length;
+    const char* p = end;
+    while (p > stat && p[-1] != ')') p--;
+    if (p == stat) {
+        return false;
+    }
+    
+    int field = 2;
+    while (p < end && field < 22) {
+        if (*p == ' ') field++;
+        p++;
+    }
+    if (field != 22) {
+        return false;
+    }
+    
+    uint64_t value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (uint64_t)(*p - '0');
+    }
+    startTime = value;
+    return true;
+}
+
+#ifdef HAVE_IO_URING
+
+// Minimal raw io_uring used to batch the open/read/close of many small
+// /proc files into three io_uring_enter() calls per batch.
+struct ProcScanner::IoUringBatch {
+    static const unsigned kEntries = 64;
+    
+    int ringFd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned pending;
+    
+    int fds[kEntries];
+    int results[kEntries];
+    char paths[kEntries][32];
+    char buffers[kEntries][kStatBuffer];
+    
+    IoUringBatch() : ringFd(-1), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+                     sqes((struct io_uring_sqe*)MAP_FAILED), sqesSize(0), pending(0) {}
+    
+    ~IoUringBatch() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+    
+    bool init() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, kEntries, &params);
+        if (ringFd < 0) {
+            return false;
+        }
+        
+        // OPENAT, READ and CLOSE all arrived in 5.6; ask instead of guessing.
+        const unsigned probeOps = 64;
+        std::vector<uint8_t> probeBuffer(sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op));
+        struct io_uring_probe* probe = (struct io_uring_probe*)probeBuffer.data();
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, probeOps) < 0) {
+            return false;
+        }
+        const uint8_t needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+        for (uint8_t op : needed) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+        
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        
+        uint8_t* sq = (uint8_t*)sqRing;
+        uint8_t* cq = (uint8_t*)cqRing;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+    
+    struct io_uring_sqe* next(unsigned slot) {
+        unsigned tail = *sqTail + pending;
+        unsigned index = tail & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = slot;
+        sqArray[index] = index;
+        pending++;
+        return sqe;
+    }
+    
+    // Submits everything queued, waits for all of it and stores each
+    // result by slot. Returns false if the ring itself failed.
+    bool submitAndWait() {
+        unsigned count = pending;
+        if (count == 0) return true;
+        
+        __atomic_store_n(sqTail, *sqTail + count, __ATOMIC_RELEASE);
+        pending = 0;
+        
+        unsigned reaped = 0;
+        while (reaped < count) {
+            int ret;
+            {
+                Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+                ret = (int)syscall(__NR_io_uring_enter, ringFd, reaped == 0 ? count : 0,
+                                   count - reaped, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+            if (ret < 0 && errno != EINTR) {
+                return false;
+            }
+            
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++, reaped++) {
+                const struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+                results[cqe->user_data] = cqe->res;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+    
+    // Reads "<pid>/<file>" for every pid into buffers[i]; results[i] is the
+    // byte count or a negative errno.
+    bool readFiles(int procFd, const pid_t* pids, unsigned count, const char* file, size_t size) {
+        for (unsigned i = 0; i < count; i++) {
+            snprintf(paths[i], sizeof(paths[i]), "%d/%s", pids[i], file);
+            struct io_uring_sqe* sqe = next(i);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = procFd;
+            sqe->addr = (uintptr_t)paths[i];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        if (!submitAndWait()) return false;
+        
+        for (unsigned i = 0; i < count; i++) {
+            fds[i] = results[i];
+            if (fds[i] < 0) continue;
+            struct io_uring_sqe* sqe = next(i);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[i];
+            sqe->addr = (uintptr_t)buffers[i];
+            sqe->len = (unsigned)size;
+            sqe->off = 0;
+        }
+        if (!submitAndWait()) return false;
+        
+        int readResults[kEntries];
+        for (unsigned i = 0; i < count; i++) {
+            readResults[i] = fds[i] < 0 ? fds[i] : results[i];
+            if (fds[i] < 0) continue;
+            struct io_uring_sqe* sqe = next(i);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fds[i];
+        }
+        bool ok = submitAndWait();
+        memcpy(results, readResults, sizeof(int) * count);
+        return ok;
+    }
+};
+
+#else
+
+struct ProcScanner::IoUringBatch {
+    static const unsigned kEntries = 1;
+    int results[kEntries];
+    char buffers[kEntries][kStatBuffer];
+    
+    bool init() { return false; }
+    bool readFiles(int, const pid_t*, unsigned, const char*, size_t) { return false; }
+};
+
+#endif // HAVE_IO_URING
+
+ProcScanner::ProcScanner() : procFd_(-1), uring_(nullptr) {
+    procFd_ = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (procFd_ < 0) {
+        LOGE("Failed to open /proc: %s", strerror(errno));
+    }
+    direntBuffer_.resize(kDirentBuffer);
+}
+
+ProcScanner::~ProcScanner() {
+    delete uring_;
+    if (procFd_ >= 0) {
+        close(procFd_);
+    }
+}
+
+bool ProcScanner::setUseIoUring(bool enable) {
+    if (!enable) {
+        delete uring_;
+        uring_ = nullptr;
+        return true;
+    }
+    if (uring_) {
+        return true;
+    }
+    
+    IoUringBatch* batch = new IoUringBatch();
+    if (!batch->init()) {
+        LOGI("io_uring not available, using plain syscalls");
+        delete batch;
+        return false;
+    }
+    uring_ = batch;
+    return true;
+}
+
+bool ProcScanner::listPids() {
+    pids_.clear();
+    if (procFd_ < 0) {
+        return false;
+    }
+    
+    // Rewinding the same descriptor restarts the listing without reopening.
+    if (lseek(procFd_, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    
+    for (;;) {
+        long n;
+        {
+            Trace::SyscallScope scope(Trace::SyscallClass::ProcFs);
+            n = syscall(SYS_getdents64, procFd_, direntBuffer_.data(), direntBuffer_.size());
+        }
+        if (n < 0) {
+            LOGE("getdents64 on /proc failed: %s", strerror(errno));
+            return false;
+        }
+        if (n == 0) break;
+        
+        for (long pos = 0; pos < n;) {
+            const LinuxDirent64* d = (const LinuxDirent64*)(direntBuffer_.data() + pos);
+            pos += d->d_reclen;
+            if (d->d_type != DT_DIR) continue;
+            pid_t pid = parsePid(d->d_name);
+            if (pid > 0) {
+                pids_.push_back(pid);
+            }
+        }
+    }
+    return true;
+}
+
+bool ProcScanner::readName(pid_t pid, char* name, size_t size, uint32_t* length) {
+    char path[32];
+    char cmdline[kProcessNameMax];
+    snprintf(path, sizeof(path), "%d/cmdline", pid);
+    ssize_t n = readAt(procFd_, path, cmdline, sizeof(cmdline));
+    if (n < 0) {
+        return false;
+    }
+    uint32_t len = copyName(cmdline, n, name, size);
+    if (length) *length = len;
+    return true;
+}
+
+bool ProcScanner::readStartTime(pid_t pid, uint64_t& startTime) {
+    char path[32];
+    char stat[kStatBuffer];
+    snprintf(path, sizeof(path), "%d/stat", pid);
+    ssize_t n = readAt(procFd_, path, stat, sizeof(stat));
+    return n > 0 && parseStartTime(stat, (size_t)n, startTime);
+}
+
+bool ProcScanner::scan(std::vector<ProcessEntry>& table, const ScanOptions& options) {
+    // A whole walk is a phase; its getdents64 calls and file reads are
+    // timed one by one as procfs syscalls
+    Trace::Scope trace("proc_scan");
+    table.clear();
+    if (!listPids()) {
+        return false;
+    }
+    
+    if (uring_ && scanBatched(table, options)) {
+        return true;
+    }
+    table.clear();
+    return scanSync(table, options);
+}
+
+bool ProcScanner::scanSync(std::vector<ProcessEntry>& table, const ScanOptions& options) {
+    ProcessEntry entry;
+    for (pid_t pid : pids_) {
+        entry.pid = pid;
+        entry.startTime = 0;
+        if (!readName(pid, entry.name, sizeof(entry.name), &entry.nameLength)) {
+            continue; // exited since listing
+        }
+        if (!nameMatches(entry, options)) {
+            continue;
+        }
+        if (options.withStartTime && !readStartTime(pid, entry.startTime)) {
+            continue;
+        }
+        table.push_back(entry);
+        if (options.stopAtFirst) break;
+    }
+    return true;
+}
+
+bool ProcScanner::scanBatched(std::vector<ProcessEntry>& table, const ScanOptions& options) {
+    const unsigned batchSize = IoUringBatch::kEntries;
+    ProcessEntry entry;
+    pid_t matched[IoUringBatch::kEntries];
+    ProcessEntry matchedEntries[IoUringBatch::kEntries];
+    
+    for (size_t base = 0; base < pids_.size(); base += batchSize) {
+        unsigned count = (unsigned)std::min<size_t>(batchSize, pids_.size() - base);
+        const pid_t* pids = pids_.data() + base;
+        
+        if (!uring_->readFiles(procFd_, pids, count, "cmdline", kProcessNameMax)) {
+            LOGE("io_uring batch failed, falling back to plain syscalls");
+            setUseIoUring(false);
+            return false;
+        }
+        
+        unsigned matchCount = 0;
+        for (unsigned i = 0; i < count; i++) {
+            if (uring_->results[i] < 0) continue;
+            entry.pid = pids[i];
+            entry.startTime = 0;
+            entry.nameLength = copyName(uring_->buffers[i], uring_->results[i], entry.name, sizeof(entry.name));
+            if (!nameMatches(entry, options)) continue;
+            matched[matchCount] = entry.pid;
+            matchedEntries[matchCount++] = entry;
+        }
+        
+        if (options.withStartTime && matchCount > 0) {
+            if (!uring_->readFiles(procFd_, matched, matchCount, "stat", kStatBuffer)) {
+                setUseIoUring(false);
+                return false;
+            }
+            for (unsigned i = 0; i < matchCount; i++) {
+                if (uring_->results[i] <= 0 ||
+                    !parseStartTime(uring_->buffers[i], (size_t)uring_->results[i], matchedEntries[i].startTime)) {
+                    matchedEntries[i].pid = 0;
+                }
+            }
+        }
+        
+        for (unsigned i = 0; i < matchCount; i++) {
+            if (matchedEntries[i].pid == 0) continue;
+            table.push_back(matchedEntries[i]);
+            if (options.stopAtFirst) return true;
+        }
+    }
+    return true;
+}
+
+} // namespace ProcessUtils
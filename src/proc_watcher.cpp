@@ -0,0 +1,344 @@
+#include "proc_watcher.h"
+#include "logger.h"
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#define LOG_TAG "ProcWatcher"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace ProcessUtils {
+
+namespace {
+
+const int kMinPollMs = 5;
+const int kMaxPollMs = 250;
+// How often a known-but-not-yet-matching process is re-read, and for how
+// long before we give up on it.
+const int kCandidateRecheckMs = 2;
+const uint64_t kCandidateTtlNs = 2000000000ULL;
+// TASK_COMM_LEN - 1: Android truncates long process names to their tail.
+const size_t kCommMax = 15;
+
+// Offset of proc_event.what inside a proc connector datagram.
+const uint32_t kWhatOffset = NLMSG_HDRLEN + sizeof(struct cn_msg);
+
+uint64_t nowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int openPidfd(pid_t pid) {
+#ifdef __NR_pidfd_open
+    return (int)syscall(__NR_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+} // namespace
+
+int openProcConnector(const uint32_t* events, size_t count) {
+    int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0) {
+        LOGI("Netlink connector unavailable: %s", strerror(errno));
+        return -1;
+    }
+    
+    // Drop every other event in the kernel: on a busy device FORK/UID/...
+    // outnumber the ones we care about by orders of magnitude.
+    std::vector<struct sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, kWhatOffset));
+    for (size_t i = 0; i < count; i++) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(events[i]), (uint8_t)(count - i), 0));
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+    struct sock_fprog filter = { (unsigned short)code.size(), code.data() };
+    setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter));
+    
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        LOGI("Failed to bind proc connector: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    // nlmsghdr | cn_msg | proc_cn_mcast_op, laid out by hand because cn_msg
+    // ends in a flexible array.
+    const size_t requestSize = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(uint32_t));
+    alignas(struct nlmsghdr) char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(uint32_t))];
+    memset(request, 0, sizeof(request));
+    
+    struct nlmsghdr* header = (struct nlmsghdr*)request;
+    header->nlmsg_len = requestSize;
+    header->nlmsg_type = NLMSG_DONE;
+    header->nlmsg_pid = getpid();
+    
+    struct cn_msg* message = (struct cn_msg*)NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(uint32_t);
+    uint32_t op = PROC_CN_MCAST_LISTEN;
+    memcpy(message->data, &op, sizeof(op));
+    
+    if (send(fd, request, requestSize, 0) != (ssize_t)requestSize) {
+        LOGI("Failed to subscribe to proc events: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+ProcWatcher::ProcWatcher() : netlinkFd_(-1), pollIntervalMs_(kMinPollMs) {
+}
+
+ProcWatcher::~ProcWatcher() {
+    stop();
+}
+
+bool ProcWatcher::openNetlink() {
+    const uint32_t events[] = { kProcEventExec, kProcEventComm };
+    netlinkFd_ = openProcConnector(events, sizeof(events) / sizeof(events[0]));
+    return netlinkFd_ >= 0;
+}
+
+bool ProcWatcher::start(const std::string& name) {
+    stop();
+    name_ = name;
+    pollIntervalMs_ = kMinPollMs;
+    
+    if (!openNetlink()) {
+        LOGI("Watching %s by polling /proc", name.c_str());
+    } else {
+        LOGI("Watching %s through the proc connector", name.c_str());
+    }
+    
+    // Baseline for the polling path; also used if netlink overruns.
+    ScanOptions options;
+    options.withStartTime = true;
+    if (!scanner_.scan(known_, options)) {
+        return netlinkFd_ >= 0;
+    }
+    std::sort(known_.begin(), known_.end(),
+              [](const ProcessEntry& a, const ProcessEntry& b) { return a.pid < b.pid; });
+    return true;
+}
+
+void ProcWatcher::stop() {
+    if (netlinkFd_ >= 0) {
+        close(netlinkFd_);
+        netlinkFd_ = -1;
+    }
+    while (!candidates_.empty()) {
+        dropCandidate(candidates_.size() - 1);
+    }
+    known_.clear();
+}
+
+bool ProcWatcher::isKnown(pid_t pid, uint64_t startTime) const {
+    auto it = std::lower_bound(known_.begin(), known_.end(), pid,
+                               [](const ProcessEntry& e, pid_t p) { return e.pid < p; });
+    return it != known_.end() && it->pid == pid && it->startTime == startTime;
+}
+
+void ProcWatcher::trackCandidate(pid_t pid, uint64_t eventNs, const char* source) {
+    for (const Candidate& c : candidates_) {
+        if (c.pid == pid) return;
+    }
+    Candidate candidate = { pid, openPidfd(pid), eventNs, source };
+    candidates_.push_back(candidate);
+}
+
+void ProcWatcher::dropCandidate(size_t index) {
+    if (candidates_[index].pidfd >= 0) {
+        close(candidates_[index].pidfd);
+    }
+    candidates_[index] = candidates_.back();
+    candidates_.pop_back();
+}
+
+bool ProcWatcher::checkCandidate(pid_t pid, uint64_t eventNs, const char* source, LaunchEvent& event) {
+    char name[kProcessNameMax];
+    if (!scanner_.readName(pid, name, sizeof(name)) || !strstr(name, name_.c_str())) {
+        return false;
+    }
+    
+    event.pid = pid;
+    event.startTime = 0;
+    scanner_.readStartTime(pid, event.startTime);
+    event.latencyNs = nowNs(CLOCK_MONOTONIC) - eventNs;
+    event.source = source;
+    return true;
+}
+
+bool ProcWatcher::recheckCandidates(LaunchEvent& event) {
+    uint64_t now = nowNs(CLOCK_MONOTONIC);
+    for (size_t i = candidates_.size(); i-- > 0;) {
+        Candidate& c = candidates_[i];
+        
+        // A readable pidfd means the candidate exited; its PID may already
+        // belong to someone else.
+        bool exited = false;
+        if (c.pidfd >= 0) {
+            struct pollfd pfd = { c.pidfd, POLLIN, 0 };
+            exited = poll(&pfd, 1, 0) > 0;
+        }
+        
+        if (!exited && checkCandidate(c.pid, c.eventNs, c.source, event)) {
+            dropCandidate(i);
+            return true;
+        }
+        if (exited || now - c.eventNs > kCandidateTtlNs) {
+            dropCandidate(i);
+        }
+    }
+    return false;
+}
+
+bool ProcWatcher::waitForLaunch(LaunchEvent& event, int timeoutMs) {
+    int64_t deadlineNs = timeoutMs < 0 ? -1 : (int64_t)(nowNs(CLOCK_MONOTONIC) + (uint64_t)timeoutMs * 1000000ULL);
+    
+    if (netlinkFd_ >= 0) {
+        return waitNetlink(event, deadlineNs);
+    }
+    return waitPolling(event, deadlineNs);
+}
+
+bool ProcWatcher::waitNetlink(LaunchEvent& event, int64_t deadlineNs) {
+    alignas(struct nlmsghdr) char buffer[8192];
+    std::string commTail = name_.size() > kCommMax ? name_.substr(name_.size() - kCommMax) : name_;
+    
+    for (;;) {
+        int timeout = -1;
+        if (deadlineNs >= 0) {
+            int64_t left = deadlineNs - (int64_t)nowNs(CLOCK_MONOTONIC);
+            if (left <= 0) return false;
+            timeout = (int)(left / 1000000) + 1;
+        }
+        if (!candidates_.empty() && (timeout < 0 || timeout > kCandidateRecheckMs)) {
+            timeout = kCandidateRecheckMs;
+        }
+        
+        struct pollfd pfd = { netlinkFd_, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            LOGE("poll on proc connector failed: %s", strerror(errno));
+            return false;
+        }
+        
+        if (recheckCandidates(event)) {
+            return true;
+        }
+        if (ready <= 0) continue;
+        
+        ssize_t len = recv(netlinkFd_, buffer, sizeof(buffer), 0);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                // Events were dropped; a poll round catches anything we missed.
+                LOGI("Proc connector overrun, rescanning /proc");
+                if (waitPolling(event, (int64_t)nowNs(CLOCK_MONOTONIC))) return true;
+            }
+            continue;
+        }
+        
+        for (struct nlmsghdr* nlh = (struct nlmsghdr*)buffer; NLMSG_OK(nlh, (size_t)len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR) continue;
+            
+            const struct cn_msg* msg = (const struct cn_msg*)NLMSG_DATA(nlh);
+            const struct proc_event* ev = (const struct proc_event*)msg->data;
+            
+            if (ev->what == kProcEventExec) {
+                pid_t pid = ev->event_data.exec.process_tgid;
+                if (checkCandidate(pid, ev->timestamp_ns, "exec", event)) return true;
+            } else if (ev->what == kProcEventComm) {
+                // Only the main thread renaming itself marks a process name change.
+                if (ev->event_data.comm.process_pid != ev->event_data.comm.process_tgid) continue;
+                pid_t pid = ev->event_data.comm.process_tgid;
+                if (checkCandidate(pid, ev->timestamp_ns, "comm", event)) return true;
+                
+                // The comm can change just before argv is rewritten; keep
+                // rechecking processes whose comm looks like our name.
+                char comm[sizeof(ev->event_data.comm.comm) + 1];
+                memcpy(comm, ev->event_data.comm.comm, sizeof(ev->event_data.comm.comm));
+                comm[sizeof(comm) - 1] = '\0';
+                if (comm[0] && (strstr(comm, commTail.c_str()) || strstr(name_.c_str(), comm))) {
+                    trackCandidate(pid, ev->timestamp_ns, "comm");
+                }
+            }
+        }
+    }
+}
+
+bool ProcWatcher::waitPolling(LaunchEvent& event, int64_t deadlineNs) {
+    ScanOptions options;
+    options.withStartTime = true;
+    const uint64_t ticksPerSecond = (uint64_t)sysconf(_SC_CLK_TCK);
+    
+    for (;;) {
+        if (recheckCandidates(event)) {
+            return true;
+        }
+        
+        if (!scanner_.scan(table_, options)) {
+            return false;
+        }
+        std::sort(table_.begin(), table_.end(),
+                  [](const ProcessEntry& a, const ProcessEntry& b) { return a.pid < b.pid; });
+        
+        bool activity = false;
+        for (const ProcessEntry& entry : table_) {
+            if (isKnown(entry.pid, entry.startTime)) continue;
+            activity = true;
+            
+            if (strstr(entry.name, name_.c_str())) {
+                // Start time has clock-tick resolution; good enough to show
+                // how much of the latency the poll interval adds.
+                uint64_t startNs = entry.startTime * 1000000000ULL / ticksPerSecond;
+                uint64_t boot = nowNs(CLOCK_BOOTTIME);
+                event.pid = entry.pid;
+                event.startTime = entry.startTime;
+                event.latencyNs = boot > startNs ? boot - startNs : 0;
+                event.source = "poll";
+                known_.swap(table_);
+                return true;
+            }
+            
+            // Not named yet: follow it closely via its pidfd until it is.
+            trackCandidate(entry.pid, nowNs(CLOCK_MONOTONIC), "poll");
+        }
+        known_.swap(table_);
+        
+        pollIntervalMs_ = (activity || !candidates_.empty()) ? kMinPollMs
+                                                             : std::min(pollIntervalMs_ * 2, kMaxPollMs);
+        
+        int64_t sleepNs = (int64_t)pollIntervalMs_ * 1000000;
+        if (deadlineNs >= 0) {
+            int64_t left = deadlineNs - (int64_t)nowNs(CLOCK_MONOTONIC);
+            if (left <= 0) return false;
+            sleepNs = std::min(sleepNs, left);
+        }
+        struct timespec ts = { (time_t)(sleepNs / 1000000000), (long)(sleepNs % 1000000000) };
+        nanosleep(&ts, nullptr);
+    }
+}
+
+} // namespace ProcessUtils
@@ -1,79 +1,55 @@
 #include "process_utils.h"
-#include <android/log.h>
-#include <dirent.h>
+#include "maps_snapshot.h"
+#include "maps_query.h"
+#include "proc_scanner.h"
+#include "logger.h"
 #include <fstream>
-#include <sstream>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #define LOG_TAG "ProcessUtils"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 namespace ProcessUtils {
 
+namespace {
+
+// One warm scanner per thread keeps repeated lookups allocation-free.
+ProcScanner& threadScanner() {
+    thread_local ProcScanner scanner;
+    return scanner;
+}
+
+} // namespace
+
 pid_t findProcessByName(const std::string& processName) {
-    DIR* dir = opendir("/proc");
-    if (!dir) {
-        LOGE("Failed to open /proc");
-        return -1;
-    }
+    thread_local std::vector<ProcessEntry> table;
     
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(entry->d_name);
-        if (pid <= 0) continue;
-        
-        std::string cmdlinePath = "/proc/" + std::string(entry->d_name) + "/cmdline";
-        std::ifstream cmdlineFile(cmdlinePath);
-        if (!cmdlineFile.is_open()) continue;
-        
-        std::string cmdline;
-        std::getline(cmdlineFile, cmdline, '\0');
-        cmdlineFile.close();
-        
-        if (cmdline.find(processName) != std::string::npos) {
-            closedir(dir);
-            return pid;
-        }
+    ScanOptions options;
+    options.nameFilter = processName.c_str();
+    options.stopAtFirst = true;
+    if (!threadScanner().scan(table, options) || table.empty()) {
+        return -1;
     }
     
-    closedir(dir);
-    return -1;
+    return table[0].pid;
 }
 
 std::vector<pid_t> findAllProcessesByName(const std::string& processName) {
     std::vector<pid_t> pids;
+    thread_local std::vector<ProcessEntry> table;
     
-    DIR* dir = opendir("/proc");
-    if (!dir) {
-        LOGE("Failed to open /proc");
+    ScanOptions options;
+    options.nameFilter = processName.c_str();
+    if (!threadScanner().scan(table, options)) {
         return pids;
     }
     
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(entry->d_name);
-        if (pid <= 0) continue;
-        
-        std::string cmdlinePath = "/proc/" + std::string(entry->d_name) + "/cmdline";
-        std::ifstream cmdlineFile(cmdlinePath);
-        if (!cmdlineFile.is_open()) continue;
-        
-        std::string cmdline;
-        std::getline(cmdlineFile, cmdline, '\0');
-        cmdlineFile.close();
-        
-        if (cmdline.find(processName) != std::string::npos) {
-            pids.push_back(pid);
-        }
+    pids.reserve(table.size());
+    for (const ProcessEntry& entry : table) {
+        pids.push_back(entry.pid);
     }
-    
-    closedir(dir);
     return pids;
 }
 
@@ -82,85 +58,44 @@ pid_t findProcessByPackage(const std::string& packageName) {
     return findProcessByName(packageName);
 }
 
+bool belongsToPackage(const std::string& name, const std::string& package) {
+    return name.compare(0, package.size(), package) == 0 &&
+           (name.size() == package.size() || name[package.size()] == ':');
+}
+
+namespace {
+
+void toModuleInfo(const MapsSnapshot& maps, const MapsModule& mod, ModuleInfo& info) {
+    info.name.assign(mod.name.data(), mod.name.size());
+    info.path.assign(mod.path.data(), mod.path.size());
+    info.baseAddress = mod.base;
+    info.endAddress = mod.end;
+    info.offset = maps.moduleSegment(mod, 0).offset;
+}
+
+} // namespace
+
 bool getProcessModules(pid_t pid, std::vector<ModuleInfo>& modules) {
     modules.clear();
     
-    std::string mapsPath = "/proc/" + std::to_string(pid) + "/maps";
-    std::ifstream mapsFile(mapsPath);
-    if (!mapsFile.is_open()) {
-        LOGE("Failed to open %s", mapsPath.c_str());
+    MapsSnapshot maps;
+    if (!maps.load(pid)) {
         return false;
     }
     
-    std::string line;
-    while (std::getline(mapsFile, line)) {
-        // Parse line: address perms offset dev inode pathname
-        std::istringstream iss(line);
-        std::string addrRange, perms, offset, dev, inode, pathname;
-        
-        iss >> addrRange >> perms >> offset >> dev >> inode;
-        std::getline(iss, pathname);
-        
-        // Skip if no pathname or not executable
-        if (pathname.empty() || perms.find('x') == std::string::npos) {
-            continue;
-        }
-        
-        // Trim whitespace from pathname
-        size_t start = pathname.find_first_not_of(" \t");
-        if (start != std::string::npos) {
-            pathname = pathname.substr(start);
-        }
-        
-        // Parse address range
-        size_t dashPos = addrRange.find('-');
-        if (dashPos == std::string::npos) continue;
-        
-        uintptr_t baseAddr = std::stoull(addrRange.substr(0, dashPos), nullptr, 16);
-        uintptr_t endAddr = std::stoull(addrRange.substr(dashPos + 1), nullptr, 16);
-        
-        // Extract module name from path
-        size_t lastSlash = pathname.find_last_of('/');
-        std::string moduleName = (lastSlash != std::string::npos) ? 
-                                 pathname.substr(lastSlash + 1) : pathname;
-        
-        // Check if module already exists (only keep first entry)
-        bool exists = false;
-        for (const auto& mod : modules) {
-            if (mod.name == moduleName) {
-                exists = true;
-                break;
-            }
-        }
-        
-        if (!exists) {
-            ModuleInfo info;
-            info.name = moduleName;
-            info.baseAddress = baseAddr;
-            info.endAddress = endAddr;
-            info.path = pathname;
-            modules.push_back(info);
-        }
+    // Only code modules; data files mapped by the process are skipped
+    modules.reserve(maps.modules().size());
+    for (const MapsModule& mod : maps.modules()) {
+        if (!(mod.perms & MAPS_EXEC)) continue;
+        modules.emplace_back();
+        toModuleInfo(maps, mod, modules.back());
     }
     
-    mapsFile.close();
     return true;
 }
 
-ModuleInfo* findModule(pid_t pid, const std::string& moduleName) {
-    static std::vector<ModuleInfo> modules;
-    
-    if (!getProcessModules(pid, modules)) {
-        return nullptr;
-    }
-    
-    for (auto& mod : modules) {
-        if (mod.name.find(moduleName) != std::string::npos) {
-            return &mod;
-        }
-    }
-    
-    return nullptr;
+bool findModule(pid_t pid, const std::string& moduleName, ModuleInfo& module) {
+    return queryModule(pid, moduleName, module);
 }
 
 bool isProcessRunning(pid_t pid) {
@@ -169,18 +104,18 @@ bool isProcessRunning(pid_t pid) {
     return (stat(procPath.c_str(), &st) == 0);
 }
 
+bool getProcessStartTime(pid_t pid, uint64_t& startTime) {
+    return threadScanner().readStartTime(pid, startTime);
+}
+
 std::string getProcessName(pid_t pid) {
-    std::string cmdlinePath = "/proc/" + std::to_string(pid) + "/cmdline";
-    std::ifstream cmdlineFile(cmdlinePath);
-    if (!cmdlineFile.is_open()) {
+    char name[kProcessNameMax];
+    uint32_t length = 0;
+    if (!threadScanner().readName(pid, name, sizeof(name), &length)) {
         return "";
     }
     
-    std::string cmdline;
-    std::getline(cmdlineFile, cmdline, '\0');
-    cmdlineFile.close();
-    
-    return cmdline;
+    return std::string(name, length);
 }
 
 bool setSelinuxContext(const std::string& context) {
@@ -1,34 +1,95 @@
 #include "ptrace_utils.h"
+#include "remote_call.h"
+#include "trace.h"
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <android/log.h>
+#include "logger.h"
 #include <unistd.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
 
 #define LOG_TAG "PtraceUtils"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 namespace PtraceUtils {
 
-bool attach(pid_t pid) {
-    if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) == -1) {
-        LOGE("PTRACE_ATTACH failed for PID %d: %s", pid, strerror(errno));
-        return false;
+bool requestAttach(pid_t pid, AttachMode mode) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
+    if (mode == AttachMode::Attach) {
+        if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) == -1) {
+            LOGE("PTRACE_ATTACH failed for PID %d: %s", pid, strerror(errno));
+            return false;
+        }
+        return true;
     }
     
-    int status;
-    if (waitpid(pid, &status, WUNTRACED) != pid) {
-        LOGE("waitpid failed for PID %d: %s", pid, strerror(errno));
+    // No PTRACE_O_EXITKILL: if the injector dies mid-session the target is
+    // detached by the kernel and gets a chance to run on, instead of being
+    // killed outright.
+    if (ptrace(PTRACE_SEIZE, pid, NULL, NULL) == -1) {
+        LOGE("PTRACE_SEIZE failed for PID %d: %s", pid, strerror(errno));
+        return false;
+    }
+    if (ptrace(PTRACE_INTERRUPT, pid, NULL, NULL) == -1) {
+        LOGE("PTRACE_INTERRUPT failed for PID %d: %s", pid, strerror(errno));
+        ptrace(PTRACE_DETACH, pid, NULL, NULL);
         return false;
     }
+    return true;
+}
+
+bool isAttachStop(int status, AttachMode mode) {
+    if (!WIFSTOPPED(status)) {
+        return false;
+    }
+    // The interrupt (or a group stop) is reported as PTRACE_EVENT_STOP
+    if (mode == AttachMode::Seize) {
+        return (status >> 16) == PTRACE_EVENT_STOP;
+    }
+    return WSTOPSIG(status) == SIGSTOP;
+}
+
+bool attach(pid_t pid, AttachMode mode) {
+    Trace::Scope trace("attach", pid);
+    if (!requestAttach(pid, mode)) {
+        return false;
+    }
+    
+    Trace::SyscallScope scope(Trace::SyscallClass::Wait);
+    for (;;) {
+        int status;
+        if (waitpid(pid, &status, __WALL) != pid) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("waitpid failed for PID %d: %s", pid, strerror(errno));
+            return false;
+        }
+        if (!WIFSTOPPED(status)) {
+            LOGE("PID %d exited while being attached", pid);
+            return false;
+        }
+        if (isAttachStop(status, mode)) {
+            break;
+        }
+        
+        // A signal that arrived first: deliver it, the attach stop stays pending
+        ptrace(PTRACE_CONT, pid, NULL, (void*)(uintptr_t)WSTOPSIG(status));
+    }
     
-    LOGI("Successfully attached to PID %d", pid);
+    LOGI("Successfully attached to PID %d (%s)", pid, mode == AttachMode::Seize ? "seize" : "attach");
     return true;
 }
 
 bool detach(pid_t pid) {
+    Trace::Scope trace("detach", pid);
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
     if (ptrace(PTRACE_DETACH, pid, NULL, NULL) == -1) {
         LOGE("PTRACE_DETACH failed for PID %d: %s", pid, strerror(errno));
         return false;
@@ -39,6 +100,7 @@ bool detach(pid_t pid) {
 }
 
 bool getRegs(pid_t pid, struct user_regs_struct* regs) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
 #ifdef __aarch64__
     struct iovec io;
     io.iov_base = regs;
@@ -54,6 +116,7 @@ bool getRegs(pid_t pid, struct user_regs_struct* regs) {
 }
 
 bool setRegs(pid_t pid, const struct user_regs_struct* regs) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
 #ifdef __aarch64__
     struct iovec io;
     io.iov_base = (void*)regs;
@@ -68,39 +131,206 @@ bool setRegs(pid_t pid, const struct user_regs_struct* regs) {
     return true;
 }
 
-bool readMemory(pid_t pid, uintptr_t addr, void* buffer, size_t size) {
-    size_t count = 0;
-    long* buf = (long*)buffer;
+namespace {
+
+// Number of iovec pairs handed to one process_vm_* call. Well below
+// UIO_MAXIOV so the arrays stay on the stack.
+const size_t kVmBatch = 64;
+
+// Cleared once the kernel reports ENOSYS so later transfers skip straight
+// to /proc/<pid>/mem instead of paying for a failing syscall every time.
+std::atomic<bool> g_vmAvailable(true);
+
+// Position inside a RemoteIoVec array; every backend consumes bytes from the
+// front and leaves the cursor on the first byte it could not transfer, so the
+// next backend in the chain resumes exactly there.
+struct IoCursor {
+    const RemoteIoVec* iov;
+    size_t count;
+    size_t index;
+    size_t offset;
+
+    bool done() const { return index >= count; }
+    uintptr_t remote() const { return iov[index].remoteAddr + offset; }
+    uint8_t* local() const { return (uint8_t*)iov[index].localBuffer + offset; }
+    size_t left() const { return iov[index].size - offset; }
+
+    void skipEmpty() {
+        while (index < count && iov[index].size == offset) {
+            index++;
+            offset = 0;
+        }
+    }
+
+    void advance(size_t bytes) {
+        while (bytes > 0 && index < count) {
+            size_t step = bytes < left() ? bytes : left();
+            offset += step;
+            bytes -= step;
+            skipEmpty();
+        }
+        skipEmpty();
+    }
+};
+
+void transferVm(pid_t pid, IoCursor& cur, bool write) {
+    if (!g_vmAvailable.load(std::memory_order_relaxed)) {
+        return;
+    }
     
-    while (count < size) {
-        long word = ptrace(PTRACE_PEEKDATA, pid, (void*)(addr + count), NULL);
-        if (word == -1 && errno != 0) {
-            LOGE("PTRACE_PEEKDATA failed at 0x%lx: %s", addr + count, strerror(errno));
-            return false;
+    struct iovec local[kVmBatch];
+    struct iovec remote[kVmBatch];
+    
+    while (!cur.done()) {
+        // Build one batch starting at the cursor, honouring the offset into
+        // the first element.
+        size_t n = 0;
+        size_t expected = 0;
+        for (size_t i = cur.index; i < cur.count && n < kVmBatch; i++) {
+            size_t skip = (i == cur.index) ? cur.offset : 0;
+            size_t len = cur.iov[i].size - skip;
+            if (len == 0) continue;
+            local[n].iov_base = (uint8_t*)cur.iov[i].localBuffer + skip;
+            local[n].iov_len = len;
+            remote[n].iov_base = (void*)(cur.iov[i].remoteAddr + skip);
+            remote[n].iov_len = len;
+            expected += len;
+            n++;
+        }
+        
+        ssize_t moved = write ? process_vm_writev(pid, local, n, remote, n, 0)
+                              : process_vm_readv(pid, local, n, remote, n, 0);
+        if (moved <= 0) {
+            if (moved == -1 && errno == ENOSYS) {
+                g_vmAvailable.store(false, std::memory_order_relaxed);
+            }
+            return;
+        }
+        
+        cur.advance((size_t)moved);
+        if ((size_t)moved < expected) {
+            // Partial transfer: the rest usually sits on a page that is
+            // not writable from here (e.g. r-x text), let the next backend
+            // try it.
+            return;
+        }
+    }
+}
+
+void transferProcMem(pid_t pid, IoCursor& cur, bool write) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+    int fd = open(path, (write ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    
+    while (!cur.done()) {
+        ssize_t moved = write ? pwrite64(fd, cur.local(), cur.left(), (off64_t)cur.remote())
+                              : pread64(fd, cur.local(), cur.left(), (off64_t)cur.remote());
+        if (moved <= 0) {
+            if (moved == -1 && errno == EINTR) continue;
+            break;
         }
-        buf[count / sizeof(long)] = word;
-        count += sizeof(long);
+        cur.advance((size_t)moved);
     }
     
-    return true;
+    close(fd);
 }
 
-bool writeMemory(pid_t pid, uintptr_t addr, const void* buffer, size_t size) {
-    size_t count = 0;
-    const long* buf = (const long*)buffer;
+void transferPtrace(pid_t pid, IoCursor& cur, bool write) {
+    const uintptr_t wordMask = sizeof(long) - 1;
     
-    while (count < size) {
-        if (ptrace(PTRACE_POKEDATA, pid, (void*)(addr + count), buf[count / sizeof(long)]) == -1) {
-            LOGE("PTRACE_POKEDATA failed at 0x%lx: %s", addr + count, strerror(errno));
-            return false;
+    while (!cur.done()) {
+        uintptr_t addr = cur.remote();
+        uintptr_t wordAddr = addr & ~wordMask;
+        size_t head = addr - wordAddr;
+        size_t len = sizeof(long) - head;
+        if (len > cur.left()) len = cur.left();
+        
+        long word = 0;
+        if (!write || head != 0 || len != sizeof(long)) {
+            // Reads always need the word; writes only when they cover part
+            // of it, so the bytes outside the buffer are preserved.
+            errno = 0;
+            word = ptrace(PTRACE_PEEKDATA, pid, (void*)wordAddr, NULL);
+            if (word == -1 && errno != 0) {
+                LOGE("PTRACE_PEEKDATA failed at 0x%lx: %s", wordAddr, strerror(errno));
+                return;
+            }
+        }
+        
+        if (write) {
+            memcpy((uint8_t*)&word + head, cur.local(), len);
+            if (ptrace(PTRACE_POKEDATA, pid, (void*)wordAddr, (void*)word) == -1) {
+                LOGE("PTRACE_POKEDATA failed at 0x%lx: %s", wordAddr, strerror(errno));
+                return;
+            }
+        } else {
+            memcpy(cur.local(), (uint8_t*)&word + head, len);
         }
-        count += sizeof(long);
+        
+        cur.advance(len);
     }
+}
+
+bool transferMemory(pid_t pid, const RemoteIoVec* iov, size_t count,
+                    MemoryBackend backend, bool write) {
+    Trace::SyscallScope scope(write ? Trace::SyscallClass::MemoryWrite : Trace::SyscallClass::MemoryRead);
+    IoCursor cur = { iov, count, 0, 0 };
+    cur.skipEmpty();
     
+    if (!cur.done() && (backend == MemoryBackend::Auto || backend == MemoryBackend::VmReadv)) {
+        transferVm(pid, cur, write);
+    }
+    if (!cur.done() && (backend == MemoryBackend::Auto || backend == MemoryBackend::ProcMem)) {
+        transferProcMem(pid, cur, write);
+    }
+    if (!cur.done() && (backend == MemoryBackend::Auto || backend == MemoryBackend::PtraceWord)) {
+        transferPtrace(pid, cur, write);
+    }
+    
+    if (!cur.done()) {
+        LOGE("Failed to %s %zu bytes at 0x%lx in PID %d via %s",
+             write ? "write" : "read", cur.left(), cur.remote(), pid,
+             memoryBackendName(backend));
+        return false;
+    }
     return true;
 }
 
+} // namespace
+
+bool readMemory(pid_t pid, uintptr_t addr, void* buffer, size_t size) {
+    RemoteIoVec iov = { addr, buffer, size };
+    return transferMemory(pid, &iov, 1, MemoryBackend::Auto, false);
+}
+
+bool writeMemory(pid_t pid, uintptr_t addr, const void* buffer, size_t size) {
+    RemoteIoVec iov = { addr, const_cast<void*>(buffer), size };
+    return transferMemory(pid, &iov, 1, MemoryBackend::Auto, true);
+}
+
+bool readMemoryV(pid_t pid, const RemoteIoVec* iov, size_t count, MemoryBackend backend) {
+    return transferMemory(pid, iov, count, backend, false);
+}
+
+bool writeMemoryV(pid_t pid, const RemoteIoVec* iov, size_t count, MemoryBackend backend) {
+    return transferMemory(pid, iov, count, backend, true);
+}
+
+const char* memoryBackendName(MemoryBackend backend) {
+    switch (backend) {
+        case MemoryBackend::Auto: return "auto";
+        case MemoryBackend::VmReadv: return "process_vm";
+        case MemoryBackend::ProcMem: return "proc_mem";
+        case MemoryBackend::PtraceWord: return "ptrace";
+    }
+    return "unknown";
+}
+
 bool continueExecution(pid_t pid) {
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
     if (ptrace(PTRACE_CONT, pid, NULL, NULL) == -1) {
         LOGE("PTRACE_CONT failed: %s", strerror(errno));
         return false;
@@ -110,6 +340,7 @@ bool continueExecution(pid_t pid) {
 
 bool waitForSignal(pid_t pid) {
     int status;
+    Trace::SyscallScope scope(Trace::SyscallClass::Wait);
     if (waitpid(pid, &status, WUNTRACED) != pid) {
         LOGE("waitpid failed: %s", strerror(errno));
         return false;
@@ -117,79 +348,30 @@ bool waitForSignal(pid_t pid) {
     return true;
 }
 
-uintptr_t callFunction(pid_t pid, uintptr_t funcAddr, const uintptr_t* args, int argCount) {
-    struct user_regs_struct originalRegs, newRegs;
-    
-    // Save original registers
-    if (!getRegs(pid, &originalRegs)) {
-        return 0;
-    }
-    
-    memcpy(&newRegs, &originalRegs, sizeof(newRegs));
-    
-    // Set up function call based on architecture
+uintptr_t getStackPointer(const struct user_regs_struct* regs) {
 #if defined(__aarch64__)
-    // ARM64: x0-x7 for arguments, pc for function address
-    for (int i = 0; i < argCount && i < 8; i++) {
-        newRegs.regs[i] = args[i];
-    }
-    newRegs.pc = funcAddr;
-    newRegs.regs[30] = 0; // LR = 0 to cause crash on return
+    return regs->sp;
 #elif defined(__arm__)
-    // ARM32: r0-r3 for arguments
-    for (int i = 0; i < argCount && i < 4; i++) {
-        newRegs.uregs[i] = args[i];
-    }
-    newRegs.ARM_pc = funcAddr;
-    newRegs.ARM_lr = 0;
+    return regs->ARM_sp;
 #elif defined(__i386__)
-    // x86: arguments on stack
-    newRegs.eip = funcAddr;
-    // Stack setup would go here
+    return regs->esp;
 #elif defined(__x86_64__)
-    // x86_64: rdi, rsi, rdx, rcx, r8, r9 for arguments
-    if (argCount > 0) newRegs.rdi = args[0];
-    if (argCount > 1) newRegs.rsi = args[1];
-    if (argCount > 2) newRegs.rdx = args[2];
-    if (argCount > 3) newRegs.rcx = args[3];
-    if (argCount > 4) newRegs.r8 = args[4];
-    if (argCount > 5) newRegs.r9 = args[5];
-    newRegs.rip = funcAddr;
+    return regs->rsp;
 #endif
-    
-    // Set new registers
-    if (!setRegs(pid, &newRegs)) {
-        return 0;
-    }
-    
-    // Continue and wait for crash (return to address 0)
-    if (!continueExecution(pid)) {
-        return 0;
-    }
-    
-    waitForSignal(pid);
-    
-    // Get return value
-    struct user_regs_struct returnRegs;
-    if (!getRegs(pid, &returnRegs)) {
+}
+
+uintptr_t callFunction(pid_t pid, uintptr_t funcAddr, const uintptr_t* args, int argCount) {
+    RemoteCallEngine engine(pid);
+    if (!engine.begin()) {
         return 0;
     }
     
-    uintptr_t retValue;
-#if defined(__aarch64__)
-    retValue = returnRegs.regs[0];
-#elif defined(__arm__)
-    retValue = returnRegs.ARM_r0;
-#elif defined(__i386__)
-    retValue = returnRegs.eax;
-#elif defined(__x86_64__)
-    retValue = returnRegs.rax;
-#endif
-    
-    // Restore original registers
-    setRegs(pid, &originalRegs);
+    std::vector<RemoteArg> remoteArgs(args, args + argCount);
+    int call = engine.queue(funcAddr, remoteArgs.data(), remoteArgs.size());
+    engine.run();
+    engine.end();
     
-    return retValue;
+    return engine.result(call);
 }
 
 } // namespace PtraceUtils
@@ -0,0 +1,184 @@
+#include "remote_arena.h"
+#include "remote_call.h"
+#include "ptrace_utils.h"
+#include "trace.h"
+#include "logger.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+#define LOG_TAG "RemoteArena"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace PtraceUtils {
+
+RemoteArena::RemoteArena(RemoteCallEngine& engine)
+    : engine_(engine), pid_(engine.pid()), base_(0), size_(0), top_(0),
+      dirtyStart_(0), dirtyEnd_(0), onStack_(false), pendingSize_(0) {
+}
+
+RemoteArena::~RemoteArena() {
+    if (base_ != 0 && !onStack_) {
+        LOGE("Arena at 0x%lx in PID %d was never unmapped", base_, pid_);
+    }
+}
+
+bool RemoteArena::map(uintptr_t mmapAddr, size_t size) {
+    if (base_ != 0) {
+        return true;
+    }
+    Trace::Scope trace("arena_map", pid_);
+    
+    int call = queueMap(mmapAddr, size);
+    return engine_.run() && completeMap(call);
+}
+
+int RemoteArena::queueMap(uintptr_t mmapAddr, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    pendingSize_ = (size + page - 1) & ~(page - 1);
+    
+    // mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+    return engine_.queue(mmapAddr, { 0, pendingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                                     (uintptr_t)-1, 0 });
+}
+
+bool RemoteArena::completeMap(int call) {
+    uintptr_t addr = engine_.result(call);
+    if (!engine_.executed(call) || addr == 0 || addr == (uintptr_t)MAP_FAILED) {
+        LOGE("Remote mmap of %zu bytes failed in PID %d", pendingSize_, pid_);
+        return false;
+    }
+    
+    base_ = addr;
+    size_ = pendingSize_;
+    onStack_ = false;
+    reset();
+    LOGI("Mapped %zu byte arena at 0x%lx in PID %d", size_, base_, pid_);
+    return true;
+}
+
+bool RemoteArena::mapOnStack(size_t size) {
+    if (base_ != 0) {
+        return true;
+    }
+    
+    size = (size + 15) & ~(size_t)15;
+    uintptr_t addr = engine_.reserveStack(size);
+    if (addr == 0) {
+        return false;
+    }
+    
+    base_ = addr;
+    size_ = size;
+    onStack_ = true;
+    reset();
+    return true;
+}
+
+bool RemoteArena::unmap(uintptr_t munmapAddr) {
+    if (base_ == 0 || onStack_) {
+        return completeUnmap(-1);
+    }
+    Trace::Scope trace("arena_unmap", pid_);
+    
+    int call = queueUnmap(munmapAddr);
+    engine_.run();
+    return completeUnmap(call);
+}
+
+int RemoteArena::queueUnmap(uintptr_t munmapAddr) {
+    if (base_ == 0 || onStack_) {
+        return -1;
+    }
+    return engine_.queue(munmapAddr, { base_, size_ });
+}
+
+bool RemoteArena::completeUnmap(int call) {
+    if (base_ == 0) {
+        return true;
+    }
+    
+    // -1: nothing was queued (a stack region)
+    bool ok = call < 0 || (engine_.executed(call) && engine_.result(call) == 0);
+    if (!ok) {
+        LOGE("Remote munmap of 0x%lx failed in PID %d", base_, pid_);
+    }
+    
+    base_ = 0;
+    size_ = 0;
+    mirror_.clear();
+    reset();
+    return ok;
+}
+
+uintptr_t RemoteArena::alloc(size_t size, size_t align) {
+    if (base_ == 0) {
+        return 0;
+    }
+    
+    size_t start = (top_ + align - 1) & ~(align - 1);
+    if (start > size_ || size > size_ - start) {
+        LOGE("Arena exhausted: %zu of %zu bytes used, %zu requested", top_, size_, size);
+        return 0;
+    }
+    
+    top_ = start + size;
+    if (mirror_.size() < top_) {
+        mirror_.resize(top_);
+    }
+    return base_ + start;
+}
+
+uintptr_t RemoteArena::put(const void* data, size_t size, size_t align) {
+    uintptr_t addr = alloc(size, align);
+    if (addr == 0) {
+        return 0;
+    }
+    
+    size_t offset = addr - base_;
+    memcpy(mirror_.data() + offset, data, size);
+    
+    // The dirty range only grows upwards, so it stays one contiguous write
+    if (dirtyStart_ == dirtyEnd_) {
+        dirtyStart_ = offset;
+    }
+    dirtyEnd_ = offset + size;
+    return addr;
+}
+
+uintptr_t RemoteArena::putString(const std::string& str) {
+    return put(str.c_str(), str.size() + 1, 1);
+}
+
+bool RemoteArena::flush() {
+    if (dirtyStart_ == dirtyEnd_) {
+        return true;
+    }
+    Trace::Scope trace("arena_write", pid_);
+    
+    RemoteIoVec iov = { base_ + dirtyStart_, mirror_.data() + dirtyStart_, dirtyEnd_ - dirtyStart_ };
+    if (!writeMemoryV(pid_, &iov, 1)) {
+        LOGE("Failed to write %zu arena bytes to PID %d", iov.size, pid_);
+        return false;
+    }
+    
+    dirtyStart_ = dirtyEnd_ = 0;
+    return true;
+}
+
+bool RemoteArena::read(uintptr_t addr, void* buffer, size_t size) const {
+    if (addr < base_ || addr + size > base_ + size_) {
+        return false;
+    }
+    return readMemory(pid_, addr, buffer, size);
+}
+
+void RemoteArena::reset() {
+    top_ = 0;
+    dirtyStart_ = dirtyEnd_ = 0;
+    std::fill(mirror_.begin(), mirror_.end(), 0);
+}
+
+} // namespace PtraceUtils
@@ -0,0 +1,479 @@
+#include "remote_call.h"
+#include "ptrace_utils.h"
+#include "maps_snapshot.h"
+#include "maps_query.h"
+#include "trace.h"
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include "logger.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <algorithm>
+
+#define LOG_TAG "RemoteCall"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace PtraceUtils {
+
+namespace {
+
+// Arguments passed in registers; the rest go on the stack.
+#if defined(__aarch64__)
+const size_t kRegisterArgs = 8;
+#elif defined(__arm__)
+const size_t kRegisterArgs = 4;
+#elif defined(__i386__)
+const size_t kRegisterArgs = 0;
+#else
+const size_t kRegisterArgs = 6;
+#endif
+
+const size_t kTrapScanChunk = 64 * 1024;
+const size_t kTrapScanLimit = 1024 * 1024;
+
+uintptr_t programCounter(const struct user_regs_struct& regs) {
+#if defined(__aarch64__)
+    return regs.pc;
+#elif defined(__arm__)
+    return regs.ARM_pc;
+#elif defined(__i386__)
+    return regs.eip;
+#else
+    return regs.rip;
+#endif
+}
+
+uintptr_t returnValue(const struct user_regs_struct& regs) {
+#if defined(__aarch64__)
+    return regs.regs[0];
+#elif defined(__arm__)
+    return regs.ARM_r0;
+#elif defined(__i386__)
+    return regs.eax;
+#else
+    return regs.rax;
+#endif
+}
+
+// Offset of the first trap instruction in buf, or size if there is none.
+size_t matchTrap(const uint8_t* buf, size_t size) {
+#if defined(__i386__) || defined(__x86_64__)
+    const void* hit = memchr(buf, 0xCC, size);      // int3
+    return hit ? (const uint8_t*)hit - buf : size;
+#else
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t insn;
+        memcpy(&insn, buf + i, sizeof(insn));
+#if defined(__aarch64__)
+        if ((insn & 0xFFE0001F) == 0xD4200000) {     // BRK #imm
+            return i;
+        }
+#else
+        if ((insn & 0xFFF000F0) == 0xE1200070 ||    // BKPT #imm
+            insn == 0xE7F001F0 ||                   // kernel ARM breakpoint
+            insn == 0xE7FFDEFE) {                   // __builtin_trap UDF
+            return i;
+        }
+#endif
+    }
+    return size;
+#endif
+}
+
+// Scans ranges (one module's code) up to kTrapScanLimit bytes in all
+bool scanRanges(pid_t pid, const std::vector<std::pair<uintptr_t, uintptr_t>>& ranges, uintptr_t& addr) {
+    std::vector<uint8_t> buffer(kTrapScanChunk);
+    size_t scanned = 0;
+    
+    for (const std::pair<uintptr_t, uintptr_t>& range : ranges) {
+        for (uintptr_t pos = range.first; pos < range.second && scanned < kTrapScanLimit; pos += kTrapScanChunk) {
+            size_t len = std::min<uintptr_t>(kTrapScanChunk, range.second - pos);
+            if (!readMemory(pid, pos, buffer.data(), len)) {
+                break;
+            }
+            scanned += len;
+            size_t hit = matchTrap(buffer.data(), len);
+            if (hit < len) {
+                addr = pos + hit;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool isTrapSignal(int sig) {
+    return sig == SIGTRAP || sig == SIGSEGV || sig == SIGBUS || sig == SIGILL;
+}
+
+bool isFaultSignal(int sig) {
+    return isTrapSignal(sig) || sig == SIGFPE || sig == SIGABRT;
+}
+
+} // namespace
+
+RemoteCallEngine::RemoteCallEngine(pid_t pid)
+    : pid_(pid), active_(false), inFlight_(false), callStartNs_(0), trapKnown_(false), trap_(0), stackTop_(0),
+      nextCall_(0), lastFrameSp_(0) {
+    memset(&saved_, 0, sizeof(saved_));
+}
+
+RemoteCallEngine::~RemoteCallEngine() {
+    end();
+}
+
+bool RemoteCallEngine::findTrap(pid_t pid, uintptr_t& addr) {
+    TrapCandidates candidates;
+    if (!ProcessUtils::withMaps(pid, [&](const ProcessUtils::MapsSnapshot& maps) {
+            trapCandidates(maps, candidates);
+        })) {
+        return false;
+    }
+    return findTrap(pid, candidates, addr);
+}
+
+void RemoteCallEngine::trapCandidates(const ProcessUtils::MapsSnapshot& maps, TrapCandidates& candidates) {
+    const char* names[] = { "libc.so", sizeof(void*) == 8 ? "linker64" : "linker" };
+    candidates.clear();
+    for (const char* name : names) {
+        const ProcessUtils::MapsModule* module = maps.findModule(name);
+        if (!module) {
+            continue;
+        }
+        TrapCandidate candidate;
+        candidate.module = name;
+        for (uint32_t i = 0; i < module->segmentCount; i++) {
+            const ProcessUtils::MapsSegment& seg = maps.moduleSegment(*module, i);
+            if (seg.perms & ProcessUtils::MAPS_EXEC) {
+                candidate.code.push_back(std::make_pair(seg.start, seg.end));
+            }
+        }
+        candidates.push_back(candidate);
+    }
+}
+
+bool RemoteCallEngine::findTrap(pid_t pid, const TrapCandidates& candidates, uintptr_t& addr) {
+    Trace::Scope trace("find_trap", pid);
+    for (const TrapCandidate& candidate : candidates) {
+        if (scanRanges(pid, candidate.code, addr)) {
+            LOGI("Return trap in %s at 0x%lx", candidate.module, addr);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RemoteCallEngine::setTrapAddress(uintptr_t addr) {
+    trap_ = addr;
+    trapKnown_ = true;
+}
+
+bool RemoteCallEngine::begin(uintptr_t stackTop) {
+    if (active_) {
+        return true;
+    }
+    Trace::Scope trace("call_setup", pid_);
+    
+    if (!getRegs(pid_, &saved_)) {
+        return false;
+    }
+    
+    stackTop_ = stackTop ? stackTop : getStackPointer(&saved_) - kStackRedZone;
+    
+    if (!trapKnown_) {
+        if (!findTrap(pid_, trap_)) {
+            LOGE("No trap instruction found, calls will return through address 0");
+            trap_ = 0;
+        }
+        trapKnown_ = true;
+    }
+    
+    calls_.clear();
+    nextCall_ = 0;
+    inFlight_ = false;
+    lastFrame_.clear();
+    lastFrameSp_ = 0;
+    active_ = true;
+    return true;
+}
+
+bool RemoteCallEngine::end() {
+    if (!active_) {
+        return true;
+    }
+    active_ = false;
+    inFlight_ = false;
+    
+    if (!setRegs(pid_, &saved_)) {
+        LOGE("Failed to restore registers of PID %d", pid_);
+        return false;
+    }
+    return true;
+}
+
+void RemoteCallEngine::discard() {
+    active_ = false;
+    inFlight_ = false;
+}
+
+uintptr_t RemoteCallEngine::reserveStack(size_t size) {
+    if (!active_) {
+        return 0;
+    }
+    stackTop_ = (stackTop_ - size) & ~(uintptr_t)15;
+    return stackTop_;
+}
+
+int RemoteCallEngine::queue(uintptr_t funcAddr, std::initializer_list<RemoteArg> args) {
+    return queue(funcAddr, args.begin(), args.size());
+}
+
+int RemoteCallEngine::queue(uintptr_t funcAddr, const RemoteArg* args, size_t argCount) {
+    Call call;
+    call.funcAddr = funcAddr;
+    call.funcResult = -1;
+    call.args.assign(args, args + argCount);
+    call.result = 0;
+    call.executed = false;
+    calls_.push_back(call);
+    return (int)calls_.size() - 1;
+}
+
+int RemoteCallEngine::queueIndirect(int funcResult, std::initializer_list<RemoteArg> args) {
+    int index = queue(0, args.begin(), args.size());
+    calls_[index].funcResult = funcResult;
+    return index;
+}
+
+uintptr_t RemoteCallEngine::result(int callIndex) const {
+    if (callIndex < 0 || (size_t)callIndex >= calls_.size()) {
+        return 0;
+    }
+    return calls_[callIndex].result;
+}
+
+bool RemoteCallEngine::executed(int callIndex) const {
+    if (callIndex < 0 || (size_t)callIndex >= calls_.size()) {
+        return false;
+    }
+    return calls_[callIndex].executed;
+}
+
+bool RemoteCallEngine::run() {
+    if (!active_) {
+        LOGE("run() without begin()");
+        return false;
+    }
+    
+    CallState state = launch();
+    while (state == CallState::Running) {
+        int status;
+        pid_t waited;
+        {
+            Trace::SyscallScope scope(Trace::SyscallClass::Wait);
+            waited = waitpid(pid_, &status, __WALL);
+        }
+        if (waited != pid_) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("waitpid failed: %s", strerror(errno));
+            return fail() == CallState::Idle;
+        }
+        state = onStop(status);
+    }
+    return state == CallState::Idle;
+}
+
+RemoteCallEngine::CallState RemoteCallEngine::launch() {
+    if (!active_) {
+        return CallState::Failed;
+    }
+    if (inFlight_) {
+        return CallState::Running;
+    }
+    
+    while (nextCall_ < calls_.size()) {
+        bool skipped = false;
+        if (!start(calls_[nextCall_], skipped)) {
+            return fail();
+        }
+        if (!skipped) {
+            inFlight_ = true;
+            return CallState::Running;
+        }
+        nextCall_++;
+    }
+    return CallState::Idle;
+}
+
+RemoteCallEngine::CallState RemoteCallEngine::onStop(int status) {
+    if (!inFlight_) {
+        return active_ ? CallState::Idle : CallState::Failed;
+    }
+    
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        LOGE("PID %d exited during a remote call", pid_);
+        active_ = false;
+        return fail();
+    }
+    if (!WIFSTOPPED(status)) {
+        return CallState::Running;
+    }
+    
+    // int3 reports the address after the trap; BRK, BKPT and a jump to 0
+    // report the trap itself
+#if defined(__i386__) || defined(__x86_64__)
+    uintptr_t expectedPc = trap_ ? trap_ + 1 : 0;
+#else
+    uintptr_t expectedPc = trap_;
+#endif
+
+    int sig = WSTOPSIG(status);
+    struct user_regs_struct regs;
+    if (!getRegs(pid_, &regs)) {
+        return fail();
+    }
+    
+    Call& call = calls_[nextCall_];
+    uintptr_t pc = programCounter(regs);
+    if (isTrapSignal(sig) && pc == expectedPc) {
+        call.result = returnValue(regs);
+        call.executed = true;
+        inFlight_ = false;
+        nextCall_++;
+        if (callStartNs_ != 0) {
+            Trace::record("remote_call", callStartNs_, Trace::nowNs(), pid_);
+        }
+        return launch();
+    }
+    if (isFaultSignal(sig)) {
+        // Suppressed: the registers are restored before the target runs
+        LOGE("Remote call to 0x%lx raised signal %d at pc 0x%lx", call.funcAddr, sig, pc);
+        return fail();
+    }
+    
+    // Unrelated signal; let the target handle it and keep waiting
+    Trace::SyscallScope scope(Trace::SyscallClass::Ptrace);
+    if (ptrace(PTRACE_CONT, pid_, NULL, (void*)(uintptr_t)(sig == SIGSTOP ? 0 : sig)) == -1) {
+        LOGE("PTRACE_CONT failed: %s", strerror(errno));
+        return fail();
+    }
+    return CallState::Running;
+}
+
+RemoteCallEngine::CallState RemoteCallEngine::fail() {
+    // The rest of the queue is dropped; results stay 0
+    inFlight_ = false;
+    nextCall_ = calls_.size();
+    return CallState::Failed;
+}
+
+bool RemoteCallEngine::resolveArg(const RemoteArg& arg, uintptr_t& value) const {
+    if (arg.resultOf < 0) {
+        value = arg.value;
+        return true;
+    }
+    if ((size_t)arg.resultOf >= calls_.size()) {
+        return false;
+    }
+    const Call& dep = calls_[arg.resultOf];
+    value = dep.result;
+    return dep.executed && value != 0;
+}
+
+bool RemoteCallEngine::start(Call& call, bool& skipped) {
+    callStartNs_ = Trace::enabled() ? Trace::nowNs() : 0;
+    uintptr_t funcAddr = call.funcAddr;
+    if (call.funcResult >= 0 && !resolveArg(RemoteArg::result(call.funcResult), funcAddr)) {
+        skipped = true;
+        return true;
+    }
+    
+    size_t argCount = call.args.size();
+    std::vector<uintptr_t> values(argCount);
+    for (size_t i = 0; i < argCount; i++) {
+        if (!resolveArg(call.args[i], values[i])) {
+            skipped = true;
+            return true;
+        }
+    }
+    
+    // Stack part of the frame: the return address on x86, then whatever
+    // does not fit in registers
+    size_t regArgs = std::min(argCount, kRegisterArgs);
+    size_t stackArgs = argCount - regArgs;
+    std::vector<uintptr_t> frame;
+#if defined(__i386__) || defined(__x86_64__)
+    frame.push_back(trap_);
+#endif
+    frame.insert(frame.end(), values.begin() + regArgs, values.end());
+    
+    // The first stack argument sits at a 16-byte boundary on every ABI
+    uintptr_t sp = (stackTop_ - stackArgs * sizeof(uintptr_t)) & ~(uintptr_t)15;
+#if defined(__i386__) || defined(__x86_64__)
+    sp -= sizeof(uintptr_t);
+#endif
+
+    // Stack arguments belong to the callee and may have been changed, but a
+    // bare return address can be reused as is
+    if (!frame.empty() && (stackArgs > 0 || sp != lastFrameSp_ || frame != lastFrame_)) {
+        if (!writeMemory(pid_, sp, frame.data(), frame.size() * sizeof(uintptr_t))) {
+            return false;
+        }
+        lastFrame_ = frame;
+        lastFrameSp_ = sp;
+    }
+    
+    struct user_regs_struct regs;
+    memcpy(&regs, &saved_, sizeof(regs));
+
+#if defined(__aarch64__)
+    for (size_t i = 0; i < regArgs; i++) {
+        regs.regs[i] = values[i];
+    }
+    regs.sp = sp;
+    regs.pc = funcAddr;
+    regs.regs[30] = trap_;
+#elif defined(__arm__)
+    for (size_t i = 0; i < regArgs; i++) {
+        regs.uregs[i] = values[i];
+    }
+    regs.ARM_sp = sp;
+    // Bit 0 of the address selects Thumb state; the trap is ARM code
+    if (funcAddr & 1) {
+        regs.ARM_pc = funcAddr & ~1u;
+        regs.ARM_cpsr |= 0x20;
+    } else {
+        regs.ARM_pc = funcAddr;
+        regs.ARM_cpsr &= ~0x20u;
+    }
+    regs.ARM_lr = trap_;
+#elif defined(__i386__)
+    regs.esp = sp;
+    regs.eip = funcAddr;
+    // Not a syscall stop any more; keeps the kernel from restarting one
+    regs.orig_eax = -1;
+#else
+    if (regArgs > 0) regs.rdi = values[0];
+    if (regArgs > 1) regs.rsi = values[1];
+    if (regArgs > 2) regs.rdx = values[2];
+    if (regArgs > 3) regs.rcx = values[3];
+    if (regArgs > 4) regs.r8 = values[4];
+    if (regArgs > 5) regs.r9 = values[5];
+    regs.rsp = sp;
+    regs.rip = funcAddr;
+    // Not a syscall stop any more; keeps the kernel from restarting one
+    regs.orig_rax = -1;
+#endif
+
+    if (!setRegs(pid_, &regs) || !continueExecution(pid_)) {
+        LOGE("Remote call to 0x%lx failed", funcAddr);
+        return false;
+    }
+    return true;
+}
+
+} // namespace PtraceUtils
@@ -0,0 +1,256 @@
+#include "symbol_cache.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <mutex>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "SymbolCache"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace SymbolCache {
+
+namespace {
+
+const uint32_t kMagic = 0x43594d53; // "SMYC"
+const uint32_t kVersion = 1;
+const uint32_t kCapacity = 1 << 14;
+const uint32_t kMaxProbe = 16;
+const uint64_t kAbsent = ~0ULL;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t entrySize;
+    uint64_t reserved[2];
+};
+
+// A slot is published by storing its tag last (release); readers load the
+// tag first (acquire) and re-check it after copying the payload, so a slot
+// being evicted by another process is seen as a miss, never as torn data.
+struct CacheEntry {
+    uint64_t tag;
+    uint64_t moduleKey;
+    uint64_t symbolKey;
+    uint64_t offset;
+};
+
+const size_t kFileSize = sizeof(CacheHeader) + sizeof(CacheEntry) * kCapacity;
+
+std::mutex g_mutex;
+int g_fd = -1;
+uint8_t* g_base = nullptr;
+
+CacheEntry* entries() {
+    return (CacheEntry*)(g_base + sizeof(CacheHeader));
+}
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t hashString(const char* s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (uint8_t)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t makeTag(uint64_t moduleKey, uint64_t symbolKey) {
+    return mix(moduleKey ^ ((symbolKey << 29) | (symbolKey >> 35))) | 1;
+}
+
+bool headerValid(const CacheHeader* header) {
+    return header->magic == kMagic && header->version == kVersion &&
+           header->capacity == kCapacity && header->entrySize == sizeof(CacheEntry);
+}
+
+bool insert(uint64_t moduleKey, const char* symbol, uint64_t offset) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_base) {
+        return false;
+    }
+    
+    // Serializes writers across injector processes; readers never take it.
+    if (flock(g_fd, LOCK_EX) != 0) {
+        return false;
+    }
+    
+    uint64_t symbolKey = hashString(symbol);
+    uint64_t tag = makeTag(moduleKey, symbolKey);
+    CacheEntry* table = entries();
+    
+    CacheEntry* slot = nullptr;
+    for (uint32_t i = 0; i < kMaxProbe; i++) {
+        CacheEntry* e = &table[(tag + i) & (kCapacity - 1)];
+        uint64_t current = __atomic_load_n(&e->tag, __ATOMIC_RELAXED);
+        if (current == 0 || (current == tag && e->moduleKey == moduleKey && e->symbolKey == symbolKey)) {
+            slot = e;
+            break;
+        }
+    }
+    
+    if (!slot) {
+        // Probe window full: evict the home slot. Entries of replaced modules
+        // are never looked up again, so this is how they age out.
+        slot = &table[tag & (kCapacity - 1)];
+    }
+    
+    // Seqlock writer: the fence keeps the field stores below from becoming
+    // visible before the cleared tag, which lookup() rechecks
+    __atomic_store_n(&slot->tag, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->moduleKey, moduleKey, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->symbolKey, symbolKey, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->offset, offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->tag, tag, __ATOMIC_RELEASE);
+    
+    flock(g_fd, LOCK_UN);
+    return true;
+}
+
+} // namespace
+
+bool open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_base) {
+        return true;
+    }
+    
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("Failed to open symbol cache %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    
+    // Initialization and resets happen under the same lock as inserts, so a
+    // concurrent injector never maps a half-written header.
+    if (flock(fd, LOCK_EX) != 0) {
+        ::close(fd);
+        return false;
+    }
+    
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    CacheHeader header;
+    bool valid = ok && (size_t)st.st_size == kFileSize &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 headerValid(&header);
+    
+    if (ok && !valid) {
+        LOGI("Initializing symbol cache %s", path.c_str());
+        memset(&header, 0, sizeof(header));
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.capacity = kCapacity;
+        header.entrySize = sizeof(CacheEntry);
+        ok = ftruncate(fd, 0) == 0 && ftruncate(fd, kFileSize) == 0 &&
+             pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    }
+    
+    void* mapping = ok ? mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    flock(fd, LOCK_UN);
+    
+    if (mapping == MAP_FAILED) {
+        LOGE("Failed to map symbol cache %s: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    
+    g_fd = fd;
+    g_base = (uint8_t*)mapping;
+    return true;
+}
+
+void close() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_base) {
+        munmap(g_base, kFileSize);
+        ::close(g_fd);
+    }
+    g_base = nullptr;
+    g_fd = -1;
+}
+
+bool isOpen() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_base != nullptr;
+}
+
+uint64_t moduleKey(const std::string& path, uintptr_t mapOffset) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    
+    uint64_t key = mix((uint64_t)st.st_dev);
+    key = mix(key ^ (uint64_t)st.st_ino);
+    key = mix(key ^ (uint64_t)st.st_size);
+    key = mix(key ^ (uint64_t)st.st_mtim.tv_sec);
+    key = mix(key ^ (uint64_t)st.st_mtim.tv_nsec);
+    key = mix(key ^ (uint64_t)mapOffset);
+    return key ? key : 1;
+}
+
+LookupResult lookup(uint64_t moduleKey, const char* symbol, uintptr_t& offset) {
+    // Deliberately lock-free: the mapping stays valid until close(), which
+    // only runs at shutdown.
+    uint8_t* base = g_base;
+    if (!base || moduleKey == 0) {
+        return LookupResult::Miss;
+    }
+    
+    uint64_t symbolKey = hashString(symbol);
+    uint64_t tag = makeTag(moduleKey, symbolKey);
+    CacheEntry* table = entries();
+    
+    for (uint32_t i = 0; i < kMaxProbe; i++) {
+        CacheEntry* e = &table[(tag + i) & (kCapacity - 1)];
+        uint64_t current = __atomic_load_n(&e->tag, __ATOMIC_ACQUIRE);
+        if (current == 0) {
+            break;
+        }
+        if (current != tag) {
+            continue;
+        }
+        
+        uint64_t m = __atomic_load_n(&e->moduleKey, __ATOMIC_RELAXED);
+        uint64_t s = __atomic_load_n(&e->symbolKey, __ATOMIC_RELAXED);
+        uint64_t value = __atomic_load_n(&e->offset, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->tag, __ATOMIC_RELAXED) != current) {
+            break;
+        }
+        
+        if (m == moduleKey && s == symbolKey) {
+            if (value == kAbsent) {
+                return LookupResult::Absent;
+            }
+            offset = (uintptr_t)value;
+            return LookupResult::Found;
+        }
+    }
+    
+    return LookupResult::Miss;
+}
+
+bool store(uint64_t moduleKey, const char* symbol, uintptr_t offset) {
+    return moduleKey != 0 && insert(moduleKey, symbol, (uint64_t)offset);
+}
+
+bool storeAbsent(uint64_t moduleKey, const char* symbol) {
+    return moduleKey != 0 && insert(moduleKey, symbol, kAbsent);
+}
+
+} // namespace SymbolCache
@@ -0,0 +1,364 @@
+#include "trace.h"
+#include "logger.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "Trace"
+#define LOGI(...) INJECTOR_LOG(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) INJECTOR_LOG(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace Trace {
+
+std::atomic<bool> g_enabled(false);
+
+namespace {
+
+// Spans beyond this are only aggregated, so a long -watch session or a
+// large fan-out cannot grow without bound.
+const size_t kMaxEvents = 1 << 20;
+
+// Four sub-buckets per power of two: percentiles within ~12%.
+const int kSubBits = 2;
+const int kBuckets = 64 << kSubBits;
+
+struct Histogram {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint32_t buckets[kBuckets];
+
+    Histogram() : count(0), totalNs(0), maxNs(0) {
+        memset(buckets, 0, sizeof(buckets));
+    }
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < (1u << kSubBits)) {
+            return (int)ns;
+        }
+        int log = 63 - __builtin_clzll(ns);
+        int sub = (int)((ns >> (log - kSubBits)) & ((1u << kSubBits) - 1));
+        return ((log - kSubBits + 1) << kSubBits) + sub;
+    }
+
+    // Midpoint of the bucket's value range
+    static uint64_t bucketValue(int bucket) {
+        if (bucket < (1 << kSubBits)) {
+            return bucket;
+        }
+        int log = (bucket >> kSubBits) + kSubBits - 1;
+        uint64_t low = (1ull << log) | ((uint64_t)(bucket & ((1 << kSubBits) - 1)) << (log - kSubBits));
+        return low + (1ull << (log - kSubBits)) / 2;
+    }
+
+    void add(uint64_t ns) {
+        count++;
+        totalNs += ns;
+        if (ns > maxNs) maxNs = ns;
+        buckets[bucketOf(ns)]++;
+    }
+
+    void merge(const Histogram& other) {
+        count += other.count;
+        totalNs += other.totalNs;
+        if (other.maxNs > maxNs) maxNs = other.maxNs;
+        for (int i = 0; i < kBuckets; i++) {
+            buckets[i] += other.buckets[i];
+        }
+    }
+
+    uint64_t percentile(double p) const {
+        uint64_t rank = (uint64_t)(p * (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                uint64_t value = bucketValue(i);
+                return value < maxNs ? value : maxNs;
+            }
+        }
+        return maxNs;
+    }
+};
+
+struct Event {
+    const char* name;
+    const char* category;
+    uint64_t startNs;
+    uint64_t durNs;
+    pid_t tid;
+    pid_t target;
+    std::string detail;
+};
+
+// Event slots are handed to threads in chunks, so the shared counter is
+// touched once per chunk rather than once per span
+const size_t kEventChunk = 256;
+
+// One thread's spans. Only its thread records into it, so the lock is
+// uncontended except while the spans are read out or reset. Phases are
+// keyed by their name pointer (the names are literals) and merged by name
+// when printed.
+struct Buffer {
+    std::mutex lock;
+    std::vector<Event> events;
+    size_t budget;
+    size_t dropped;
+    std::vector<std::pair<const char*, Histogram>> phases;
+    Histogram syscalls[(int)SyscallClass::Count];
+
+    Buffer() : budget(0), dropped(0) {}
+
+    Histogram& phase(const char* name) {
+        for (auto& entry : phases) {
+            if (entry.first == name) return entry.second;
+        }
+        phases.emplace_back(name, Histogram());
+        return phases.back().second;
+    }
+
+    void clear() {
+        events.clear();
+        budget = 0;
+        dropped = 0;
+        phases.clear();
+        for (Histogram& h : syscalls) {
+            h = Histogram();
+        }
+    }
+};
+
+// The live threads' buffers, plus one holding what exited threads recorded
+struct State {
+    std::mutex lock;
+    std::vector<Buffer*> buffers;
+    Buffer retired;
+    std::atomic<size_t> reserved;
+
+    State() : reserved(0) {}
+};
+
+State& state() {
+    static State s;
+    return s;
+}
+
+pid_t currentTid() {
+    static thread_local pid_t tid = (pid_t)syscall(SYS_gettid);
+    return tid;
+}
+
+// Registers the calling thread's buffer on first use and folds it into the
+// retired one when the thread exits
+class ThreadBuffer {
+public:
+    ThreadBuffer() : state_(state()) {
+        std::lock_guard<std::mutex> guard(state_.lock);
+        state_.buffers.push_back(&buffer_);
+    }
+
+    ~ThreadBuffer() {
+        std::lock_guard<std::mutex> guard(state_.lock);
+        state_.buffers.erase(std::find(state_.buffers.begin(), state_.buffers.end(), &buffer_));
+        std::lock_guard<std::mutex> bufferGuard(buffer_.lock);
+        Buffer& retired = state_.retired;
+        for (Event& ev : buffer_.events) {
+            retired.events.push_back(std::move(ev));
+        }
+        retired.dropped += buffer_.dropped;
+        for (const auto& entry : buffer_.phases) {
+            retired.phase(entry.first).merge(entry.second);
+        }
+        for (int i = 0; i < (int)SyscallClass::Count; i++) {
+            retired.syscalls[i].merge(buffer_.syscalls[i]);
+        }
+    }
+
+    Buffer& get() { return buffer_; }
+
+private:
+    State& state_;
+    Buffer buffer_;
+};
+
+Buffer& threadBuffer() {
+    static thread_local ThreadBuffer buffer;
+    return buffer.get();
+}
+
+void appendEvent(Buffer& b, const char* name, const char* category, uint64_t startNs, uint64_t endNs,
+                 pid_t target, const std::string& detail) {
+    if (b.budget == 0) {
+        size_t first = state().reserved.fetch_add(kEventChunk, std::memory_order_relaxed);
+        b.budget = first < kMaxEvents ? std::min(kEventChunk, kMaxEvents - first) : 0;
+        if (b.budget == 0) {
+            b.dropped++;
+            return;
+        }
+    }
+    b.budget--;
+    Event ev;
+    ev.name = name;
+    ev.category = category;
+    ev.startNs = startNs;
+    ev.durNs = endNs - startNs;
+    ev.tid = currentTid();
+    ev.target = target;
+    if (!detail.empty()) ev.detail = detail;
+    b.events.push_back(std::move(ev));
+}
+
+// Calls fn for the retired buffer and every live one, each under its lock
+template <typename Fn>
+void forEachBuffer(Fn fn) {
+    State& s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    fn(s.retired);
+    for (Buffer* b : s.buffers) {
+        std::lock_guard<std::mutex> bufferGuard(b->lock);
+        fn(*b);
+    }
+}
+
+void writeJsonString(FILE* out, const std::string& str) {
+    fputc('"', out);
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void printRow(FILE* out, const char* name, const Histogram& h) {
+    fprintf(out, "  %-20s %8llu %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+            (unsigned long long)h.count, h.totalNs / 1e6, h.totalNs / 1e6 / h.count,
+            h.percentile(0.50) / 1e6, h.percentile(0.90) / 1e6, h.percentile(0.99) / 1e6,
+            h.maxNs / 1e6);
+}
+
+} // namespace
+
+void setEnabled(bool enable) {
+    g_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void reset() {
+    forEachBuffer([](Buffer& b) { b.clear(); });
+    state().reserved.store(0, std::memory_order_relaxed);
+}
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void record(const char* phase, uint64_t startNs, uint64_t endNs, pid_t target, const std::string& detail) {
+    if (!enabled()) {
+        return;
+    }
+    Buffer& b = threadBuffer();
+    std::lock_guard<std::mutex> guard(b.lock);
+    b.phase(phase).add(endNs - startNs);
+    appendEvent(b, phase, "phase", startNs, endNs, target, detail);
+}
+
+void recordSyscall(SyscallClass cls, uint64_t startNs, uint64_t endNs) {
+    if (!enabled()) {
+        return;
+    }
+    Buffer& b = threadBuffer();
+    std::lock_guard<std::mutex> guard(b.lock);
+    b.syscalls[(int)cls].add(endNs - startNs);
+    appendEvent(b, syscallClassName(cls), "syscall", startNs, endNs, 0, std::string());
+}
+
+const char* syscallClassName(SyscallClass cls) {
+    switch (cls) {
+        case SyscallClass::Ptrace: return "ptrace";
+        case SyscallClass::Wait: return "wait";
+        case SyscallClass::MemoryRead: return "mem_read";
+        case SyscallClass::MemoryWrite: return "mem_write";
+        case SyscallClass::ProcFs: return "procfs";
+        default: return "unknown";
+    }
+}
+
+bool writeChromeTrace(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        LOGE("Failed to open trace file %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    // Complete ("X") events with microsecond timestamps, thread by thread
+    pid_t self = getpid();
+    size_t written = 0;
+    size_t dropped = 0;
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    forEachBuffer([&](Buffer& b) {
+        dropped += b.dropped;
+        for (const Event& ev : b.events) {
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d", written++ ? "," : "", ev.name, ev.category,
+                    ev.startNs / 1e3, ev.durNs / 1e3, self, ev.tid);
+            if (ev.target != 0 || !ev.detail.empty()) {
+                fprintf(out, ",\"args\":{\"target\":%d", ev.target);
+                if (!ev.detail.empty()) {
+                    fprintf(out, ",\"detail\":");
+                    writeJsonString(out, ev.detail);
+                }
+                fputc('}', out);
+            }
+            fputc('}', out);
+        }
+    });
+    fprintf(out, "\n]}\n");
+
+    bool ok = fclose(out) == 0;
+    LOGI("Wrote %zu trace events to %s (%zu dropped)", written, path, dropped);
+    return ok;
+}
+
+void printStats(FILE* out) {
+    // Merged across threads; phases by name
+    std::map<std::string, Histogram> phases;
+    Histogram syscalls[(int)SyscallClass::Count];
+    forEachBuffer([&](Buffer& b) {
+        for (const auto& entry : b.phases) {
+            phases[entry.first].merge(entry.second);
+        }
+        for (int i = 0; i < (int)SyscallClass::Count; i++) {
+            syscalls[i].merge(b.syscalls[i]);
+        }
+    });
+
+    const char* header = "  %-20s %8s %12s %10s %10s %10s %10s %10s\n";
+    fprintf(out, "Phases (ms):\n");
+    fprintf(out, header, "PHASE", "COUNT", "TOTAL", "MEAN", "P50", "P90", "P99", "MAX");
+    for (const auto& entry : phases) {
+        printRow(out, entry.first.c_str(), entry.second);
+    }
+
+    fprintf(out, "Syscalls (ms):\n");
+    fprintf(out, header, "CLASS", "COUNT", "TOTAL", "MEAN", "P50", "P90", "P99", "MAX");
+    for (int i = 0; i < (int)SyscallClass::Count; i++) {
+        if (syscalls[i].count > 0) {
+            printRow(out, syscallClassName((SyscallClass)i), syscalls[i]);
+        }
+    }
+}
+
+} // namespace Trace
@@ -0,0 +1,148 @@
+// Round trip of a large daemon reply: the results of a 4096-target fan-out
+// are split into datagrams, sent over a SOCK_SEQPACKET pair the way the
+// daemon sends them and read back the way the client does.
+
+#include "daemon_protocol.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failures++;                                                   \
+        }                                                                   \
+    } while (0)
+
+std::vector<Injector::TargetResult> makeResults(size_t count) {
+    std::vector<Injector::TargetResult> results(count);
+    for (size_t i = 0; i < count; i++) {
+        Injector::TargetResult& r = results[i];
+        r.pid = (pid_t)(1000 + i);
+        r.success = i % 7 != 0;
+        r.planMs = i * 0.25;
+        r.stopMs = i * 0.5;
+        r.totalMs = i * 1.0;
+        r.error = r.success ? "" : "attach timed out";
+        r.entryResult = i;
+        Injector::LibraryResult lib;
+        lib.path = "/data/local/tmp/libpayload_" + std::to_string(i) + ".so";
+        lib.handle = 0x7f0000000000 + i * 0x1000;
+        lib.success = r.success;
+        lib.loadMs = i * 0.125;
+        r.libraries.push_back(lib);
+    }
+    return results;
+}
+
+// Sends the parts as InjectorDaemon does and reads them as DaemonClient does
+bool roundTrip(bool success, const std::vector<Injector::TargetResult>& sent,
+               bool& received, std::vector<Injector::TargetResult>& results, size_t& messages) {
+    std::vector<DaemonProtocol::Writer> parts = DaemonProtocol::writeResultParts(success, sent);
+    messages = parts.size();
+    
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+        return false;
+    }
+    // The daemon side runs on its own thread, the reply is larger than the
+    // socket buffer
+    bool sendOk = true;
+    std::thread sender([&]() {
+        for (size_t i = 0; i < parts.size() && sendOk; i++) {
+            DaemonProtocol::MessageType type = i + 1 < parts.size() ? DaemonProtocol::MessageType::ResultPart
+                                                                    : DaemonProtocol::MessageType::Result;
+            sendOk = DaemonProtocol::sendMessage(fds[0], type, parts[i].bytes());
+        }
+        close(fds[0]);
+    });
+    for (const DaemonProtocol::Writer& part : parts) {
+        CHECK(part.bytes().size() + sizeof(DaemonProtocol::MessageHeader) <= DaemonProtocol::kMaxMessage);
+    }
+    
+    bool ok = true;
+    results.clear();
+    DaemonProtocol::MessageType type = DaemonProtocol::MessageType::ResultPart;
+    std::vector<uint8_t> body;
+    while (ok && type == DaemonProtocol::MessageType::ResultPart) {
+        ok = DaemonProtocol::recvMessage(fds[1], type, body);
+        std::vector<Injector::TargetResult> batch;
+        DaemonProtocol::Reader in(body.data(), body.size());
+        ok = ok && DaemonProtocol::readResults(in, received, batch);
+        results.insert(results.end(), batch.begin(), batch.end());
+    }
+    close(fds[1]);
+    sender.join();
+    return ok && sendOk && type == DaemonProtocol::MessageType::Result;
+}
+
+void testLargeFanOut() {
+    std::vector<Injector::TargetResult> sent = makeResults(4096);
+    bool success = false;
+    std::vector<Injector::TargetResult> results;
+    size_t messages = 0;
+    CHECK(roundTrip(true, sent, success, results, messages));
+    CHECK(messages > 1);
+    CHECK(success);
+    CHECK(results.size() == sent.size());
+    for (size_t i = 0; i < results.size() && i < sent.size(); i++) {
+        const Injector::TargetResult& a = sent[i];
+        const Injector::TargetResult& b = results[i];
+        CHECK(a.pid == b.pid && a.success == b.success && a.stopMs == b.stopMs && a.error == b.error);
+        CHECK(b.libraries.size() == 1 && b.libraries[0].path == a.libraries[0].path &&
+              b.libraries[0].handle == a.libraries[0].handle);
+    }
+}
+
+void testSmallReplyIsOneMessage() {
+    bool success = true;
+    std::vector<Injector::TargetResult> results;
+    size_t messages = 0;
+    CHECK(roundTrip(false, makeResults(3), success, results, messages));
+    CHECK(messages == 1);
+    CHECK(!success);
+    CHECK(results.size() == 3);
+    
+    CHECK(roundTrip(true, std::vector<Injector::TargetResult>(), success, results, messages));
+    CHECK(messages == 1 && success && results.empty());
+}
+
+// One target whose library list alone exceeds a datagram
+void testOversizedTarget() {
+    std::vector<Injector::TargetResult> sent = makeResults(3);
+    Injector::LibraryResult lib = sent[1].libraries[0];
+    lib.path.assign(1000, 'x');
+    sent[1].libraries.assign(100, lib);
+    
+    bool success = false;
+    std::vector<Injector::TargetResult> results;
+    size_t messages = 0;
+    CHECK(roundTrip(true, sent, success, results, messages));
+    CHECK(results.size() == 3);
+    if (results.size() == 3) {
+        CHECK(results[1].pid == sent[1].pid && results[1].libraries.empty() && !results[1].error.empty());
+        CHECK(results[2].libraries.size() == 1);
+    }
+}
+
+} // namespace
+
+int main() {
+    testLargeFanOut();
+    testSmallReplyIsOneMessage();
+    testOversizedTarget();
+    if (g_failures) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("daemon_protocol_test: ok\n");
+    return 0;
+}